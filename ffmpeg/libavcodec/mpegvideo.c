@@ -620,13 +620,46 @@ static int alloc_picture_tables(MpegEncContext *s, Picture *pic)
     return 0;
 }
 
-static int make_tables_writable(Picture *pic)
+/* A table still shared, e.g. with a frame the qp table was exported to,
+ * is copied into a buffer from the pool of its size, so the copies are
+ * reused once the frames are released. */
+static int make_table_writable(MpegEncContext *s, AVBufferRef **table)
+{
+    AVBufferRef *copy;
+    int i;
+
+    if (av_buffer_is_writable(*table))
+        return 0;
+
+    for (i = 0; i < MAX_TABLE_POOLS && s->table_pools[i]; i++)
+        if (s->table_pool_sizes[i] == (*table)->size)
+            break;
+    if (i == MAX_TABLE_POOLS)
+        return av_buffer_make_writable(table);
+    if (!s->table_pools[i]) {
+        s->table_pools[i] = av_buffer_pool_init((*table)->size, NULL);
+        if (!s->table_pools[i])
+            return AVERROR(ENOMEM);
+        s->table_pool_sizes[i] = (*table)->size;
+    }
+
+    copy = av_buffer_pool_get(s->table_pools[i]);
+    if (!copy)
+        return AVERROR(ENOMEM);
+    memcpy(copy->data, (*table)->data, (*table)->size);
+    av_buffer_unref(table);
+    *table = copy;
+
+    return 0;
+}
+
+static int make_tables_writable(MpegEncContext *s, Picture *pic)
 {
     int ret, i;
 #define MAKE_WRITABLE(table) \
 do {\
     if (pic->table &&\
-       (ret = av_buffer_make_writable(&pic->table)) < 0)\
+       (ret = make_table_writable(s, &pic->table)) < 0)\
     return ret;\
 } while (0)
 
@@ -674,7 +707,7 @@ int ff_alloc_picture(MpegEncContext *s, Picture *pic, int shared)
     if (!pic->qscale_table_buf)
         ret = alloc_picture_tables(s, pic);
     else
-        ret = make_tables_writable(pic);
+        ret = make_tables_writable(s, pic);
     if (ret < 0)
         goto fail;
 
@@ -960,6 +993,7 @@ int ff_mpeg_update_thread_context(AVCodecContext *dst,
         memcpy(s, s1, sizeof(MpegEncContext));
 
         s->avctx                 = dst;
+        memset(s->table_pools, 0, sizeof(s->table_pools));
         s->bitstream_buffer      = NULL;
         s->bitstream_buffer_size = s->allocated_bitstream_buffer_size = 0;
 
@@ -1450,6 +1484,9 @@ static void free_context_frame(MpegEncContext *s)
     av_freep(&s->cplx_tab);
     av_freep(&s->bits_tab);
 
+    for (i = 0; i < MAX_TABLE_POOLS; i++)
+        av_buffer_pool_uninit(&s->table_pools[i]);
+
     s->linesize = s->uvlinesize = 0;
 }
 
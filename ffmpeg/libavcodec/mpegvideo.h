@@ -69,6 +69,7 @@ enum OutputFormat {
 
 #define MAX_THREADS 32
 #define MAX_PICTURE_COUNT 36
+#define MAX_TABLE_POOLS   8
 
 #define MAX_B_FRAMES 16
 
@@ -268,6 +269,8 @@ typedef struct MpegEncContext {
     ptrdiff_t linesize;        ///< line size, in bytes, may be different from width
     ptrdiff_t uvlinesize;      ///< line size, for chroma in bytes, may be different from width
     Picture *picture;          ///< main picture buffer
+    AVBufferPool *table_pools[MAX_TABLE_POOLS]; ///< copies of shared picture tables, by size
+    int table_pool_sizes[MAX_TABLE_POOLS];
     Picture **input_picture;   ///< next pictures on display order for encoding
     Picture **reordered_input_picture; ///< pointer to the next pictures in codedorder for encoding
 
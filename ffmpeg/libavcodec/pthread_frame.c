@@ -110,6 +110,8 @@ typedef struct FrameThreadContext {
 
     pthread_mutex_t buffer_mutex;  ///< Mutex used to protect get/release_buffer().
 
+    AVBufferPool *progress_pool;   ///< Buffers for the progress of frames, 2 ints each.
+
     int next_decoding;             ///< The next context to submit a packet to.
     int next_finished;             ///< The next context to return output from.
 
@@ -601,6 +603,7 @@ void ff_frame_thread_free(AVCodecContext *avctx, int thread_count)
     }
 
     av_freep(&fctx->threads);
+    av_buffer_pool_uninit(&fctx->progress_pool);
     pthread_mutex_destroy(&fctx->buffer_mutex);
     av_freep(&avctx->internal->thread_ctx);
 }
@@ -636,6 +639,12 @@ int ff_frame_thread_init(AVCodecContext *avctx)
     avctx->internal->thread_ctx = fctx = av_mallocz(sizeof(FrameThreadContext));
 
     fctx->threads = av_mallocz_array(thread_count, sizeof(PerThreadContext));
+    fctx->progress_pool = av_buffer_pool_init(2 * sizeof(int), NULL);
+    if (!fctx->progress_pool) {
+        av_freep(&fctx->threads);
+        av_freep(&avctx->internal->thread_ctx);
+        return AVERROR(ENOMEM);
+    }
     pthread_mutex_init(&fctx->buffer_mutex, NULL);
     fctx->delaying = 1;
 
@@ -770,7 +779,7 @@ static int thread_get_buffer_internal(AVCodecContext *avctx, ThreadFrame *f, int
 
     if (avctx->internal->allocate_progress) {
         int *progress;
-        f->progress = av_buffer_alloc(2 * sizeof(int));
+        f->progress = av_buffer_pool_get(p->parent->progress_pool);
         if (!f->progress) {
             return AVERROR(ENOMEM);
         }
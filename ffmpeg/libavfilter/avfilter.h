@@ -860,6 +860,12 @@ struct AVFilterLink {
      * Number of past frames sent through the link.
      */
     int64_t frame_count;
+
+    /**
+     * A pointer to a FFVideoFramePool struct, the buffers of the frames
+     * ff_default_get_video_buffer() returns for this link.
+     */
+    void *frame_pool;
 };
 
 /**
@@ -0,0 +1,192 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include "libavutil/common.h"
+#include "libavutil/imgutils.h"
+#include "libavutil/mem.h"
+#include "libavutil/pixdesc.h"
+
+#include "framepool.h"
+
+struct FFVideoFramePool {
+    int width;
+    int height;
+    enum AVPixelFormat format;
+    int align;
+    int linesize[4];
+    AVBufferPool *pools[4];
+};
+
+FFVideoFramePool *ff_video_frame_pool_init(int width, int height,
+                                           enum AVPixelFormat format,
+                                           int align)
+{
+    const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get(format);
+    FFVideoFramePool *pool;
+    int i, ret;
+
+    if (!desc || av_image_check_size(width, height, 0, NULL) < 0)
+        return NULL;
+
+    pool = av_mallocz(sizeof(*pool));
+    if (!pool)
+        return NULL;
+
+    pool->width  = width;
+    pool->height = height;
+    pool->format = format;
+    pool->align  = align;
+
+    /* the same layout as get_video_buffer() in libavutil/frame.c */
+    for (i = 1; i <= align; i += i) {
+        ret = av_image_fill_linesizes(pool->linesize, format, FFALIGN(width, i));
+        if (ret < 0)
+            goto fail;
+        if (!(pool->linesize[0] & (align - 1)))
+            break;
+    }
+
+    for (i = 0; i < 4 && pool->linesize[i]; i++) {
+        int h = FFALIGN(height, 32);
+        int size;
+
+        pool->linesize[i] = FFALIGN(pool->linesize[i], align);
+        if (i == 1 || i == 2)
+            h = FF_CEIL_RSHIFT(h, desc->log2_chroma_h);
+        size = pool->linesize[i] * h + 16 + 16 - 1;
+
+        pool->pools[i] = av_buffer_pool_init(size, NULL);
+        if (!pool->pools[i])
+            goto fail;
+    }
+    /* linesize[1] is 0 for these, the palette is not a plane */
+    if (desc->flags & (AV_PIX_FMT_FLAG_PAL | AV_PIX_FMT_FLAG_PSEUDOPAL)) {
+        av_buffer_pool_uninit(&pool->pools[1]);
+        pool->pools[1] = av_buffer_pool_init(1024, NULL);
+        if (!pool->pools[1])
+            goto fail;
+    }
+
+    return pool;
+fail:
+    ff_video_frame_pool_uninit(&pool);
+    return NULL;
+}
+
+void ff_video_frame_pool_uninit(FFVideoFramePool **pool)
+{
+    int i;
+
+    if (!*pool)
+        return;
+
+    for (i = 0; i < 4; i++)
+        av_buffer_pool_uninit(&(*pool)->pools[i]);
+    av_freep(pool);
+}
+
+int ff_video_frame_pool_matches(FFVideoFramePool *pool, int width, int height,
+                                enum AVPixelFormat format, int align)
+{
+    return pool->width == width && pool->height == height &&
+           pool->format == format && pool->align == align;
+}
+
+AVFrame *ff_video_frame_pool_get(FFVideoFramePool *pool)
+{
+    AVFrame *frame = av_frame_alloc();
+    int i;
+
+    if (!frame)
+        return NULL;
+
+    frame->width  = pool->width;
+    frame->height = pool->height;
+    frame->format = pool->format;
+
+    for (i = 0; i < 4 && pool->pools[i]; i++) {
+        frame->buf[i] = av_buffer_pool_get(pool->pools[i]);
+        if (!frame->buf[i]) {
+            av_frame_free(&frame);
+            return NULL;
+        }
+        frame->data[i]     = frame->buf[i]->data;
+        frame->linesize[i] = pool->linesize[i];
+    }
+    frame->extended_data = frame->data;
+
+    return frame;
+}
+
+#ifdef TEST
+
+#undef printf
+
+int main(void)
+{
+    static const enum AVPixelFormat formats[] = {
+        AV_PIX_FMT_YUV420P, AV_PIX_FMT_NV12, AV_PIX_FMT_RGB24,
+        AV_PIX_FMT_PAL8, AV_PIX_FMT_GRAY8, AV_PIX_FMT_BGR8,
+    };
+    int i, j, ret = 0;
+
+    for (i = 0; i < FF_ARRAY_ELEMS(formats); i++) {
+        const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get(formats[i]);
+        FFVideoFramePool *pool = ff_video_frame_pool_init(35, 17, formats[i], 32);
+        AVFrame *frame = NULL, *ref = av_frame_alloc(), *copy = av_frame_alloc();
+        int planes = 0;
+
+        printf("%-8s", desc->name);
+        if (!pool || !ref || !copy)
+            goto fail;
+        frame = ff_video_frame_pool_get(pool);
+        ref->width  = copy->width  = 35;
+        ref->height = copy->height = 17;
+        ref->format = copy->format = formats[i];
+        if (!frame || av_frame_get_buffer(ref, 32) < 0 ||
+            av_frame_get_buffer(copy, 32) < 0)
+            goto fail;
+
+        /* the planes have to be those av_frame_get_buffer would give */
+        for (j = 0; j < 4; j++) {
+            if (!frame->data[j] != !ref->data[j] ||
+                frame->linesize[j] != ref->linesize[j] ||
+                (frame->buf[j] ? frame->buf[j]->size : 0) !=
+                (ref->buf[j] ? ref->buf[j]->size : 0))
+                goto fail;
+            planes += !!frame->data[j];
+        }
+        for (j = 0; j < 4 && ref->buf[j]; j++)
+            memset(ref->buf[j]->data, j + 1, ref->buf[j]->size);
+        if (av_frame_copy(frame, ref) < 0 || av_frame_copy(copy, frame) < 0)
+            goto fail;
+        printf("%d planes, ok\n", planes);
+        goto end;
+fail:
+        printf("failed\n");
+        ret = 1;
+end:
+        av_frame_free(&frame);
+        av_frame_free(&ref);
+        av_frame_free(&copy);
+        ff_video_frame_pool_uninit(&pool);
+    }
+    return ret;
+}
+
+#endif
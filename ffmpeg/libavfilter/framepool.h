@@ -0,0 +1,62 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef AVFILTER_FRAMEPOOL_H
+#define AVFILTER_FRAMEPOOL_H
+
+#include "libavutil/buffer.h"
+#include "libavutil/frame.h"
+
+/**
+ * Video frame pool. The planes of the frames it returns come from one
+ * AVBufferPool each, so once a filter's output frames are released their
+ * memory is reused for the next ones instead of being freed.
+ */
+typedef struct FFVideoFramePool FFVideoFramePool;
+
+/**
+ * Allocate and initialize a video frame pool for frames of the given size
+ * and format, laid out like av_frame_get_buffer() would.
+ *
+ * @param align  alignment of the linesizes
+ * @return newly created frame pool, NULL on error
+ */
+FFVideoFramePool *ff_video_frame_pool_init(int width, int height,
+                                           enum AVPixelFormat format,
+                                           int align);
+
+/**
+ * Free a frame pool. Frames still in use keep their buffers until they are
+ * released.
+ */
+void ff_video_frame_pool_uninit(FFVideoFramePool **pool);
+
+/**
+ * @return 1 if frames from pool have the given size, format and alignment
+ */
+int ff_video_frame_pool_matches(FFVideoFramePool *pool, int width, int height,
+                                enum AVPixelFormat format, int align);
+
+/**
+ * Get a new frame from the pool.
+ *
+ * @return a frame on success, NULL on error
+ */
+AVFrame *ff_video_frame_pool_get(FFVideoFramePool *pool);
+
+#endif /* AVFILTER_FRAMEPOOL_H */
@@ -343,6 +343,10 @@ static int filter_frame(AVFilterLink *link, AVFrame *frame)
     }
 
     if ((yadif->deint && !yadif->cur->interlaced_frame) || ctx->is_disabled) {
+        /* the first frame is only a copy of next, which is passed on as
+         * cur with the following frame */
+        if (!yadif->prev)
+            return 0;
         yadif->out  = av_frame_clone(yadif->cur);
         if (!yadif->out)
             return AVERROR(ENOMEM);
@@ -395,8 +399,9 @@ static int request_frame(AVFilterLink *link)
 
             next->pts = yadif->next->pts * 2 - yadif->cur->pts;
 
-            filter_frame(link->src->inputs[0], next);
+            /* passing cur on frees prev, so don't wait for it */
             yadif->eof = 1;
+            return filter_frame(link->src->inputs[0], next);
         } else if (ret < 0) {
             return ret;
         }
@@ -29,6 +29,7 @@
 #include "libavutil/mem.h"
 
 #include "avfilter.h"
+#include "framepool.h"
 #include "internal.h"
 #include "video.h"
 
@@ -37,26 +38,23 @@ AVFrame *ff_null_get_video_buffer(AVFilterLink *link, int w, int h)
     return ff_get_video_buffer(link->dst->outputs[0], w, h);
 }
 
-/* TODO: set the buffer's priv member to a context structure for the whole
- * filter chain.  This will allow for a buffer pool instead of the constant
- * alloc & free cycle currently implemented. */
+#define BUFFER_ALIGN 32
+
+/* Every link keeps a pool of buffers for the frames it carries, so frames
+ * released downstream are reused instead of freed and allocated again. */
 AVFrame *ff_default_get_video_buffer(AVFilterLink *link, int w, int h)
 {
-    AVFrame *frame = av_frame_alloc();
-    int ret;
-
-    if (!frame)
-        return NULL;
-
-    frame->width  = w;
-    frame->height = h;
-    frame->format = link->format;
+    if (link->frame_pool &&
+        !ff_video_frame_pool_matches(link->frame_pool, w, h, link->format, BUFFER_ALIGN))
+        ff_video_frame_pool_uninit((FFVideoFramePool **)&link->frame_pool);
 
-    ret = av_frame_get_buffer(frame, 32);
-    if (ret < 0)
-        av_frame_free(&frame);
+    if (!link->frame_pool) {
+        link->frame_pool = ff_video_frame_pool_init(w, h, link->format, BUFFER_ALIGN);
+        if (!link->frame_pool)
+            return NULL;
+    }
 
-    return frame;
+    return ff_video_frame_pool_get(link->frame_pool);
 }
 
 #if FF_API_AVFILTERBUFFER
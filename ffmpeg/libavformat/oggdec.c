@@ -30,9 +30,11 @@
 
 #include <stdio.h>
 #include "libavutil/avassert.h"
+#include "libavutil/crc.h"
 #include "libavutil/intreadwrite.h"
 #include "oggdec.h"
 #include "avformat.h"
+#include "avio_internal.h"
 #include "internal.h"
 #include "vorbiscomment.h"
 
@@ -76,8 +78,11 @@ static int ogg_save(AVFormatContext *s)
 
     for (i = 0; i < ogg->nstreams; i++) {
         struct ogg_stream *os = ogg->streams + i;
-        os->buf = av_mallocz(os->bufsize + FF_INPUT_BUFFER_PADDING_SIZE);
-        memcpy(os->buf, ost->streams[i].buf, os->bufpos);
+        os->buf = av_malloc(os->bufsize + FF_INPUT_BUFFER_PADDING_SIZE);
+        if (os->buf) {
+            memcpy(os->buf, ost->streams[i].buf, os->bufpos);
+            memset(os->buf + os->bufpos, 0, FF_INPUT_BUFFER_PADDING_SIZE);
+        }
         os->new_metadata      = NULL;
         os->new_metadata_size = 0;
     }
@@ -156,7 +161,7 @@ static int ogg_reset(AVFormatContext *s)
     return 0;
 }
 
-static const struct ogg_codec *ogg_find_codec(uint8_t *buf, int size)
+static const struct ogg_codec *ogg_find_codec(const uint8_t *buf, int size)
 {
     int i;
 
@@ -173,7 +178,9 @@ static const struct ogg_codec *ogg_find_codec(uint8_t *buf, int size)
  * situation where a new audio stream spawn (identified with a new serial) and
  * must replace the previous one (track switch).
  */
-static int ogg_replace_stream(AVFormatContext *s, uint32_t serial, int nsegs)
+/* magic is the start of the first page of the new stream, padded */
+static int ogg_replace_stream(AVFormatContext *s, uint32_t serial,
+                              const uint8_t *magic)
 {
     struct ogg *ogg = s->priv_data;
     struct ogg_stream *os;
@@ -181,12 +188,7 @@ static int ogg_replace_stream(AVFormatContext *s, uint32_t serial, int nsegs)
     int i = 0;
 
     if (s->pb->seekable) {
-        uint8_t magic[8];
-        int64_t pos = avio_tell(s->pb);
-        avio_skip(s->pb, nsegs);
-        avio_read(s->pb, magic, sizeof(magic));
-        avio_seek(s->pb, pos, SEEK_SET);
-        codec = ogg_find_codec(magic, sizeof(magic));
+        codec = ogg_find_codec(magic, 8);
         if (!codec) {
             av_log(s, AV_LOG_ERROR, "Cannot identify new stream\n");
             return AVERROR_INVALIDDATA;
@@ -270,21 +272,31 @@ static int ogg_new_stream(AVFormatContext *s, uint32_t serial)
     return idx;
 }
 
-static int ogg_new_buf(struct ogg *ogg, int idx)
+/* Drops the packets already returned from the buffer of os. */
+static void ogg_buf_shift(struct ogg_stream *os)
 {
-    struct ogg_stream *os = ogg->streams + idx;
-    uint8_t *nb = av_malloc(os->bufsize + FF_INPUT_BUFFER_PADDING_SIZE);
     int size = os->bufpos - os->pstart;
 
-    if (os->buf) {
-        memcpy(nb, os->buf + os->pstart, size);
-        av_free(os->buf);
-    }
-
-    os->buf    = nb;
+    if (os->pstart)
+        memmove(os->buf, os->buf + os->pstart, size);
     os->bufpos = size;
     os->pstart = 0;
+}
 
+/* Makes room for size more bytes in the buffer of os. */
+static int ogg_buf_reserve(struct ogg_stream *os, int size)
+{
+    if (os->bufsize - os->bufpos < size) {
+        unsigned bufsize = os->bufsize;
+        uint8_t *nb;
+        while (bufsize - os->bufpos < size)
+            bufsize *= 2;
+        nb = av_realloc(os->buf, bufsize + FF_INPUT_BUFFER_PADDING_SIZE);
+        if (!nb)
+            return AVERROR(ENOMEM);
+        os->buf     = nb;
+        os->bufsize = bufsize;
+    }
     return 0;
 }
 
@@ -298,92 +310,189 @@ static int data_packets_seen(const struct ogg *ogg)
     return 0;
 }
 
+/* Consumes the capture pattern if the input is at one. */
+static int ogg_sync_at(AVIOContext *bc)
+{
+    uint8_t sync[4];
+    int64_t pos;
+
+    if (bc->buf_end - bc->buf_ptr >= 4) {
+        if (AV_RL32(bc->buf_ptr) != MKTAG('O', 'g', 'g', 'S'))
+            return 0;
+        bc->buf_ptr += 4;
+        return 1;
+    }
+
+    pos = avio_tell(bc);
+    if (ffio_ensure_seekback(bc, 4) < 0 || avio_read(bc, sync, 4) < 4)
+        return AVERROR_EOF;
+    if (AV_RL32(sync) == MKTAG('O', 'g', 'g', 'S'))
+        return 1;
+    avio_seek(bc, pos, SEEK_SET);
+    return 0;
+}
+
+/* Skips ahead to the next capture pattern and past it. The bytes in the
+   I/O buffer are searched with memchr(), only the up to 3 bytes straddling
+   the end of the buffer are checked one position at a time. */
+static int ogg_sync(AVFormatContext *s)
+{
+    AVIOContext *bc = s->pb;
+    struct ogg *ogg = s->priv_data;
+    int skipped = 0, ret;
+
+    if ((ret = ogg_sync_at(bc)))
+        return ret < 0 ? ret : 0;
+
+    if (bc->seekable && ogg->page_pos > 0) {
+        avio_seek(bc, ogg->page_pos + 4, SEEK_SET);
+        ogg->page_pos = -1;
+    }
+
+    while (skipped < MAX_PAGE_SIZE) {
+        int left = bc->buf_end - bc->buf_ptr;
+        uint8_t *p;
+
+        if (left < 4) {
+            if ((ret = ogg_sync_at(bc)))
+                return ret < 0 ? ret : 0;
+            avio_skip(bc, 1);
+            skipped++;
+            continue;
+        }
+
+        p = memchr(bc->buf_ptr, 'O', left - 3);
+        if (p && AV_RL32(p) == MKTAG('O', 'g', 'g', 'S')) {
+            bc->buf_ptr = p + 4;
+            return 0;
+        }
+        left = p ? p + 1 - bc->buf_ptr : left - 3;
+        bc->buf_ptr += left;
+        skipped     += left;
+    }
+
+    av_log(s, AV_LOG_INFO, "cannot find sync word\n");
+    return AVERROR_INVALIDDATA;
+}
+
 static int ogg_read_page(AVFormatContext *s, int *sid)
 {
     AVIOContext *bc = s->pb;
     struct ogg *ogg = s->priv_data;
     struct ogg_stream *os;
-    int ret, i = 0;
+    const AVCRC *crc_table = av_crc_get_table(AV_CRC_32_IEEE);
+    int ret, i;
     int flags, nsegs;
     uint64_t gp;
     uint32_t serial;
     int size, idx;
-    uint8_t sync[4];
-    int sp = 0;
+    uint8_t header[27], segments[255], *data;
+    int64_t page_pos;
+    uint32_t crc = 0, page_crc = 0;
+    int crccheck = s->error_recognition & AV_EF_CRCCHECK;
 
-    ret = avio_read(bc, sync, 4);
-    if (ret < 4)
-        return ret < 0 ? ret : AVERROR_EOF;
+    if ((ret = ogg_sync(s)) < 0)
+        return ret;
+    page_pos = avio_tell(bc) - 4;
 
-    do {
-        int c;
+    /* everything after the capture pattern, up to the segment table */
+    AV_WL32(header, MKTAG('O', 'g', 'g', 'S'));
+    ret = avio_read(bc, header + 4, 23);
+    if (ret < 23)
+        return ret < 0 ? ret : AVERROR_EOF;
 
-        if (sync[sp & 3] == 'O' &&
-            sync[(sp + 1) & 3] == 'g' &&
-            sync[(sp + 2) & 3] == 'g' && sync[(sp + 3) & 3] == 'S')
-            break;
+    if (header[4] != 0) {      /* version */
+        av_log (s, AV_LOG_ERROR, "ogg page, unsupported version\n");
+        return AVERROR_INVALIDDATA;
+    }
 
-        if(!i && bc->seekable && ogg->page_pos > 0) {
-            memset(sync, 0, 4);
-            avio_seek(bc, ogg->page_pos+4, SEEK_SET);
-            ogg->page_pos = -1;
-        }
+    flags    = header[5];
+    gp       = AV_RL64(header + 6);
+    serial   = AV_RL32(header + 14);
+    /* seq */
+    page_crc = AV_RB32(header + 22);
+    nsegs    = header[26];
 
-        c = avio_r8(bc);
+    ret = avio_read(bc, segments, nsegs);
+    if (ret < nsegs)
+        return ret < 0 ? ret : AVERROR_EOF;
 
-        if (avio_feof(bc))
-            return AVERROR_EOF;
+    if (crccheck) {
+        /* the checksum is taken with the crc field set to 0 */
+        AV_WN32(header + 22, 0);
+        crc = av_crc(crc_table, 0, header, 27);
+        crc = av_crc(crc_table, crc, segments, nsegs);
+    }
 
-        sync[sp++ & 3] = c;
-    } while (i++ < MAX_PAGE_SIZE);
+    size = 0;
+    for (i = 0; i < nsegs; i++)
+        size += segments[i];
 
-    if (i >= MAX_PAGE_SIZE) {
-        av_log(s, AV_LOG_INFO, "cannot find sync word\n");
-        return AVERROR_INVALIDDATA;
+    /* The page goes straight to the buffer of a known stream. A new one
+       is only set up once the checksum matched. */
+    idx = ogg_find_stream(ogg, serial);
+    if (idx >= 0) {
+        os = ogg->streams + idx;
+        if (os->psize > 0)
+            ogg_buf_shift(os);
+        if ((ret = ogg_buf_reserve(os, size)) < 0)
+            return ret;
+        data = os->buf + os->bufpos;
+    } else {
+        data = av_mallocz(size + FF_INPUT_BUFFER_PADDING_SIZE);
+        if (!data)
+            return AVERROR(ENOMEM);
     }
 
-    if (avio_r8(bc) != 0) {      /* version */
-        av_log (s, AV_LOG_ERROR, "ogg page, unsupported version\n");
-        return AVERROR_INVALIDDATA;
+    ret = avio_read(bc, data, size);
+    if (ret < size) {
+        if (idx < 0)
+            av_free(data);
+        return ret < 0 ? ret : AVERROR_EOF;
     }
 
-    flags  = avio_r8(bc);
-    gp     = avio_rl64(bc);
-    serial = avio_rl32(bc);
-    avio_skip(bc, 8); /* seq, crc */
-    nsegs  = avio_r8(bc);
+    if (crccheck && av_crc(crc_table, crc, data, size) != page_crc) {
+        av_log(s, AV_LOG_ERROR, "ogg page at %"PRId64" has a wrong CRC, skipping it\n",
+               page_pos);
+        if (idx < 0)
+            av_free(data);
+        /* look for the next page from right after this capture pattern */
+        avio_seek(bc, page_pos + 4, SEEK_SET);
+        ogg->page_pos = -1;
+        if (sid)
+            *sid = -1;
+        return 0;
+    }
 
-    idx = ogg_find_stream(ogg, serial);
     if (idx < 0) {
         if (data_packets_seen(ogg))
-            idx = ogg_replace_stream(s, serial, nsegs);
+            idx = ogg_replace_stream(s, serial, data);
         else
             idx = ogg_new_stream(s, serial);
 
         if (idx < 0) {
             av_log(s, AV_LOG_ERROR, "failed to create or replace stream\n");
+            av_free(data);
             return idx;
         }
+        os = ogg->streams + idx;
+        if (os->psize > 0)
+            ogg_buf_shift(os);
+        ret = ogg_buf_reserve(os, size);
+        if (ret >= 0)
+            memcpy(os->buf + os->bufpos, data, size);
+        av_free(data);
+        if (ret < 0)
+            return ret;
     }
 
-    os = ogg->streams + idx;
     ogg->page_pos =
-    os->page_pos = avio_tell(bc) - 27;
-
-    if (os->psize > 0)
-        ogg_new_buf(ogg, idx);
-
-    ret = avio_read(bc, os->segments, nsegs);
-    if (ret < nsegs)
-        return ret < 0 ? ret : AVERROR_EOF;
+    os->page_pos = page_pos;
 
+    memcpy(os->segments, segments, nsegs);
     os->nsegs = nsegs;
     os->segp  = 0;
 
-    size = 0;
-    for (i = 0; i < nsegs; i++)
-        size += os->segments[i];
-
     if (!(flags & OGG_FLAG_BOS))
         os->got_data = 1;
 
@@ -405,19 +514,6 @@ static int ogg_read_page(AVFormatContext *s, int *sid)
         os->sync_pos = os->page_pos;
     }
 
-    if (os->bufsize - os->bufpos < size) {
-        uint8_t *nb = av_malloc((os->bufsize *= 2) + FF_INPUT_BUFFER_PADDING_SIZE);
-        if (!nb)
-            return AVERROR(ENOMEM);
-        memcpy(nb, os->buf, os->bufpos);
-        av_free(os->buf);
-        os->buf = nb;
-    }
-
-    ret = avio_read(bc, os->buf + os->bufpos, size);
-    if (ret < size)
-        return ret < 0 ? ret : AVERROR_EOF;
-
     os->bufpos += size;
     os->granule = gp;
     os->flags   = flags;
@@ -595,6 +691,8 @@ static int ogg_get_length(AVFormatContext *s)
     ogg->page_pos = -1;
 
     while (!ogg_read_page(s, &i)) {
+        if (i < 0)
+            continue;
         if (ogg->streams[i].granule != -1 && ogg->streams[i].granule != 0 &&
             ogg->streams[i].codec) {
             s->streams[i]->duration =
@@ -879,6 +977,20 @@ static int ogg_read_seek(AVFormatContext *s, int stream_index,
         && !(flags & AVSEEK_FLAG_ANY))
         os->keyframe_seek = 1;
 
+    // A skeleton index tells where every keyframe starts, so go straight
+    // there instead of reading timestamps all over the file.
+    if (os->index_end && timestamp <= os->index_end) {
+        AVStream *st = s->streams[stream_index];
+        int index = av_index_search_timestamp(st, timestamp, flags);
+        if (index >= 0) {
+            AVIndexEntry *ie = &st->index_entries[index];
+            if (avio_seek(s->pb, ie->pos, SEEK_SET) >= 0) {
+                ff_update_cur_dts(s, st, ie->timestamp);
+                return 0;
+            }
+        }
+    }
+
     ret = ff_seek_frame_binary(s, stream_index, timestamp, flags);
     os  = ogg->streams + stream_index;
     if (ret < 0)
@@ -85,6 +85,7 @@ struct ogg_stream {
     int got_data;   ///< 1 if the stream got some data (non-initial packets), 0 otherwise
     int nb_header; ///< set to the number of parsed headers
     int end_trimming; ///< set the number of packets to drop from the end
+    int64_t index_end; ///< end time of the keyframe index read from a skeleton, 0 without one
     uint8_t *new_metadata;
     unsigned int new_metadata_size;
     void *private;
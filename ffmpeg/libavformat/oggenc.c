@@ -29,7 +29,6 @@
 #include "libavcodec/bytestream.h"
 #include "libavcodec/flac.h"
 #include "avformat.h"
-#include "avio_internal.h"
 #include "internal.h"
 #include "vorbiscomment.h"
 
@@ -42,8 +41,8 @@ typedef struct {
     uint8_t flags;
     uint8_t segments_count;
     uint8_t segments[255];
-    uint8_t data[MAX_PAGE_SIZE];
     uint16_t size;
+    uint8_t data[MAX_PAGE_SIZE]; ///< last, only size bytes are copied
 } OGGPage;
 
 typedef struct {
@@ -69,6 +68,7 @@ typedef struct OGGPageList {
 typedef struct {
     const AVClass *class;
     OGGPageList *page_list;
+    OGGPageList *free_pages; ///< written pages kept for reuse
     int pref_size; ///< preferred page size (0 => fill all segments)
     int64_t pref_duration;      ///< preferred page duration (0 => fill all segments)
 } OGGContext;
@@ -94,49 +94,29 @@ static const AVClass flavor ## _muxer_class = {\
     .version    = LIBAVUTIL_VERSION_INT,\
 };
 
-static void ogg_update_checksum(AVFormatContext *s, AVIOContext *pb, int64_t crc_offset)
-{
-    int64_t pos = avio_tell(pb);
-    uint32_t checksum = ffio_get_checksum(pb);
-    avio_seek(pb, crc_offset, SEEK_SET);
-    avio_wb32(pb, checksum);
-    avio_seek(pb, pos, SEEK_SET);
-}
-
 static int ogg_write_page(AVFormatContext *s, OGGPage *page, int extra_flags)
 {
     OGGStreamContext *oggstream = s->streams[page->stream_index]->priv_data;
-    AVIOContext *pb;
-    int64_t crc_offset;
-    int ret, size;
-    uint8_t *buf;
-
-    ret = avio_open_dyn_buf(&pb);
-    if (ret < 0)
-        return ret;
-    ffio_init_checksum(pb, ff_crc04C11DB7_update, 0);
-    ffio_wfourcc(pb, "OggS");
-    avio_w8(pb, 0);
-    avio_w8(pb, page->flags | extra_flags);
-    avio_wl64(pb, page->granule);
-    avio_wl32(pb, oggstream->serial_num);
-    avio_wl32(pb, oggstream->page_counter++);
-    crc_offset = avio_tell(pb);
-    avio_wl32(pb, 0); // crc
-    avio_w8(pb, page->segments_count);
-    avio_write(pb, page->segments, page->segments_count);
-    avio_write(pb, page->data, page->size);
-
-    ogg_update_checksum(s, pb, crc_offset);
-    avio_flush(pb);
-
-    size = avio_close_dyn_buf(pb, &buf);
-    if (size < 0)
-        return size;
-
-    avio_write(s->pb, buf, size);
-    avio_flush(s->pb);
-    av_free(buf);
+    const AVCRC *crc_table = av_crc_get_table(AV_CRC_32_IEEE);
+    uint8_t header[27 + 255], *p = header;
+    uint32_t crc;
+
+    bytestream_put_buffer(&p, "OggS", 4);
+    bytestream_put_byte(&p, 0);
+    bytestream_put_byte(&p, page->flags | extra_flags);
+    bytestream_put_le64(&p, page->granule);
+    bytestream_put_le32(&p, oggstream->serial_num);
+    bytestream_put_le32(&p, oggstream->page_counter++);
+    bytestream_put_le32(&p, 0); // crc
+    bytestream_put_byte(&p, page->segments_count);
+    bytestream_put_buffer(&p, page->segments, page->segments_count);
+
+    crc = av_crc(crc_table, 0, header, p - header);
+    crc = av_crc(crc_table, crc, page->data, page->size);
+    AV_WB32(header + 22, crc);
+
+    avio_write(s->pb, header, p - header);
+    avio_write(s->pb, page->data, page->size);
     oggstream->page_count--;
     return 0;
 }
@@ -184,11 +164,14 @@ static int ogg_buffer_page(AVFormatContext *s, OGGStreamContext *oggstream)
 {
     OGGContext *ogg = s->priv_data;
     OGGPageList **p = &ogg->page_list;
-    OGGPageList *l = av_mallocz(sizeof(*l));
+    OGGPageList *l = ogg->free_pages;
 
-    if (!l)
+    if (l)
+        ogg->free_pages = l->next;
+    else if (!(l = av_malloc(sizeof(*l))))
         return AVERROR(ENOMEM);
-    l->page = oggstream->page;
+    memcpy(&l->page, &oggstream->page,
+           offsetof(OGGPage, data) + oggstream->page.size);
 
     oggstream->page.start_granule = oggstream->page.granule;
     oggstream->page_count++;
@@ -413,7 +396,8 @@ static void ogg_write_pages(AVFormatContext *s, int flush)
         ogg_write_page(s, &p->page,
                        flush == 1 && oggstream->page_count == 1 ? 4 : 0); // eos
         next = p->next;
-        av_freep(&p);
+        p->next = ogg->free_pages;
+        ogg->free_pages = p;
         p = next;
     }
     ogg->page_list = p;
@@ -615,11 +599,14 @@ static int ogg_write_packet(AVFormatContext *s, AVPacket *pkt)
     }
 
     ogg_write_pages(s, 2);
+    avio_flush(s->pb);
     return 0;
 }
 
 static int ogg_write_trailer(AVFormatContext *s)
 {
+    OGGContext *ogg = s->priv_data;
+    OGGPageList *p;
     int i;
 
     /* flush current page if needed */
@@ -643,6 +630,11 @@ static int ogg_write_trailer(AVFormatContext *s)
         av_freep(&oggstream->header[1]);
         av_freep(&st->priv_data);
     }
+
+    while ((p = ogg->free_pages)) {
+        ogg->free_pages = p->next;
+        av_free(p);
+    }
     return 0;
 }
 
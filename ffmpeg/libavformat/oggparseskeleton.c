@@ -23,6 +23,80 @@
 #include "internal.h"
 #include "oggdec.h"
 
+/**
+ * Read a variable length integer of a skeleton index, 7 bits per byte
+ * starting with the least significant, the last byte has the high bit set.
+ * @return the value, or -1 if it runs past end
+ */
+static int64_t read_vl_int(const uint8_t **p, const uint8_t *end)
+{
+    int64_t n = 0;
+    int shift;
+
+    for (shift = 0; *p < end && shift < 63; shift += 7) {
+        uint8_t b = *(*p)++;
+        n |= (int64_t)(b & 0x7f) << shift;
+        if (b & 0x80)
+            return n;
+    }
+    return -1;
+}
+
+/**
+ * Add the keypoints of a Skeleton 4 index packet to the index entries of
+ * the stream it describes, so seeks can go straight to the keyframe
+ * instead of bisecting the file.
+ */
+static int skeleton_index(AVFormatContext *s, uint8_t *buf, int size)
+{
+    struct ogg *ogg = s->priv_data;
+    const uint8_t *p = buf + 42, *end = buf + size;
+    int64_t num_keypoints, den, offset = 0, time = 0;
+    AVRational time_base;
+    AVStream *st;
+    int64_t i;
+    int target_idx;
+
+    if (size < 42)
+        return -1;
+
+    target_idx = ogg_find_stream(ogg, AV_RL32(buf+6));
+    if (target_idx < 0) {
+        av_log(s, AV_LOG_WARNING, "Serial number in index doesn't match any stream\n");
+        return 1;
+    }
+    st = s->streams[target_idx];
+
+    num_keypoints = AV_RL64(buf+10);
+    den           = AV_RL64(buf+18);
+    if (num_keypoints <= 0)
+        return 1;
+    if (den <= 0 || den > INT_MAX) {
+        av_log(s, AV_LOG_WARNING, "Invalid timestamp denominator in index\n");
+        return 1;
+    }
+    time_base = (AVRational){ 1, den };
+
+    for (i = 0; i < num_keypoints; i++) {
+        int64_t offset_diff = read_vl_int(&p, end);
+        int64_t time_diff   = read_vl_int(&p, end);
+        if (offset_diff < 0 || time_diff < 0) {
+            av_log(s, AV_LOG_WARNING, "Truncated index, %"PRId64" of %"PRId64
+                   " keypoints read\n", i, num_keypoints);
+            break;
+        }
+        offset += offset_diff;
+        time   += time_diff;
+        av_add_index_entry(st, offset, av_rescale_q(time, time_base, st->time_base),
+                           0, 0, AVINDEX_KEYFRAME);
+    }
+    if (i > 0)
+        ogg->streams[target_idx].index_end =
+            av_rescale_q(AV_RL64(buf+34), time_base, st->time_base);
+
+    return 1;
+}
+
 static int skeleton_header(AVFormatContext *s, int idx)
 {
     struct ogg *ogg = s->priv_data;
@@ -88,6 +162,8 @@ static int skeleton_header(AVFormatContext *s, int idx)
         if (start_granule != OGG_NOGRANULE_VALUE) {
             os->start_granule = start_granule;
         }
+    } else if (!strncmp(buf, "index", 6)) {
+        return skeleton_index(s, buf, os->psize);
     }
 
     return 1;
@@ -24,16 +24,12 @@
 #include "common.h"
 #include "mem.h"
 
-AVBufferRef *av_buffer_create(uint8_t *data, int size,
-                              void (*free)(void *opaque, uint8_t *data),
-                              void *opaque, int flags)
+/* sets up the zeroed buf for data, the reference returned is its first one */
+static AVBufferRef *buffer_create(AVBuffer *buf, uint8_t *data, int size,
+                                  void (*free)(void *opaque, uint8_t *data),
+                                  void *opaque, int flags)
 {
-    AVBufferRef *ref = NULL;
-    AVBuffer    *buf = NULL;
-
-    buf = av_mallocz(sizeof(*buf));
-    if (!buf)
-        return NULL;
+    AVBufferRef *ref = &buf->refs[0];
 
     buf->data     = data;
     buf->size     = size;
@@ -44,12 +40,7 @@ AVBufferRef *av_buffer_create(uint8_t *data, int size,
     if (flags & AV_BUFFER_FLAG_READONLY)
         buf->flags |= BUFFER_FLAG_READONLY;
 
-    ref = av_mallocz(sizeof(*ref));
-    if (!ref) {
-        av_freep(&buf);
-        return NULL;
-    }
-
+    buf->refs_used[0] = 1;
     ref->buffer = buf;
     ref->data   = data;
     ref->size   = size;
@@ -57,6 +48,62 @@ AVBufferRef *av_buffer_create(uint8_t *data, int size,
     return ref;
 }
 
+AVBufferRef *av_buffer_create(uint8_t *data, int size,
+                              void (*free)(void *opaque, uint8_t *data),
+                              void *opaque, int flags)
+{
+    AVBuffer *buf = av_mallocz(sizeof(*buf));
+    if (!buf)
+        return NULL;
+
+    return buffer_create(buf, data, size, free, opaque, flags);
+}
+
+/* References that didn't fit into the refs of their AVBuffer are kept here
+ * when freed, for buffers that many threads hold at once. */
+#define REF_CACHE_SIZE 64
+
+static AVBufferRef * volatile ref_cache[REF_CACHE_SIZE];
+
+/* a reference to b, one of its own while any is free */
+static AVBufferRef *ref_alloc(AVBuffer *b)
+{
+    AVBufferRef *ref;
+    int i;
+
+    for (i = 0; i < BUFFER_REFS; i++) {
+        /* whoever counts the slot up from 0 takes it */
+        if (avpriv_atomic_int_add_and_fetch(&b->refs_used[i], 1) == 1)
+            return &b->refs[i];
+        avpriv_atomic_int_add_and_fetch(&b->refs_used[i], -1);
+    }
+
+    for (i = 0; i < REF_CACHE_SIZE; i++) {
+        ref = ref_cache[i];
+        if (ref &&
+            avpriv_atomic_ptr_cas((void * volatile *)&ref_cache[i], ref, NULL) == ref)
+            return ref;
+    }
+
+    return av_mallocz(sizeof(AVBufferRef));
+}
+
+static void ref_free(AVBufferRef *ref)
+{
+    AVBuffer *b = ref->buffer;
+    int i;
+
+    if (ref >= b->refs && ref < b->refs + BUFFER_REFS) {
+        avpriv_atomic_int_add_and_fetch(&b->refs_used[ref - b->refs], -1);
+        return;
+    }
+
+    for (i = 0; i < REF_CACHE_SIZE; i++)
+        if (!avpriv_atomic_ptr_cas((void * volatile *)&ref_cache[i], NULL, ref))
+            return;
+    av_free(ref);
+}
+
 void av_buffer_default_free(void *opaque, uint8_t *data)
 {
     av_free(data);
@@ -90,7 +137,7 @@ AVBufferRef *av_buffer_allocz(int size)
 
 AVBufferRef *av_buffer_ref(AVBufferRef *buf)
 {
-    AVBufferRef *ret = av_mallocz(sizeof(*ret));
+    AVBufferRef *ret = ref_alloc(buf->buffer);
 
     if (!ret)
         return NULL;
@@ -109,11 +156,17 @@ void av_buffer_unref(AVBufferRef **buf)
     if (!buf || !*buf)
         return;
     b = (*buf)->buffer;
-    av_freep(buf);
+    ref_free(*buf);
+    *buf = NULL;
 
     if (!avpriv_atomic_int_add_and_fetch(&b->refcount, -1)) {
+        /* b->free may return the pool entry b is part of to the pool,
+         * where it can be taken again right away */
+        int free_buffer = !(b->flags & BUFFER_FLAG_NO_FREE);
+
         b->free(b->opaque, b->data);
-        av_freep(&b);
+        if (free_buffer)
+            av_free(b);
     }
 }
 
@@ -346,12 +399,11 @@ AVBufferRef *av_buffer_pool_get(AVBufferPool *pool)
     add_to_pool(buf->next);
     buf->next = NULL;
 
-    ret = av_buffer_create(buf->data, pool->size, pool_release_buffer,
-                           buf, 0);
-    if (!ret) {
-        add_to_pool(buf);
-        return NULL;
-    }
+    /* the entry's own AVBuffer describes the data again */
+    memset(&buf->buffer, 0, sizeof(buf->buffer));
+    ret = buffer_create(&buf->buffer, buf->data, pool->size,
+                        pool_release_buffer, buf, 0);
+    buf->buffer.flags |= BUFFER_FLAG_NO_FREE;
     avpriv_atomic_int_add_and_fetch(&pool->refcount, 1);
 
     return ret;
@@ -31,6 +31,16 @@
  * The buffer was av_realloc()ed, so it is reallocatable.
  */
 #define BUFFER_FLAG_REALLOCATABLE (1 << 1)
+/**
+ * The AVBuffer is part of a BufferPoolEntry, so it must not be freed.
+ */
+#define BUFFER_FLAG_NO_FREE       (1 << 2)
+
+/**
+ * The number of references an AVBuffer keeps for itself. More references
+ * than that at once are taken from the cache in buffer.c or allocated.
+ */
+#define BUFFER_REFS 8
 
 struct AVBuffer {
     uint8_t *data; /**< data described by this buffer */
@@ -55,6 +65,13 @@ struct AVBuffer {
      * A combination of BUFFER_FLAG_*
      */
     int flags;
+
+    /**
+     * References to this buffer, handed out instead of allocated ones.
+     * refs_used[i] is 1 while refs[i] is in use.
+     */
+    AVBufferRef refs[BUFFER_REFS];
+    volatile int refs_used[BUFFER_REFS];
 };
 
 typedef struct BufferPoolEntry {
@@ -69,6 +86,12 @@ typedef struct BufferPoolEntry {
 
     AVBufferPool *pool;
     struct BufferPoolEntry * volatile next;
+
+    /*
+     * The AVBuffer of data while it is out of the pool, reused every time
+     * instead of being allocated again.
+     */
+    AVBuffer buffer;
 } BufferPoolEntry;
 
 struct AVBufferPool {
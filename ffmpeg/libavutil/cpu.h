@@ -54,6 +54,7 @@
 #define AV_CPU_FLAG_FMA3        0x10000 ///< Haswell FMA3 functions
 #define AV_CPU_FLAG_BMI1        0x20000 ///< Bit Manipulation Instruction Set 1
 #define AV_CPU_FLAG_BMI2        0x40000 ///< Bit Manipulation Instruction Set 2
+#define AV_CPU_FLAG_CLMUL       0x80000 ///< PCLMULQDQ carry-less multiplication
 
 #define AV_CPU_FLAG_ALTIVEC      0x0001 ///< standard
 
@@ -22,6 +22,9 @@
 #include "common.h"
 #include "bswap.h"
 #include "crc.h"
+#if ARCH_X86
+#include "x86/crc.h"
+#endif
 
 #if CONFIG_HARDCODED_TABLES
 static const AVCRC av_crc_table[AV_CRC_MAX][257] = {
@@ -288,7 +291,8 @@ static const AVCRC av_crc_table[AV_CRC_MAX][257] = {
 #if CONFIG_SMALL
 #define CRC_TABLE_SIZE 257
 #else
-#define CRC_TABLE_SIZE 1024
+/* 8 tables, for taking 8 bytes at a time */
+#define CRC_TABLE_SIZE 2048
 #endif
 static struct {
     uint8_t  le;
@@ -306,15 +310,15 @@ static struct {
 static AVCRC av_crc_table[AV_CRC_MAX][CRC_TABLE_SIZE];
 #endif
 
-int av_crc_init(AVCRC *ctx, int le, int bits, uint32_t poly, int ctx_size)
+/* Fills in tables tables of 256 entries, the one at j taking a byte
+   followed by j zero bytes. */
+static int crc_init(AVCRC *ctx, int le, int bits, uint32_t poly, int tables)
 {
     unsigned i, j;
     uint32_t c;
 
     if (bits < 8 || bits > 32 || poly >= (1LL << bits))
         return -1;
-    if (ctx_size != sizeof(AVCRC) * 257 && ctx_size != sizeof(AVCRC) * 1024)
-        return -1;
 
     for (i = 0; i < 256; i++) {
         if (le) {
@@ -329,25 +333,31 @@ int av_crc_init(AVCRC *ctx, int le, int bits, uint32_t poly, int ctx_size)
     }
     ctx[256] = 1;
 #if !CONFIG_SMALL
-    if (ctx_size >= sizeof(AVCRC) * 1024)
-        for (i = 0; i < 256; i++)
-            for (j = 0; j < 3; j++)
-                ctx[256 *(j + 1) + i] =
-                    (ctx[256 * j + i] >> 8) ^ ctx[ctx[256 * j + i] & 0xFF];
+    for (i = 0; i < 256; i++)
+        for (j = 0; j + 1 < tables; j++)
+            ctx[256 *(j + 1) + i] =
+                (ctx[256 * j + i] >> 8) ^ ctx[ctx[256 * j + i] & 0xFF];
 #endif
 
     return 0;
 }
 
+int av_crc_init(AVCRC *ctx, int le, int bits, uint32_t poly, int ctx_size)
+{
+    if (ctx_size != sizeof(AVCRC) * 257 && ctx_size != sizeof(AVCRC) * 1024)
+        return -1;
+    return crc_init(ctx, le, bits, poly, ctx_size / (sizeof(AVCRC) * 256));
+}
+
 const AVCRC *av_crc_get_table(AVCRCId crc_id)
 {
 #if !CONFIG_HARDCODED_TABLES
     if (!av_crc_table[crc_id][FF_ARRAY_ELEMS(av_crc_table[crc_id]) - 1])
-        if (av_crc_init(av_crc_table[crc_id],
-                        av_crc_table_params[crc_id].le,
-                        av_crc_table_params[crc_id].bits,
-                        av_crc_table_params[crc_id].poly,
-                        sizeof(av_crc_table[crc_id])) < 0)
+        if (crc_init(av_crc_table[crc_id],
+                     av_crc_table_params[crc_id].le,
+                     av_crc_table_params[crc_id].bits,
+                     av_crc_table_params[crc_id].poly,
+                     CRC_TABLE_SIZE / 256) < 0)
             return NULL;
 #endif
     return av_crc_table[crc_id];
@@ -360,6 +370,40 @@ uint32_t av_crc(const AVCRC *ctx, uint32_t crc,
 
 #if !CONFIG_SMALL
     if (!ctx[256]) {
+#if !CONFIG_HARDCODED_TABLES
+        /* the standard tables have 8 slices, contexts of av_crc_init() 4 */
+        if (ctx >= av_crc_table[0] && ctx < av_crc_table[AV_CRC_MAX]) {
+#if ARCH_X86
+            if (length >= 128 && (ctx == av_crc_table[AV_CRC_32_IEEE] ||
+                                  ctx == av_crc_table[AV_CRC_32_IEEE_LE])) {
+                uint8_t rem[16];
+                size_t blocks = length & ~(size_t)15;
+
+                if (ff_crc32_fold_x86(rem, ctx == av_crc_table[AV_CRC_32_IEEE_LE],
+                                      crc, buffer, blocks)) {
+                    crc     = av_crc(ctx, 0, rem, sizeof(rem));
+                    buffer += blocks;
+                }
+            }
+#endif
+            while (((intptr_t) buffer & 3) && buffer < end)
+                crc = ctx[((uint8_t) crc) ^ *buffer++] ^ (crc >> 8);
+
+            while (buffer < end - 7) {
+                uint32_t a = crc ^ av_le2ne32(*(const uint32_t *) buffer);
+                uint32_t b = av_le2ne32(*(const uint32_t *) (buffer + 4));
+                buffer += 8;
+                crc = ctx[7 * 256 + ( a        & 0xFF)] ^
+                      ctx[6 * 256 + ((a >> 8 ) & 0xFF)] ^
+                      ctx[5 * 256 + ((a >> 16) & 0xFF)] ^
+                      ctx[4 * 256 + ((a >> 24)       )] ^
+                      ctx[3 * 256 + ( b        & 0xFF)] ^
+                      ctx[2 * 256 + ((b >> 8 ) & 0xFF)] ^
+                      ctx[1 * 256 + ((b >> 16) & 0xFF)] ^
+                      ctx[0 * 256 + ((b >> 24)       )];
+            }
+        }
+#endif
         while (((intptr_t) buffer & 3) && buffer < end)
             crc = ctx[((uint8_t) crc) ^ *buffer++] ^ (crc >> 8);
 
@@ -399,6 +443,27 @@ int main(void)
         ctx = av_crc_get_table(p[i][0]);
         printf("crc %08X = %X\n", p[i][1], av_crc(ctx, 0, buf, sizeof(buf)));
     }
+
+    /* the faster paths against one byte at a time, at any alignment
+       and with a CRC carried over from a first part */
+    for (i = 0; i < 6; i++) {
+        int offset, length;
+        ctx = av_crc_get_table(p[i][0]);
+        for (offset = 0; offset < 16; offset++)
+            for (length = 0; length < 600; length += length < 140 ? 1 : 37) {
+                const uint8_t *b = buf + offset;
+                uint32_t ref = 0, crc;
+                int j, split = length / 3;
+                for (j = 0; j < length; j++)
+                    ref = ctx[((uint8_t) ref) ^ b[j]] ^ (ref >> 8);
+                crc = av_crc(ctx, av_crc(ctx, 0, b, split), b + split, length - split);
+                if (crc != ref) {
+                    printf("crc %08X mismatch at offset %d length %d: %X, %X expected\n",
+                           p[i][1], offset, length, crc, ref);
+                    return 1;
+                }
+            }
+    }
     return 0;
 }
 #endif
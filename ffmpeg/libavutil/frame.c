@@ -18,6 +18,7 @@
  */
 
 #include "channel_layout.h"
+#include "atomic.h"
 #include "avassert.h"
 #include "buffer.h"
 #include "common.h"
@@ -111,19 +112,84 @@ static void get_frame_defaults(AVFrame *frame)
     frame->chroma_location     = AVCHROMA_LOC_UNSPECIFIED;
 }
 
+/* Freed frames are kept here for the next av_frame_alloc(), so callers
+ * that allocate a frame for every picture, like libavfilter, don't touch
+ * the heap once there are enough of them. Side data is cached the same way.
+ * Each cache holds up to FRAME_CACHE_SIZE entries. */
+#define FRAME_CACHE_SIZE 16
+
+/* Side data of up to SIDE_DATA_INLINE_SIZE bytes, e.g. the pan-scan that
+ * mpeg12dec attaches to every picture, is allocated in one piece with its
+ * AVFrameSideData. side_data arrays grow SIDE_DATA_ARRAY_SIZE entries at
+ * a time. */
+#define SIDE_DATA_INLINE_SIZE 64
+#define SIDE_DATA_ARRAY_SIZE  4
+
+static void * volatile frame_cache[FRAME_CACHE_SIZE];
+static void * volatile side_data_cache[FRAME_CACHE_SIZE];
+static void * volatile side_data_array_cache[FRAME_CACHE_SIZE];
+
+static void *cache_get(void * volatile *cache)
+{
+    void *entry;
+    int i;
+
+    for (i = 0; i < FRAME_CACHE_SIZE; i++) {
+        entry = cache[i];
+        if (entry && avpriv_atomic_ptr_cas(&cache[i], entry, NULL) == entry)
+            return entry;
+    }
+    return NULL;
+}
+
+/* Returns 0 if the cache is full. */
+static int cache_put(void * volatile *cache, void *entry)
+{
+    int i;
+
+    for (i = 0; i < FRAME_CACHE_SIZE; i++)
+        if (!avpriv_atomic_ptr_cas(&cache[i], NULL, entry))
+            return 1;
+    return 0;
+}
+
 static void free_side_data(AVFrameSideData **ptr_sd)
 {
     AVFrameSideData *sd = *ptr_sd;
 
-    av_freep(&sd->data);
     av_dict_free(&sd->metadata);
+    /* larger data is allocated on its own, even if it happens to follow sd */
+    if (sd->size >= 0 && sd->size <= SIDE_DATA_INLINE_SIZE &&
+        sd->data == (uint8_t *)(sd + 1)) {
+        if (cache_put(side_data_cache, sd)) {
+            *ptr_sd = NULL;
+            return;
+        }
+    } else
+        av_freep(&sd->data);
     av_freep(ptr_sd);
 }
 
+static void free_side_data_array(AVFrame *frame)
+{
+    int i;
+
+    for (i = 0; i < frame->nb_side_data; i++) {
+        free_side_data(&frame->side_data[i]);
+    }
+    if (frame->side_data && frame->nb_side_data <= SIDE_DATA_ARRAY_SIZE &&
+        cache_put(side_data_array_cache, frame->side_data))
+        frame->side_data = NULL;
+    av_freep(&frame->side_data);
+    frame->nb_side_data = 0;
+}
+
 AVFrame *av_frame_alloc(void)
 {
-    AVFrame *frame = av_mallocz(sizeof(*frame));
+    AVFrame *frame = cache_get(frame_cache);
 
+    if (!frame)
+        frame = av_mallocz(sizeof(*frame));
     if (!frame)
         return NULL;
 
@@ -139,7 +205,10 @@ void av_frame_free(AVFrame **frame)
         return;
 
     av_frame_unref(*frame);
-    av_freep(frame);
+    if (cache_put(frame_cache, *frame))
+        *frame = NULL;
+    else
+        av_freep(frame);
 }
 
 static int get_video_buffer(AVFrame *frame, int align)
@@ -366,10 +435,7 @@ void av_frame_unref(AVFrame *frame)
 {
     int i;
 
-    for (i = 0; i < frame->nb_side_data; i++) {
-        free_side_data(&frame->side_data[i]);
-    }
-    av_freep(&frame->side_data);
+    free_side_data_array(frame);
 
     for (i = 0; i < FF_ARRAY_ELEMS(frame->buf); i++)
         av_buffer_unref(&frame->buf[i]);
@@ -499,10 +565,7 @@ int av_frame_copy_props(AVFrame *dst, const AVFrame *src)
         sd_dst = av_frame_new_side_data(dst, sd_src->type,
                                                          sd_src->size);
         if (!sd_dst) {
-            for (i = 0; i < dst->nb_side_data; i++) {
-                free_side_data(&dst->side_data[i]);
-            }
-            av_freep(&dst->side_data);
+            free_side_data_array(dst);
             return AVERROR(ENOMEM);
         }
         memcpy(sd_dst->data, sd_src->data, sd_src->size);
@@ -559,25 +622,40 @@ AVFrameSideData *av_frame_new_side_data(AVFrame *frame,
                                         enum AVFrameSideDataType type,
                                         int size)
 {
-    AVFrameSideData *ret, **tmp;
+    AVFrameSideData *ret, **tmp = frame->side_data;
 
-    if (frame->nb_side_data > INT_MAX / sizeof(*frame->side_data) - 1)
+    if (frame->nb_side_data > INT_MAX / sizeof(*frame->side_data) - SIDE_DATA_ARRAY_SIZE)
         return NULL;
 
-    tmp = av_realloc(frame->side_data,
-                     (frame->nb_side_data + 1) * sizeof(*frame->side_data));
+    if (!tmp) {
+        tmp = cache_get(side_data_array_cache);
+        if (!tmp)
+            tmp = av_malloc(SIDE_DATA_ARRAY_SIZE * sizeof(*frame->side_data));
+    } else if (frame->nb_side_data && !(frame->nb_side_data % SIDE_DATA_ARRAY_SIZE))
+        tmp = av_realloc(frame->side_data,
+                         (frame->nb_side_data + SIDE_DATA_ARRAY_SIZE) * sizeof(*frame->side_data));
     if (!tmp)
         return NULL;
     frame->side_data = tmp;
 
-    ret = av_mallocz(sizeof(*ret));
-    if (!ret)
-        return NULL;
+    if (size >= 0 && size <= SIDE_DATA_INLINE_SIZE) {
+        ret = cache_get(side_data_cache);
+        if (!ret)
+            ret = av_malloc(sizeof(*ret) + SIDE_DATA_INLINE_SIZE);
+        if (!ret)
+            return NULL;
+        memset(ret, 0, sizeof(*ret));
+        ret->data = (uint8_t *)(ret + 1);
+    } else {
+        ret = av_mallocz(sizeof(*ret));
+        if (!ret)
+            return NULL;
 
-    ret->data = av_malloc(size);
-    if (!ret->data) {
-        av_freep(&ret);
-        return NULL;
+        ret->data = av_malloc(size);
+        if (!ret->data) {
+            av_freep(&ret);
+            return NULL;
+        }
     }
 
     ret->size = size;
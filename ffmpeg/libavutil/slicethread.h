@@ -0,0 +1,52 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/**
+ * @file
+ * internal API, a pool of worker threads running the jobs of one call at
+ * a time, for libraries without the codec threading of libavcodec
+ */
+
+#ifndef AVUTIL_SLICETHREAD_H
+#define AVUTIL_SLICETHREAD_H
+
+typedef struct AVSliceThread AVSliceThread;
+
+typedef int (AVSliceThreadFunc)(void *priv, void *arg, int jobnr, int nb_jobs);
+
+/**
+ * Start nb_threads worker threads, nothing is started for 1 or less.
+ *
+ * @param pctx set to the new pool, or to NULL when nothing was started
+ * @return 0 on success, a negative AVERROR code on failure
+ */
+int avpriv_slicethread_create(AVSliceThread **pctx, int nb_threads);
+
+/**
+ * Run func for jobs 0 to nb_jobs - 1 on the worker threads and wait for
+ * all of them, the return value of each job is stored in rets.
+ */
+void avpriv_slicethread_execute(AVSliceThread *ctx, AVSliceThreadFunc *func,
+                                void *priv, void *arg, int *rets, int nb_jobs);
+
+/**
+ * Stop the worker threads and free the pool, *pctx is set to NULL.
+ */
+void avpriv_slicethread_free(AVSliceThread **pctx);
+
+#endif /* AVUTIL_SLICETHREAD_H */
@@ -0,0 +1,150 @@
+/*
+ * CRC-32 folding with carry-less multiplication
+ *
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+ * Four 128-bit lanes run over the data 64 bytes at a time. A lane holding
+ * the polynomial H * x^64 + L stands for (H * x^64 + L) * x^D once D more
+ * bits follow it, which is H * (x^(D+64) mod P) + L * (x^D mod P) modulo P,
+ * two carry-less multiplications by 32-bit constants. The result is xored
+ * into the lane of the data D bits on, so the lanes never grow. At the end
+ * the lanes are folded into one, which is as good as the whole buffer.
+ *
+ * AV_CRC_32_IEEE takes the bytes most significant first, so each 16 bytes
+ * are reversed to make the first byte the top of the lane. AV_CRC_32_IEEE_LE
+ * takes the bits least significant first, which is the bit reversal of the
+ * above. A carry-less product of reversed operands is the reversed product
+ * shifted down by one bit, so its constants are x^(D+63) and x^(D-1) mod P,
+ * reversed, and the 16 bytes are taken as they are.
+ */
+
+#include "config.h"
+#include "libavutil/attributes.h"
+#include "libavutil/cpu.h"
+#include "libavutil/mem.h"
+#include "libavutil/x86/asm.h"
+#include "libavutil/x86/cpu.h"
+#include "crc.h"
+
+#if HAVE_INLINE_ASM && HAVE_SSSE3_INLINE
+
+/* the constants of the low and high half of a lane for D = 512 and 128 */
+DECLARE_ASM_CONST(16, uint64_t, crc32_le_fold)[4] = {
+    0x653d982200000000ULL, 0xcad38e8f00000000ULL,
+    0x65673b4600000000ULL, 0x9ba54c6f00000000ULL,
+};
+DECLARE_ASM_CONST(16, uint64_t, crc32_be_fold)[4] = {
+    0x00000000e6228b11ULL, 0x000000008833794cULL,
+    0x00000000e8a45605ULL, 0x00000000c5b9cd4cULL,
+};
+
+/* pshufb masks, keeping the bytes in order or reversing them */
+DECLARE_ASM_CONST(16, uint64_t, crc32_le_shuf)[2] = {
+    0x0706050403020100ULL, 0x0f0e0d0c0b0a0908ULL,
+};
+DECLARE_ASM_CONST(16, uint64_t, crc32_be_shuf)[2] = {
+    0x08090a0b0c0d0e0fULL, 0x0001020304050607ULL,
+};
+
+/* lane = lane * x^D mod P, xmm7 holding the constants, xmm4 is clobbered */
+#define FOLD(lane)                                  \
+    "movdqa    %%"lane", %%xmm4             \n\t"   \
+    "pclmulqdq $0x00, %%xmm7, %%"lane"      \n\t"   \
+    "pclmulqdq $0x11, %%xmm7, %%xmm4        \n\t"   \
+    "pxor      %%xmm4, %%"lane"             \n\t"
+
+/* lane = lane * x^D mod P + 16 bytes at offset of the buffer */
+#define FOLD_LOAD(lane, offset)                     \
+    FOLD(lane)                                      \
+    "movdqu    "offset"(%0), %%xmm5         \n\t"   \
+    "pshufb    %%xmm6, %%xmm5               \n\t"   \
+    "pxor      %%xmm5, %%"lane"             \n\t"
+
+static void crc32_fold_clmul(uint8_t *rem, const uint64_t *fold,
+                             const uint64_t *shuf, uint32_t crc,
+                             const uint8_t *buffer, size_t length)
+{
+    x86_reg len = length - 64;
+
+    __asm__ volatile(
+        "movdqa    (%4), %%xmm6                 \n\t"
+        "movdqa    (%3), %%xmm7                 \n\t"
+        "movd      %5, %%xmm4                   \n\t"
+        "movdqu    (%0), %%xmm0                 \n\t"
+        "movdqu    16(%0), %%xmm1               \n\t"
+        "movdqu    32(%0), %%xmm2               \n\t"
+        "movdqu    48(%0), %%xmm3               \n\t"
+        "pxor      %%xmm4, %%xmm0               \n\t"
+        "pshufb    %%xmm6, %%xmm0               \n\t"
+        "pshufb    %%xmm6, %%xmm1               \n\t"
+        "pshufb    %%xmm6, %%xmm2               \n\t"
+        "pshufb    %%xmm6, %%xmm3               \n\t"
+        "add       $64, %0                      \n\t"
+        "cmp       $64, %1                      \n\t"
+        "jb        2f                           \n\t"
+        "1:                                     \n\t"
+        FOLD_LOAD("xmm0", "0")
+        FOLD_LOAD("xmm1", "16")
+        FOLD_LOAD("xmm2", "32")
+        FOLD_LOAD("xmm3", "48")
+        "add       $64, %0                      \n\t"
+        "sub       $64, %1                      \n\t"
+        "cmp       $64, %1                      \n\t"
+        "jae       1b                           \n\t"
+        "2:                                     \n\t"
+        "movdqa    16(%3), %%xmm7               \n\t"
+        FOLD("xmm0")
+        "pxor      %%xmm0, %%xmm1               \n\t"
+        FOLD("xmm1")
+        "pxor      %%xmm1, %%xmm2               \n\t"
+        FOLD("xmm2")
+        "pxor      %%xmm2, %%xmm3               \n\t"
+        "test      %1, %1                       \n\t"
+        "jz        4f                           \n\t"
+        "3:                                     \n\t"
+        FOLD_LOAD("xmm3", "0")
+        "add       $16, %0                      \n\t"
+        "sub       $16, %1                      \n\t"
+        "jnz       3b                           \n\t"
+        "4:                                     \n\t"
+        "pshufb    %%xmm6, %%xmm3               \n\t"
+        "movdqu    %%xmm3, (%2)                 \n\t"
+        : "+r"(buffer), "+r"(len)
+        : "r"(rem), "r"(fold), "r"(shuf), "m"(crc)
+        : XMM_CLOBBERS("xmm0", "xmm1", "xmm2", "xmm3",
+                       "xmm4", "xmm5", "xmm6", "xmm7",) "memory"
+    );
+}
+
+#endif /* HAVE_INLINE_ASM && HAVE_SSSE3_INLINE */
+
+int ff_crc32_fold_x86(uint8_t *rem, int le, uint32_t crc,
+                      const uint8_t *buffer, size_t length)
+{
+#if HAVE_INLINE_ASM && HAVE_SSSE3_INLINE
+    int cpu_flags = av_get_cpu_flags();
+
+    if (INLINE_SSSE3(cpu_flags) && cpu_flags & AV_CPU_FLAG_CLMUL) {
+        crc32_fold_clmul(rem, le ? crc32_le_fold : crc32_be_fold,
+                         le ? crc32_le_shuf : crc32_be_shuf, crc, buffer, length);
+        return 1;
+    }
+#endif
+    return 0;
+}
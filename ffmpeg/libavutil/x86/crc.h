@@ -0,0 +1,38 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef AVUTIL_X86_CRC_H
+#define AVUTIL_X86_CRC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Fold length bytes of buffer, a multiple of 16 and at least 64, into a
+ * 16 byte remainder with PCLMULQDQ, for one of the 32-bit CRCs of
+ * poly 0x04C11DB7. The CRC of the remainder, starting from 0, is then the
+ * CRC of buffer, starting from crc.
+ *
+ * @param rem 16 bytes for the remainder
+ * @param le  1 for AV_CRC_32_IEEE_LE, 0 for AV_CRC_32_IEEE
+ * @return 0 if the CPU lacks PCLMULQDQ and nothing was done, 1 otherwise
+ */
+int ff_crc32_fold_x86(uint8_t *rem, int le, uint32_t crc,
+                      const uint8_t *buffer, size_t length);
+
+#endif /* AVUTIL_X86_CRC_H */
@@ -26,6 +26,7 @@
  */
 
 #include "libavutil/avassert.h"
+#include "libavutil/cpu.h"
 #include "resample.h"
 
 /**
@@ -171,9 +172,19 @@ static int build_filter(ResampleContext *c, void *filter, double factor, int tap
     return 0;
 }
 
+static void resample_free(ResampleContext **c){
+    if(!*c)
+        return;
+#if HAVE_THREADS
+    avpriv_slicethread_free(&(*c)->thread);
+#endif
+    av_freep(&(*c)->filter_bank);
+    av_freep(c);
+}
+
 static ResampleContext *resample_init(ResampleContext *c, int out_rate, int in_rate, int filter_size, int phase_shift, int linear,
                                     double cutoff0, enum AVSampleFormat format, enum SwrFilterType filter_type, int kaiser_beta,
-                                    double precision, int cheby)
+                                    double precision, int cheby, int nb_threads)
 {
     double cutoff = cutoff0? cutoff0 : 0.97;
     double factor= FFMIN(out_rate * cutoff / in_rate, 1.0);
@@ -182,6 +193,7 @@ static ResampleContext *resample_init(ResampleContext *c, int out_rate, int in_r
     if (!c || c->phase_shift != phase_shift || c->linear!=linear || c->factor != factor
            || c->filter_length != FFMAX((int)ceil(filter_size/factor), 1) || c->format != format
            || c->filter_type != filter_type || c->kaiser_beta != kaiser_beta) {
+        resample_free(&c);
         c = av_mallocz(sizeof(*c));
         if (!c)
             return NULL;
@@ -238,22 +250,28 @@ static ResampleContext *resample_init(ResampleContext *c, int out_rate, int in_r
     c->index= -phase_count*((c->filter_length-1)/2);
     c->frac= 0;
 
+#if HAVE_THREADS
+    nb_threads = FFMIN(nb_threads ? nb_threads : av_cpu_count(), SWR_CH_MAX);
+    if (c->nb_threads != nb_threads) {
+        avpriv_slicethread_free(&c->thread);
+        c->nb_threads = nb_threads;
+        if (avpriv_slicethread_create(&c->thread, nb_threads) < 0)
+            goto error;
+    }
+#endif
+
     swri_resample_dsp_init(c);
 
     return c;
 error:
+#if HAVE_THREADS
+    avpriv_slicethread_free(&c->thread);
+#endif
     av_freep(&c->filter_bank);
     av_free(c);
     return NULL;
 }
 
-static void resample_free(ResampleContext **c){
-    if(!*c)
-        return;
-    av_freep(&(*c)->filter_bank);
-    av_freep(c);
-}
-
 static int set_compensation(ResampleContext *c, int sample_delta, int compensation_distance){
     c->compensation_distance= compensation_distance;
     if (compensation_distance)
@@ -305,6 +323,32 @@ static int swri_resample(ResampleContext *c,
     return dst_size;
 }
 
+#if HAVE_THREADS
+typedef struct ResampleThreadArgs {
+    ResampleContext last;       ///< copy of the context for the last channel, which updates it
+    AudioData *dst, *src;
+    int dst_size, src_size;
+    int consumed;
+    int need_emms;
+} ResampleThreadArgs;
+
+static int resample_channel(void *priv, void *arg, int ch, int nb_jobs){
+    ResampleContext *c = priv;
+    ResampleThreadArgs *a = arg;
+    int consumed, ret;
+
+    if (ch + 1 < nb_jobs)
+        ret = swri_resample(c, a->dst->ch[ch], a->src->ch[ch],
+                            &consumed, a->src_size, a->dst_size, 0);
+    else
+        ret = swri_resample(&a->last, a->dst->ch[ch], a->src->ch[ch],
+                            &a->consumed, a->src_size, a->dst_size, 1);
+    if (a->need_emms)
+        emms_c();
+    return ret;
+}
+#endif
+
 static int multiple_resample(ResampleContext *c, AudioData *dst, int dst_size, AudioData *src, int src_size, int *consumed){
     int i, ret= -1;
     int av_unused mm_flags = av_get_cpu_flags();
@@ -316,9 +360,24 @@ static int multiple_resample(ResampleContext *c, AudioData *dst, int dst_size, A
         dst_size = FFMIN(dst_size, c->compensation_distance);
     src_size = FFMIN(src_size, max_src_size);
 
-    for(i=0; i<dst->ch_count; i++){
-        ret= swri_resample(c, dst->ch[i], src->ch[i],
-                           consumed, src_size, dst_size, i+1==dst->ch_count);
+#if HAVE_THREADS
+    if (c->thread && dst->ch_count > 1) {
+        /* the channels only read the context, but for the one updating it */
+        ResampleThreadArgs args = { *c, dst, src, dst_size, src_size, 0, need_emms };
+        int rets[SWR_CH_MAX];
+
+        avpriv_slicethread_execute(c->thread, resample_channel, c, &args, rets, dst->ch_count);
+        c->index  = args.last.index;
+        c->frac   = args.last.frac;
+        *consumed = args.consumed;
+        ret = rets[dst->ch_count - 1];
+    } else
+#endif
+    {
+        for(i=0; i<dst->ch_count; i++){
+            ret= swri_resample(c, dst->ch[i], src->ch[i],
+                               consumed, src_size, dst_size, i+1==dst->ch_count);
+        }
     }
     if(need_emms)
         emms_c();
@@ -24,6 +24,7 @@
 
 #include "libavutil/log.h"
 #include "libavutil/samplefmt.h"
+#include "libavutil/slicethread.h"
 
 #include "swresample_internal.h"
 
@@ -49,6 +50,8 @@ typedef struct ResampleContext {
     enum AVSampleFormat format;
     int felem_size;
     int filter_shift;
+    int nb_threads;             ///< number of threads the channels are resampled on
+    AVSliceThread *thread;      ///< worker threads, NULL when resampling on the caller's thread
 
     struct {
         void (*resample_one)(void *dst, const void *src,
@@ -22,7 +22,9 @@
 #include "libavutil/avassert.h"
 #include "libavutil/channel_layout.h"
 #include "libavutil/common.h"
+#include "libavutil/cpu.h"
 #include "libavutil/opt.h"
+#include "libavutil/time.h"
 #include "swresample.h"
 
 #undef time
@@ -221,6 +223,107 @@ static void audiogen(void *data, enum AVSampleFormat sample_fmt,
     }
 }
 
+#define BENCH_SAMPLES (10 * 48000)
+#define BENCH_CHUNK   1024
+
+/**
+ * Resample the input like a decoder would feed it, in chunks, and flush.
+ * @return the time taken in microseconds, the output length in *out_count
+ */
+static int64_t bench_run(uint64_t layout, enum AVSampleFormat fmt, int nb_threads,
+                         uint8_t **in, uint8_t **out, int *out_count){
+    struct SwrContext *ctx = swr_alloc_set_opts(NULL, layout, fmt, 44100,
+                                                layout, fmt, 48000, 0, NULL);
+    uint8_t *ip[SWR_CH_MAX], *op[SWR_CH_MAX];
+    int channels = av_get_channel_layout_nb_channels(layout);
+    int bps = av_get_bytes_per_sample(fmt);
+    int max_out = av_rescale_rnd(BENCH_SAMPLES, 44100, 48000, AV_ROUND_UP) + 256;
+    int64_t t;
+    int i, ch, ret;
+
+    /* a long filter, as used for high quality resampling */
+    av_opt_set_int(ctx, "filter_size", 128, 0);
+    av_opt_set_int(ctx, "threads", nb_threads, 0);
+    if (!ctx || swr_init(ctx) < 0) {
+        fprintf(stderr, "swr_init() failed\n");
+        exit(1);
+    }
+
+    *out_count = 0;
+    t = av_gettime();
+    for (i = 0; i <= BENCH_SAMPLES; i += BENCH_CHUNK) {
+        int n = FFMIN(BENCH_CHUNK, BENCH_SAMPLES - i);
+        for (ch = 0; ch < channels; ch++) {
+            ip[ch] = in[ch] + i * bps;
+            op[ch] = out[ch] + *out_count * bps;
+        }
+        /* the last round, with no input, flushes */
+        ret = swr_convert(ctx, op, max_out - *out_count,
+                          n ? (const uint8_t **)ip : NULL, n);
+        av_assert0(ret >= 0);
+        *out_count += ret;
+    }
+    t = av_gettime() - t;
+
+    swr_free(&ctx);
+    return t;
+}
+
+/**
+ * Time resampling 5.1 and 7.1 from 48 kHz to 44.1 kHz on one and on
+ * nb_threads threads, and check the threads produce the same output.
+ */
+static int bench(int nb_threads){
+    static const uint64_t bench_layouts[] = { AV_CH_LAYOUT_5POINT1, AV_CH_LAYOUT_7POINT1 };
+    static const enum AVSampleFormat bench_formats[] = { AV_SAMPLE_FMT_S16P, AV_SAMPLE_FMT_FLTP };
+    int i, j, ch, failed = 0;
+
+    if (!nb_threads)
+        nb_threads = av_cpu_count();
+    for (i = 0; i < FF_ARRAY_ELEMS(bench_layouts); i++) {
+        for (j = 0; j < FF_ARRAY_ELEMS(bench_formats); j++) {
+            uint64_t layout = bench_layouts[i];
+            enum AVSampleFormat fmt = bench_formats[j];
+            int channels = av_get_channel_layout_nb_channels(layout);
+            int max_out = av_rescale_rnd(BENCH_SAMPLES, 44100, 48000, AV_ROUND_UP) + 256;
+            uint8_t **in, **serial, **threaded;
+            int serial_count, threaded_count, same;
+            int64_t serial_time, threaded_time;
+            char layout_string[256];
+
+            if (av_samples_alloc_array_and_samples(&in,       NULL, channels, BENCH_SAMPLES, fmt, 0) < 0 ||
+                av_samples_alloc_array_and_samples(&serial,   NULL, channels, max_out,       fmt, 0) < 0 ||
+                av_samples_alloc_array_and_samples(&threaded, NULL, channels, max_out,       fmt, 0) < 0) {
+                fprintf(stderr, "Failed to allocate samples\n");
+                return 1;
+            }
+            audiogen(in, fmt, channels, 48000, BENCH_SAMPLES);
+
+            serial_time   = bench_run(layout, fmt, 1,          in, serial,   &serial_count);
+            threaded_time = bench_run(layout, fmt, nb_threads, in, threaded, &threaded_count);
+
+            same = serial_count == threaded_count;
+            for (ch = 0; ch < channels && same; ch++)
+                same = !memcmp(serial[ch], threaded[ch], serial_count * av_get_bytes_per_sample(fmt));
+            failed |= !same;
+
+            av_get_channel_layout_string(layout_string, sizeof(layout_string), channels, layout);
+            fprintf(stderr, "%-10s %s 48000->44100: 1 thread %7.3f s, %d threads %7.3f s, %5.2fx, output %s\n",
+                    layout_string, av_get_sample_fmt_name(fmt),
+                    serial_time / 1000000.0, nb_threads, threaded_time / 1000000.0,
+                    (double)serial_time / threaded_time, same ? "identical" : "DIFFERENT");
+
+            av_freep(&in[0]);
+            av_freep(&in);
+            av_freep(&serial[0]);
+            av_freep(&serial);
+            av_freep(&threaded[0]);
+            av_freep(&threaded);
+        }
+    }
+    return failed;
+}
+
 int main(int argc, char **argv){
     int in_sample_rate, out_sample_rate, ch ,i, flush_count;
     uint64_t in_ch_layout, out_ch_layout;
@@ -247,9 +350,13 @@ int main(int argc, char **argv){
     if (argc > 1) {
         if (!strcmp(argv[1], "-h") || !strcmp(argv[1], "--help")) {
             av_log(NULL, AV_LOG_INFO, "Usage: swresample-test [<num_tests>[ <test>]]  \n"
-                   "num_tests           Default is %d\n", num_tests);
+                   "       swresample-test -bench [<threads>]\n"
+                   "num_tests           Default is %d\n"
+                   "threads             Default is one per core\n", num_tests);
             return 0;
         }
+        if (!strcmp(argv[1], "-bench"))
+            return bench(argc > 2 ? strtol(argv[2], NULL, 0) : 0);
         num_tests = strtol(argv[1], NULL, 0);
         if(num_tests < 0) {
             num_tests = -num_tests;
@@ -76,6 +76,8 @@ static const AVOption swscale_options[] = {
     { "a_dither",        "arithmetic addition dither",    0,                 AV_OPT_TYPE_CONST,  { .i64  = SWS_DITHER_A_DITHER}, INT_MIN, INT_MAX,        VE, "sws_dither" },
     { "x_dither",        "arithmetic xor dither",         0,                 AV_OPT_TYPE_CONST,  { .i64  = SWS_DITHER_X_DITHER}, INT_MIN, INT_MAX,        VE, "sws_dither" },
 
+    { "threads",         "number of threads",             OFFSET(nb_threads), AV_OPT_TYPE_INT,   { .i64 = 1                  }, 0,       INT_MAX,        VE },
+
     { NULL }
 };
 
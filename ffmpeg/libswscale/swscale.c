@@ -345,6 +345,7 @@ static int swscale(SwsContext *c, const uint8_t *src[],
     const int chrSrcSliceH           = FF_CEIL_RSHIFT(srcSliceH,   c->chrSrcVSubSample);
     int should_dither                = is9_OR_10BPS(c->srcFormat) ||
                                        is16BPS(c->srcFormat);
+    const int dstEnd                 = c->dstSliceH ? c->dstSliceY + c->dstSliceH : dstH;
     int lastDstY;
 
     /* vars which will change and which we need to store back in the context */
@@ -411,7 +412,7 @@ static int swscale(SwsContext *c, const uint8_t *src[],
     if (srcSliceY == 0) {
         lumBufIndex  = -1;
         chrBufIndex  = -1;
-        dstY         = 0;
+        dstY         = c->dstSliceY;
         lastInLumBuf = -1;
         lastInChrBuf = -1;
     }
@@ -421,7 +422,7 @@ static int swscale(SwsContext *c, const uint8_t *src[],
     }
     lastDstY = dstY;
 
-    for (; dstY < dstH; dstY++) {
+    for (; dstY < dstEnd; dstY++) {
         const int chrDstY = dstY >> c->chrDstVSubSample;
         uint8_t *dest[4]  = {
             dst[0] + dstStride[0] * dstY,
@@ -881,6 +882,57 @@ static void rgb48Toxyz12(struct SwsContext *c, uint16_t *dst,
     }
 }
 
+typedef struct ScaleBandArgs {
+    const uint8_t * const *src;
+    const int *srcStride;
+    uint8_t * const *dst;
+    const int *dstStride;
+} ScaleBandArgs;
+
+/**
+ * Scale the destination lines of one band context, from the source lines
+ * its vertical filters reach.
+ */
+static int scale_band(void *priv, void *arg, int jobnr, int nb_jobs)
+{
+    SwsContext *c      = priv;
+    SwsContext *band   = c->band_context[jobnr];
+    ScaleBandArgs *a   = arg;
+    const int subV     = band->chrSrcVSubSample;
+    const int y0       = band->dstSliceY;
+    const int y1       = band->dstSliceY + band->dstSliceH;
+    const uint8_t *src[4];
+    int first = INT_MAX, last = 0;
+    int i, y;
+
+    for (y = y0; y < y1; y++) {
+        const int chrY = y >> band->chrDstVSubSample;
+        first = FFMIN(first, band->vLumFilterPos[y]);
+        first = FFMIN(first, band->vChrFilterPos[chrY] << subV);
+        last  = FFMAX(last,  band->vLumFilterPos[y] + band->vLumFilterSize);
+        last  = FFMAX(last,  (band->vChrFilterPos[chrY] + band->vChrFilterSize) << subV);
+    }
+    first = av_clip(first & ~((1 << subV) - 1), 0, band->srcH - 1);
+    last  = av_clip(last, first + 1, band->srcH);
+
+    for (i = 0; i < 4; i++) {
+        src[i] = a->src[i];
+        if (!src[i] || (i == 1 && usePal(band->srcFormat)))
+            continue;
+        src[i] += (ptrdiff_t)a->srcStride[i] * (i == 1 || i == 2 ? first >> subV : first);
+    }
+
+    /* the band starts in the middle of the picture, so start it by hand */
+    band->sliceDir     = 1;
+    band->dstY         = y0;
+    band->lumBufIndex  = -1;
+    band->chrBufIndex  = -1;
+    band->lastInLumBuf = -1;
+    band->lastInChrBuf = -1;
+    return sws_scale(band, src, a->srcStride, first, last - first,
+                     a->dst, a->dstStride);
+}
+
 /**
  * swscale wrapper, so we don't need to export the SwsContext.
  * Assumes planar YUV to be in YUV order instead of YVU.
@@ -912,6 +964,18 @@ int attribute_align_arg sws_scale(struct SwsContext *c,
         return ret;
     }
 
+#if HAVE_THREADS
+    if (c->nb_band_contexts && srcSliceY == 0 && srcSliceH == c->srcH) {
+        ScaleBandArgs args = { srcSlice, srcStride, dst, dstStride };
+
+        avpriv_slicethread_execute(c->thread, scale_band, c, &args,
+                                   c->band_rets, c->nb_band_contexts);
+        for (i = ret = 0; i < c->nb_band_contexts; i++)
+            ret += c->band_rets[i];
+        return ret;
+    }
+#endif
+
     memcpy(src2, srcSlice, sizeof(src2));
     memcpy(dst2, dst, sizeof(dst2));
 
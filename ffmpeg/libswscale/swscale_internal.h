@@ -36,6 +36,7 @@
 #include "libavutil/log.h"
 #include "libavutil/pixfmt.h"
 #include "libavutil/pixdesc.h"
+#include "libavutil/slicethread.h"
 
 #define STR(s) AV_TOSTRING(s) // AV_STRINGIFY is too long
 
@@ -311,6 +312,19 @@ typedef struct SwsContext {
     int cascaded_tmpStride[4];
     uint8_t *cascaded_tmp[4];
 
+    /* With more than one thread a whole picture is split into bands of
+     * destination lines. Each band is scaled by its own copy of the context,
+     * which only reads the source lines the vertical filter of the band
+     * needs, so the bands can be scaled at the same time.
+     */
+    int nb_threads;               ///< Number of threads to scale a picture with, 0 for one per core.
+    struct SwsContext **band_context;
+    int nb_band_contexts;
+    int *band_rets;               ///< Number of lines each band context wrote.
+    AVSliceThread *thread;        ///< Worker threads running the band contexts.
+    int dstSliceY;                ///< First destination line written by a band context.
+    int dstSliceH;                ///< Number of destination lines written by a band context, 0 for all.
+
     uint32_t pal_yuv[256];
     uint32_t pal_rgb[256];
 
@@ -807,6 +807,12 @@ int sws_setColorspaceDetails(struct SwsContext *c, const int inv_table[4],
     const AVPixFmtDescriptor *desc_dst;
     const AVPixFmtDescriptor *desc_src;
     int need_reinit = 0;
+    int i;
+
+    for (i = 0; i < c->nb_band_contexts; i++)
+        sws_setColorspaceDetails(c->band_context[i], inv_table, srcRange,
+                                 table, dstRange, brightness, contrast, saturation);
+
     memmove(c->srcColorspaceTable, inv_table, sizeof(int) * 4);
     memmove(c->dstColorspaceTable, table, sizeof(int) * 4);
 
@@ -942,6 +948,48 @@ SwsContext *sws_alloc_context(void)
     return c;
 }
 
+#if HAVE_THREADS
+/**
+ * Split the destination into one band per thread, with a context each.
+ * Only the generic scaler can start in the middle of the picture, and
+ * error diffusion carries from line to line, so those stay on one thread.
+ */
+static av_cold int init_bands(SwsContext *c, SwsFilter *srcFilter,
+                              SwsFilter *dstFilter)
+{
+    int nb_threads = c->nb_threads ? c->nb_threads : av_cpu_count();
+    int align      = 1 << c->chrDstVSubSample;
+    int i, ret;
+
+    /* bands of fewer lines would read mostly the same source lines */
+    nb_threads = FFMIN(nb_threads, c->dstH / (16 * align));
+    if (nb_threads <= 1 || c->vChrDrop || c->dither == SWS_DITHER_ED ||
+        c->srcXYZ || c->dstXYZ)
+        return 0;
+
+    c->band_context = av_mallocz_array(nb_threads, sizeof(*c->band_context));
+    c->band_rets    = av_malloc_array(nb_threads, sizeof(*c->band_rets));
+    if (!c->band_context || !c->band_rets)
+        return AVERROR(ENOMEM);
+    for (i = 0; i < nb_threads; i++) {
+        SwsContext *band = sws_alloc_context();
+        if (!band)
+            return AVERROR(ENOMEM);
+        c->band_context[c->nb_band_contexts++] = band;
+        if ((ret = av_opt_copy(band, c)) < 0)
+            return ret;
+        band->nb_threads = 1;
+        if ((ret = sws_init_context(band, srcFilter, dstFilter)) < 0)
+            return ret;
+        band->dstSliceY = (int64_t)c->dstH * i / nb_threads & ~(align - 1);
+        band->dstSliceH = (i == nb_threads - 1 ? c->dstH :
+                           (int64_t)c->dstH * (i + 1) / nb_threads & ~(align - 1)) -
+                          band->dstSliceY;
+    }
+    return avpriv_slicethread_create(&c->thread, nb_threads);
+}
+#endif
+
 av_cold int sws_init_context(SwsContext *c, SwsFilter *srcFilter,
                              SwsFilter *dstFilter)
 {
@@ -1503,6 +1551,10 @@ av_cold int sws_init_context(SwsContext *c, SwsFilter *srcFilter,
     }
 
     c->swscale = ff_getSwsFunc(c);
+#if HAVE_THREADS
+    if (c->nb_threads != 1)
+        return init_bands(c, srcFilter, dstFilter);
+#endif
     return 0;
 fail: // FIXME replace things by appropriate error codes
     if (ret == RETCODE_USE_CASCADE)  {
@@ -1947,6 +1999,14 @@ void sws_freeContext(SwsContext *c)
     memset(c->cascaded_context, 0, sizeof(c->cascaded_context));
     av_freep(&c->cascaded_tmp[0]);
 
+#if HAVE_THREADS
+    avpriv_slicethread_free(&c->thread);
+#endif
+    for (i = 0; i < c->nb_band_contexts; i++)
+        sws_freeContext(c->band_context[i]);
+    av_freep(&c->band_context);
+    av_freep(&c->band_rets);
+
     av_free(c);
 }
 
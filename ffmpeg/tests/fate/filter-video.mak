@@ -389,6 +389,12 @@ $(FATE_FILTER_VSYNTH-yes): SRC = $(TARGET_PATH)/tests/vsynth1/%02d.pgm
 
 FATE_AVCONV-$(call DEMDEC, IMAGE2, PGMYUV) += $(FATE_FILTER_VSYNTH-yes)
 
+FATE_FILTER_POOL-$(CONFIG_AVFILTER) += fate-filter-framepool
+fate-filter-framepool: libavfilter/framepool-test$(EXESUF)
+fate-filter-framepool: CMD = run libavfilter/framepool-test
+
+FATE-yes += $(FATE_FILTER_POOL-yes)
+
 #
 # Metadata tests
 #
@@ -412,6 +418,6 @@ fate-filter-metadata-ebur128: CMD = run $(FILTER_METADATA_COMMAND) "amovie='$(SR
 
 FATE_SAMPLES_FFPROBE += $(FATE_METADATA_FILTER-yes)
 
-fate-vfilter: $(FATE_FILTER-yes) $(FATE_FILTER_VSYNTH-yes)
+fate-vfilter: $(FATE_FILTER-yes) $(FATE_FILTER_VSYNTH-yes) $(FATE_FILTER_POOL-yes)
 
 fate-filter: fate-afilter fate-vfilter $(FATE_METADATA_FILTER-yes)
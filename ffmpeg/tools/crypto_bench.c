@@ -29,6 +29,7 @@
 
 #include "libavutil/avutil.h"
 #include "libavutil/avstring.h"
+#include "libavutil/cpu.h"
 #include "libavutil/crc.h"
 #include "libavutil/intreadwrite.h"
 #include "libavutil/timer.h"
@@ -122,6 +123,18 @@ static void run_lavu_cast128(uint8_t *output,
     av_cast5_crypt(cast, output, input, size >> 3, 0);
 }
 
+static void run_lavu_crc32(uint8_t *output,
+                           const uint8_t *input, unsigned size)
+{
+    AV_WB32(output, av_crc(av_crc_get_table(AV_CRC_32_IEEE), 0, input, size));
+}
+
+static void run_lavu_crc32le(uint8_t *output,
+                             const uint8_t *input, unsigned size)
+{
+    AV_WB32(output, av_crc(av_crc_get_table(AV_CRC_32_IEEE_LE), 0, input, size));
+}
+
 /***************************************************************************
  * crypto: OpenSSL's libcrypto
  ***************************************************************************/
@@ -351,16 +364,18 @@ struct hash_impl implementations[] = {
     IMPL_ALL("RIPEMD-160", ripemd160, "62a5321e4fc8784903bb43ab7752c75f8b25af00")
     IMPL_ALL("AES-128",    aes128,    "crc:ff6bc888")
     IMPL_ALL("CAST-128",   cast128,   "crc:456aa584")
+    IMPL(lavu, "CRC-32",    crc32,     "ffe7b880")
+    IMPL(lavu, "CRC-32-LE", crc32le,   "b56da6ba")
 };
 
 int main(int argc, char **argv)
 {
     uint8_t *input = av_malloc(MAX_INPUT_SIZE * 2);
     uint8_t *output = input + MAX_INPUT_SIZE;
-    unsigned i, impl, size;
+    unsigned i, impl, size, cpu_flags;
     int opt;
 
-    while ((opt = getopt(argc, argv, "hl:a:r:")) != -1) {
+    while ((opt = getopt(argc, argv, "hl:a:r:c:")) != -1) {
         switch (opt) {
         case 'l':
             enabled_libs = optarg;
@@ -371,9 +386,15 @@ int main(int argc, char **argv)
         case 'r':
             specified_runs = strtol(optarg, NULL, 0);
             break;
+        case 'c':
+            cpu_flags = av_get_cpu_flags();
+            if (av_parse_cpu_caps(&cpu_flags, optarg) < 0)
+                fatal_error("invalid cpu flags");
+            av_force_cpu_flags(cpu_flags);
+            break;
         case 'h':
         default:
-            fprintf(stderr, "Usage: %s [-l libs] [-a algos] [-r runs]\n",
+            fprintf(stderr, "Usage: %s [-l libs] [-a algos] [-r runs] [-c cpuflags]\n",
                     argv[0]);
             if ((USE_EXT_LIBS)) {
                 char buf[1024];
@@ -0,0 +1,158 @@
+/*
+ * Ogg muxing throughput with many small audio pages
+ *
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with FFmpeg; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include "config.h"
+#if HAVE_UNISTD_H
+#include <unistd.h>             /* getopt */
+#endif
+
+#include "libavformat/avformat.h"
+#include "libavutil/time.h"
+
+#if !HAVE_GETOPT
+#include "compat/getopt.c"
+#endif
+
+#define FRAME_SAMPLES 960
+
+static int64_t bytes_written;
+static int writes;
+
+static int discard_packet(void *opaque, uint8_t *buf, int size)
+{
+    bytes_written += size;
+    writes++;
+    return size;
+}
+
+static void usage(int ret)
+{
+    fprintf(ret ? stderr : stdout,
+            "Usage: ogg_mux_bench [-n packets] [-s size] [-c streams] "
+            "[-d page_duration] [-f]\n"
+            "    -n packets        packets per stream (default 100000)\n"
+            "    -s size           bytes per packet (default 40)\n"
+            "    -c streams        audio streams (default 1)\n"
+            "    -d page_duration  page duration in microseconds (default 20000,\n"
+            "                      one 20 ms packet per page)\n"
+            "    -f                flush the output after every packet\n"
+            );
+    exit(ret);
+}
+
+int main(int argc, char **argv)
+{
+    int opt, ret, i, j;
+    int packets = 100000, size = 40, streams = 1, flush = 0;
+    int64_t page_duration = 20000, t;
+    AVFormatContext *avf = NULL;
+    AVDictionary *options = NULL;
+    uint8_t *iobuf, *data;
+    AVPacket pkt;
+
+    while ((opt = getopt(argc, argv, "hn:s:c:d:f")) != -1) {
+        switch (opt) {
+        case 'n':
+            packets = atoi(optarg);
+            break;
+        case 's':
+            size = av_clip(atoi(optarg), 1, 65025);
+            break;
+        case 'c':
+            streams = av_clip(atoi(optarg), 1, 64);
+            break;
+        case 'd':
+            page_duration = strtoll(optarg, NULL, 0);
+            break;
+        case 'f':
+            flush = 1;
+            break;
+        case 'h':
+            usage(0);
+        default:
+            usage(1);
+        }
+    }
+
+    av_register_all();
+    if ((ret = avformat_alloc_output_context2(&avf, NULL, "ogg", NULL)) < 0) {
+        fprintf(stderr, "ogg: %s\n", av_err2str(ret));
+        return 1;
+    }
+    iobuf = av_malloc(32768);
+    data = av_mallocz(size);
+    avf->pb = avio_alloc_context(iobuf, 32768, 1, NULL, NULL, discard_packet, NULL);
+    if (!data || !avf->pb) {
+        fprintf(stderr, "Failed to allocate memory\n");
+        return 1;
+    }
+    avf->flags |= AVFMT_FLAG_BITEXACT;
+    if (!flush)
+        avf->flags &= ~AVFMT_FLAG_FLUSH_PACKETS;
+
+    for (i = 0; i < streams; i++) {
+        AVStream *st = avformat_new_stream(avf, NULL);
+        if (!st || !(st->codec->extradata = av_mallocz(34 + FF_INPUT_BUFFER_PADDING_SIZE))) {
+            fprintf(stderr, "Failed to allocate memory\n");
+            return 1;
+        }
+        st->codec->codec_type = AVMEDIA_TYPE_AUDIO;
+        st->codec->codec_id = AV_CODEC_ID_FLAC;
+        st->codec->sample_rate = 48000;
+        st->codec->channels = 2;
+        st->codec->extradata_size = 34;
+        st->time_base = (AVRational){ 1, 48000 };
+    }
+    av_dict_set_int(&options, "page_duration", page_duration, 0);
+    if ((ret = avformat_write_header(avf, &options)) < 0) {
+        fprintf(stderr, "write header: %s\n", av_err2str(ret));
+        return 1;
+    }
+    av_dict_free(&options);
+
+    av_init_packet(&pkt);
+    t = av_gettime_relative();
+    for (i = 0; i < packets; i++) {
+        for (j = 0; j < streams; j++) {
+            pkt.data = data;
+            pkt.size = size;
+            pkt.stream_index = j;
+            pkt.pts = pkt.dts = (int64_t)i * FRAME_SAMPLES;
+            pkt.duration = FRAME_SAMPLES;
+            if ((ret = av_write_frame(avf, &pkt)) < 0) {
+                fprintf(stderr, "write packet: %s\n", av_err2str(ret));
+                return 1;
+            }
+        }
+    }
+    av_write_trailer(avf);
+    t = av_gettime_relative() - t;
+
+    printf("%d packets of %d bytes in %d streams, %"PRId64" bytes in %d writes\n",
+           packets * streams, size, streams, bytes_written, writes);
+    printf("%.3f s, %.0f packets/s, %.1f MB/s\n", t / 1000000.0,
+           packets * streams * 1000000.0 / t, bytes_written / (double)t);
+
+    av_freep(&avf->pb->buffer);
+    av_freep(&avf->pb);
+    avformat_free_context(avf);
+    av_free(data);
+    return 0;
+}
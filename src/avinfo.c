@@ -399,42 +399,45 @@ static void json_stream_format(FILE *output, AVFormatContext *ic, int i, int ind
  * plus modification for files < 64k, buffer is filled with file data and padded with 0
  */
 
-unsigned long long gen_oshash(char const *filename) {
-    FILE *file;
+/* Hashes the input through the AVIOContext it is read with, so the file
+ * isn't opened a second time. The read position is restored afterwards. */
+unsigned long long gen_oshash(AVIOContext *pb) {
     int i;
+    int64_t pos;
     unsigned long long t1=0;
     unsigned long long buffer1[8192*2];
     int used = 8192*2;
-    file = fopen(filename, "rb");
-    if (file) {
+    if (pb && pb->seekable) {
         //add filesize
-        fseeko(file, 0, SEEK_END);
-        t1 = ftello(file);
-        fseeko(file, 0, SEEK_SET);
+        t1 = avio_size(pb);
+        if ((int64_t)t1 < 0)
+            return 0;
+        pos = avio_tell(pb);
+        avio_seek(pb, 0, SEEK_SET);
 
         if(t1 < 65536) {
             used = t1/8;
-            fread(buffer1, used, 8, file);
+            avio_read(pb, (unsigned char *)buffer1, used * 8);
         } else {
-            fread(buffer1, 8192, 8, file);
-            fseeko(file, -65536, SEEK_END);
-            fread(&buffer1[8192], 8192, 8, file); 
+            avio_read(pb, (unsigned char *)buffer1, 65536);
+            avio_seek(pb, t1 - 65536, SEEK_SET);
+            avio_read(pb, (unsigned char *)&buffer1[8192], 65536);
         }
         for (i=0; i < used; i++)
             t1+=htonll(buffer1[i]);
-        fclose(file);
+        avio_seek(pb, pos, SEEK_SET);
     }
     return t1;
 }
 
-void json_oshash(FILE *output, char const *filename, int indent) {
+void json_oshash(FILE *output, AVIOContext *pb, int indent) {
     char hash[32];
 #ifdef WIN32
-    sprintf(hash,"%016I64x", gen_oshash(filename));
+    sprintf(hash,"%016I64x", gen_oshash(pb));
 #elif defined (__SVR4) && defined (__sun)
-    sprintf(hash,"%016llx", gen_oshash(filename));
+    sprintf(hash,"%016llx", gen_oshash(pb));
 #else
-    sprintf(hash,"%016qx", gen_oshash(filename));
+    sprintf(hash,"%016qx", gen_oshash(pb));
 #endif
     if (strcmp(hash,"0000000000000000") > 0)
         json_add_key_value(output, "oshash", (void *)hash, JSON_STRING, 0, indent);
@@ -495,7 +498,7 @@ void json_format_info(FILE* output, AVFormatContext *ic, const char *url) {
         json_add_key_value(output, "code", "badfile", JSON_STRING, 0, 1);
         json_add_key_value(output, "error", "file does not exist or has unknown format.", JSON_STRING, 0, 1);
     }
-    json_oshash(output, url, 1);
+    json_oshash(output, ic ? ic->pb : NULL, 1);
     json_add_key_value(output, "path", (void *)url, JSON_STRING, 0, 1);
 
     filesize = get_filesize(url);
@@ -1,7 +1,7 @@
 #ifndef _F2T_AVINFO_H_
 #define _F2T_AVINFO_H_
 
-unsigned long long gen_oshash(char const *filename);
+unsigned long long gen_oshash(AVIOContext *pb);
 void json_format_info(FILE* output, AVFormatContext *ic, const char *url);
 
 #endif
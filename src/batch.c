@@ -0,0 +1,566 @@
+/* -*- tab-width:4;c-file-style:"cc-mode"; -*- */
+/*
+ * batch.c -- decode an input once for several outputs encoded at once
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with This program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/wait.h>
+#endif
+
+#include "libavutil/buffer.h"
+#include "libavutil/imgutils.h"
+#include "libavutil/mem.h"
+#include "libavutil/samplefmt.h"
+#include "libavcodec/avcodec.h"
+#include "libavformat/avformat.h"
+
+#include "batch.h"
+
+/* stdio buffer on either end of the pipes */
+#define BATCH_FILE_BUFFER (64 * 1024)
+/* shared memory the decoded frames are passed in, a few 4:4:4 4K ones */
+#define BATCH_RING_SIZE (128 * 1024 * 1024)
+/* line alignment of the pictures passed, as the decoders give them */
+#define BATCH_ALIGN 32
+/* how often the first process looks for outputs that exited while it
+   waits for room in the ring, in milliseconds */
+#define BATCH_REAP_INTERVAL 100
+
+enum {
+    BATCH_PACKET,
+    BATCH_FRAME,
+};
+
+/*
+ * The first process writes a packet record for every packet it reads,
+ * followed by a frame record for every decoder call on it. The outputs run
+ * the same code on what they read as they would on the input, so they make
+ * the same calls in the same order, up to where they are done with the
+ * packet or the input. The records are only read back by processes forked
+ * from the one that wrote them, so they are in host byte order.
+ *
+ * The records go through a pipe per output, the picture or samples of a
+ * frame are put in a ring of shared memory just once for all of them. Ring
+ * positions only grow, a frame is at offset % BATCH_RING_SIZE, in one
+ * piece. Every output tells how far it has taken the frames from the ring,
+ * the first process waits for the slowest one before overwriting them.
+ */
+typedef struct batch_record {
+    int type;
+    int stream_index;
+    /* of av_read_frame or the decoder */
+    int ret;
+    int got_frame;
+    /* the packet data following the record, or the frame in the ring */
+    int size;
+    int64_t offset;
+
+    int packet_size;
+    int flags;
+    int duration;
+    int64_t pts;
+    int64_t dts;
+    int64_t pos;
+
+    int format;
+    int width;
+    int height;
+    int nb_samples;
+    int channels;
+    int sample_rate;
+    uint64_t channel_layout;
+    int64_t frame_pts;
+    int64_t pkt_pts;
+    int64_t pkt_dts;
+    int64_t best_effort_timestamp;
+    int64_t pkt_duration;
+    int64_t pkt_pos;
+    int key_frame;
+    int pict_type;
+    int interlaced_frame;
+    int top_field_first;
+    int repeat_pict;
+    int color_range;
+    int colorspace;
+    AVRational sample_aspect_ratio;
+} batch_record;
+
+typedef struct batch_shared {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    /* ring position up to which each output is done with the frames */
+    int64_t taken[BATCH_MAX_OUTPUTS];
+    uint8_t ring[BATCH_RING_SIZE];
+} batch_shared;
+
+struct batch {
+    int n;
+    batch_shared *shared;
+
+    /* in the first process, NULL once an output closed its end or exited */
+    FILE **outputs;
+    char **output_buffers;
+    int *pids;
+    int *exited;
+    int *status;
+    int running;
+    int64_t written;
+
+    /* in an output */
+    int output;
+    FILE *input;
+    char *input_buffer;
+    /* for the pictures and samples taken, of pool_size bytes */
+    AVBufferPool *pool;
+    int pool_size;
+};
+
+static void *xmalloc(size_t size) {
+    void *p = av_mallocz(size);
+    if (!p) {
+        fprintf(stderr, "ERROR: out of memory in batch\n");
+        exit(1);
+    }
+    return p;
+}
+
+static FILE *open_pipe(int fd, const char *mode, char **buffer) {
+    FILE *f = fdopen(fd, mode);
+    if (!f) {
+        fprintf(stderr, "Unable to open a pipe to the batch outputs.\n");
+        exit(1);
+    }
+    *buffer = xmalloc(BATCH_FILE_BUFFER);
+    setvbuf(f, *buffer, _IOFBF, BATCH_FILE_BUFFER);
+    return f;
+}
+
+batch *batch_fork(int n, int *output) {
+#ifdef _WIN32
+    fprintf(stderr, "ERROR: --batch is not supported on Windows.\n");
+    exit(1);
+#else
+    batch *b;
+    int (*fds)[2];
+    pthread_mutexattr_t mutex_attr;
+    pthread_condattr_t cond_attr;
+    int i, j;
+
+    if (n > BATCH_MAX_OUTPUTS) {
+        fprintf(stderr, "ERROR: no more than %d outputs can be encoded at once\n", BATCH_MAX_OUTPUTS);
+        exit(1);
+    }
+    b = xmalloc(sizeof(*b));
+    fds = xmalloc(n * sizeof(*fds));
+    b->n = n;
+    b->shared = mmap(NULL, sizeof(*b->shared), PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (b->shared == MAP_FAILED) {
+        fprintf(stderr, "Unable to map memory for the batch outputs: %s\n", strerror(errno));
+        exit(1);
+    }
+    pthread_mutexattr_init(&mutex_attr);
+    pthread_mutexattr_setpshared(&mutex_attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutex_init(&b->shared->lock, &mutex_attr);
+    pthread_mutexattr_destroy(&mutex_attr);
+    pthread_condattr_init(&cond_attr);
+    pthread_condattr_setpshared(&cond_attr, PTHREAD_PROCESS_SHARED);
+    pthread_cond_init(&b->shared->cond, &cond_attr);
+    pthread_condattr_destroy(&cond_attr);
+
+    b->pids = xmalloc(n * sizeof(*b->pids));
+    for (i = 0; i < n; i++) {
+        if (pipe(fds[i]) < 0) {
+            fprintf(stderr, "Unable to create a pipe for the batch outputs: %s\n", strerror(errno));
+            exit(1);
+        }
+    }
+    /* nothing buffered so far is written by every process */
+    fflush(NULL);
+    for (i = 0; i < n; i++) {
+        int pid = fork();
+        if (pid < 0) {
+            fprintf(stderr, "Unable to start the batch outputs: %s\n", strerror(errno));
+            exit(1);
+        }
+        if (pid == 0) {
+            /* the pipe of an output is only open here and in the first process */
+            for (j = 0; j < n; j++) {
+                close(fds[j][1]);
+                if (j != i)
+                    close(fds[j][0]);
+            }
+            av_freep(&b->pids);
+            b->input = open_pipe(fds[i][0], "rb", &b->input_buffer);
+            b->output = i;
+            av_free(fds);
+            *output = i;
+            return b;
+        }
+        b->pids[i] = pid;
+    }
+
+    /* outputs that are done close their end, writes to it fail then */
+    signal(SIGPIPE, SIG_IGN);
+    b->outputs = xmalloc(n * sizeof(*b->outputs));
+    b->output_buffers = xmalloc(n * sizeof(*b->output_buffers));
+    b->exited = xmalloc(n * sizeof(*b->exited));
+    b->status = xmalloc(n * sizeof(*b->status));
+    for (i = 0; i < n; i++) {
+        close(fds[i][0]);
+        b->outputs[i] = open_pipe(fds[i][1], "wb", &b->output_buffers[i]);
+    }
+    b->running = n;
+    b->output = -1;
+    av_free(fds);
+    *output = -1;
+    return b;
+#endif
+}
+
+static void close_output(batch *b, int i) {
+    fclose(b->outputs[i]);
+    av_freep(&b->output_buffers[i]);
+    b->outputs[i] = NULL;
+    b->running--;
+}
+
+static void write_outputs(batch *b, const void *data, size_t size) {
+    int i;
+    for (i = 0; i < b->n; i++) {
+        if (b->outputs[i] && fwrite(data, 1, size, b->outputs[i]) < size)
+            close_output(b, i);
+    }
+}
+
+/* Outputs that failed stop taking frames without closing their pipe first. */
+static void reap_outputs(batch *b) {
+#ifndef _WIN32
+    int i;
+    for (i = 0; i < b->n; i++) {
+        if (!b->exited[i] && waitpid(b->pids[i], &b->status[i], WNOHANG) == b->pids[i]) {
+            b->exited[i] = 1;
+            if (b->outputs[i])
+                close_output(b, i);
+        }
+    }
+#endif
+}
+
+/* Finds room for size bytes in the ring once every output is done with
+   what was there, returns its position. */
+static int64_t ring_alloc(batch *b, int size) {
+    batch_shared *s = b->shared;
+    int64_t pos = b->written;
+    int i;
+
+    if (size > BATCH_RING_SIZE) {
+        fprintf(stderr, "ERROR: decoded frame too large to pass to the batch outputs\n");
+        exit(1);
+    }
+    /* frames are never split at the end of the ring */
+    if (pos % BATCH_RING_SIZE + size > BATCH_RING_SIZE)
+        pos += BATCH_RING_SIZE - pos % BATCH_RING_SIZE;
+
+    /* the records written so far have to reach the outputs to be taken */
+    for (i = 0; i < b->n; i++) {
+        if (b->outputs[i] && fflush(b->outputs[i]) != 0)
+            close_output(b, i);
+    }
+    pthread_mutex_lock(&s->lock);
+    for (;;) {
+        int full = 0;
+        for (i = 0; i < b->n; i++) {
+            if (b->outputs[i] && pos + size - s->taken[i] > BATCH_RING_SIZE)
+                full = 1;
+        }
+        if (!full)
+            break;
+        {
+            struct timespec ts;
+            clock_gettime(CLOCK_REALTIME, &ts);
+            ts.tv_nsec += BATCH_REAP_INTERVAL * 1000000;
+            if (ts.tv_nsec >= 1000000000) {
+                ts.tv_sec++;
+                ts.tv_nsec -= 1000000000;
+            }
+            if (pthread_cond_timedwait(&s->cond, &s->lock, &ts) == ETIMEDOUT)
+                reap_outputs(b);
+        }
+    }
+    pthread_mutex_unlock(&s->lock);
+    b->written = pos + size;
+    return pos;
+}
+
+/* Lets the first process reuse the ring up to the end of a frame. */
+static void ring_take(batch *b, const batch_record *r) {
+    batch_shared *s = b->shared;
+    pthread_mutex_lock(&s->lock);
+    s->taken[b->output] = r->offset + r->size;
+    pthread_cond_signal(&s->cond);
+    pthread_mutex_unlock(&s->lock);
+}
+
+int batch_write_packet(batch *b, const AVPacket *pkt, int ret, int with_data) {
+    batch_record r;
+
+    memset(&r, 0, sizeof(r));
+    r.type = BATCH_PACKET;
+    r.ret = ret;
+    if (ret >= 0) {
+        r.stream_index = pkt->stream_index;
+        r.packet_size = pkt->size;
+        r.flags = pkt->flags;
+        r.duration = pkt->duration;
+        r.pts = pkt->pts;
+        r.dts = pkt->dts;
+        r.pos = pkt->pos;
+        if (with_data)
+            r.size = pkt->size;
+    }
+    write_outputs(b, &r, sizeof(r));
+    if (r.size)
+        write_outputs(b, pkt->data, r.size);
+    if (b->running < b->n)
+        reap_outputs(b);
+    return b->running;
+}
+
+void batch_write_frame(batch *b, int stream_index, int ret, int got_frame,
+                       const AVFrame *frame) {
+    batch_record r;
+    int i;
+
+    memset(&r, 0, sizeof(r));
+    r.type = BATCH_FRAME;
+    r.stream_index = stream_index;
+    r.ret = ret;
+    r.got_frame = got_frame;
+    if (got_frame) {
+        r.format = frame->format;
+        r.width = frame->width;
+        r.height = frame->height;
+        r.nb_samples = frame->nb_samples;
+        r.channels = av_frame_get_channels(frame);
+        r.sample_rate = frame->sample_rate;
+        r.channel_layout = frame->channel_layout;
+        r.frame_pts = frame->pts;
+        r.pkt_pts = frame->pkt_pts;
+        r.pkt_dts = frame->pkt_dts;
+        r.best_effort_timestamp = av_frame_get_best_effort_timestamp(frame);
+        r.pkt_duration = av_frame_get_pkt_duration(frame);
+        r.pkt_pos = av_frame_get_pkt_pos(frame);
+        r.key_frame = frame->key_frame;
+        r.pict_type = frame->pict_type;
+        r.interlaced_frame = frame->interlaced_frame;
+        r.top_field_first = frame->top_field_first;
+        r.repeat_pict = frame->repeat_pict;
+        r.color_range = av_frame_get_color_range(frame);
+        r.colorspace = av_frame_get_colorspace(frame);
+        r.sample_aspect_ratio = frame->sample_aspect_ratio;
+        if (frame->width > 0) {
+            r.size = av_image_get_buffer_size(frame->format, frame->width, frame->height, BATCH_ALIGN);
+            if (r.size < 0) {
+                fprintf(stderr, "ERROR: unable to pass a decoded picture to the batch outputs\n");
+                exit(1);
+            }
+            r.offset = ring_alloc(b, r.size);
+            av_image_copy_to_buffer(b->shared->ring + r.offset % BATCH_RING_SIZE, r.size,
+                                    (const uint8_t * const *)frame->data, frame->linesize,
+                                    frame->format, frame->width, frame->height, BATCH_ALIGN);
+        }
+        else {
+            int planes = av_sample_fmt_is_planar(frame->format) ? r.channels : 1;
+            int plane_size = frame->nb_samples * av_get_bytes_per_sample(frame->format) *
+                             (planes == 1 ? r.channels : 1);
+            r.size = planes * plane_size;
+            r.offset = ring_alloc(b, r.size);
+            for (i = 0; i < planes; i++)
+                memcpy(b->shared->ring + r.offset % BATCH_RING_SIZE + i * plane_size,
+                       frame->extended_data[i], plane_size);
+        }
+    }
+    write_outputs(b, &r, sizeof(r));
+}
+
+int batch_finish(batch *b) {
+    int i, failed = 0;
+    for (i = 0; i < b->n; i++) {
+        if (b->outputs[i])
+            close_output(b, i);
+    }
+#ifndef _WIN32
+    for (i = 0; i < b->n; i++) {
+        if (!b->exited[i])
+            while (waitpid(b->pids[i], &b->status[i], 0) < 0 && errno == EINTR);
+        if (!WIFEXITED(b->status[i]) || WEXITSTATUS(b->status[i]) != 0)
+            failed++;
+    }
+    munmap(b->shared, sizeof(*b->shared));
+#endif
+    av_free(b->outputs);
+    av_free(b->output_buffers);
+    av_free(b->pids);
+    av_free(b->exited);
+    av_free(b->status);
+    av_free(b);
+    return failed;
+}
+
+static void read_input(batch *b, void *data, int size) {
+    if (fread(data, 1, size, b->input) < size) {
+        fprintf(stderr, "ERROR: the input of the batch ended early\n");
+        exit(1);
+    }
+}
+
+int batch_read_packet(batch *b, AVPacket *pkt) {
+    batch_record r;
+
+    /* frames of the last packet the output had no use for */
+    for (;;) {
+        read_input(b, &r, sizeof(r));
+        if (r.type == BATCH_PACKET)
+            break;
+        if (r.got_frame)
+            ring_take(b, &r);
+    }
+
+    av_init_packet(pkt);
+    pkt->data = NULL;
+    pkt->size = 0;
+    if (r.ret < 0)
+        return r.ret;
+    if (r.size > 0) {
+        if (av_new_packet(pkt, r.size) < 0) {
+            fprintf(stderr, "ERROR: out of memory in batch\n");
+            exit(1);
+        }
+        read_input(b, pkt->data, r.size);
+    }
+    pkt->stream_index = r.stream_index;
+    pkt->size = r.packet_size;
+    pkt->flags = r.flags;
+    pkt->duration = r.duration;
+    pkt->pts = r.pts;
+    pkt->dts = r.dts;
+    pkt->pos = r.pos;
+    return r.ret;
+}
+
+/* Gets a buffer of at least size bytes for a frame taken from the ring.
+   The pool only grows, so pictures and samples share it. */
+static AVBufferRef *pool_get(batch *b, int size) {
+    AVBufferRef *buf = NULL;
+
+    if (size + FF_INPUT_BUFFER_PADDING_SIZE > b->pool_size) {
+        av_buffer_pool_uninit(&b->pool);
+        b->pool_size = size + FF_INPUT_BUFFER_PADDING_SIZE;
+        b->pool = av_buffer_pool_init(b->pool_size, NULL);
+    }
+    if (size < 0 || !b->pool || !(buf = av_buffer_pool_get(b->pool))) {
+        fprintf(stderr, "ERROR: out of memory in batch\n");
+        exit(1);
+    }
+    return buf;
+}
+
+int batch_read_frame(batch *b, int stream_index, AVFrame *frame, int *got_frame) {
+    batch_record r;
+    const uint8_t *data;
+    int i;
+
+    av_frame_unref(frame);
+    /* at the end of the input every decoder is drained, the output may be
+       done with some of the streams already */
+    for (;;) {
+        read_input(b, &r, sizeof(r));
+        if (r.type != BATCH_FRAME) {
+            fprintf(stderr, "ERROR: decoding in a batch output went out of step with the input\n");
+            exit(1);
+        }
+        if (r.stream_index == stream_index)
+            break;
+        if (r.got_frame)
+            ring_take(b, &r);
+    }
+    *got_frame = r.got_frame;
+    if (!r.got_frame)
+        return r.ret;
+
+    data = b->shared->ring + r.offset % BATCH_RING_SIZE;
+    frame->format = r.format;
+    if (r.width > 0) {
+        /* the picture keeps the layout it has in the ring */
+        frame->buf[0] = pool_get(b, r.size);
+        memcpy(frame->buf[0]->data, data, r.size);
+        av_image_fill_arrays(frame->data, frame->linesize, frame->buf[0]->data,
+                             r.format, r.width, r.height, BATCH_ALIGN);
+        frame->extended_data = frame->data;
+        frame->width = r.width;
+        frame->height = r.height;
+    }
+    else {
+        int planes, plane_size;
+        frame->nb_samples = r.nb_samples;
+        frame->channel_layout = r.channel_layout;
+        av_frame_set_channels(frame, r.channels);
+        frame->sample_rate = r.sample_rate;
+        planes = av_sample_fmt_is_planar(r.format) ? r.channels : 1;
+        if (planes > AV_NUM_DATA_POINTERS) {
+            /* needs an allocated extended_data */
+            if (av_frame_get_buffer(frame, 0) < 0) {
+                fprintf(stderr, "ERROR: out of memory in batch\n");
+                exit(1);
+            }
+        }
+        else {
+            frame->buf[0] = pool_get(b, av_samples_get_buffer_size(NULL, r.channels, r.nb_samples, r.format, 0));
+            av_samples_fill_arrays(frame->data, frame->linesize, frame->buf[0]->data,
+                                   r.channels, r.nb_samples, r.format, 0);
+            frame->extended_data = frame->data;
+        }
+        plane_size = r.size / planes;
+        for (i = 0; i < planes; i++)
+            memcpy(frame->extended_data[i], data + i * plane_size, plane_size);
+    }
+    ring_take(b, &r);
+    frame->pts = r.frame_pts;
+    frame->pkt_pts = r.pkt_pts;
+    frame->pkt_dts = r.pkt_dts;
+    av_frame_set_best_effort_timestamp(frame, r.best_effort_timestamp);
+    av_frame_set_pkt_duration(frame, r.pkt_duration);
+    av_frame_set_pkt_pos(frame, r.pkt_pos);
+    frame->key_frame = r.key_frame;
+    frame->pict_type = r.pict_type;
+    frame->interlaced_frame = r.interlaced_frame;
+    frame->top_field_first = r.top_field_first;
+    frame->repeat_pict = r.repeat_pict;
+    av_frame_set_color_range(frame, r.color_range);
+    av_frame_set_colorspace(frame, r.colorspace);
+    frame->sample_aspect_ratio = r.sample_aspect_ratio;
+    return r.ret;
+}
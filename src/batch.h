@@ -0,0 +1,66 @@
+/* -*- tab-width:4;c-file-style:"cc-mode"; -*- */
+/*
+ * batch.h -- decode an input once for several outputs encoded at once
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with This program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef _F2T_BATCH_H_
+#define _F2T_BATCH_H_
+
+#include "libavformat/avformat.h"
+
+/* most outputs of one --batch run */
+#define BATCH_MAX_OUTPUTS 16
+
+typedef struct batch batch;
+
+/**
+ * Starts a process for each of n outputs, all of them continuing from
+ * here. In the process that called it *output is -1, it reads and decodes
+ * the input and sends every packet and decoded frame to the others. In
+ * those *output is the number of the output, from 0, and the calls that
+ * read and decode the input are replaced by batch_read_packet and
+ * batch_read_frame.
+ */
+extern batch *batch_fork(int n, int *output);
+
+/**
+ * Sends a packet read with av_read_frame, ret is what it returned. The data
+ * is only sent with_data, the outputs decode nothing but what they get
+ * from batch_read_frame otherwise. Returns the number of outputs still
+ * running, reading the input is pointless once it is 0.
+ */
+extern int batch_write_packet(batch *b, const AVPacket *pkt, int ret, int with_data);
+/* Sends what decoding the last packet or draining a decoder gave. */
+extern void batch_write_frame(batch *b, int stream_index, int ret, int got_frame,
+                              const AVFrame *frame);
+/* Ends the input and waits for the outputs, returns how many failed. */
+extern int batch_finish(batch *b);
+
+/**
+ * Like av_read_frame, the packet has no data unless it was sent with_data,
+ * but its size is that of the packet read. The frames of the previous
+ * packet not read yet are skipped.
+ */
+extern int batch_read_packet(batch *b, AVPacket *pkt);
+/**
+ * Like avcodec_decode_video2 and avcodec_decode_audio4, gives the result of
+ * the next decoder call for stream_index on the current packet. For every
+ * stream the calls have to be a prefix of those made for the packet by the
+ * first process, the streams taken in the same order. Calls for streams
+ * the output asks for no more are skipped.
+ */
+extern int batch_read_frame(batch *b, int stream_index, AVFrame *frame, int *got_frame);
+
+#endif
@@ -0,0 +1,193 @@
+/* -*- tab-width:4;c-file-style:"cc-mode"; -*- */
+/*
+ * decodepool.c -- pooled buffers for the pictures and samples decoders give
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with This program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "libavcodec/avcodec.h"
+#include "libavutil/imgutils.h"
+#include "libavutil/mem.h"
+#include "libavutil/pixdesc.h"
+#include "libavutil/samplefmt.h"
+
+#include "decodepool.h"
+
+/* bytes decoders may read past the end of a picture */
+#define DECODEPOOL_PADDING 16
+
+/* The buffers of a decoder, all of them for frames of one format and size,
+   each holding every plane of a frame. */
+typedef struct {
+    pthread_mutex_t lock;
+    AVBufferPool *pool;
+
+    int format;
+    /* pictures */
+    int width;
+    int height;
+    int linesize[4];
+    int offset[4];
+    /* samples, the pool's buffers fit up to max_samples */
+    int channels;
+    int max_samples;
+} decodepool;
+
+/* Lays out the planes of width x height pictures like libavcodec does, but
+   with every line aligned to DECODEPOOL_ALIGN. Returns the size of a
+   picture, or a negative value for formats left to libavcodec. */
+static int video_layout(decodepool *dp, AVCodecContext *enc, int format, int width, int height) {
+    const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get(format);
+    int stride_align[AV_NUM_DATA_POINTERS];
+    int w = width, h = height, size = 0, unaligned, i;
+
+    /* palettes are set up by libavcodec */
+    if (!desc || desc->flags & (AV_PIX_FMT_FLAG_PAL | AV_PIX_FMT_FLAG_PSEUDOPAL | AV_PIX_FMT_FLAG_HWACCEL))
+        return -1;
+
+    avcodec_align_dimensions2(enc, &w, &h, stride_align);
+    /* widen all lines at once, aligning them one by one would break
+       e.g. linesize[0] == 2 * linesize[1] for 4:2:2 */
+    do {
+        if (av_image_fill_linesizes(dp->linesize, format, w) < 0)
+            return -1;
+        w += w & ~(w - 1);
+        unaligned = 0;
+        for (i = 0; i < 4; i++)
+            unaligned |= dp->linesize[i] % FFMAX(DECODEPOOL_ALIGN, stride_align[i]);
+    } while (unaligned);
+
+    for (i = 0; i < 4 && dp->linesize[i]; i++) {
+        dp->offset[i] = size;
+        if (i == 1 || i == 2)
+            size += dp->linesize[i] * FF_CEIL_RSHIFT(h, desc->log2_chroma_h);
+        else
+            size += dp->linesize[i] * h;
+    }
+    for (; i < 4; i++)
+        dp->offset[i] = -1;
+    return size;
+}
+
+/* Makes the pool fit frame, returns a negative value if it can't. */
+static int update_pool(decodepool *dp, AVCodecContext *enc, AVFrame *frame) {
+    int size;
+
+    if (enc->codec_type == AVMEDIA_TYPE_VIDEO) {
+        if (dp->pool && dp->format == frame->format &&
+            dp->width == frame->width && dp->height == frame->height)
+            return 0;
+        size = video_layout(dp, enc, frame->format, frame->width, frame->height);
+        dp->width = frame->width;
+        dp->height = frame->height;
+    }
+    else {
+        int channels = av_frame_get_channels(frame);
+
+        if (dp->pool && dp->format == frame->format &&
+            dp->channels == channels && frame->nb_samples <= dp->max_samples)
+            return 0;
+        /* planar samples with more channels than frame->data has would
+           need an allocated extended_data */
+        if (av_sample_fmt_is_planar(frame->format) && channels > AV_NUM_DATA_POINTERS)
+            size = -1;
+        else
+            size = av_samples_get_buffer_size(NULL, channels, frame->nb_samples,
+                                              frame->format, DECODEPOOL_ALIGN);
+        dp->channels = channels;
+        dp->max_samples = frame->nb_samples;
+    }
+
+    /* frames still using the old buffers keep them until they are released */
+    av_buffer_pool_uninit(&dp->pool);
+    dp->format = frame->format;
+    if (size < 0)
+        return -1;
+    dp->pool = av_buffer_pool_init(size + DECODEPOOL_PADDING + DECODEPOOL_ALIGN - 1,
+                                   av_buffer_allocz);
+    return dp->pool ? 0 : -1;
+}
+
+static int get_buffer(AVCodecContext *enc, AVFrame *frame, int flags) {
+    decodepool *dp = enc->opaque;
+    int linesize[4], offset[4];
+    AVBufferRef *buf;
+    uint8_t *data;
+    int i;
+
+    if (!(enc->codec->capabilities & CODEC_CAP_DR1))
+        return avcodec_default_get_buffer2(enc, frame, flags);
+
+    /* frame threads may ask from several threads */
+    pthread_mutex_lock(&dp->lock);
+    if (update_pool(dp, enc, frame) < 0) {
+        pthread_mutex_unlock(&dp->lock);
+        return avcodec_default_get_buffer2(enc, frame, flags);
+    }
+    buf = av_buffer_pool_get(dp->pool);
+    memcpy(linesize, dp->linesize, sizeof(linesize));
+    memcpy(offset, dp->offset, sizeof(offset));
+    pthread_mutex_unlock(&dp->lock);
+    if (!buf)
+        return AVERROR(ENOMEM);
+
+    data = (uint8_t *)FFALIGN((uintptr_t)buf->data, DECODEPOOL_ALIGN);
+    memset(frame->data, 0, sizeof(frame->data));
+    memset(frame->linesize, 0, sizeof(frame->linesize));
+    if (enc->codec_type == AVMEDIA_TYPE_VIDEO) {
+        for (i = 0; i < 4 && offset[i] >= 0; i++) {
+            frame->data[i] = data + offset[i];
+            frame->linesize[i] = linesize[i];
+        }
+    }
+    else {
+        av_samples_fill_arrays(frame->data, &frame->linesize[0], data,
+                               av_frame_get_channels(frame), frame->nb_samples,
+                               frame->format, DECODEPOOL_ALIGN);
+    }
+    frame->extended_data = frame->data;
+    frame->buf[0] = buf;
+    return 0;
+}
+
+void decodepool_open(AVCodecContext *enc) {
+    decodepool *dp = av_mallocz(sizeof(*dp));
+
+    if (!dp) {
+        fprintf(stderr, "Failed to allocate memory\n");
+        exit(1);
+    }
+    pthread_mutex_init(&dp->lock, NULL);
+    enc->opaque = dp;
+    enc->get_buffer2 = get_buffer;
+    enc->thread_safe_callbacks = 1;
+}
+
+void decodepool_close(AVCodecContext *enc) {
+    decodepool *dp = enc->opaque;
+
+    if (enc->get_buffer2 != get_buffer)
+        return;
+    av_buffer_pool_uninit(&dp->pool);
+    pthread_mutex_destroy(&dp->lock);
+    av_free(dp);
+    enc->opaque = NULL;
+    enc->get_buffer2 = avcodec_default_get_buffer2;
+}
@@ -0,0 +1,36 @@
+/* -*- tab-width:4;c-file-style:"cc-mode"; -*- */
+/*
+ * decodepool.h -- pooled buffers for the pictures and samples decoders give
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with This program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef _F2T_DECODEPOOL_H_
+#define _F2T_DECODEPOOL_H_
+
+#include "libavcodec/avcodec.h"
+
+/* alignment of the planes and lines decoded into, for the SIMD code of
+   libswscale and libavfilter reading them */
+#define DECODEPOOL_ALIGN 32
+
+/**
+ * Has the decoder of enc write its pictures or samples into buffers from
+ * a pool, which are reused once the frames are released, through
+ * enc->get_buffer2 and enc->opaque. Call before avcodec_open2().
+ */
+extern void decodepool_open(AVCodecContext *enc);
+/* Call after avcodec_close(), buffers still in use stay valid. */
+extern void decodepool_close(AVCodecContext *enc);
+
+#endif
@@ -28,6 +28,7 @@
 
 #include "libavformat/avformat.h"
 #include "libavdevice/avdevice.h"
+#include "libavfilter/avfilter.h"
 #ifdef HAVE_FRAMEHOOK
 #include "libavformat/framehook.h"
 #endif
@@ -35,6 +36,9 @@
 #include "libpostproc/postprocess.h"
 
 #include "libavutil/opt.h"
+#include "libavutil/avstring.h"
+#include "libavutil/bprint.h"
+#include "libavutil/cpu.h"
 #include "libavutil/channel_layout.h"
 #include "libavutil/samplefmt.h"
 #include "libswresample_compat.h"
@@ -52,6 +56,12 @@
 #include "subtitles.h"
 #include "ffmpeg2theora.h"
 #include "avinfo.h"
+#include "batch.h"
+#include "decodepool.h"
+#include "pipeline.h"
+#include "preprocess.h"
+#include "probecache.h"
+#include "videofilter.h"
 
 #define MAX_AUDIO_FRAME_SIZE 192000 // 1 second of 48khz 32bit audio
 
@@ -95,14 +105,28 @@ enum {
     FRONTENDFILE_FLAG,
     SPEEDLEVEL_FLAG,
     PP_FLAG,
+    VF_FLAG,
     RESIZE_METHOD_FLAG,
+    DEINTERLACER_FLAG,
     NOSKELETON,
     SKELETON_3,
     INDEX_INTERVAL,
     THEORA_INDEX_RESERVE,
     VORBIS_INDEX_RESERVE,
     KATE_INDEX_RESERVE,
-    INFO_FLAG
+    ADAPTIVE_INDEX_FLAG,
+    INFO_FLAG,
+    NOPIPELINE_FLAG,
+    DECODE_THREADS_FLAG,
+    TWOPASS_CACHE_FLAG,
+    SEGMENTS_FLAG,
+    OUTPUT_BUFFER_FLAG,
+    PAGE_POLICY_FLAG,
+    PAGE_STATS_FLAG,
+    LIVE_FLAG,
+    MAX_DELAY_FLAG,
+    PROBE_CACHE_FLAG,
+    BATCH_FLAG
 } F2T_FLAGS;
 
 enum {
@@ -114,6 +138,13 @@ enum {
     V2V_PRESET_PADMASTREAM,
 } F2T_PRESETS;
 
+/* an output of --batch */
+typedef struct {
+    char preset_name[16];
+    int preset;
+    const char *filename;
+} batch_output;
+
 
 #define PAL_HALF_WIDTH 384
 #define PAL_HALF_HEIGHT 288
@@ -132,8 +163,6 @@ oggmux_info info;
 
 static int using_stdin = 0;
 
-static int padcolor[3] = { 16, 128, 128 };
-
 
 static int ilog(unsigned _v){
   int ret;
@@ -141,37 +170,6 @@ static int ilog(unsigned _v){
   return ret;
 }
 
-/**
- * Allocate and initialise an AVFrame.
- */
-static AVFrame *frame_alloc(int pix_fmt, int width, int height) {
-    AVFrame *picture;
-    uint8_t *picture_buf;
-    int size;
-
-    picture = avcodec_alloc_frame();
-    if (!picture)
-        return NULL;
-    size = avpicture_get_size (pix_fmt, width, height);
-    picture_buf = av_malloc (size);
-    if (!picture_buf) {
-        av_free (picture);
-        return NULL;
-    }
-    avpicture_fill((AVPicture *) picture, picture_buf, pix_fmt, width, height);
-    return picture;
-}
-
-/**
- * Frees an AVFrame.
- */
-static void frame_dealloc(AVFrame *frame) {
-    if (frame) {
-        avpicture_free((AVPicture*)frame);
-        av_free(frame);
-    }
-}
-
 /**
  * initialize ff2theora with default values
  * @return ff2theora struct
@@ -186,7 +184,6 @@ static ff2theora ff2theora_init() {
         this->disable_oshash=0;
         this->no_upscaling=0;
         this->video_index = -1;
-        this->audio_index = -1;
         this->start_time=0;
         this->end_time=0; /* 0 denotes no end time set */
 
@@ -195,7 +192,9 @@ static ff2theora ff2theora_init() {
         this->channels = -1;
         this->audio_quality = 1.00;// audio quality 1
         this->audio_bitrate=0;
-        this->audiostream = -1;
+        this->audiostreams = NULL;
+        this->n_audiostreams = 0;
+        this->all_audiostreams = 0;
 
         // video
         this->videostream = -1;
@@ -217,9 +216,11 @@ static ff2theora ff2theora_init() {
         this->max_x=-1;
         this->max_y=-1;
         this->deinterlace=0; // auto by default, if input is flaged as interlaced it will deinterlace.
+        this->deinterlacer=DEINTERLACER_FAST;
         this->soft_target=0;
         this->buf_delay=-1;
         this->vhook=0;
+        this->video_filters=NULL;
         this->framerate_new.num = -1;
         this->framerate_new.den = 1;
 
@@ -246,6 +247,12 @@ static ff2theora ff2theora_init() {
         this->sws_scale_ctx = NULL;
 
         this->resize_method = -1;
+        this->pipeline = 1;
+        this->decode_threads = 0; // one per core
+        this->twopass_cache = 0;
+        this->twopass_frames = NULL;
+        this->segments = 1;
+        this->batch = NULL;
     }
     return this;
 }
@@ -278,9 +285,9 @@ static void y_lut_init(ff2theora this) {
         v = pow(v, g) * 255.0;    // mplayer's vf_eq2.c multiplies with 256 here, strange...
 
         if (v >= 255)
-            this->y_lut[i] = 255;
+            this->y_lut.table[i] = 255;
         else
-            this->y_lut[i] = (unsigned char)(v+0.5);
+            this->y_lut.table[i] = (unsigned char)(v+0.5);
     }
 }
 
@@ -302,27 +309,61 @@ static void uv_lut_init(ff2theora this) {
         if (v < 0.0) v = 0.0;
 
         if (v >= 255.0)
-            this->uv_lut[i] = 255;
+            this->uv_lut.table[i] = 255;
         else
-            this->uv_lut[i] = (unsigned char)(v+0.5);
+            this->uv_lut.table[i] = (unsigned char)(v+0.5);
     }
 }
 
+/* the tables are applied while scaling, see preprocess.c */
 static void lut_init(ff2theora this) {
     y_lut_init(this);
     uv_lut_init(this);
+    if (this->y_lut_used)
+        color_lut_prepare(&this->y_lut);
+    if (this->uv_lut_used)
+        color_lut_prepare(&this->uv_lut);
 }
 
-static void lut_apply(unsigned char *lut, unsigned char *src, unsigned char *dst, int width, int height, int stride) {
-    int x, y;
-
-    for (y = 0; y < height; y++) {
-        for (x = 0; x < width; x++) {
-            dst[x] = lut[src[x]];
+/* The filters that run on the decoded pictures ahead of the pipeline: the
+   yadif deinterlacer, --pp and --vf in that order. Cropping, scaling and
+   color correction are left to the single sws_scale call in preprocess.c.
+   Returns NULL if there is nothing to filter. */
+static char *video_filters_description(ff2theora this, int bob) {
+    AVBPrint description;
+    char *str;
+
+    av_bprint_init(&description, 0, AV_BPRINT_SIZE_UNLIMITED);
+    if (this->deinterlacer != DEINTERLACER_FAST && this->deinterlace != -1)
+        av_bprintf(&description, "yadif=mode=%s:deint=%s",
+                   bob ? "send_field" : "send_frame",
+                   this->deinterlace == 1 || bob ? "all" : "interlaced");
+    if (strcmp(this->pp_mode, "")) {
+        char mode[sizeof(this->pp_mode)], *p, *escaped;
+        /* the pp filter takes | between a filter's options, the filters
+           themselves are separated by , or / like the graph's */
+        av_strlcpy(mode, this->pp_mode, sizeof(mode));
+        for (p = mode; (p = strchr(p, ':')); p++)
+            *p = '|';
+        if (av_escape(&escaped, mode, "[],;", AV_ESCAPE_MODE_BACKSLASH, 0) < 0) {
+            fprintf(stderr, "Failed to allocate memory\n");
+            exit(1);
         }
-        src += stride;
-        dst += stride;
+        av_bprintf(&description, "%spp=%s", description.len ? "," : "", escaped);
+        av_free(escaped);
+    }
+    if (this->video_filters)
+        av_bprintf(&description, "%s%s", description.len ? "," : "", this->video_filters);
+    if (!av_bprint_is_complete(&description)) {
+        fprintf(stderr, "Failed to allocate memory\n");
+        exit(1);
+    }
+    if (!description.len) {
+        av_bprint_finalize(&description, NULL);
+        return NULL;
     }
+    av_bprint_finalize(&description, &str);
+    return str;
 }
 
 static void prepare_ycbcr_buffer(ff2theora this, th_ycbcr_buffer ycbcr, AVFrame *frame) {
@@ -341,14 +382,82 @@ static void prepare_ycbcr_buffer(ff2theora this, th_ycbcr_buffer ycbcr, AVFrame
     ycbcr[2].height = this->frame_height / 2;
     ycbcr[2].stride = frame->linesize[1];
     ycbcr[2].data = frame->data[2];
+}
+
+static void prepare_video_frame(void *opaque, th_ycbcr_buffer ycbcr, AVFrame *frame) {
+    video_preprocess *vp = opaque;
+    prepare_ycbcr_buffer(vp->this, ycbcr, frame);
+}
 
-    if (this->y_lut_used) {
-        lut_apply(this->y_lut, ycbcr[0].data, ycbcr[0].data, ycbcr[0].width, ycbcr[0].height, ycbcr[0].stride);
+/* Allocates a theora encoder for info.ti with the speed, keyframe and rate
+   control settings, everything but two-pass and the buffer delay. The speed
+   level must already be clamped, -1 leaves the default. */
+static th_enc_ctx *theora_encoder_alloc(ff2theora this, int speed_level) {
+    th_enc_ctx *td = th_encode_alloc(&info.ti);
+    int ret;
+
+    if (speed_level >= 0)
+        th_encode_ctl(td, TH_ENCCTL_SET_SPLEVEL, &speed_level, sizeof(int));
+    /* setting just the granule shift only allows power-of-two keyframe
+       spacing.  Set the actual requested spacing. */
+    ret = th_encode_ctl(td, TH_ENCCTL_SET_KEYFRAME_FREQUENCY_FORCE,
+                        &this->keyint, sizeof(this->keyint-1));
+    if(ret<0){
+        fprintf(stderr,"Could not set keyframe interval to %d.\n",(int)this->keyint);
     }
-    if (this->uv_lut_used) {
-        lut_apply(this->uv_lut, ycbcr[1].data, ycbcr[1].data, ycbcr[1].width, ycbcr[1].height, ycbcr[1].stride);
-        lut_apply(this->uv_lut, ycbcr[2].data, ycbcr[2].data, ycbcr[2].width, ycbcr[2].height, ycbcr[2].stride);
+
+    if(this->soft_target){
+      /* reverse the rate control flags to favor a 'long time' strategy */
+      int arg = TH_RATECTL_CAP_UNDERFLOW;
+      ret = th_encode_ctl(td, TH_ENCCTL_SET_RATE_FLAGS, &arg, sizeof(arg));
+      if(ret<0)
+        fprintf(stderr, "Could not set encoder flags for --soft-target\n");
+        /* Default buffer control is overridden on two-pass */
+        if(!info.twopass && this->buf_delay<0){
+            if((this->keyint*7>>1)>5*this->framerate_new.num/this->framerate_new.den)
+                arg = this->keyint*7>>1;
+            else
+                arg = 5*this->framerate_new.num/this->framerate_new.den;
+            ret = th_encode_ctl(td, TH_ENCCTL_SET_RATE_BUFFER, &arg,sizeof(arg));
+            if(ret<0)
+                fprintf(stderr, "Could not set rate control buffer for --soft-target\n");
+      }
     }
+    return td;
+}
+
+/* Lowers info.speed_level to the highest level td supports and sets it.
+   Done once for info.td on the main thread, before the segment encoders
+   are set up. */
+static void clamp_speed_level(th_enc_ctx *td) {
+    int max_speed_level;
+
+    if (info.speed_level < 0)
+        return;
+    th_encode_ctl(td, TH_ENCCTL_GET_SPLEVEL_MAX, &max_speed_level, sizeof(int));
+    if (info.speed_level > max_speed_level)
+        info.speed_level = max_speed_level;
+    th_encode_ctl(td, TH_ENCCTL_SET_SPLEVEL, &info.speed_level, sizeof(int));
+}
+
+/* Encoder for a segment of the video, set up like info.td. Called from the
+   pipeline's theora threads, which only read info.speed_level. */
+static th_enc_ctx *alloc_segment_encoder(void *opaque) {
+    video_preprocess *vp = opaque;
+    th_enc_ctx *td = theora_encoder_alloc(vp->this, info.speed_level);
+    int buf_delay = vp->this->buf_delay;
+    th_comment tc;
+    ogg_packet op;
+
+    if (buf_delay >= 0)
+        th_encode_ctl(td, TH_ENCCTL_SET_RATE_BUFFER, &buf_delay, sizeof(buf_delay));
+    /* only info.td's headers are written, these just get the encoder
+       ready for the first frame */
+    th_comment_init(&tc);
+    while (th_encode_flushheader(td, &tc, &op) > 0)
+        ;
+    th_comment_clear(&tc);
+    return td;
 }
 
 static const char *find_category_for_subtitle_stream (ff2theora this, int idx, int included_subtitles)
@@ -379,6 +488,22 @@ static int is_supported_subtitle_stream(ff2theora this, int idx, int included_su
   return find_category_for_subtitle_stream(this, idx, included_subtitles) != NULL;
 }
 
+/* whether the input has subtitle streams that will be muxed as kate streams */
+static int has_subtitle_streams(ff2theora this)
+{
+#ifdef HAVE_KATE
+  int i;
+  if (this->included_subtitles) {
+    for (i = 0; i < this->context->nb_streams; i++) {
+      if (this->context->streams[i]->codec->codec_type == AVMEDIA_TYPE_SUBTITLE
+          && is_supported_subtitle_stream(this, i, this->included_subtitles))
+        return 1;
+    }
+  }
+#endif
+  return 0;
+}
+
 static char *get_raw_text_from_ssa(const char *ssa)
 {
   int n,intag,inescape;
@@ -511,6 +636,30 @@ static void extra_info_from_ssa(AVPacket *pkt, const char **utf8, size_t *utf8le
   }
 }
 
+/* Language of an audio stream for its LANGUAGE comment, NULL if unknown. */
+static const char *find_language_for_audio_stream(const AVStream *s)
+{
+  AVDictionaryEntry *language = av_dict_get(s->metadata, "language", NULL, 0);
+  const char *lang;
+  if (!language || !strcmp(language->value, "und"))
+    return NULL;
+  lang=find_iso639_1(language->value);
+  return lang ? lang : language->value;
+}
+
+/* Adds input stream index to the audio streams to encode, once. */
+static int add_audio_stream(ff2theora_audio_stream *audio, int n_audio, int index)
+{
+  int i;
+  for (i=0; i<n_audio; ++i) {
+    if (audio[i].stream_index == index)
+      return n_audio;
+  }
+  memset(&audio[n_audio], 0, sizeof(audio[n_audio]));
+  audio[n_audio].stream_index = index;
+  return n_audio+1;
+}
+
 static const char *find_language_for_subtitle_stream(const AVStream *s)
 {
   AVDictionaryEntry *language = av_dict_get(s->metadata, "language", NULL, 0);
@@ -522,49 +671,35 @@ static const char *find_language_for_subtitle_stream(const AVStream *s)
   return lang;
 }
 
-void ff2theora_output(ff2theora this) {
+/* Picks the input streams to encode, sets video_index and returns the
+   number of audio streams put in audio. */
+static int select_input_streams(ff2theora this, ff2theora_audio_stream *audio, int verbose)
+{
     unsigned int i;
-    AVCodecContext *aenc = NULL;
-    AVCodecContext *venc = NULL;
-    int venc_pix_fmt = 0;
-    AVStream *astream = NULL;
-    AVStream *vstream = NULL;
-    AVCodec *acodec = NULL;
-    AVCodec *vcodec = NULL;
-    pp_mode *ppMode = NULL;
-    pp_context *ppContext = NULL;
-    int sws_flags = this->resize_method;
-    float frame_aspect = 0;
-    double fps = 0.0;
-    AVRational vstream_fps;
-    int display_width = -1, display_height = -1;
-    char *subtitles_enabled = (char*)alloca(this->context->nb_streams);
-    char *subtitles_opened = (char*)alloca(this->context->nb_streams);
-    int synced = this->start_time == 0.0;
-    AVRational display_aspect_ratio, sample_aspect_ratio;
-
-    struct SwrContext *swr_ctx;
-    uint8_t **dst_audio_data = NULL;
-    int dst_linesize;
-    int src_nb_samples = 1024, dst_nb_samples, max_dst_nb_samples;
-
-    if (this->audiostream >= 0 && this->context->nb_streams > this->audiostream) {
-        AVCodecContext *enc = this->context->streams[this->audiostream]->codec;
-        if (enc->codec_type == AVMEDIA_TYPE_AUDIO) {
-            this->audio_index = this->audiostream;
-            fprintf(stderr, "  Using stream #0.%d as audio input\n",this->audio_index);
+    int n_audio = 0;
+
+    for (i = 0; i < this->n_audiostreams; i++) {
+        int index = this->audiostreams[i];
+        if (index >= 0 && this->context->nb_streams > index &&
+            this->context->streams[index]->codec->codec_type == AVMEDIA_TYPE_AUDIO) {
+            n_audio = add_audio_stream(audio, n_audio, index);
+            if (verbose)
+                fprintf(stderr, "  Using stream #0.%d as audio input\n", index);
         }
-        else {
-            fprintf(stderr, "  The selected stream is not audio, falling back to automatic selection\n");
+        else if (verbose) {
+            fprintf(stderr, "  The selected stream %d is not audio, ignoring it\n", index);
         }
     }
+    if (verbose && this->n_audiostreams && !n_audio && !this->all_audiostreams)
+        fprintf(stderr, "  No selected stream is audio, falling back to automatic selection\n");
     if (this->videostream >= 0 && this->context->nb_streams > this->videostream) {
         AVCodecContext *enc = this->context->streams[this->videostream]->codec;
         if (enc->codec_type == AVMEDIA_TYPE_VIDEO) {
             this->video_index = this->videostream;
-            fprintf(stderr, "  Using stream #0.%d as video input\n",this->video_index);
+            if (verbose)
+                fprintf(stderr, "  Using stream #0.%d as video input\n",this->video_index);
         }
-        else {
+        else if (verbose) {
             fprintf(stderr, "  The selected stream is not video, falling back to automatic selection\n");
         }
     }
@@ -577,18 +712,118 @@ void ff2theora_output(ff2theora this) {
                     this->video_index = i;
                 break;
             case AVMEDIA_TYPE_AUDIO:
-                if (this->audio_index < 0 && !this->disable_audio)
-                    this->audio_index = i;
+                if ((!n_audio || this->all_audiostreams) && !this->disable_audio)
+                    n_audio = add_audio_stream(audio, n_audio, i);
                 break;
             default:
                 break;
         }
     }
 
+    return n_audio;
+}
+
+/* Opens the decoder of an input stream. A batch output only opens them for
+   their parameters, it gets the decoded frames from the first process. */
+static int open_decoder(ff2theora this, AVCodecContext *enc)
+{
+    AVCodec *codec = avcodec_find_decoder(enc->codec_id);
+
+    enc->thread_count = this->decode_threads > 0 ? this->decode_threads : av_cpu_count();
+    if (this->batch)
+        enc->thread_count = 1;
+    if (enc->codec_type == AVMEDIA_TYPE_VIDEO) {
+        /* frame threads hold a picture back per thread */
+        if (info.live)
+            enc->thread_type = FF_THREAD_SLICE;
+        /* decoded pictures are handed to the pipeline without copying */
+        enc->refcounted_frames = 1;
+    }
+    if (codec == NULL)
+        return -1;
+    /* decode into reused buffers instead of allocating them per frame */
+    if (!this->batch)
+        decodepool_open(enc);
+    if (avcodec_open2(enc, codec, NULL) < 0) {
+        decodepool_close(enc);
+        return -1;
+    }
+    return 0;
+}
+
+static void close_decoder(AVCodecContext *enc)
+{
+    avcodec_close(enc);
+    decodepool_close(enc);
+}
+
+/* Reads the input, or in a batch output what the first process read. */
+static int read_packet(ff2theora this, AVPacket *pkt)
+{
+    if (this->batch)
+        return batch_read_packet(this->batch, pkt);
+    return av_read_frame(this->context, pkt);
+}
+
+/* Decodes pkt of an input stream, or in a batch output takes what the
+   first process decoded from it. */
+static int decode_frame(ff2theora this, int stream_index, AVFrame *frame,
+                        int *got_frame, AVPacket *pkt)
+{
+    AVCodecContext *enc = this->context->streams[stream_index]->codec;
+
+    if (this->batch)
+        return batch_read_frame(this->batch, stream_index, frame, got_frame);
+    if (enc->codec_type == AVMEDIA_TYPE_VIDEO)
+        return avcodec_decode_video2(enc, frame, got_frame, pkt);
+    return avcodec_decode_audio4(enc, frame, got_frame, pkt);
+}
+
+/* Moves pkt past the len bytes a decoder call used. The packets of a
+   --batch output and the empty ones draining a decoder have no data,
+   only the size is counted down then. */
+static void consume_packet(AVPacket *pkt, int len)
+{
+    pkt->size -= len;
+    if (pkt->data)
+        pkt->data += len;
+}
+
+void ff2theora_output(ff2theora this) {
+    unsigned int i;
+    AVCodecContext *venc = NULL;
+    int venc_pix_fmt = 0;
+    AVStream *vstream = NULL;
+    video_preprocess vp;
+    int sws_flags = this->resize_method;
+    float frame_aspect = 0;
+    double fps = 0.0;
+    AVRational vstream_fps;
+    int display_width = -1, display_height = -1;
+    char *subtitles_enabled = (char*)alloca(this->context->nb_streams);
+    char *subtitles_opened = (char*)alloca(this->context->nb_streams);
+    int synced = this->start_time == 0.0;
+    AVRational display_aspect_ratio, sample_aspect_ratio, filtered_aspect_ratio;
+    pipeline *pipe = NULL;
+    videofilter *vf = NULL;
+    char *description = NULL;
+    int bob = 0;
+    ff2theora_audio_stream *audio;
+    int n_audio = 0;
+
+    memset(&vp, 0, sizeof(vp));
+    vp.this = this;
+
+    audio = calloc(this->context->nb_streams + 1, sizeof(*audio));
+    if (!audio) {
+        fprintf(stderr, "Failed to allocate memory\n");
+        exit(1);
+    }
+    n_audio = select_input_streams(this, audio, 1);
+
     if (this->video_index >= 0) {
         vstream = this->context->streams[this->video_index];
         venc = vstream->codec;
-        vcodec = avcodec_find_decoder (venc->codec_id);
 
         display_width = venc->width;
         display_height = venc->height;
@@ -607,12 +842,33 @@ void ff2theora_output(ff2theora this) {
         if (av_q2d(vstream->avg_frame_rate) < av_q2d(vstream_fps)) {
             vstream_fps = vstream->avg_frame_rate;
         }
+        /* bob deinterlacing gives a picture for every field, the frame rate
+           has to be known up front, so in auto mode it is only used when
+           the decoder reports interlaced material */
+        bob = this->deinterlacer == DEINTERLACER_BOB &&
+              (this->deinterlace == 1 ||
+               (this->deinterlace == 0 && venc->field_order > AV_FIELD_PROGRESSIVE));
         this->fps = fps = av_q2d(vstream_fps);
 
-        venc->thread_count = 1;
-        if (vcodec == NULL || avcodec_open2 (venc, vcodec, NULL) < 0) {
+        if (open_decoder(this, venc) < 0) {
             this->video_index = -1;
         }
+
+        /* everything from here on works on the filtered pictures, which
+           may differ in format, size and frame rate from the decoded ones */
+        if (this->video_index >= 0 && (description = video_filters_description(this, bob))) {
+            AVRational frame_rate;
+
+            vf = videofilter_open(description, venc_pix_fmt, display_width, display_height,
+                                  vstream->time_base, venc->sample_aspect_ratio, vstream_fps,
+                                  this->decode_threads);
+            videofilter_get_output(vf, &venc_pix_fmt, &display_width, &display_height,
+                                   &filtered_aspect_ratio, &frame_rate);
+            av_free(description);
+            if (frame_rate.num > 0 && frame_rate.den > 0)
+                vstream_fps = frame_rate;
+            fps = av_q2d(vstream_fps);
+        }
         this->fps = fps;
 #if DEBUG
         fprintf(stderr, "FPS1(stream): %f\n", 1/av_q2d(vstream->time_base));
@@ -650,6 +906,15 @@ void ff2theora_output(ff2theora this) {
                       venc->height*venc->sample_aspect_ratio.den,
                       1024*1024);
         }
+        /* filters that scale adjust the pixel aspect to keep the picture's */
+        if (vf && (display_width != venc->width || display_height != venc->height) &&
+            filtered_aspect_ratio.num) {
+            sample_aspect_ratio = filtered_aspect_ratio;
+            av_reduce(&display_aspect_ratio.num, &display_aspect_ratio.den,
+                      display_width*sample_aspect_ratio.num,
+                      display_height*sample_aspect_ratio.den,
+                      1024*1024);
+        }
 
         if (this->preset == V2V_PRESET_PREVIEW) {
             if (abs(this->fps-30)<1 && (display_width!=NTSC_HALF_WIDTH || display_height!=NTSC_HALF_HEIGHT) ) {
@@ -839,8 +1104,8 @@ void ff2theora_output(ff2theora this) {
                     int width=display_width-this->frame_leftBand-this->frame_rightBand;
                     int height=display_height-this->frame_topBand-this->frame_bottomBand;
                     av_reduce(&this->aspect_numerator,&this->aspect_denominator,
-                    vstream->sample_aspect_ratio.num*width*this->picture_height,
-                    vstream->sample_aspect_ratio.den*height*this->picture_width,10000);
+                    sample_aspect_ratio.num*width*this->picture_height,
+                    sample_aspect_ratio.den*height*this->picture_width,10000);
                     frame_aspect=(float)(this->aspect_numerator*this->picture_width)/
                                     (this->aspect_denominator*this->picture_height);
                 }
@@ -876,11 +1141,13 @@ void ff2theora_output(ff2theora this) {
             this->deinterlace==-1)
             fprintf(stderr, "  Deinterlace: off\n");
 
-        if (strcmp(this->pp_mode, "")) {
-            ppContext = pp_get_context(display_width, display_height, PP_FORMAT_420);
-            ppMode = pp_get_mode_by_name_and_quality(this->pp_mode, PP_QUALITY_MAX);
-            if(!(info.twopass==3 && info.passno==2) && !info.frontend)
+        if (!(info.twopass==3 && info.passno==2) && !info.frontend) {
+            if (this->deinterlacer != DEINTERLACER_FAST && this->deinterlace != -1)
+                fprintf(stderr, "  Deinterlacer: %s\n", bob ? "yadif, one frame per field" : "yadif");
+            if (strcmp(this->pp_mode, ""))
                 fprintf(stderr, "  Postprocessing: %s\n", this->pp_mode);
+            if (this->video_filters)
+                fprintf(stderr, "  Video filters: %s\n", this->video_filters);
         }
 
         if (venc->color_primaries == AVCOL_PRI_BT470M)
@@ -914,18 +1181,28 @@ void ff2theora_output(ff2theora this) {
         }
 
         if (this->frame_width > 0 || this->frame_height > 0) {
-            this->sws_colorspace_ctx = sws_getContext(
+            this->sws_colorspace_ctx = video_preprocess_sws_context(
                             display_width, display_height, venc_pix_fmt,
                             display_width, display_height, this->pix_fmt,
-                            sws_flags, NULL, NULL, NULL
+                            sws_flags, this->decode_threads
             );
-            this->sws_scale_ctx = sws_getContext(
+            this->sws_scale_ctx = video_preprocess_sws_context(
                         display_width - (this->frame_leftBand + this->frame_rightBand),
                         display_height - (this->frame_topBand + this->frame_bottomBand),
                         this->pix_fmt,
                         this->picture_width, this->picture_height, this->pix_fmt,
-                        sws_flags, NULL, NULL, NULL
+                        sws_flags, this->decode_threads
             );
+            /* frames that need no full size processing go straight from
+               the decoder to the encoder's picture */
+            if ((this->deinterlace != 1 || this->deinterlacer != DEINTERLACER_FAST) && !this->vhook)
+                this->sws_fused_ctx = video_preprocess_sws_context(
+                        display_width - (this->frame_leftBand + this->frame_rightBand),
+                        display_height - (this->frame_topBand + this->frame_bottomBand),
+                        venc_pix_fmt,
+                        this->picture_width, this->picture_height, this->pix_fmt,
+                        sws_flags, this->decode_threads
+                );
             if (!info.frontend && !(info.twopass==3 && info.passno==2)) {
                 if (this->frame_topBand || this->frame_bottomBand ||
                     this->frame_leftBand || this->frame_rightBand ||
@@ -951,30 +1228,31 @@ void ff2theora_output(ff2theora this) {
         fprintf(stderr, "  Resample Framerate: %0.3f => %0.3f\n",
                         this->fps, av_q2d(this->framerate_new));
     }
-    if (this->audio_index >= 0) {
-        astream = this->context->streams[this->audio_index];
-        aenc = this->context->streams[this->audio_index]->codec;
-        acodec = avcodec_find_decoder (aenc->codec_id);
+    for (i = 0; i < n_audio; i++) {
+        ff2theora_audio_stream *as = &audio[i];
+        AVCodecContext *aenc = this->context->streams[as->stream_index]->codec;
         int sample_rate = aenc->sample_rate;
-        if (this->channels < 1) {
-            this->channels = aenc->channels;
+        as->enc = aenc;
+        as->channels = this->channels;
+        if (as->channels < 1) {
+            as->channels = aenc->channels;
         }
-        if (this->sample_rate==-1) {
-            this->sample_rate = aenc->sample_rate;
+        as->sample_rate = this->sample_rate;
+        if (as->sample_rate==-1) {
+            as->sample_rate = aenc->sample_rate;
         }
 
         if (this->no_upscaling) {
-            if (this->sample_rate > aenc->sample_rate)
-                this->sample_rate = aenc->sample_rate;
-            if (this->channels > aenc->channels)
-                this->channels = aenc->channels;
-        }
-        aenc->thread_count = 1;
-        if (acodec != NULL && avcodec_open2 (aenc, acodec, NULL) >= 0) {
-            if (this->sample_rate != sample_rate
-                || this->channels != aenc->channels
+            if (as->sample_rate > aenc->sample_rate)
+                as->sample_rate = aenc->sample_rate;
+            if (as->channels > aenc->channels)
+                as->channels = aenc->channels;
+        }
+        if (open_decoder(this, aenc) >= 0) {
+            if (as->sample_rate != sample_rate
+                || as->channels != aenc->channels
                 || aenc->sample_fmt != AV_SAMPLE_FMT_FLTP) {
-                swr_ctx = swr_alloc();
+                struct SwrContext *swr_ctx = swr_alloc();
                 /* set options */
                 if (aenc->channel_layout) {
                     av_opt_set_int(swr_ctx, "in_channel_layout",    aenc->channel_layout, 0);
@@ -984,36 +1262,34 @@ void ff2theora_output(ff2theora this) {
                 av_opt_set_int(swr_ctx, "in_sample_rate",       aenc->sample_rate, 0);
                 av_opt_set_int(swr_ctx, "in_sample_fmt", aenc->sample_fmt, 0);
 
-                av_opt_set_int(swr_ctx, "out_channel_layout", av_get_default_channel_layout(this->channels), 0);
-                av_opt_set_int(swr_ctx, "out_sample_rate",       this->sample_rate, 0);
+                av_opt_set_int(swr_ctx, "out_channel_layout", av_get_default_channel_layout(as->channels), 0);
+                av_opt_set_int(swr_ctx, "out_sample_rate",       as->sample_rate, 0);
                 av_opt_set_int(swr_ctx, "out_sample_fmt", AV_SAMPLE_FMT_FLTP, 0);
+                /* resampling surround channels on threads outweighs
+                   handing them over for every decoded frame */
+                if (as->channels > 2)
+                    av_opt_set_int(swr_ctx, "threads", this->decode_threads, 0);
 
                 /* initialize the resampling context */
                 if (swr_init(swr_ctx) < 0) {
                     fprintf(stderr, "Failed to initialize the resampling context\n");
                     exit(1);
                 }
+                as->swr_ctx = swr_ctx;
 
-                max_dst_nb_samples = dst_nb_samples =
-                    av_rescale_rnd(src_nb_samples, this->sample_rate, sample_rate, AV_ROUND_UP);
-
-                if (av_samples_alloc(dst_audio_data, &dst_linesize, this->channels,
-                                     dst_nb_samples, AV_SAMPLE_FMT_FLTP, 0) < 0) {
-                    fprintf(stderr, "Could not allocate destination samples\n");
-                    exit(1);
-                }
-
-                if (!info.frontend && this->sample_rate!=sample_rate)
-                    fprintf(stderr, "  Resample: %dHz => %dHz\n", sample_rate,this->sample_rate);
-                if (!info.frontend && this->channels!=aenc->channels)
-                    fprintf(stderr, "  Channels: %d => %d\n",aenc->channels,this->channels);
+                if (!info.frontend && as->sample_rate!=sample_rate)
+                    fprintf(stderr, "  Resample: %dHz => %dHz\n", sample_rate,as->sample_rate);
+                if (!info.frontend && as->channels!=aenc->channels)
+                    fprintf(stderr, "  Channels: %d => %d\n",aenc->channels,as->channels);
             }
             else{
-                swr_ctx = NULL;
+                as->swr_ctx = NULL;
             }
         }
         else{
-            this->audio_index = -1;
+            memmove(audio+i, audio+i+1, (n_audio-i-1)*sizeof(*audio));
+            --n_audio;
+            --i;
         }
     }
 
@@ -1081,21 +1357,10 @@ void ff2theora_output(ff2theora this) {
       oggmux_setup_kate_streams(&info, this->n_kate_streams);
     }
 
-    if (this->video_index >= 0 || this->audio_index >= 0) {
+    if (this->video_index >= 0 || n_audio > 0) {
         AVFrame *frame=NULL;
-        AVFrame *frame_p=NULL;
-        AVFrame *output=NULL;
-        AVFrame *output_p=NULL;
-        AVFrame *output_tmp_p=NULL;
         AVFrame *output_tmp=NULL;
-        AVFrame *output_resized_p=NULL;
-        AVFrame *output_resized=NULL;
-        AVFrame *output_buffered_p=NULL;
-        AVFrame *output_buffered=NULL;
-        AVFrame *output_cropped_p=NULL;
-        AVFrame *output_cropped=NULL;
-        AVFrame *output_padded_p=NULL;
-        AVFrame *output_padded=NULL;
+        pipeline_video_filter filter;
 
         AVPacket pkt;
         AVPacket avpkt;
@@ -1103,11 +1368,12 @@ void ff2theora_output(ff2theora this) {
         int got_frame;
         int first = 1;
         int audio_eos = 0, video_eos = 0, audio_done = 0, video_done = 0;
+        int dst_nb_samples;
         int ret;
         AVFrame *audio_frame = NULL;
-        uint8_t **audio_p = NULL;
         int no_frames;
         int no_samples;
+        double videotime = 0;
 
         double framerate_add = 0;
 
@@ -1116,32 +1382,47 @@ void ff2theora_output(ff2theora this) {
         else
             info.audio_only=1;
 
-        if (this->audio_index>=0)
+        if (n_audio > 0)
             info.video_only=0;
         else
             info.video_only=1;
 
         if(info.audio_only)
             video_done = 1;
-        if(info.video_only || info.passno == 1)
+        /* Only video is encoded in the first pass. When it caches its
+           input for the second pass the audio is decoded as well. Kate
+           streams are read from the input during the second pass, so
+           they rule out the cache. */
+        if (info.twopass == 3 && info.passno == 1 && this->twopass_cache && !info.audio_only
+            && !info.with_kate && !has_subtitle_streams(this)) {
+            this->twopass_frames = frame_cache_open(FRAME_CACHE_MEMORY);
+        }
+        if(info.video_only || (info.passno == 1 && !this->twopass_frames)) {
             audio_done = 1;
+            for (i = 0; i < n_audio; i++)
+                audio[i].done = 1;
+        }
 
         if (!info.audio_only) {
-            frame_p = frame = frame_alloc(venc_pix_fmt,
-                            venc->width,venc->height);
-            output_tmp_p = output_tmp = frame_alloc(this->pix_fmt,
-                            venc->width, venc->height);
-            output_p = output = frame_alloc(this->pix_fmt,
-                            venc->width,venc->height);
-            output_resized_p = output_resized = frame_alloc(this->pix_fmt,
-                            this->picture_width, this->picture_height);
-            output_cropped_p = output_cropped = frame_alloc(this->pix_fmt,
-                            venc->width-this->frame_leftBand,
-                            venc->height-this->frame_topBand);
-            output_buffered_p = output_buffered = frame_alloc(this->pix_fmt,
-                            this->frame_width, this->frame_height);
-            output_padded_p = output_padded = frame_alloc(this->pix_fmt,
-                            this->frame_width, this->frame_height);
+            frame = avcodec_alloc_frame();
+            if (!frame) {
+                fprintf(stderr, "Failed to allocate memory\n");
+                exit(1);
+            }
+            vp.src_pix_fmt = venc_pix_fmt;
+            vp.display_width = display_width;
+            vp.display_height = display_height;
+
+            filter.init = video_preprocess_init_picture;
+            filter.process = video_preprocess_frame;
+            filter.prepare = prepare_video_frame;
+            filter.opaque = &vp;
+            filter.pix_fmt = this->pix_fmt;
+            filter.frame_width = this->frame_width;
+            filter.frame_height = this->frame_height;
+            filter.segments = this->segments;
+            filter.segment_frames = this->keyint;
+            filter.alloc_encoder = alloc_segment_encoder;
 
             /* video settings here */
             /* config file? commandline options? v2v presets? */
@@ -1194,40 +1475,9 @@ void ff2theora_output(ff2theora this) {
             // range 0-2, 0 sharp, 2 less sharp,less bandwidth
             info.ti.sharpness = this->sharpness;
             */
-            info.td = th_encode_alloc(&info.ti);
-
-            if (info.speed_level >= 0) {
-                int max_speed_level;
-                th_encode_ctl(info.td, TH_ENCCTL_GET_SPLEVEL_MAX, &max_speed_level, sizeof(int));
-                if (info.speed_level > max_speed_level)
-                    info.speed_level = max_speed_level;
-                th_encode_ctl(info.td, TH_ENCCTL_SET_SPLEVEL, &info.speed_level, sizeof(int));
-            }
-            /* setting just the granule shift only allows power-of-two keyframe
-               spacing.  Set the actual requested spacing. */
-            ret = th_encode_ctl(info.td, TH_ENCCTL_SET_KEYFRAME_FREQUENCY_FORCE,
-                                &this->keyint, sizeof(this->keyint-1));
-            if(ret<0){
-                fprintf(stderr,"Could not set keyframe interval to %d.\n",(int)this->keyint);
-            }
+            info.td = theora_encoder_alloc(this, -1);
+            clamp_speed_level(info.td);
 
-            if(this->soft_target){
-              /* reverse the rate control flags to favor a 'long time' strategy */
-              int arg = TH_RATECTL_CAP_UNDERFLOW;
-              ret = th_encode_ctl(info.td, TH_ENCCTL_SET_RATE_FLAGS, &arg, sizeof(arg));
-              if(ret<0)
-                fprintf(stderr, "Could not set encoder flags for --soft-target\n");
-                /* Default buffer control is overridden on two-pass */
-                if(!info.twopass && this->buf_delay<0){
-                    if((this->keyint*7>>1)>5*this->framerate_new.num/this->framerate_new.den)
-                        arg = this->keyint*7>>1;
-                    else
-                        arg = 5*this->framerate_new.num/this->framerate_new.den;
-                    ret = th_encode_ctl(info.td, TH_ENCCTL_SET_RATE_BUFFER, &arg,sizeof(arg));
-                    if(ret<0)
-                        fprintf(stderr, "Could not set rate control buffer for --soft-target\n");
-              }
-            }
             /* set up two-pass if needed */
             if(info.passno==1){
               unsigned char *buffer;
@@ -1241,15 +1491,8 @@ void ff2theora_output(ff2theora this) {
               /*Perform a seek test to ensure we can overwrite this placeholder data at
                  the end; this is better than letting the user sit through a whole
                  encode only to find out their pass 1 file is useless at the end.*/
-              if(fseek(info.twopass_file,0,SEEK_SET)<0){
-                fprintf(stderr,"Unable to seek in two-pass data file.\n");
-                exit(1);
-              }
-              if(fwrite(buffer,1,bytes,info.twopass_file)<bytes){
-                fprintf(stderr,"Unable to write to two-pass data file.\n");
-                exit(1);
-              }
-              fflush(info.twopass_file);
+              oggmux_twopass_rewind(&info);
+              oggmux_twopass_write(&info,buffer,bytes);
             }
             if(info.passno==2){
               /* enable second pass here, actual data feeding comes later */
@@ -1260,10 +1503,7 @@ void ff2theora_output(ff2theora this) {
               if(info.twopass==3){
                 info.videotime = 0;
                 this->frame_count = 0;
-                if(fseek(info.twopass_file,0,SEEK_SET)<0){
-                  fprintf(stderr,"Unable to seek in two-pass data file.\n");
-                  exit(1);
-                }
+                oggmux_twopass_rewind(&info);
               }
             }
             if(info.passno!=1 && this->buf_delay >= 0){
@@ -1280,8 +1520,15 @@ void ff2theora_output(ff2theora this) {
 
         }
         /* audio settings here */
-        info.channels = this->channels;
-        info.sample_rate = this->sample_rate;
+        oggmux_setup_audio_streams(&info, n_audio);
+        for (i = 0; i < n_audio; i++) {
+            oggmux_audio_stream *as = &info.audio_streams[i];
+            const char *lang = find_language_for_audio_stream(this->context->streams[audio[i].stream_index]);
+            as->channels = audio[i].channels;
+            as->sample_rate = audio[i].sample_rate;
+            if (lang)
+                av_strlcpy(as->language, lang, sizeof(as->language));
+        }
         info.vorbis_quality = this->audio_quality * 0.1;
         info.vorbis_bitrate = this->audio_bitrate;
         /* subtitles */
@@ -1344,7 +1591,9 @@ void ff2theora_output(ff2theora this) {
             /* add the stream start time */
             if (this->context->start_time != AV_NOPTS_VALUE)
                 timestamp += this->context->start_time;
-            av_seek_frame( this->context, -1, timestamp, AVSEEK_FLAG_BACKWARD);
+            /* in a batch output the first process reads the input */
+            if (!this->batch)
+                av_seek_frame( this->context, -1, timestamp, AVSEEK_FLAG_BACKWARD);
             /* discard subtitles by their end time, so we still have those that start before the start time,
              but end after it */
             if (info.passno != 1) {
@@ -1367,7 +1616,7 @@ void ff2theora_output(ff2theora this) {
 
         /*check for end time and calculate number of frames to encode*/
         no_frames = this->fps*(this->end_time - this->start_time) - 1;
-        no_samples = this->sample_rate * (this->end_time - this->start_time);
+        no_samples = (n_audio ? audio[0].sample_rate : 0) * (this->end_time - this->start_time);
         if ((info.audio_only && this->end_time > 0 && no_samples <= 0)
             || (!info.audio_only && this->end_time > 0 && no_frames <= 0)) {
             fprintf(stderr, "End time has to be bigger than start time.\n");
@@ -1376,15 +1625,35 @@ void ff2theora_output(ff2theora this) {
 
         av_init_packet(&avpkt);
 
+        if (!info.audio_only && filter.segments > 1 &&
+            (info.twopass || info.live || !this->pipeline || info.with_kate)) {
+            fprintf(stderr, "WARNING: --segments can't be used with two-pass encoding, --live, "
+                            "--no-pipeline or subtitles, encoding the video in one piece.\n");
+            filter.segments = 1;
+        }
+
+        /* subtitles are timed from the muxer state, so keep everything on
+           this thread when muxing kate streams */
+        pipe = pipeline_start(&info, info.audio_only ? NULL : &filter,
+                              this->pipeline && !info.with_kate, this->twopass_frames);
+
+        if (info.passno == 2 && this->twopass_frames) {
+            /* the first pass decoded and preprocessed everything */
+            pipeline_replay(pipe);
+        }
         /* main decoding loop */
-        do{
-            ret = av_read_frame(this->context, &pkt);
+        else do{
+            ret = read_packet(this, &pkt);
             avpkt.size = pkt.size;
             avpkt.data = pkt.data;
 
             if (ret<0) {
-                if (!info.video_only)
-                    audio_eos = 1;
+                /* at the end of the input, empty packets drain the frames
+                   still held by delayed or frame threaded decoders */
+                avpkt.data = NULL;
+                avpkt.size = 0;
+                for (i = 0; i < n_audio; i++)
+                    audio[i].eos = 1;
                 if (!info.audio_only)
                     video_eos = 1;
             }
@@ -1401,7 +1670,7 @@ void ff2theora_output(ff2theora this) {
                       first frame decodec in case its not a keyframe
                     */
                     if (pkt.stream_index == this->video_index) {
-                      avcodec_decode_video2(venc, frame, &got_frame, &pkt);
+                      decode_frame(this, this->video_index, frame, &got_frame, &pkt);
                     }
                     av_free_packet (&pkt);
                     continue;
@@ -1417,23 +1686,45 @@ void ff2theora_output(ff2theora this) {
                 if (avpkt.size == 0 && !first && !video_eos) {
                     //fprintf (stderr, "no frame available\n");
                 }
-                while(video_eos || avpkt.size > 0) {
+                /* At the end time no more frames are wanted, only the
+                   buffered one has to be written. */
+                if (video_eos && ret >= 0) {
+                    if (!first) {
+                        this->frame_count++;
+                        videotime = this->frame_count / av_q2d(this->framerate);
+                        pipeline_encode_video(pipe, 0, 1, videotime);
+                    }
+                    video_done = 1;
+                }
+                while(!video_done && (video_eos || avpkt.size > 0)) {
                     int dups = 0;
-                    static th_ycbcr_buffer ycbcr;
-                    len1 = avcodec_decode_video2(venc, frame, &got_frame, &avpkt);
+                    int drop = 0;
+                    len1 = decode_frame(this, this->video_index, frame, &got_frame, &avpkt);
                     if (len1>=0) {
                         if (got_frame) {
+                            /* Use the timestamp of the packet the frame was
+                               decoded from, the decoder may return frames
+                               several packets late. */
+                            int64_t frame_dts = frame->pkt_dts;
+                            int64_t frame_pts = av_frame_get_best_effort_timestamp(frame);
+
+                            /* frames decoded from packets before the start
+                               time can come out after the first synced packet */
+                            if (this->start_time && frame_pts != AV_NOPTS_VALUE &&
+                                frame_pts * av_q2d(vstream->time_base) < this->start_time) {
+                                drop = 1;
+                            }
                             // this is disabled by default since it does not work
                             // for all input formats the way it should.
-                            if (this->sync == 1 && pkt.dts != AV_NOPTS_VALUE) {
+                            else if (this->sync == 1 && frame_dts != AV_NOPTS_VALUE) {
                                 if (this->pts_offset == AV_NOPTS_VALUE) {
-                                    this->pts_offset = pkt.dts;
+                                    this->pts_offset = frame_dts;
                                     this->pts_offset_frame = this->frame_count;
                                 }
 
                                 double fr = 1/av_q2d(this->framerate);
 
-                                double ivtime = (pkt.dts - this->pts_offset) * av_q2d(vstream->time_base);
+                                double ivtime = (frame_dts - this->pts_offset) * av_q2d(vstream->time_base);
                                 double ovtime = (this->frame_count - this->pts_offset_frame) / av_q2d(this->framerate);
                                 double delta = ivtime - ovtime;
 
@@ -1444,9 +1735,9 @@ void ff2theora_output(ff2theora this) {
 #ifdef DEBUG
                                     fprintf(stderr, "Frame dropped to maintain sync\n");
 #endif
-                                    break;
+                                    drop = 1;
                                 }
-                                if (delta >= 1.5*fr) {
+                                else if (delta >= 1.5*fr) {
                                     dups = (int)(0.5+delta*av_q2d(this->framerate)) - 1;
 #ifdef DEBUG
                                     fprintf(stderr, "%d duplicate %s added to maintain sync\n", dups, (dups == 1) ? "frame" : "frames");
@@ -1457,124 +1748,86 @@ void ff2theora_output(ff2theora this) {
                             //For audio only files command line option"-e" will not work
                             //as we don't increment frame_count in audio section.
 
-                            if (venc_pix_fmt != this->pix_fmt) {
-                                sws_scale(this->sws_colorspace_ctx,
-                                (const uint8_t * const*)frame->data, frame->linesize, 0, display_height,
-                                output_tmp->data, output_tmp->linesize);
-                            }
-                            else{
-                                av_picture_copy((AVPicture *)output_tmp, (AVPicture *)frame, this->pix_fmt,
-                                                display_width, display_height);
-                                output_tmp_p=NULL;
-                            }
-                            if ((this->deinterlace==0 && frame->interlaced_frame) ||
-                                this->deinterlace==1) {
-                                if (avpicture_deinterlace((AVPicture *)output,(AVPicture *)output_tmp,this->pix_fmt,display_width,display_height)<0) {
-                                        fprintf(stderr, "Deinterlace failed.\n");
-                                        exit(1);
-                                }
-                            }
-                            else{
-                                av_picture_copy((AVPicture *)output, (AVPicture *)output_tmp, this->pix_fmt,
-                                                display_width, display_height);
-                            }
-                            // now output
-
-                            if (ppMode)
-                                pp_postprocess((const uint8_t **)output->data, output->linesize,
-                                               output->data, output->linesize,
-                                               display_width, display_height,
-                                               output->qscale_table, output->qstride,
-                                               ppMode, ppContext, this->pix_fmt);
-#ifdef HAVE_FRAMEHOOK
-                            if (this->vhook)
-                                frame_hook_process((AVPicture *)output, this->pix_fmt, display_width,display_height, 0);
-#endif
-
-                            if (this->frame_topBand || this->frame_leftBand) {
-                                if (av_picture_crop((AVPicture *)output_cropped,
-                                                  (AVPicture *)output, this->pix_fmt,
-                                                  this->frame_topBand, this->frame_leftBand) < 0) {
-                                    av_log(NULL, AV_LOG_ERROR, "error cropping picture\n");
-                                }
-                                output_cropped_p = NULL;
-                            } else {
-                                output_cropped = output;
+                            if (!drop && vf) {
+                                frame->pts = frame_pts;
+                                videofilter_add_frame(vf, frame);
                             }
-                            if (this->sws_scale_ctx) {
-                                sws_scale(this->sws_scale_ctx,
-                                    (const uint8_t * const*)output_cropped->data,
-                                    output_cropped->linesize, 0,
-                                    display_height - (this->frame_topBand + this->frame_bottomBand),
-                                    output_resized->data,
-                                    output_resized->linesize);
-                            }
-                            else{
-                                output_resized = output_cropped;
-                            }
-                            if ((this->frame_width!=this->picture_width) || (this->frame_height!=this->picture_height)) {
-                                if (av_picture_pad((AVPicture *)output_padded,
-                                                 (AVPicture *)output_resized,
-                                                 this->frame_height, this->frame_width, this->pix_fmt,
-                                                 this->frame_y_offset, this->frame_y_offset,
-                                                 this->frame_x_offset, this->frame_x_offset,
-                                                 padcolor ) < 0 ) {
-                                    av_log(NULL, AV_LOG_ERROR, "error padding frame\n");
-                                }
-                            } else {
-                                output_padded = output_resized;
+                            else if (!drop) {
+                                output_tmp = pipeline_get_frame(pipe);
+                                av_frame_move_ref(output_tmp, frame);
                             }
                         }
-                        avpkt.size -= len1;
-                        avpkt.data += len1;
+                        consume_packet(&avpkt, len1);
                     }
-                    //now output_resized
-
-                    if (!first) {
-                        if (got_frame || video_eos) {
-                            prepare_ycbcr_buffer(this, ycbcr, output_buffered);
-                            if(dups>0) {
-                                //this only works if dups < keyint,
-                                //see http://theora.org/doc/libtheora-1.1/theoraenc_8h.html#a8bb9b05471c42a09f8684a2583b8a1df
-                                if (th_encode_ctl(info.td,TH_ENCCTL_SET_DUP_COUNT,&dups,sizeof(int)) == TH_EINVAL) {
-                                    int _dups = dups;
-                                    while(_dups--)
-                                        oggmux_add_video(&info, ycbcr, video_eos);
+                    else {
+                        got_frame = 0;
+                    }
+                    if (drop) {
+                        continue;
+                    }
+                    if (vf && video_eos && !got_frame)
+                        videofilter_add_frame(vf, NULL);
+
+                    /* The filters may hold frames back or give several
+                       pictures for a frame, bob and fps do, every picture
+                       out of them is handled like a decoded one. */
+                    for (;;) {
+                        int got_picture = got_frame;
+                        int drained;
+
+                        if (vf && (got_picture = videofilter_get_frame(vf, frame))) {
+                            output_tmp = pipeline_get_frame(pipe);
+                            av_frame_move_ref(output_tmp, frame);
+                        }
+                        drained = video_eos && !got_frame;
+
+                        /* The buffered frame is encoded once the next one is
+                           known, so dups apply to it. At the end of the stream it
+                           is only the last frame once the decoder is drained. */
+                        if (!first) {
+                            if (got_picture || drained) {
+                                this->frame_count += dups+1;
+                                videotime = this->frame_count / av_q2d(this->framerate);
+                                pipeline_encode_video(pipe, dups, drained && !got_picture, videotime);
+                                if (drained && !got_picture) {
+                                    video_done = 1;
                                 }
                             }
-                            oggmux_add_video(&info, ycbcr, video_eos);
-                            if(video_eos) {
-                                video_done = 1;
-                            }
-                            this->frame_count += dups+1;
-                            if (info.passno == 1)
-                                info.videotime = this->frame_count / av_q2d(this->framerate);
                         }
-                    }
-                    if (got_frame) {
-                        first=0;
-                        av_picture_copy((AVPicture *)output_buffered, (AVPicture *)output_padded, this->pix_fmt, this->frame_width, this->frame_height);
+                        if (got_picture) {
+                            first=0;
+                            dups = 0;
+                            pipeline_add_frame(pipe, output_tmp);
+                        }
+                        if (!vf || !got_picture) {
+                            break;
+                        }
                     }
                     if (!got_frame) {
                         break;
                     }
                 }
             }
-            if (info.passno!=1)
-              if ((audio_eos && !audio_done) || (ret >= 0 && pkt.stream_index == this->audio_index)) {
-                while((audio_eos && !audio_done) || avpkt.size > 0 ) {
-                    int bytes_per_sample = av_get_bytes_per_sample(aenc->sample_fmt);
-
-                    if (avpkt.size > 0) {
-                        if (!audio_frame && !(audio_frame = avcodec_alloc_frame())) {
-                            fprintf(stderr, "Failed to allocate memory\n");
-                            exit(1);
-                        }
-                        len1 = avcodec_decode_audio4(astream->codec, audio_frame, &got_frame, &avpkt);
-                        if (len1 < 0) {
-                            /* if error, we skip the frame */
+            for (i = 0; i < n_audio; i++) {
+              ff2theora_audio_stream *as = &audio[i];
+              if (!as->done && (as->eos || (ret >= 0 && pkt.stream_index == as->stream_index))) {
+                /* the samples of the stream until the end time */
+                int end_samples = as->sample_rate * (this->end_time - this->start_time);
+                while(!as->done && (as->eos || avpkt.size > 0)) {
+                    /* reused for every packet, the decoder keeps the samples
+                       in its own buffer until the next call */
+                    if (!audio_frame && !(audio_frame = avcodec_alloc_frame())) {
+                        fprintf(stderr, "Failed to allocate memory\n");
+                        exit(1);
+                    }
+                    len1 = decode_frame(this, as->stream_index, audio_frame, &got_frame, &avpkt);
+                    if (len1 < 0) {
+                        /* if error, we skip the frame */
+                        if (!as->eos)
                             break;
-                        }
+                        got_frame = 0;
+                    }
+                    else {
                         /* Some audio decoders decode only part of the packet, and have to be
                          * called again with the remainder of the packet data.
                          * Sample: http://fate-suite.libav.org/lossless-audio/luckynight-partial.shn
@@ -1582,51 +1835,55 @@ void ff2theora_output(ff2theora this) {
                         len1 = FFMIN(len1, avpkt.size);
                         if (got_frame) {
                             dst_nb_samples = audio_frame->nb_samples;
-                            if (swr_ctx) {
-                                dst_nb_samples = av_rescale_rnd(audio_frame->nb_samples,
-                                    this->sample_rate, aenc->sample_rate, AV_ROUND_UP);
-                                if (dst_nb_samples > max_dst_nb_samples) {
-                                    av_free(dst_audio_data[0]);
-                                    if (av_samples_alloc(dst_audio_data, &dst_linesize, this->channels,
-                                                           dst_nb_samples, AV_SAMPLE_FMT_FLTP, 1) < 0) {
-                                        fprintf(stderr, "Error while converting audio\n");
-                                        exit(1);
-                                    }
-                                    max_dst_nb_samples = dst_nb_samples;
-                                }
-                                if (swr_convert(swr_ctx, dst_audio_data, dst_nb_samples,
-                                    (const uint8_t**)audio_frame->extended_data, audio_frame->nb_samples) < 0) {
+                            if (as->swr_ctx) {
+                                /* convert straight into the buffer the samples are encoded
+                                   from, with room for what the resampler still holds */
+                                dst_nb_samples = av_rescale_rnd(swr_get_delay(as->swr_ctx, as->enc->sample_rate) +
+                                    audio_frame->nb_samples, as->sample_rate, as->enc->sample_rate, AV_ROUND_UP);
+                                dst_nb_samples = swr_convert(as->swr_ctx, pipeline_get_audio(pipe, i, dst_nb_samples),
+                                    dst_nb_samples, (const uint8_t**)audio_frame->extended_data,
+                                    audio_frame->nb_samples);
+                                if (dst_nb_samples < 0) {
                                     fprintf(stderr, "Error while converting audio\n");
                                     exit(1);
                                 }
-                                audio_p = dst_audio_data;
-                            } else {
-                                audio_p = audio_frame->extended_data;
                             }
                         }
-                        avpkt.size -= len1;
-                        avpkt.data += len1;
+                        consume_packet(&avpkt, len1);
                     }
-                    if(got_frame || audio_eos) {
-                        if (no_samples > 0 && this->sample_count + dst_nb_samples > no_samples) {
-                            audio_eos = 1;
-                            dst_nb_samples = no_samples - this->sample_count;
-                            if (dst_nb_samples <= 0) {
-                                break;
-                            }
+                    if (got_frame) {
+                        int e_o_s = 0;
+                        if (end_samples > 0 && as->sample_count + dst_nb_samples >= end_samples) {
+                            dst_nb_samples = end_samples - as->sample_count;
+                            as->eos = e_o_s = 1;
                         }
-                        oggmux_add_audio(&info, audio_p, dst_nb_samples, audio_eos);
-                        avcodec_free_frame(&audio_frame);
-                        this->sample_count += dst_nb_samples;
+                        if (as->swr_ctx)
+                            pipeline_wrote_audio(pipe, i, dst_nb_samples, e_o_s);
+                        else
+                            pipeline_add_audio(pipe, i, audio_frame->extended_data, dst_nb_samples, e_o_s);
+                        if (dst_nb_samples > 0)
+                            as->sample_count += dst_nb_samples;
+                        if (e_o_s)
+                            as->done = 1;
                     }
-                    if(audio_eos) {
-                        audio_done = 1;
+                    else if (as->eos) {
+                        /* the decoder has no more delayed frames */
+                        pipeline_add_audio(pipe, i, NULL, 0, 1);
+                        as->done = 1;
                     }
-
-                    if (audio_eos && avpkt.size <= 0) {
+                    else if (len1 == 0) {
                         break;
                     }
                 }
+              }
+            }
+            /* the audio is done, or at its end, once every stream is */
+            if (n_audio > 0) {
+                audio_eos = audio_done = 1;
+                for (i = 0; i < n_audio; i++) {
+                    audio_eos &= audio[i].eos;
+                    audio_done &= audio[i].done;
+                }
             }
 
             if (info.passno!=1)
@@ -1772,11 +2029,17 @@ void ff2theora_output(ff2theora this) {
             }
 
             /* flush out the file */
-            oggmux_flush (&info, video_eos + audio_eos);
+            pipeline_flush (pipe, video_eos + audio_eos);
 
             av_free_packet (&pkt);
         } while (ret >= 0 && !(audio_done && video_done));
 
+        pipeline_finish(pipe);
+        if (info.passno == 2 && this->twopass_frames) {
+            frame_cache_close(this->twopass_frames);
+            this->twopass_frames = NULL;
+        }
+
         if (info.passno != 1) {
 #ifdef HAVE_KATE
           for (i=0; i<this->n_kate_streams; ++i) {
@@ -1800,12 +2063,12 @@ void ff2theora_output(ff2theora this) {
         }
 
         if (this->video_index >= 0) {
-            avcodec_close(venc);
+            close_decoder(venc);
         }
-        if (this->audio_index >= 0) {
-            if (swr_ctx)
-                swr_free(&swr_ctx);
-            avcodec_close(aenc);
+        for (i = 0; i < n_audio; i++) {
+            if (audio[i].swr_ctx)
+                swr_free(&audio[i].swr_ctx);
+            close_decoder(audio[i].enc);
         }
 
         /* Write the index out to disk. */
@@ -1814,39 +2077,33 @@ void ff2theora_output(ff2theora this) {
         }
 
         oggmux_close(&info);
-        if (ppContext)
-            pp_free_context(ppContext);
-        if (!info.audio_only) {
-            av_free(frame_p);
-            frame_dealloc(output_p);
-            frame_dealloc(output_tmp_p);
-            frame_dealloc(output_resized_p);
-            frame_dealloc(output_buffered_p);
-            frame_dealloc(output_cropped_p);
-            frame_dealloc(output_padded_p);
-        }
-        if (dst_audio_data)
-            av_freep(&dst_audio_data[0]);
-        av_freep(&dst_audio_data);
-        if(swr_ctx) {
-            swr_close(swr_ctx);
-        }
+        video_preprocess_close(&vp);
+        if (vf)
+            videofilter_close(vf);
+        av_frame_free(&frame);
+        av_frame_free(&audio_frame);
     }
     else{
         fprintf(stderr, "No video or audio stream found.\n");
     }
+    free(audio);
 }
 
 void ff2theora_close(ff2theora this) {
     sws_freeContext(this->sws_colorspace_ctx);
     sws_freeContext(this->sws_scale_ctx);
+    sws_freeContext(this->sws_fused_ctx);
+    color_lut_free(&this->y_lut);
+    color_lut_free(&this->uv_lut);
     this->sws_colorspace_ctx = NULL;
     this->sws_scale_ctx = NULL;
+    this->sws_fused_ctx = NULL;
     /* clear out state */
     if (info.passno != 1)
       free_subtitles(this);
     this->context = NULL;
     if (info.twopass != 3) {
+        free(this->audiostreams);
         av_free(this);
     }
 }
@@ -1953,6 +2210,70 @@ static int get_resize_method_by_name(const char *name)
   return -1;
 }
 
+static const struct {
+  const char *name;
+  int preset;
+} presets[] = {
+  { "pro", V2V_PRESET_PRO },
+  { "preview", V2V_PRESET_PREVIEW },
+  { "videobin", V2V_PRESET_VIDEOBIN },
+  { "padma", V2V_PRESET_PADMA },
+  { "padma-stream", V2V_PRESET_PADMASTREAM },
+};
+
+static int get_preset_by_name(const char *name)
+{
+  int n;
+  for (n=0; n<sizeof(presets)/sizeof(presets[0]); ++n) {
+    if (!strcmp(presets[n].name, name))
+      return presets[n].preset;
+  }
+  return V2V_PRESET_NONE;
+}
+
+/* Sets what -p does, the sizes are worked out in ff2theora_output.
+   Returns 0 for V2V_PRESET_NONE. */
+static int set_preset(ff2theora this, int preset)
+{
+    switch (preset) {
+        case V2V_PRESET_PRO:
+            //need a way to set resize here. and not later
+            this->video_quality = rint(8*6.3);
+            this->audio_quality = 3.00;
+            break;
+        case V2V_PRESET_PREVIEW:
+            //need a way to set resize here. and not later
+            this->video_quality = rint(6*6.3);
+            this->audio_quality = 1.00;
+            break;
+        case V2V_PRESET_VIDEOBIN:
+            this->video_bitrate=rint(600*1000);
+            this->soft_target = 1;
+            this->video_quality = 3;
+            this->audio_quality = 3.00;
+            break;
+        case V2V_PRESET_PADMA:
+            this->video_quality = rint(6*6.3);
+            this->audio_quality = 3.00;
+            this->channels = 2;
+            break;
+        case V2V_PRESET_PADMASTREAM:
+            this->video_bitrate=rint(180*1000);
+            this->soft_target = 1;
+            this->video_quality = 0;
+            this->audio_quality = -1.00;
+            this->sample_rate=44100;
+            this->channels = 1;
+            this->keyint = 16;
+            break;
+        default:
+            return 0;
+    }
+    this->preset = preset;
+    info.speed_level = 0;
+    return 1;
+}
+
 static void print_resize_help(void)
 {
   int n;
@@ -2032,6 +2353,162 @@ void print_presets_info() {
         );
 }
 
+/* Growing an adaptive index moves what has been written so far, so the
+   output is opened for reading as well if it can be. */
+static FILE *open_output(const char *name, int adaptive_index) {
+    FILE *outfile = NULL;
+
+    if (adaptive_index)
+        outfile = fopen(name, "w+b");
+    if (!outfile)
+        outfile = fopen(name, "wb");
+    return outfile;
+}
+
+/* Makes the decoder calls ff2theora_output makes for a packet, or for the
+   empty ones at the end of the input, and passes on what they give. */
+static void decode_batch_packet(ff2theora this, batch *b, int stream_index,
+                                AVFrame *frame, AVPacket *avpkt, int eos) {
+    int video = stream_index == this->video_index;
+    int len1, got_frame;
+
+    do {
+        len1 = decode_frame(this, stream_index, frame, &got_frame, avpkt);
+        if (len1 < 0)
+            got_frame = 0;
+        batch_write_frame(b, stream_index, len1, got_frame, frame);
+        if (len1 < 0) {
+            if (!eos)
+                break;
+        }
+        else {
+            if (!video)
+                len1 = FFMIN(len1, avpkt->size);
+            consume_packet(avpkt, len1);
+        }
+    } while (eos ? got_frame : avpkt->size > 0 && (got_frame || (!video && len1 > 0)));
+}
+
+/* Reads and decodes the input for the outputs of a batch. The decoders get
+   the same packets in the same order as in ff2theora_output, the outputs
+   take what they give up to where they are done with a packet, so each of
+   them gets exactly what decoding the input on its own would give. */
+static void decode_batch_input(ff2theora this, batch *b) {
+    ff2theora_audio_stream *audio;
+    AVFrame *frame;
+    AVPacket pkt, avpkt;
+    int synced = this->start_time == 0.0;
+    int n_audio, i, ret, len1, got_frame;
+
+    audio = calloc(this->context->nb_streams + 1, sizeof(*audio));
+    frame = av_frame_alloc();
+    if (!audio || !frame) {
+        fprintf(stderr, "Failed to allocate memory\n");
+        exit(1);
+    }
+    n_audio = select_input_streams(this, audio, 0);
+    if (this->video_index >= 0 &&
+        open_decoder(this, this->context->streams[this->video_index]->codec) < 0)
+        this->video_index = -1;
+    for (i = 0; i < n_audio; i++) {
+        audio[i].enc = this->context->streams[audio[i].stream_index]->codec;
+        if (open_decoder(this, audio[i].enc) < 0) {
+            memmove(audio+i, audio+i+1, (n_audio-i-1)*sizeof(*audio));
+            --n_audio;
+            --i;
+        }
+    }
+
+    if (this->start_time) {
+        int64_t timestamp = this->start_time * AV_TIME_BASE;
+        if (this->context->start_time != AV_NOPTS_VALUE)
+            timestamp += this->context->start_time;
+        av_seek_frame(this->context, -1, timestamp, AVSEEK_FLAG_BACKWARD);
+    }
+
+    av_init_packet(&avpkt);
+    if (this->video_index >= 0 || n_audio > 0) do {
+        ret = av_read_frame(this->context, &pkt);
+        /* subtitles are decoded by the outputs, they are cheap */
+        if (!batch_write_packet(b, &pkt, ret, ret >= 0 &&
+                this->context->streams[pkt.stream_index]->codec->codec_type == AVMEDIA_TYPE_SUBTITLE)) {
+            av_free_packet(&pkt);
+            break;
+        }
+        avpkt.size = pkt.size;
+        avpkt.data = pkt.data;
+
+        if (ret < 0) {
+            /* drain the decoders, all with the same empty packet */
+            avpkt.data = NULL;
+            avpkt.size = 0;
+            if (this->video_index >= 0)
+                decode_batch_packet(this, b, this->video_index, frame, &avpkt, 1);
+            for (i = 0; i < n_audio; i++)
+                decode_batch_packet(this, b, audio[i].stream_index, frame, &avpkt, 1);
+        }
+        else {
+            if (!synced) {
+                AVStream *stream=this->context->streams[pkt.stream_index];
+                double t = pkt.pts * av_q2d(stream->time_base) - this->start_time;
+                synced = (t >= 0);
+            }
+            if (!synced) {
+                /* only the video is decoded before the start time */
+                if (pkt.stream_index == this->video_index) {
+                    len1 = decode_frame(this, this->video_index, frame, &got_frame, &pkt);
+                    batch_write_frame(b, this->video_index, len1, got_frame, frame);
+                }
+            }
+            else if (pkt.stream_index == this->video_index) {
+                decode_batch_packet(this, b, this->video_index, frame, &avpkt, 0);
+            }
+            else {
+                for (i = 0; i < n_audio; i++) {
+                    if (pkt.stream_index == audio[i].stream_index)
+                        decode_batch_packet(this, b, audio[i].stream_index, frame, &avpkt, 0);
+                }
+            }
+        }
+        av_free_packet(&pkt);
+    } while (ret >= 0);
+
+    if (this->video_index >= 0)
+        close_decoder(this->context->streams[this->video_index]->codec);
+    for (i = 0; i < n_audio; i++)
+        close_decoder(audio[i].enc);
+    av_frame_free(&frame);
+    free(audio);
+}
+
+/* Encodes every output of --batch in a process of its own, from what this
+   one decodes. Returns the number of outputs that failed. */
+static int ff2theora_batch(ff2theora this, const batch_output *outputs, int n) {
+    batch *b;
+    int output;
+
+    b = batch_fork(n, &output);
+    if (output >= 0) {
+        /* like -p preset -o filename after all the other options */
+        set_preset(this, outputs[output].preset);
+        this->batch = b;
+        /* the progress of one of them is enough */
+        info.no_stats = output > 0;
+        info.outfile = open_output(outputs[output].filename, info.adaptive_index);
+        if (!info.outfile) {
+            if (info.frontend)
+                fprintf(info.frontend, "{\"code\": \"badfile\", \"error\":\"Unable to open output file.\"}\n");
+            else
+                fprintf(stderr,"\nUnable to open output file `%s'.\n", outputs[output].filename);
+            exit(1);
+        }
+        ff2theora_output(this);
+        exit(0);
+    }
+    decode_batch_input(this, b);
+    return batch_finish(b);
+}
+
 void print_usage() {
     th_info ti;
     th_enc_ctx *td;
@@ -2064,6 +2541,19 @@ void print_usage() {
         "\n"
         "General output options:\n"
         "  -o, --output           alternative output filename\n"
+        "      --output-buffer n  collect n kB of pages before writing them\n"
+        "                         out (default: 1024)\n"
+        "      --page-policy p    how audio and video are cut into pages:\n"
+        "                          default, latency for small pages as soon\n"
+        "                          as there is data, seek for a page at every\n"
+        "                          keyframe or throughput for full 64 kB pages\n"
+        "      --page-stats       print the page count and header overhead\n"
+        "                          of every stream when done\n"
+        "      --live             stream live: never seek, write pages as soon\n"
+        "                          as they can go and show the delay from input\n"
+        "                          to output\n"
+        "      --max-delay ms     with --live, the longest a page waits for the\n"
+        "                          other streams (default: 500)\n"
         "      --no-skeleton      disables ogg skeleton metadata output\n"
         "      --skeleton-3       outputs Skeleton Version 3, without keyframe indexes\n"
         "  -s, --starttime        start encoding at this time (in sec.)\n"
@@ -2071,6 +2561,9 @@ void print_usage() {
         "  -p, --preset           encode file with preset.\n"
         "                          Right now there is preview, pro and videobin. Run\n"
         "                          '"PACKAGE" -p info' for more informations\n"
+        "      --batch preset:file  encode the input with preset to file, can be\n"
+        "                          given several times to encode all of them at\n"
+        "                          once from a single decode of the input\n"
         "\n"
         "Video output options:\n"
         "  -v, --videoquality     [0 to 10] encoding quality for video (default: 6)\n"
@@ -2086,6 +2579,10 @@ void print_usage() {
         "                         This option requires that the input to the\n"
         "                         to the encoder is seekable and performs\n"
         "                         both passes automatically.\n\n"
+        "      --two-pass-cache   With --two-pass, decode the input only once\n"
+        "                         and keep the preprocessed frames for the\n"
+        "                         second pass. Needs as much temporary disk\n"
+        "                         space as the uncompressed video.\n\n"
         "      --first-pass <filename> Perform first-pass of a two-pass rate\n"
         "                         controlled encoding, saving pass data to\n"
         "                         <filename> for a later second pass\n\n"
@@ -2113,6 +2610,8 @@ void print_usage() {
         "      --croptop, --cropbottom, --cropleft, --cropright\n"
         "                         crop input by given pixels before resizing\n"
         "  -K, --keyint           [1 to 2147483647] keyframe interval (default: 64)\n"
+        "      --segments n       encode the video in keyframe interval long\n"
+        "                         segments on n threads at once\n"
         "  -d --buf-delay <n>     Buffer delay (in frames). Longer delays\n"
         "                         allow smoother rate adaptation and provide\n"
         "                         better overall quality, but require more\n"
@@ -2130,6 +2629,8 @@ void print_usage() {
         "Video transfer options:\n"
         "  --pp                   Video Postprocessing, denoise, deblock, deinterlacer\n"
             "                          use --pp help for a list of available filters.\n"
+        "      --vf filters       libavfilter filters for the video, run after\n"
+        "                          deinterlacing and --pp, e.g. hqdn3d,unsharp\n"
         "  -C, --contrast         [0.1 to 10.0] contrast correction (default: 1.0)\n"
             "                          Note: lower values make the video darker.\n"
         "  -B, --brightness       [-1.0 to 1.0] brightness correction (default: 0.0)\n"
@@ -2152,6 +2653,9 @@ void print_usage() {
         "      --deinterlace      force deinterlace, otherwise only material\n"
         "                          marked as interlaced will be deinterlaced\n"
         "      --no-deinterlace   force deinterlace off\n"
+        "      --deinterlacer m   fast: 5 tap line filter (default),\n"
+        "                         yadif: motion adaptive, bob: yadif giving\n"
+        "                          one frame per field, at twice the frame rate\n"
 #ifdef HAVE_FRAMEHOOK
         "      --vhook            you can use ffmpeg's vhook system, example:\n"
         "        ffmpeg2theora --vhook '/path/watermark.so -f wm.gif' input.dv\n"
@@ -2159,11 +2663,18 @@ void print_usage() {
         "  -f, --format           specify input format\n"
         "      --inputfps fps     override input fps\n"
         "      --audiostream id   by default the first audio stream is selected,\n"
-        "                          use this to select another audio stream\n"
+        "                          use this to select another audio stream,\n"
+        "                          several as a list like 1,2 or all of them\n"
+        "                          with all, each is encoded to its own stream\n"
         "      --videostream id   by default the first video stream is selected,\n"
         "                          use this to select another video stream\n"
         "      --nosync           do not use A/V sync from input container.\n"
         "                         try this if you have issues with A/V sync\n"
+        "      --decode-threads n use n threads to decode, scale and resample\n"
+        "                         the input\n"
+        "                         (default: number of cores)\n"
+        "      --probe-cache dir  keep what was found out about local input\n"
+        "                         files in dir, to start faster on later runs\n"
 #ifdef HAVE_KATE
         "Subtitles options:\n"
         "      --subtitles file                 use subtitles from the given file (SubRip (.srt) format)\n"
@@ -2200,11 +2711,16 @@ void print_usage() {
         "      --theora-index-reserve <n>   reserve <n> bytes for theora keyframe index\n"
         "      --vorbis-index-reserve <n>   reserve <n> bytes for vorbis keyframe index\n"
         "      --kate-index-reserve <n>     reserve <n> bytes for kate keyframe index\n"
+        "      --adaptive-index             grow the index reserve to fit all keyframes\n"
+        "                                   once encoding is done, also indexes input\n"
+        "                                   of unknown duration like stdin\n"
         "\n"
         "Other options:\n"
 #ifndef _WIN32
         "      --nice n           set niceness to n\n"
 #endif
+        "      --no-pipeline      decode, filter, encode and write on a single\n"
+        "                         thread instead of one thread per stage\n"
         "  -P, --pid fname        write the process' id to a file\n"
         "  -h, --help             this message\n"
         "      --info             output json info about input file, use -o to save json to file\n"
@@ -2222,7 +2738,7 @@ void print_usage() {
         "    ffmpeg2theora frame%%06d.png -o output.ogv\n"
         "\n"
         "  Live streaming from V4L Device:\n"
-        "    ffmpeg2theora --no-skeleton /dev/video0 -f video4linux \\\n"
+        "    ffmpeg2theora --live /dev/video0 -f video4linux \\\n"
         "                  --inputfps 15 -x 160 -y 128 -o - \\\n"
         "                  | oggfwd icast2server 8000 password /theora.ogv\n"
         "\n"
@@ -2247,6 +2763,11 @@ int main(int argc, char **argv) {
     char inputfile_name[1024];
     char *str_ptr;
     int output_json = 0;
+    const char *probe_cache_dir = NULL;
+    probe_cache *probe = NULL;
+    batch_output batch_outputs[BATCH_MAX_OUTPUTS];
+    int n_batch_outputs = 0;
+    char probe_hash[32] = "";
     int output_filename_needs_building=0;
 
     static int flag = -1;
@@ -2267,6 +2788,7 @@ int main(int argc, char **argv) {
         {"theora-index-reserve",required_argument,&flag,THEORA_INDEX_RESERVE},
         {"vorbis-index-reserve",required_argument,&flag,VORBIS_INDEX_RESERVE},
         {"kate-index-reserve",required_argument,&flag,KATE_INDEX_RESERVE},
+        {"adaptive-index",no_argument,&flag,ADAPTIVE_INDEX_FLAG},
         {"format",required_argument,NULL,'f'},
         {"width",required_argument,NULL,'x'},
         {"height",required_argument,NULL,'y'},
@@ -2277,13 +2799,17 @@ int main(int argc, char **argv) {
         {"audiobitrate",required_argument,NULL,'A'},
         {"soft-target",0,&flag,SOFTTARGET_FLAG},
         {"two-pass",0,&flag,TWOPASS_FLAG},
+        {"two-pass-cache",0,&flag,TWOPASS_CACHE_FLAG},
         {"first-pass",required_argument,&flag,FIRSTPASS_FLAG},
         {"second-pass",required_argument,&flag,SECONDPASS_FLAG},
         {"keyint",required_argument,NULL,'K'},
+        {"segments",required_argument,&flag,SEGMENTS_FLAG},
         {"buf-delay",required_argument,NULL,'d'},
         {"deinterlace",0,&flag,DEINTERLACE_FLAG},
         {"no-deinterlace",0,&flag,NODEINTERLACE_FLAG},
+        {"deinterlacer",required_argument,&flag,DEINTERLACER_FLAG},
         {"pp",required_argument,&flag,PP_FLAG},
+        {"vf",required_argument,&flag,VF_FLAG},
         {"resize-method",required_argument,&flag,RESIZE_METHOD_FLAG},
         {"samplerate",required_argument,NULL,'H'},
         {"channels",required_argument,NULL,'c'},
@@ -2327,6 +2853,15 @@ int main(int argc, char **argv) {
         {"frontend",0,&flag,FRONTEND_FLAG},
         {"frontendfile",required_argument,&flag,FRONTENDFILE_FLAG},
         {"info",no_argument,&flag,INFO_FLAG},
+        {"no-pipeline",no_argument,&flag,NOPIPELINE_FLAG},
+        {"decode-threads",required_argument,&flag,DECODE_THREADS_FLAG},
+        {"output-buffer",required_argument,&flag,OUTPUT_BUFFER_FLAG},
+        {"page-policy",required_argument,&flag,PAGE_POLICY_FLAG},
+        {"page-stats",0,&flag,PAGE_STATS_FLAG},
+        {"live",0,&flag,LIVE_FLAG},
+        {"max-delay",required_argument,&flag,MAX_DELAY_FLAG},
+        {"probe-cache",required_argument,&flag,PROBE_CACHE_FLAG},
+        {"batch",required_argument,&flag,BATCH_FLAG},
         {"artist",required_argument,&metadata_flag,0},
         {"title",required_argument,&metadata_flag,1},
         {"date",required_argument,&metadata_flag,2},
@@ -2342,7 +2877,6 @@ int main(int argc, char **argv) {
     };
 
     char pidfile_name[255] = { '\0' };
-    char _tmp_2pass[1024] = { '\0' };
 
     FILE *fpid = NULL;
 
@@ -2350,6 +2884,7 @@ int main(int argc, char **argv) {
     avcodec_register_all();
     avdevice_register_all();
     av_register_all();
+    avfilter_register_all();
 
     if (argc == 1) {
         print_usage();
@@ -2374,29 +2909,30 @@ int main(int argc, char **argv) {
                             convert->deinterlace = -1;
                             flag = -1;
                             break;
+                        case DEINTERLACER_FLAG:
+                            if (!strcmp(optarg, "fast")) {
+                                convert->deinterlacer = DEINTERLACER_FAST;
+                            } else if (!strcmp(optarg, "yadif")) {
+                                convert->deinterlacer = DEINTERLACER_YADIF;
+                            } else if (!strcmp(optarg, "bob")) {
+                                convert->deinterlacer = DEINTERLACER_BOB;
+                            } else {
+                                fprintf(stderr, "Unknown deinterlacer %s, use fast, yadif or bob.\n", optarg);
+                                exit(1);
+                            }
+                            flag = -1;
+                            break;
                         case SOFTTARGET_FLAG:
                             convert->soft_target = 1;
                             flag = -1;
                             break;
                         case TWOPASS_FLAG:
+                            /* the pass data is kept in memory */
                             info.twopass = 3;
-#ifdef WIN32
-                            {
-                              char *tmp;
-                              srand (time (NULL));
-                              tmp = getenv("TEMP");
-                              if (!tmp) tmp = getenv("TMP");
-                              if (!tmp) tmp = ".";
-                              snprintf(_tmp_2pass, sizeof(_tmp_2pass), "%s\\f2t_%06d.log", tmp, rand());
-                              info.twopass_file = fopen(_tmp_2pass,"wb+");
-                            }
-#else
-                            info.twopass_file = tmpfile();
-#endif
-                            if(!info.twopass_file){
-                                fprintf(stderr,"Unable to open temporary file for twopass data\n");
-                                exit(1);
-                            }
+                            flag = -1;
+                            break;
+                        case TWOPASS_CACHE_FLAG:
+                            convert->twopass_cache = 1;
                             flag = -1;
                             break;
                         case FIRSTPASS_FLAG:
@@ -2425,6 +2961,10 @@ int main(int argc, char **argv) {
                             snprintf(convert->pp_mode,sizeof(convert->pp_mode),"%s",optarg);
                             flag = -1;
                             break;
+                        case VF_FLAG:
+                            convert->video_filters = optarg;
+                            flag = -1;
+                            break;
                         case RESIZE_METHOD_FLAG:
                             if (!strcmp(optarg, "help")) {
                                 print_resize_help();
@@ -2550,7 +3090,22 @@ int main(int argc, char **argv) {
                             flag = -1;
                             break;
                         case AUDIOSTREAM_FLAG:
-                            convert->audiostream = atoi(optarg);
+                            if (!strcmp(optarg, "all")) {
+                                convert->all_audiostreams = 1;
+                            }
+                            else {
+                                char *p = optarg;
+                                do {
+                                    int *tmp = realloc(convert->audiostreams,
+                                                       (convert->n_audiostreams + 1) * sizeof(int));
+                                    if (!tmp) {
+                                        fprintf(stderr, "Failed to allocate memory\n");
+                                        exit(1);
+                                    }
+                                    convert->audiostreams = tmp;
+                                    convert->audiostreams[convert->n_audiostreams++] = strtol(p, &p, 10);
+                                } while (*p++ == ',');
+                            }
                             flag = -1;
                             break;
                         case VIDEOSTREAM_FLAG:
@@ -2579,9 +3134,101 @@ int main(int argc, char **argv) {
                             info.kate_index_reserve = atoi(optarg);
                             flag = -1;
                             break;
+                        case ADAPTIVE_INDEX_FLAG:
+                            info.adaptive_index = 1;
+                            flag = -1;
+                            break;
                         case INFO_FLAG:
                             output_json = 1;
                             break;
+                        case NOPIPELINE_FLAG:
+                            convert->pipeline = 0;
+                            flag = -1;
+                            break;
+                        case SEGMENTS_FLAG:
+                            convert->segments = atoi(optarg);
+                            if (convert->segments < 1) {
+                                fprintf(stderr, "Only positive values are valid for segments.\n");
+                                exit(1);
+                            }
+                            flag = -1;
+                            break;
+                        case PROBE_CACHE_FLAG:
+                            probe_cache_dir = optarg;
+                            flag = -1;
+                            break;
+                        case BATCH_FLAG:
+                            {
+                                batch_output *out = &batch_outputs[n_batch_outputs];
+                                const char *sep = strchr(optarg, ':');
+                                if (n_batch_outputs == BATCH_MAX_OUTPUTS) {
+                                    fprintf(stderr, "ERROR: no more than %d --batch outputs can be given\n", BATCH_MAX_OUTPUTS);
+                                    exit(1);
+                                }
+                                if (!sep || !sep[1]) {
+                                    fprintf(stderr, "ERROR: --batch takes a preset and an output file, like padma:output.ogv\n");
+                                    exit(1);
+                                }
+                                av_strlcpy(out->preset_name, optarg, FFMIN(sizeof(out->preset_name), sep - optarg + 1));
+                                out->preset = get_preset_by_name(out->preset_name);
+                                if (out->preset == V2V_PRESET_NONE) {
+                                    fprintf(stderr, "\nUnknown preset.\n\n");
+                                    print_presets_info();
+                                    exit(1);
+                                }
+                                out->filename = sep + 1;
+                                n_batch_outputs++;
+                            }
+                            flag = -1;
+                            break;
+                        case DECODE_THREADS_FLAG:
+                            convert->decode_threads = atoi(optarg);
+                            if (convert->decode_threads < 1) {
+                                fprintf(stderr, "Only positive values are valid for decode threads.\n");
+                                exit(1);
+                            }
+                            flag = -1;
+                            break;
+                        case OUTPUT_BUFFER_FLAG:
+                            n = atoi(optarg);
+                            if (n < 1 || n > 1024 * 1024) {
+                                fprintf(stderr, "The output buffer has to be between 1 kB and 1 GB.\n");
+                                exit(1);
+                            }
+                            info.output_buffer_size = n * 1024;
+                            flag = -1;
+                            break;
+                        case PAGE_POLICY_FLAG:
+                            if (!strcmp(optarg, "default")) {
+                                info.page_policy = PAGE_POLICY_DEFAULT;
+                            } else if (!strcmp(optarg, "latency")) {
+                                info.page_policy = PAGE_POLICY_LATENCY;
+                            } else if (!strcmp(optarg, "seek")) {
+                                info.page_policy = PAGE_POLICY_SEEK;
+                            } else if (!strcmp(optarg, "throughput")) {
+                                info.page_policy = PAGE_POLICY_THROUGHPUT;
+                            } else {
+                                fprintf(stderr, "Unknown page policy %s, use default, latency, seek or throughput.\n", optarg);
+                                exit(1);
+                            }
+                            flag = -1;
+                            break;
+                        case PAGE_STATS_FLAG:
+                            info.page_stats = 1;
+                            flag = -1;
+                            break;
+                        case LIVE_FLAG:
+                            info.live = 1;
+                            flag = -1;
+                            break;
+                        case MAX_DELAY_FLAG:
+                            info.max_delay = atoi(optarg);
+                            if (info.max_delay < 0) {
+                                fprintf(stderr, "The maximum delay can't be negative.\n");
+                                exit(1);
+                            }
+                            flag = -1;
+                            break;
 #ifdef HAVE_KATE
                         case SUBTITLES_FLAG:
                             set_subtitles_file(convert,optarg);
@@ -2743,47 +3390,7 @@ int main(int argc, char **argv) {
                     print_presets_info();
                     exit(1);
                 }
-                else if (!strcmp(optarg, "pro")) {
-                    //need a way to set resize here. and not later
-                    convert->preset=V2V_PRESET_PRO;
-                    convert->video_quality = rint(8*6.3);
-                    convert->audio_quality = 3.00;
-                    info.speed_level = 0;
-                }
-                else if (!strcmp(optarg,"preview")) {
-                    //need a way to set resize here. and not later
-                    convert->preset=V2V_PRESET_PREVIEW;
-                    convert->video_quality = rint(6*6.3);
-                    convert->audio_quality = 1.00;
-                    info.speed_level = 0;
-                }
-                else if (!strcmp(optarg,"videobin")) {
-                    convert->preset=V2V_PRESET_VIDEOBIN;
-                    convert->video_bitrate=rint(600*1000);
-                    convert->soft_target = 1;
-                    convert->video_quality = 3;
-                    convert->audio_quality = 3.00;
-                    info.speed_level = 0;
-                }
-                else if (!strcmp(optarg,"padma")) {
-                    convert->preset=V2V_PRESET_PADMA;
-                    convert->video_quality = rint(6*6.3);
-                    convert->audio_quality = 3.00;
-                    convert->channels = 2;
-                    info.speed_level = 0;
-                }
-                else if (!strcmp(optarg,"padma-stream")) {
-                    convert->preset=V2V_PRESET_PADMASTREAM;
-                    convert->video_bitrate=rint(180*1000);
-                    convert->soft_target = 1;
-                    convert->video_quality = 0;
-                    convert->audio_quality = -1.00;
-                    convert->sample_rate=44100;
-                    convert->channels = 1;
-                    convert->keyint = 16;
-                    info.speed_level = 0;
-                }
-                else{
+                else if (!set_preset(convert, get_preset_by_name(optarg))) {
                     fprintf(stderr, "\nUnknown preset.\n\n");
                     print_presets_info();
                     exit(1);
@@ -2810,6 +3417,17 @@ int main(int argc, char **argv) {
         exit(1);
     }
 
+    if (n_batch_outputs) {
+        if (outputfile_set || output_json) {
+            fprintf(stderr, "ERROR: --batch names its own output files, it can't be used with -o or --info\n");
+            exit(1);
+        }
+        if (info.twopass) {
+            fprintf(stderr, "ERROR: --batch can't be used with two-pass encoding\n");
+            exit(1);
+        }
+    }
+
     if (output_json && !outputfile_set) {
         snprintf(outputfile_name, sizeof(outputfile_name), "-");
         outputfile_set = 1;
@@ -2820,7 +3438,7 @@ int main(int argc, char **argv) {
         if (!strcmp(inputfile_name,"-")) {
             snprintf(inputfile_name,sizeof(inputfile_name),"pipe:");
         }
-        if (outputfile_set!=1) {
+        if (outputfile_set!=1 && !n_batch_outputs) {
             /* we'll create an output filename based on the input name, but not now, only
                when we know what types of streams we'll ouput, as the extension we'll add
                depends on these */
@@ -2840,7 +3458,7 @@ int main(int argc, char **argv) {
     using_stdin |= !strcmp(inputfile_name, "pipe:" ) ||
                    !strcmp( inputfile_name, "/dev/stdin" );
 
-    if (outputfile_set != 1) {
+    if (outputfile_set != 1 && !n_batch_outputs) {
         fprintf(stderr, "You have to specify an output file with -o output.ogv.\n");
         exit(1);
     }
@@ -2875,6 +3493,16 @@ int main(int argc, char **argv) {
         fprintf(stderr, "Buffer delay can only be used with target bitrate (-V).\n");
         exit(1);
     }
+    if (info.live) {
+        if (info.twopass) {
+            fprintf(stderr, "Two-pass encoding can't be used with --live.\n");
+            exit(1);
+        }
+        /* the keyframe indexes would have to be written back at the start */
+        info.skeleton_3 = 1;
+        if (info.page_policy == PAGE_POLICY_DEFAULT)
+            info.page_policy = PAGE_POLICY_LATENCY;
+    }
 
     if (*pidfile_name) {
         fpid = fopen(pidfile_name, "w");
@@ -2905,7 +3533,31 @@ int main(int argc, char **argv) {
         }
     }
     if (avformat_open_input(&convert->context, inputfile_name, input_fmt, &format_opts) >= 0) {
-        if (avformat_find_stream_info(convert->context, NULL) >= 0) {
+        int probed = 0;
+
+        /* the second pass starts from what the first one found */
+        if (!*probe_hash && (!convert->disable_oshash || probe_cache_dir)) {
+            unsigned long long oshash = gen_oshash(convert->context->pb);
+#ifdef WIN32
+            sprintf(probe_hash,"%016I64x", oshash);
+#else
+            sprintf(probe_hash,"%016qx", oshash);
+#endif
+            if (!oshash)
+                probe_cache_dir = NULL; /* not a file the cache can be keyed on */
+            if (probe_cache_dir)
+                probe = probe_cache_load(probe_cache_dir, probe_hash, inputfile_name);
+        }
+        if (probe && probe_cache_apply(probe, convert->context)) {
+            probed = 1;
+        } else if (avformat_find_stream_info(convert->context, NULL) >= 0) {
+            probe_cache_free(probe);
+            probe = probe_cache_create(convert->context);
+            if (probe_cache_dir)
+                probe_cache_save(probe, probe_cache_dir, probe_hash, inputfile_name);
+            probed = 1;
+        }
+        if (probed) {
 
                 if (output_filename_needs_building) {
                     int i;
@@ -2945,12 +3597,8 @@ int main(int argc, char **argv) {
                     }
                 }
 
-                if(!convert->disable_oshash) {
-#ifdef WIN32
-                    sprintf(info.oshash,"%016I64x", gen_oshash(inputfile_name));
-#else
-                    sprintf(info.oshash,"%016qx", gen_oshash(inputfile_name));
-#endif
+                if(!convert->disable_oshash && *probe_hash) {
+                    strcpy(info.oshash, probe_hash);
                 }
 #ifdef WIN32
                 if (!strcmp(outputfile_name,"-") || !strcmp(outputfile_name,"/dev/stdout")) {
@@ -2958,15 +3606,15 @@ int main(int argc, char **argv) {
                     info.outfile = stdout;
                 }
                 else {
-                    if(info.twopass!=1)
-                        info.outfile = fopen(outputfile_name,"wb");
+                    if(info.twopass!=1 && !n_batch_outputs)
+                        info.outfile = open_output(outputfile_name, info.adaptive_index);
                 }
 #else
                 if (!strcmp(outputfile_name,"-")) {
                     snprintf(outputfile_name,sizeof(outputfile_name),"/dev/stdout");
                 }
-                if(info.twopass!=1)
-                    info.outfile = fopen(outputfile_name,"wb");
+                if(info.twopass!=1 && !n_batch_outputs)
+                    info.outfile = open_output(outputfile_name, info.adaptive_index);
 #endif
                 if (output_json) {
                     if (using_stdin) {
@@ -3007,7 +3655,7 @@ int main(int argc, char **argv) {
 
                 convert->pts_offset = AV_NOPTS_VALUE;
 
-                if (info.twopass!=1 && !info.outfile) {
+                if (info.twopass!=1 && !n_batch_outputs && !info.outfile) {
                     if (info.frontend)
                         fprintf(info.frontend, "{\"code\": \"badfile\", \"error\":\"Unable to open output file.\"}\n");
                     else
@@ -3021,7 +3669,30 @@ int main(int argc, char **argv) {
                         info.duration = convert->end_time - convert->start_time;
                 }
 
-                ff2theora_output(convert);
+                if (n_batch_outputs) {
+                    int failed, i;
+                    if (!info.frontend) {
+                        for (i = 0; i < n_batch_outputs; i++)
+                            fprintf(stderr, "  Output #%d: %s with preset %s\n", i,
+                                    batch_outputs[i].filename, batch_outputs[i].preset_name);
+                    }
+                    failed = ff2theora_batch(convert, batch_outputs, n_batch_outputs);
+                    if (failed) {
+                        if (info.frontend)
+                            fprintf(info.frontend, "{\"code\": \"batch\", \"error\":\"%d of %d outputs failed.\"}\n",
+                                    failed, n_batch_outputs);
+                        else
+                            fprintf(stderr, "\n%d of %d outputs failed.\n", failed, n_batch_outputs);
+                        return(1);
+                    }
+                }
+                else {
+                    ff2theora_output(convert);
+                }
+
+                /* keep the keyframe index from reading the input for later seeks */
+                if (probe_cache_dir && probe_cache_update_index(probe, convert->context))
+                    probe_cache_save(probe, probe_cache_dir, probe_hash, inputfile_name);
         }
         else{
             if (info.frontend)
@@ -3053,6 +3724,8 @@ int main(int argc, char **argv) {
         unlink(pidfile_name);
     if (info.twopass_file)
         fclose(info.twopass_file);
+    oggmux_twopass_free(&info);
+    probe_cache_free(probe);
 
     if (info.frontend) {
         fprintf(info.frontend, "{\"result\": \"ok\"}\n");
@@ -3060,10 +3733,6 @@ int main(int argc, char **argv) {
     }
     if (info.frontend && info.frontend != stdout)
         fclose(info.frontend);
-#ifdef WIN32
-    if (info.twopass==3)
-        unlink(_tmp_2pass);
-#endif
     av_dict_free(&format_opts); 
     return(0);
 }
@@ -2,6 +2,9 @@
 #define _F2T_FFMPEG2THEORA_H_
 
 #include "subtitles.h"
+#include "lut.h"
+#include "framecache.h"
+#include "batch.h"
 
 typedef struct ff2theora_subtitle{
     char *text;
@@ -32,19 +35,40 @@ typedef struct ff2theora_kate_stream{
     char subtitles_category[16];
 } ff2theora_kate_stream;
 
+/* an input audio stream, encoded to a vorbis stream of its own */
+typedef struct ff2theora_audio_stream{
+    int stream_index;
+    AVCodecContext *enc;
+    struct SwrContext *swr_ctx; /* NULL if the decoded samples fit */
+    int sample_rate;
+    int channels;
+    int64_t sample_count; /* total audio samples output so far */
+    int eos;
+    int done;
+} ff2theora_audio_stream;
+
+/* ways to deinterlace, see --deinterlacer */
+#define DEINTERLACER_FAST  0
+#define DEINTERLACER_YADIF 1
+#define DEINTERLACER_BOB   2
+
 typedef struct ff2theora{
     AVFormatContext *context;
     int video_index;
-    int audio_index;
 
     int deinterlace;
+    int deinterlacer;
     int soft_target;
     int buf_delay;
     int vhook;
     int disable_video;
     int no_upscaling;
 
-    int audiostream;
+    /* --audiostream, the input streams to encode, all of them with
+       all_audiostreams or the first one if none is given */
+    int *audiostreams;
+    int n_audiostreams;
+    int all_audiostreams;
     int sample_rate;
     int channels;
     int disable_audio;
@@ -62,6 +86,7 @@ typedef struct ff2theora{
     double fps;
     struct SwsContext *sws_colorspace_ctx; /* for image resampling/resizing */
     struct SwsContext *sws_scale_ctx; /* for image resampling/resizing */
+    struct SwsContext *sws_fused_ctx; /* colorspace and resize in one pass */
     ogg_int32_t aspect_numerator;
     ogg_int32_t aspect_denominator;
     int colorspace;
@@ -75,6 +100,7 @@ typedef struct ff2theora{
     int video_bitrate;
     ogg_uint32_t keyint;
     char pp_mode[255];
+    char *video_filters; /* --vf, run after the deinterlacer and --pp */
     int resize_method;
 
     AVRational force_input_fps;
@@ -101,7 +127,6 @@ typedef struct ff2theora{
     int64_t pts_offset_frame; /* frame, which pts is used as pts_offset */
     int64_t pts_offset; /* base value for input pts */
     int64_t frame_count; /* total video frames output so far */
-    int64_t sample_count; /* total audio samples output so far */
 
     size_t n_kate_streams;
     ff2theora_kate_stream *kate_streams;
@@ -114,9 +139,21 @@ typedef struct ff2theora{
     double video_satur;
     int y_lut_used;
     int uv_lut_used;
-    unsigned char y_lut[256];
-    unsigned char uv_lut[256];
-
+    color_lut y_lut;
+    color_lut uv_lut;
+
+    /* run preprocessing, encoding and muxing on separate threads */
+    int pipeline;
+    /* threads used by the input decoders, 0 for one per core */
+    int decode_threads;
+    /* --two-pass decodes the input once and the second pass encodes
+       what the first pass left in twopass_frames */
+    int twopass_cache;
+    frame_cache *twopass_frames;
+    /* number of video segments encoded at once */
+    int segments;
+    /* set in an output of --batch, it takes the decoded input from there */
+    batch *batch;
 }
 *ff2theora;
 
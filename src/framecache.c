@@ -0,0 +1,161 @@
+/* -*- tab-width:4;c-file-style:"cc-mode"; -*- */
+/*
+ * framecache.c -- sequential store for the preprocessed input of a two-pass run
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with This program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "framecache.h"
+
+/* stdio buffer of the spill file, large writes bypass it anyway */
+#define FRAME_CACHE_FILE_BUFFER (1024 * 1024)
+
+struct frame_cache {
+    long long memory_limit;
+
+    /* in-memory part, FRAME_CACHE_BLOCK bytes per block */
+    char **blocks;
+    int blocks_count;
+    long long memory_size;
+
+    FILE *file;
+    char *file_buffer;
+    long long file_size;
+#ifdef WIN32
+    char file_name[1024];
+#endif
+
+    /* position of the next read once rewound */
+    long long read_pos;
+};
+
+static void *xrealloc(void *p, size_t size) {
+    p = realloc(p, size);
+    if (!p) {
+        fprintf(stderr, "ERROR: out of memory in frame cache\n");
+        exit(1);
+    }
+    return p;
+}
+
+static void open_file(frame_cache *cache) {
+#ifdef WIN32
+    char *tmp;
+    srand (time (NULL));
+    tmp = getenv("TEMP");
+    if (!tmp) tmp = getenv("TMP");
+    if (!tmp) tmp = ".";
+    snprintf(cache->file_name, sizeof(cache->file_name), "%s\\f2t_%06d.cache", tmp, rand());
+    cache->file = fopen(cache->file_name, "wb+");
+#else
+    cache->file = tmpfile();
+#endif
+    if (!cache->file) {
+        fprintf(stderr, "Unable to open temporary file for the frame cache\n");
+        exit(1);
+    }
+    cache->file_buffer = xrealloc(NULL, FRAME_CACHE_FILE_BUFFER);
+    setvbuf(cache->file, cache->file_buffer, _IOFBF, FRAME_CACHE_FILE_BUFFER);
+}
+
+frame_cache *frame_cache_open(long long memory_limit) {
+    frame_cache *cache = xrealloc(NULL, sizeof(*cache));
+    memset(cache, 0, sizeof(*cache));
+    cache->memory_limit = memory_limit;
+    return cache;
+}
+
+void frame_cache_write(frame_cache *cache, const void *data, int size) {
+    const char *src = data;
+
+    /* fill up the memory first */
+    while (size > 0 && cache->memory_size < cache->memory_limit) {
+        int offset = cache->memory_size % FRAME_CACHE_BLOCK;
+        int n = FRAME_CACHE_BLOCK - offset;
+        if (n > size)
+            n = size;
+        if (n > cache->memory_limit - cache->memory_size)
+            n = cache->memory_limit - cache->memory_size;
+        if (offset == 0) {
+            cache->blocks = xrealloc(cache->blocks, (cache->blocks_count + 1) * sizeof(char *));
+            cache->blocks[cache->blocks_count++] = xrealloc(NULL, FRAME_CACHE_BLOCK);
+        }
+        memcpy(cache->blocks[cache->blocks_count - 1] + offset, src, n);
+        cache->memory_size += n;
+        src += n;
+        size -= n;
+    }
+    if (size > 0) {
+        if (!cache->file)
+            open_file(cache);
+        if (fwrite(src, 1, size, cache->file) < size) {
+            fprintf(stderr, "Unable to write to the frame cache file.\n");
+            exit(1);
+        }
+        cache->file_size += size;
+    }
+}
+
+void frame_cache_rewind(frame_cache *cache) {
+    cache->read_pos = 0;
+    if (cache->file && fseek(cache->file, 0, SEEK_SET) < 0) {
+        fprintf(stderr, "Unable to seek in the frame cache file.\n");
+        exit(1);
+    }
+}
+
+void frame_cache_read(frame_cache *cache, void *data, int size) {
+    char *dst = data;
+
+    while (size > 0 && cache->read_pos < cache->memory_size) {
+        int offset = cache->read_pos % FRAME_CACHE_BLOCK;
+        int n = FRAME_CACHE_BLOCK - offset;
+        if (n > size)
+            n = size;
+        if (n > cache->memory_size - cache->read_pos)
+            n = cache->memory_size - cache->read_pos;
+        memcpy(dst, cache->blocks[cache->read_pos / FRAME_CACHE_BLOCK] + offset, n);
+        cache->read_pos += n;
+        dst += n;
+        size -= n;
+    }
+    if (size > 0) {
+        if (!cache->file || fread(dst, 1, size, cache->file) < size) {
+            fprintf(stderr, "Could not read from the frame cache.\n");
+            exit(1);
+        }
+        cache->read_pos += size;
+    }
+}
+
+void frame_cache_close(frame_cache *cache) {
+    int i;
+    for (i = 0; i < cache->blocks_count; i++)
+        free(cache->blocks[i]);
+    free(cache->blocks);
+    if (cache->file) {
+        fclose(cache->file);
+#ifdef WIN32
+        unlink(cache->file_name);
+#endif
+    }
+    free(cache->file_buffer);
+    free(cache);
+}
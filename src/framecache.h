@@ -0,0 +1,42 @@
+/* -*- tab-width:4;c-file-style:"cc-mode"; -*- */
+/*
+ * framecache.h -- sequential store for the preprocessed input of a two-pass run
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with This program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef _F2T_FRAMECACHE_H_
+#define _F2T_FRAMECACHE_H_
+
+/* Bytes kept in memory before the cache spills to a temporary file. */
+#define FRAME_CACHE_MEMORY (256 * 1024 * 1024)
+
+/* size of the blocks the in-memory part is allocated in */
+#define FRAME_CACHE_BLOCK (4 * 1024 * 1024)
+
+typedef struct frame_cache frame_cache;
+
+/**
+ * Creates an empty cache. Everything is written first and then read back
+ * in the same order, the first memory_limit bytes from memory and the rest
+ * from a temporary file that is only created once it is needed.
+ */
+extern frame_cache *frame_cache_open(long long memory_limit);
+extern void frame_cache_write(frame_cache *cache, const void *data, int size);
+/* Reads exactly size bytes, a short read is a fatal error. */
+extern void frame_cache_read(frame_cache *cache, void *data, int size);
+/* Ends writing and starts reading from the beginning. */
+extern void frame_cache_rewind(frame_cache *cache);
+extern void frame_cache_close(frame_cache *cache);
+
+#endif
@@ -0,0 +1,43 @@
+/* -*- tab-width:4;c-file-style:"cc-mode"; -*- */
+/*
+ * lut.h -- byte lookup tables for gamma, contrast and saturation correction
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with This program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef _F2T_LUT_H_
+#define _F2T_LUT_H_
+
+#include <stdint.h>
+
+typedef struct color_lut {
+    unsigned char table[256];
+    /* table applied to two bytes at once, set up by color_lut_prepare */
+    uint16_t *pairs;
+}
+color_lut;
+
+/* Call after filling in table and again whenever it changes. */
+extern void color_lut_prepare(color_lut *lut);
+extern void color_lut_free(color_lut *lut);
+
+/**
+ * dst[x] = table[src[x]] for a width x height plane. src and dst may be the
+ * same plane.
+ */
+extern void color_lut_apply(const color_lut *lut,
+                            uint8_t *dst, int dst_stride,
+                            const uint8_t *src, int src_stride,
+                            int width, int height);
+
+#endif
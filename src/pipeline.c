@@ -0,0 +1,852 @@
+/* -*- tab-width:4;c-file-style:"cc-mode"; -*- */
+/*
+ * pipeline.c -- run preprocessing, encoding and muxing on worker threads
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with This program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * The decoding thread feeds three queues:
+ *
+ *   frames/encode jobs -> preprocess thread -> theora thread -+
+ *   audio jobs         -> vorbis thread per audio stream -----+-> done
+ *   all jobs + flushes -> mux thread (in submission order) <--+
+ *
+ * The mux thread waits for each job to be encoded before adding its
+ * packets to the ogg streams, so packets and pages end up in exactly
+ * the order a single threaded run would produce them.
+ *
+ * With segments there are several theora threads. The preprocess thread
+ * cuts the video into segments and hands them out in turn, each thread
+ * encoding its segments with a new encoder, so they start with a keyframe
+ * and can be encoded at the same time. Their packets are moved to their
+ * place in the stream when encoded, and the mux thread puts them in order
+ * like any other jobs.
+ *
+ * With a frame cache the first pass of a two-pass run also writes every
+ * job to the cache from the mux thread, with the picture or samples it
+ * was given. The second pass reads the jobs back in the same order and
+ * queues them as if they had just been decoded, with cached pictures
+ * taking the place of the preprocessed ones.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "libavutil/pixdesc.h"
+#include "libavutil/time.h"
+
+#include "pipeline.h"
+
+enum {
+    JOB_FRAME,
+    JOB_VIDEO,
+    JOB_AUDIO,
+    JOB_FLUSH,
+    JOB_END
+};
+
+/* A preprocessed picture, shared between the preprocess thread, which keeps
+   the last one around until the next frame arrives, and the video jobs
+   encoding it. */
+typedef struct pipeline_picture {
+    AVFrame *frame;
+    /* when the frame came in, for --live */
+    int64_t input_time;
+    int refs;
+    struct pipeline_picture *next;
+} pipeline_picture;
+
+typedef struct pipeline_job {
+    int type;
+    int e_o_s;
+
+    /* JOB_FRAME */
+    AVFrame *frame;
+    int64_t input_time;
+
+    /* JOB_VIDEO */
+    pipeline_picture *picture;
+    int dups;
+    double videotime;
+    /* first frame of a segment, and the number of frames before it */
+    int segment_start;
+    int64_t frame_offset;
+
+    /* JOB_AUDIO */
+    int track;
+    uint8_t **audio;
+    int samples;
+    int audio_capacity;
+    int audio_channels;
+
+    oggmux_packet_list packets;
+    int done;
+
+    struct pipeline_job *next;
+} pipeline_job;
+
+/* header of every job in the frame cache, followed by the planes of the
+   picture for JOB_VIDEO and samples floats per channel for JOB_AUDIO */
+typedef struct {
+    int type;
+    int dups;
+    int e_o_s;
+    int samples;
+    int track;
+    double videotime;
+} cache_record;
+
+typedef struct {
+    pipeline_job **jobs;
+    int size;
+    int head;
+    int count;
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+} pipeline_queue;
+
+/* A theora thread. With segments it keeps the encoder of the segment it
+   is working on. */
+typedef struct {
+    pipeline *p;
+    pipeline_queue queue;
+    pthread_t thread;
+    th_enc_ctx *td;
+} theora_encoder;
+
+/* A vorbis thread, encoding one audio stream. */
+typedef struct {
+    pipeline *p;
+    int track;
+    pipeline_queue queue;
+    pthread_t thread;
+    /* samples being written by the caller between pipeline_get_audio and
+       pipeline_wrote_audio, a job when threaded, otherwise buffered to be
+       cached while recording */
+    pipeline_job *audio_job;
+    uint8_t **audio;
+    int audio_capacity;
+    int audio_channels;
+} vorbis_encoder;
+
+struct pipeline {
+    oggmux_info *info;
+    pipeline_video_filter filter;
+    int has_video;
+    int threaded;
+
+    pipeline_queue video_queue;
+    pipeline_queue mux_queue;
+
+    pthread_t preprocess_thread;
+    pthread_t mux_thread;
+
+    theora_encoder *encoders;
+    int num_encoders;
+    vorbis_encoder *audio_encoders;
+    int num_audio;
+    /* owned by the preprocess stage, the encoder of the current segment,
+       the frames before it and the frames handed out so far */
+    int segment_encoder;
+    int64_t segment_offset;
+    int64_t frames;
+
+    /* protects the free lists and job completion */
+    pthread_mutex_t lock;
+    pthread_cond_t job_done;
+    pipeline_job *free_jobs;
+    AVFrame **free_frames;
+    int free_frames_count;
+    int free_frames_size;
+    pipeline_picture *free_pictures;
+
+    /* owned by the preprocess stage */
+    pipeline_picture *buffered;
+
+    /* first pass writing to cache, or second pass reading from it */
+    frame_cache *cache;
+    int recording;
+    int plane_width[3];
+    int plane_height[3];
+    /* owned by the mux stage while recording */
+    int last_record;
+    int last_flush_e_o_s;
+};
+
+static void *xmalloc(size_t size) {
+    void *p = calloc(1, size);
+    if (!p) {
+        fprintf(stderr, "ERROR: out of memory in pipeline\n");
+        exit(1);
+    }
+    return p;
+}
+
+static AVFrame *picture_alloc(int pix_fmt, int width, int height) {
+    AVFrame *frame = avcodec_alloc_frame();
+    if (!frame || avpicture_alloc((AVPicture *)frame, pix_fmt, width, height) < 0) {
+        fprintf(stderr, "ERROR: out of memory in pipeline\n");
+        exit(1);
+    }
+    return frame;
+}
+
+static void picture_free(AVFrame *frame) {
+    avpicture_free((AVPicture *)frame);
+    av_free(frame);
+}
+
+static void queue_init(pipeline_queue *q, int size) {
+    q->jobs = xmalloc(size * sizeof(*q->jobs));
+    q->size = size;
+    q->head = 0;
+    q->count = 0;
+    pthread_mutex_init(&q->lock, NULL);
+    pthread_cond_init(&q->not_empty, NULL);
+    pthread_cond_init(&q->not_full, NULL);
+}
+
+static void queue_destroy(pipeline_queue *q) {
+    pthread_mutex_destroy(&q->lock);
+    pthread_cond_destroy(&q->not_empty);
+    pthread_cond_destroy(&q->not_full);
+    free(q->jobs);
+}
+
+static void queue_push(pipeline_queue *q, pipeline_job *job) {
+    pthread_mutex_lock(&q->lock);
+    while (q->count == q->size)
+        pthread_cond_wait(&q->not_full, &q->lock);
+    q->jobs[(q->head + q->count) % q->size] = job;
+    q->count++;
+    pthread_cond_signal(&q->not_empty);
+    pthread_mutex_unlock(&q->lock);
+}
+
+static pipeline_job *queue_pop(pipeline_queue *q) {
+    pipeline_job *job;
+    pthread_mutex_lock(&q->lock);
+    while (q->count == 0)
+        pthread_cond_wait(&q->not_empty, &q->lock);
+    job = q->jobs[q->head];
+    q->head = (q->head + 1) % q->size;
+    q->count--;
+    pthread_cond_signal(&q->not_full);
+    pthread_mutex_unlock(&q->lock);
+    return job;
+}
+
+static pipeline_job *job_get(pipeline *p, int type) {
+    pipeline_job *job;
+    pthread_mutex_lock(&p->lock);
+    job = p->free_jobs;
+    if (job)
+        p->free_jobs = job->next;
+    pthread_mutex_unlock(&p->lock);
+    if (!job)
+        job = xmalloc(sizeof(*job));
+    job->type = type;
+    job->e_o_s = 0;
+    job->frame = NULL;
+    job->input_time = 0;
+    job->picture = NULL;
+    job->dups = 0;
+    job->segment_start = 0;
+    job->frame_offset = 0;
+    job->track = 0;
+    job->samples = 0;
+    job->done = 0;
+    job->next = NULL;
+    return job;
+}
+
+static void job_release(pipeline *p, pipeline_job *job) {
+    pthread_mutex_lock(&p->lock);
+    job->next = p->free_jobs;
+    p->free_jobs = job;
+    pthread_mutex_unlock(&p->lock);
+}
+
+/* Makes room for samples floats per channel in *audio. */
+static uint8_t **audio_alloc(uint8_t ***audio, int *capacity, int *allocated_channels,
+                             int channels, int samples) {
+    if (samples > *capacity || channels != *allocated_channels) {
+        int linesize;
+        if (*audio) {
+            av_freep(&(*audio)[0]);
+            av_freep(audio);
+        }
+        if (av_samples_alloc_array_and_samples(audio, &linesize, channels,
+                                               samples, AV_SAMPLE_FMT_FLTP, 0) < 0) {
+            fprintf(stderr, "ERROR: out of memory in pipeline\n");
+            exit(1);
+        }
+        *capacity = samples;
+        *allocated_channels = channels;
+    }
+    return *audio;
+}
+
+static void job_free(pipeline_job *job) {
+    if (job->audio) {
+        av_freep(&job->audio[0]);
+        av_freep(&job->audio);
+    }
+    oggmux_packet_list_free(&job->packets);
+    free(job);
+}
+
+static void job_finished(pipeline *p, pipeline_job *job) {
+    pthread_mutex_lock(&p->lock);
+    job->done = 1;
+    pthread_cond_broadcast(&p->job_done);
+    pthread_mutex_unlock(&p->lock);
+}
+
+static void job_wait(pipeline *p, pipeline_job *job) {
+    pthread_mutex_lock(&p->lock);
+    while (!job->done)
+        pthread_cond_wait(&p->job_done, &p->lock);
+    pthread_mutex_unlock(&p->lock);
+}
+
+static pipeline_picture *picture_get(pipeline *p) {
+    pipeline_picture *picture;
+    pthread_mutex_lock(&p->lock);
+    picture = p->free_pictures;
+    if (picture)
+        p->free_pictures = picture->next;
+    pthread_mutex_unlock(&p->lock);
+    if (!picture) {
+        picture = xmalloc(sizeof(*picture));
+        picture->frame = picture_alloc(p->filter.pix_fmt,
+                                       p->filter.frame_width, p->filter.frame_height);
+        p->filter.init(p->filter.opaque, picture->frame);
+    }
+    picture->input_time = 0;
+    picture->refs = 1;
+    picture->next = NULL;
+    return picture;
+}
+
+static void picture_unref(pipeline *p, pipeline_picture *picture) {
+    pthread_mutex_lock(&p->lock);
+    if (--picture->refs == 0) {
+        picture->next = p->free_pictures;
+        p->free_pictures = picture;
+    }
+    pthread_mutex_unlock(&p->lock);
+}
+
+static void picture_ref(pipeline *p, pipeline_picture *picture) {
+    pthread_mutex_lock(&p->lock);
+    picture->refs++;
+    pthread_mutex_unlock(&p->lock);
+}
+
+AVFrame *pipeline_get_frame(pipeline *p) {
+    AVFrame *frame = NULL;
+    pthread_mutex_lock(&p->lock);
+    if (p->free_frames_count > 0)
+        frame = p->free_frames[--p->free_frames_count];
+    pthread_mutex_unlock(&p->lock);
+    if (!frame && !(frame = avcodec_alloc_frame())) {
+        fprintf(stderr, "ERROR: out of memory in pipeline\n");
+        exit(1);
+    }
+    return frame;
+}
+
+static void frame_release(pipeline *p, AVFrame *frame) {
+    av_frame_unref(frame);
+    pthread_mutex_lock(&p->lock);
+    if (p->free_frames_count == p->free_frames_size) {
+        int size = p->free_frames_size * 2 + 4;
+        AVFrame **tmp = realloc(p->free_frames, size * sizeof(AVFrame *));
+        if (!tmp) {
+            fprintf(stderr, "ERROR: out of memory in pipeline\n");
+            exit(1);
+        }
+        p->free_frames = tmp;
+        p->free_frames_size = size;
+    }
+    p->free_frames[p->free_frames_count++] = frame;
+    pthread_mutex_unlock(&p->lock);
+}
+
+static void buffer_picture(pipeline *p, pipeline_picture *picture) {
+    if (p->buffered)
+        picture_unref(p, p->buffered);
+    p->buffered = picture;
+}
+
+/* Filters frame into a new buffered picture. Once the encoder is done with
+   the previous one it is reused, so in the single threaded case two pictures
+   take turns. */
+static void preprocess(pipeline *p, AVFrame *frame, int64_t input_time) {
+    pipeline_picture *picture = picture_get(p);
+
+    picture->input_time = input_time;
+    p->filter.process(p->filter.opaque, frame, picture->frame);
+    frame_release(p, frame);
+    buffer_picture(p, picture);
+}
+
+/* Writes a job to the frame cache. Consecutive flushes are only written
+   once, there is one after every input packet. */
+static void cache_write(pipeline *p, int type, int dups, int e_o_s, double videotime,
+                        AVFrame *picture, int track, uint8_t **audio, int samples) {
+    cache_record r;
+    int i, y;
+
+    if (type == JOB_FLUSH && p->last_record == JOB_FLUSH && p->last_flush_e_o_s == e_o_s)
+        return;
+    p->last_record = type;
+    p->last_flush_e_o_s = e_o_s;
+
+    memset(&r, 0, sizeof(r));
+    r.type = type;
+    r.dups = dups;
+    r.e_o_s = e_o_s;
+    r.samples = samples;
+    r.track = track;
+    r.videotime = videotime;
+    frame_cache_write(p->cache, &r, sizeof(r));
+    if (picture) {
+        for (i = 0; i < 3; i++) {
+            for (y = 0; y < p->plane_height[i]; y++)
+                frame_cache_write(p->cache, picture->data[i] + y * picture->linesize[i],
+                                  p->plane_width[i]);
+        }
+    }
+    for (i = 0; audio && i < p->info->audio_streams[track].channels && samples > 0; i++)
+        frame_cache_write(p->cache, audio[i], samples * sizeof(float));
+}
+
+static void encode_video(pipeline *p, theora_encoder *e, pipeline_job *job) {
+    th_ycbcr_buffer ycbcr;
+    p->filter.prepare(p->filter.opaque, ycbcr, job->picture->frame);
+    if (p->num_encoders == 1) {
+        oggmux_encode_video(p->info, ycbcr, job->dups, job->e_o_s, &job->packets);
+        return;
+    }
+    if (job->segment_start) {
+        if (e->td)
+            th_encode_free(e->td);
+        e->td = p->filter.alloc_encoder(p->filter.opaque);
+    }
+    oggmux_encode_video_segment(p->info, e->td, ycbcr, job->dups, job->e_o_s,
+                                job->frame_offset, &job->packets);
+}
+
+/* Picks the theora thread for a video job. A new segment starts once the
+   current one has segment_frames frames, on the next thread in turn. */
+static theora_encoder *assign_encoder(pipeline *p, pipeline_job *job) {
+    if (p->num_encoders == 1)
+        return &p->encoders[0];
+    if (p->frames == 0) {
+        job->segment_start = 1;
+    }
+    else if (p->frames - p->segment_offset >= p->filter.segment_frames) {
+        job->segment_start = 1;
+        p->segment_encoder = (p->segment_encoder + 1) % p->num_encoders;
+        p->segment_offset = p->frames;
+    }
+    job->frame_offset = p->segment_offset;
+    p->frames += job->dups + 1;
+    return &p->encoders[p->segment_encoder];
+}
+
+static void *preprocess_thread(void *arg) {
+    pipeline *p = arg;
+    for (;;) {
+        pipeline_job *job = queue_pop(&p->video_queue);
+        switch (job->type) {
+            case JOB_FRAME:
+                if (job->picture)
+                    buffer_picture(p, job->picture);
+                else
+                    preprocess(p, job->frame, job->input_time);
+                job_release(p, job);
+                break;
+            case JOB_VIDEO:
+                job->picture = p->buffered;
+                job->packets.input_time = job->picture->input_time;
+                picture_ref(p, job->picture);
+                queue_push(&assign_encoder(p, job)->queue, job);
+                break;
+            case JOB_END: {
+                int i;
+                for (i = 1; i < p->num_encoders; i++)
+                    queue_push(&p->encoders[i].queue, job_get(p, JOB_END));
+                queue_push(&p->encoders[0].queue, job);
+                return NULL;
+            }
+        }
+    }
+}
+
+static void *theora_thread(void *arg) {
+    theora_encoder *e = arg;
+    pipeline *p = e->p;
+    for (;;) {
+        pipeline_job *job = queue_pop(&e->queue);
+        if (job->type == JOB_END) {
+            if (e->td)
+                th_encode_free(e->td);
+            job_release(p, job);
+            return NULL;
+        }
+        encode_video(p, e, job);
+        /* the mux thread still has to write it to the cache */
+        if (!p->recording) {
+            picture_unref(p, job->picture);
+            job->picture = NULL;
+        }
+        job_finished(p, job);
+    }
+}
+
+static void *vorbis_thread(void *arg) {
+    vorbis_encoder *e = arg;
+    pipeline *p = e->p;
+    for (;;) {
+        pipeline_job *job = queue_pop(&e->queue);
+        if (job->type == JOB_END) {
+            job_release(p, job);
+            return NULL;
+        }
+        oggmux_encode_audio(p->info, e->track, job->audio, job->samples, job->e_o_s, &job->packets);
+        job_finished(p, job);
+    }
+}
+
+static void *mux_thread(void *arg) {
+    pipeline *p = arg;
+    oggmux_info *info = p->info;
+    for (;;) {
+        pipeline_job *job = queue_pop(&p->mux_queue);
+        switch (job->type) {
+            case JOB_VIDEO:
+                job_wait(p, job);
+                oggmux_mux_video(info, &job->packets);
+                if (info->passno == 1)
+                    info->videotime = job->videotime;
+                if (p->recording) {
+                    cache_write(p, JOB_VIDEO, job->dups, job->e_o_s, job->videotime,
+                                job->picture->frame, 0, NULL, 0);
+                    picture_unref(p, job->picture);
+                    job->picture = NULL;
+                }
+                break;
+            case JOB_AUDIO:
+                job_wait(p, job);
+                if (p->recording)
+                    cache_write(p, JOB_AUDIO, 0, job->e_o_s, 0, NULL,
+                                job->track, job->audio, job->samples);
+                else
+                    oggmux_mux_audio(info, job->track, &job->packets);
+                break;
+            case JOB_FLUSH:
+                oggmux_flush(info, job->e_o_s);
+                if (p->recording)
+                    cache_write(p, JOB_FLUSH, 0, job->e_o_s, 0, NULL, 0, NULL, 0);
+                break;
+            case JOB_END:
+                job_release(p, job);
+                return NULL;
+        }
+        job_release(p, job);
+    }
+}
+
+static void start_thread(pthread_t *thread, void *(*func)(void *), void *arg) {
+    if (pthread_create(thread, NULL, func, arg) != 0) {
+        fprintf(stderr, "ERROR: failed to start pipeline thread\n");
+        exit(1);
+    }
+}
+
+pipeline *pipeline_start(oggmux_info *info, const pipeline_video_filter *filter,
+                         int threaded, frame_cache *cache) {
+    pipeline *p = xmalloc(sizeof(*p));
+    int segment_jobs = 0;
+    int i;
+
+    p->info = info;
+    p->threaded = threaded;
+    p->num_encoders = 1;
+    p->num_audio = info->n_audio_streams;
+    p->audio_encoders = xmalloc(FFMAX(p->num_audio, 1) * sizeof(*p->audio_encoders));
+    for (i = 0; i < p->num_audio; i++) {
+        p->audio_encoders[i].p = p;
+        p->audio_encoders[i].track = i;
+    }
+    if (filter) {
+        p->filter = *filter;
+        p->has_video = 1;
+        if (threaded && filter->segments > 1) {
+            p->num_encoders = filter->segments;
+            segment_jobs = filter->segments * filter->segment_frames;
+        }
+    }
+    p->cache = cache;
+    p->recording = cache && info->passno == 1;
+    p->last_record = -1;
+    if (p->has_video) {
+        const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get(p->filter.pix_fmt);
+        for (i = 0; i < 3; i++) {
+            int shift_w = i ? desc->log2_chroma_w : 0;
+            int shift_h = i ? desc->log2_chroma_h : 0;
+            p->plane_width[i] = FF_CEIL_RSHIFT(p->filter.frame_width, shift_w);
+            p->plane_height[i] = FF_CEIL_RSHIFT(p->filter.frame_height, shift_h);
+        }
+    }
+    pthread_mutex_init(&p->lock, NULL);
+    pthread_cond_init(&p->job_done, NULL);
+
+    if (!p->threaded)
+        return p;
+
+    queue_init(&p->video_queue, PIPELINE_QUEUE_SIZE);
+    /* the muxer gets a flush after every input packet. With segments it
+       waits for the oldest one while the others are encoded, so it has to
+       take all of their frames, and the audio and flushes in between. */
+    queue_init(&p->mux_queue, PIPELINE_QUEUE_SIZE * 8 * FFMAX(p->num_audio, 1) + segment_jobs * 8);
+
+    if (p->has_video) {
+        p->encoders = xmalloc(p->num_encoders * sizeof(*p->encoders));
+        start_thread(&p->preprocess_thread, preprocess_thread, p);
+        for (i = 0; i < p->num_encoders; i++) {
+            theora_encoder *e = &p->encoders[i];
+            e->p = p;
+            /* a thread has to take a whole segment for the preprocess
+               thread to move on to the next one */
+            queue_init(&e->queue, PIPELINE_QUEUE_SIZE +
+                       (p->num_encoders > 1 ? p->filter.segment_frames : 0));
+            start_thread(&e->thread, theora_thread, e);
+        }
+    }
+    for (i = 0; i < p->num_audio; i++) {
+        vorbis_encoder *e = &p->audio_encoders[i];
+        queue_init(&e->queue, PIPELINE_QUEUE_SIZE);
+        start_thread(&e->thread, vorbis_thread, e);
+    }
+    start_thread(&p->mux_thread, mux_thread, p);
+    return p;
+}
+
+void pipeline_add_frame(pipeline *p, AVFrame *frame) {
+    pipeline_job *job;
+    int64_t input_time = p->info->live ? av_gettime() : 0;
+    if (!p->threaded) {
+        preprocess(p, frame, input_time);
+        return;
+    }
+    job = job_get(p, JOB_FRAME);
+    job->frame = frame;
+    job->input_time = input_time;
+    queue_push(&p->video_queue, job);
+}
+
+void pipeline_encode_video(pipeline *p, int dups, int e_o_s, double videotime) {
+    pipeline_job *job;
+    if (!p->threaded) {
+        th_ycbcr_buffer ycbcr;
+        p->filter.prepare(p->filter.opaque, ycbcr, p->buffered->frame);
+        p->info->video_packets.input_time = p->buffered->input_time;
+        oggmux_add_video(p->info, ycbcr, dups, e_o_s);
+        if (p->info->passno == 1)
+            p->info->videotime = videotime;
+        if (p->recording)
+            cache_write(p, JOB_VIDEO, dups, e_o_s, videotime, p->buffered->frame, 0, NULL, 0);
+        return;
+    }
+    job = job_get(p, JOB_VIDEO);
+    job->dups = dups;
+    job->e_o_s = e_o_s;
+    job->videotime = videotime;
+    queue_push(&p->video_queue, job);
+    queue_push(&p->mux_queue, job);
+}
+
+uint8_t **pipeline_get_audio(pipeline *p, int track, int samples) {
+    vorbis_encoder *e = &p->audio_encoders[track];
+    int channels = p->info->audio_streams[track].channels;
+    if (!p->threaded) {
+        if (p->recording)
+            return audio_alloc(&e->audio, &e->audio_capacity, &e->audio_channels,
+                               channels, samples);
+        return (uint8_t **)oggmux_audio_buffer(p->info, track, samples);
+    }
+    if (!e->audio_job)
+        e->audio_job = job_get(p, JOB_AUDIO);
+    return audio_alloc(&e->audio_job->audio, &e->audio_job->audio_capacity,
+                       &e->audio_job->audio_channels, channels, samples);
+}
+
+void pipeline_wrote_audio(pipeline *p, int track, int samples, int e_o_s) {
+    vorbis_encoder *e = &p->audio_encoders[track];
+    pipeline_job *job;
+    if (!p->threaded) {
+        /* there is no vorbis stream in the first pass, the audio is
+           only decoded to be cached */
+        if (p->recording) {
+            cache_write(p, JOB_AUDIO, 0, e_o_s, 0, NULL, track, e->audio, samples);
+        }
+        else {
+            oggmux_packet_list *packets = &p->info->audio_streams[track].packets;
+            oggmux_encode_audio_buffer(p->info, track, samples, e_o_s, packets);
+            oggmux_mux_audio(p->info, track, packets);
+        }
+        return;
+    }
+    job = e->audio_job ? e->audio_job : job_get(p, JOB_AUDIO);
+    e->audio_job = NULL;
+    job->track = track;
+    job->samples = samples;
+    job->e_o_s = e_o_s;
+    if (p->recording)
+        job->done = 1;
+    else
+        queue_push(&e->queue, job);
+    queue_push(&p->mux_queue, job);
+}
+
+void pipeline_add_audio(pipeline *p, int track, uint8_t **buffer, int samples, int e_o_s) {
+    int i;
+    if (samples > 0) {
+        uint8_t **audio = pipeline_get_audio(p, track, samples);
+        for (i = 0; i < p->info->audio_streams[track].channels; i++)
+            memcpy(audio[i], buffer[i], samples * sizeof(float));
+    }
+    pipeline_wrote_audio(p, track, samples, e_o_s);
+}
+
+void pipeline_flush(pipeline *p, int e_o_s) {
+    pipeline_job *job;
+    if (!p->threaded) {
+        oggmux_flush(p->info, e_o_s);
+        if (p->recording)
+            cache_write(p, JOB_FLUSH, 0, e_o_s, 0, NULL, 0, NULL, 0);
+        return;
+    }
+    job = job_get(p, JOB_FLUSH);
+    job->e_o_s = e_o_s;
+    queue_push(&p->mux_queue, job);
+}
+
+void pipeline_replay(pipeline *p) {
+    cache_record r;
+    int i, y;
+
+    frame_cache_rewind(p->cache);
+    for (;;) {
+        frame_cache_read(p->cache, &r, sizeof(r));
+        switch (r.type) {
+            case JOB_VIDEO: {
+                pipeline_picture *picture = picture_get(p);
+                AVFrame *frame = picture->frame;
+                for (i = 0; i < 3; i++) {
+                    for (y = 0; y < p->plane_height[i]; y++)
+                        frame_cache_read(p->cache, frame->data[i] + y * frame->linesize[i],
+                                         p->plane_width[i]);
+                }
+                if (p->threaded) {
+                    pipeline_job *job = job_get(p, JOB_FRAME);
+                    job->picture = picture;
+                    queue_push(&p->video_queue, job);
+                }
+                else {
+                    buffer_picture(p, picture);
+                }
+                pipeline_encode_video(p, r.dups, r.e_o_s, r.videotime);
+                break;
+            }
+            case JOB_AUDIO:
+                if (r.samples > 0) {
+                    /* read straight into the vorbis buffer, or the job */
+                    uint8_t **audio = pipeline_get_audio(p, r.track, r.samples);
+                    for (i = 0; i < p->info->audio_streams[r.track].channels; i++)
+                        frame_cache_read(p->cache, audio[i], r.samples * sizeof(float));
+                }
+                pipeline_wrote_audio(p, r.track, r.samples, r.e_o_s);
+                break;
+            case JOB_FLUSH:
+                pipeline_flush(p, r.e_o_s);
+                break;
+            case JOB_END:
+                return;
+        }
+    }
+}
+
+void pipeline_finish(pipeline *p) {
+    int i;
+    if (p->threaded) {
+        if (p->has_video) {
+            queue_push(&p->video_queue, job_get(p, JOB_END));
+            pthread_join(p->preprocess_thread, NULL);
+            for (i = 0; i < p->num_encoders; i++) {
+                pthread_join(p->encoders[i].thread, NULL);
+                queue_destroy(&p->encoders[i].queue);
+            }
+            free(p->encoders);
+        }
+        for (i = 0; i < p->num_audio; i++) {
+            queue_push(&p->audio_encoders[i].queue, job_get(p, JOB_END));
+            pthread_join(p->audio_encoders[i].thread, NULL);
+            queue_destroy(&p->audio_encoders[i].queue);
+        }
+        queue_push(&p->mux_queue, job_get(p, JOB_END));
+        pthread_join(p->mux_thread, NULL);
+
+        queue_destroy(&p->video_queue);
+        queue_destroy(&p->mux_queue);
+    }
+    if (p->recording)
+        cache_write(p, JOB_END, 0, 0, 0, NULL, 0, NULL, 0);
+
+    if (p->buffered)
+        picture_unref(p, p->buffered);
+    while (p->free_pictures) {
+        pipeline_picture *picture = p->free_pictures;
+        p->free_pictures = picture->next;
+        picture_free(picture->frame);
+        free(picture);
+    }
+    while (p->free_frames_count > 0)
+        av_frame_free(&p->free_frames[--p->free_frames_count]);
+    free(p->free_frames);
+    while (p->free_jobs) {
+        pipeline_job *job = p->free_jobs;
+        p->free_jobs = job->next;
+        job_free(job);
+    }
+    for (i = 0; i < p->num_audio; i++) {
+        vorbis_encoder *e = &p->audio_encoders[i];
+        if (e->audio) {
+            av_freep(&e->audio[0]);
+            av_freep(&e->audio);
+        }
+    }
+    free(p->audio_encoders);
+    pthread_mutex_destroy(&p->lock);
+    pthread_cond_destroy(&p->job_done);
+    free(p);
+}
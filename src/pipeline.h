@@ -0,0 +1,94 @@
+/* -*- tab-width:4;c-file-style:"cc-mode"; -*- */
+/*
+ * pipeline.h -- run preprocessing, encoding and muxing on worker threads
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with This program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef _F2T_PIPELINE_H_
+#define _F2T_PIPELINE_H_
+
+#include "libavcodec/avcodec.h"
+#include "theorautils.h"
+#include "framecache.h"
+
+/* Number of jobs a stage may have queued before the previous stage blocks. */
+#define PIPELINE_QUEUE_SIZE 8
+
+typedef struct
+{
+    /* Sets up a newly allocated picture, e.g. fills in the padding. */
+    void (*init)(void *opaque, AVFrame *picture);
+    /* Runs the filter chain on a decoded picture, writing the result into
+       out. Pictures are reused, so out still holds whatever init and an
+       earlier frame left in it. Only called from one thread at a time. */
+    void (*process)(void *opaque, AVFrame *in, AVFrame *out);
+    /* Sets up ycbcr for frame. Must leave frame as it is, it may still
+       have to be written to the frame cache. */
+    void (*prepare)(void *opaque, th_ycbcr_buffer ycbcr, AVFrame *frame);
+    void *opaque;
+
+    /* format and size of the encoded pictures */
+    int pix_fmt;
+    int frame_width;
+    int frame_height;
+
+    /* With segments > 1 the video is cut into segments of segment_frames
+       frames, which are encoded on that many threads at once, each segment
+       by a new encoder from alloc_encoder starting with a keyframe. Only
+       used by threaded pipelines. */
+    int segments;
+    int segment_frames;
+    th_enc_ctx *(*alloc_encoder)(void *opaque);
+}
+pipeline_video_filter;
+
+typedef struct pipeline pipeline;
+
+/**
+ * Creates a pipeline writing to info. With threaded set to 0 every call
+ * runs synchronously on the calling thread, otherwise preprocessing,
+ * theora encoding, vorbis encoding of each audio stream and muxing each
+ * get their own thread and the calls only queue work. Output is identical in both modes.
+ * filter may be NULL for audio only output.
+ * With a cache, the first pass of a two-pass run writes every preprocessed
+ * picture and audio buffer it is given to cache, and the second pass
+ * encodes them again with pipeline_replay instead of decoding the input.
+ */
+extern pipeline *pipeline_start(oggmux_info *info, const pipeline_video_filter *filter,
+                                int threaded, frame_cache *cache);
+/* Returns an empty frame to move a reference counted decoded picture into,
+   to be handed back with pipeline_add_frame. The reference is dropped once
+   the picture is preprocessed, so nothing is copied on the decoding thread. */
+extern AVFrame *pipeline_get_frame(pipeline *p);
+/* Preprocesses frame, it becomes the frame encoded by the next pipeline_encode_video. */
+extern void pipeline_add_frame(pipeline *p, AVFrame *frame);
+/* Encodes the last added frame dups+1 times. videotime is the position after
+   the frame, it is reported as progress during the first pass. */
+extern void pipeline_encode_video(pipeline *p, int dups, int e_o_s, double videotime);
+/* Returns planar float buffers with room for samples samples of every
+   channel of audio stream track, for its next audio to be written in
+   place: the vorbis analysis buffer itself when not threaded. Each audio
+   stream is encoded on a thread of its own. */
+extern uint8_t **pipeline_get_audio(pipeline *p, int track, int samples);
+/* Queues the first samples written to the buffers of pipeline_get_audio. */
+extern void pipeline_wrote_audio(pipeline *p, int track, int samples, int e_o_s);
+/* Copies samples of planar float audio in with pipeline_get_audio. */
+extern void pipeline_add_audio(pipeline *p, int track, uint8_t **buffer, int samples, int e_o_s);
+extern void pipeline_flush(pipeline *p, int e_o_s);
+/* Queues everything the first pass wrote to the cache. */
+extern void pipeline_replay(pipeline *p);
+/* Waits for all queued work to be written and frees the pipeline. */
+extern void pipeline_finish(pipeline *p);
+
+#endif
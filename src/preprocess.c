@@ -0,0 +1,473 @@
+/* -*- tab-width:4;c-file-style:"cc-mode"; -*- */
+/*
+ * preprocess.c -- deinterlace, crop, scale and pad decoded video pictures
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with This program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libavformat/avformat.h"
+#ifdef HAVE_FRAMEHOOK
+#include "libavformat/framehook.h"
+#endif
+#include "libswscale/swscale.h"
+#include "libavutil/imgutils.h"
+#include "libavutil/opt.h"
+#include "libavutil/pixdesc.h"
+
+#include "preprocess.h"
+
+/* source lines scaled at a time when the output is color corrected */
+#define LUT_BAND_HEIGHT 32
+
+static int padcolor[3] = { 16, 128, 128 };
+
+/**
+ * Allocate and initialise an AVFrame.
+ */
+static AVFrame *frame_alloc(int pix_fmt, int width, int height) {
+    AVFrame *picture;
+    uint8_t *picture_buf;
+    int size;
+
+    picture = avcodec_alloc_frame();
+    if (!picture)
+        return NULL;
+    size = avpicture_get_size (pix_fmt, width, height);
+    picture_buf = av_malloc (size);
+    if (!picture_buf) {
+        av_free (picture);
+        return NULL;
+    }
+    avpicture_fill((AVPicture *) picture, picture_buf, pix_fmt, width, height);
+    return picture;
+}
+
+/**
+ * Frees an AVFrame.
+ */
+static void frame_dealloc(AVFrame *frame) {
+    if (frame) {
+        avpicture_free((AVPicture*)frame);
+        av_free(frame);
+    }
+}
+
+/**
+ * Point data at the part of picture starting at top/left, nothing is copied.
+ * @return -1 if the offsets do not line up with the chroma samples of pix_fmt
+ */
+static int crop_picture(uint8_t *data[4], int linesize[4],
+                        uint8_t *const src[4], const int src_linesize[4],
+                        int pix_fmt, int top, int left) {
+    const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get(pix_fmt);
+    int max_step[4], max_step_comp[4];
+    int i;
+
+    if (!desc || desc->flags & (AV_PIX_FMT_FLAG_BITSTREAM | AV_PIX_FMT_FLAG_HWACCEL))
+        return -1;
+    if (top % (1 << desc->log2_chroma_h) || left % (1 << desc->log2_chroma_w))
+        return -1;
+
+    av_image_fill_max_pixsteps(max_step, max_step_comp, desc);
+    for (i = 0; i < 4; i++) {
+        int x_shift = (max_step_comp[i] == 1 || max_step_comp[i] == 2) ? desc->log2_chroma_w : 0;
+        int y_shift = (i == 1 || i == 2) ? desc->log2_chroma_h : 0;
+
+        data[i] = src[i];
+        linesize[i] = src_linesize[i];
+        /* the palette lives in the second plane */
+        if (!data[i] || (i == 1 && desc->flags & (AV_PIX_FMT_FLAG_PAL | AV_PIX_FMT_FLAG_PSEUDOPAL)))
+            continue;
+        data[i] += (top >> y_shift) * linesize[i] + (left >> x_shift) * max_step[i];
+    }
+    return 0;
+}
+
+static AVFrame *get_output(video_preprocess *vp) {
+    if (!vp->output) {
+        vp->output = frame_alloc(vp->this->pix_fmt, vp->display_width, vp->display_height);
+        if (!vp->output) {
+            fprintf(stderr, "Failed to allocate memory\n");
+            exit(1);
+        }
+    }
+    return vp->output;
+}
+
+/**
+ * Fill a rectangle of picture with the padding color. The color correction
+ * is only applied to the picture area, so the padding is stored corrected.
+ */
+static void fill_padding(ff2theora this, AVFrame *picture,
+                         int x, int y, int width, int height) {
+    const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get(this->pix_fmt);
+    int i, row;
+
+    for (i = 0; i < 3; i++) {
+        int x_shift = i ? desc->log2_chroma_w : 0;
+        int y_shift = i ? desc->log2_chroma_h : 0;
+        int left = x >> x_shift;
+        int top = y >> y_shift;
+        int right = -((-(x + width)) >> x_shift);
+        int bottom = -((-(y + height)) >> y_shift);
+        int color = padcolor[i];
+
+        if (i == 0 && this->y_lut_used)
+            color = this->y_lut.table[color];
+        else if (i > 0 && this->uv_lut_used)
+            color = this->uv_lut.table[color];
+        for (row = top; row < bottom; row++)
+            memset(picture->data[i] + row * picture->linesize[i] + left, color, right - left);
+    }
+}
+
+void video_preprocess_init_picture(void *opaque, AVFrame *picture) {
+    video_preprocess *vp = opaque;
+    ff2theora this = vp->this;
+
+    fill_padding(this, picture, 0, 0, this->frame_width, this->frame_height);
+}
+
+/* Color correct lines top to bottom of the picture area in place. */
+static void correct_lines(ff2theora this, uint8_t *dst[4], int dst_linesize[4],
+                          int top, int bottom) {
+    const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get(this->pix_fmt);
+    int i;
+
+    for (i = 0; i < 3; i++) {
+        const color_lut *lut = i ? &this->uv_lut : &this->y_lut;
+        int x_shift = i ? desc->log2_chroma_w : 0;
+        int y_shift = i ? desc->log2_chroma_h : 0;
+        int first = -((-top) >> y_shift);
+        int last = -((-bottom) >> y_shift);
+
+        if (!(i ? this->uv_lut_used : this->y_lut_used))
+            continue;
+        color_lut_apply(lut, dst[i] + first * dst_linesize[i], dst_linesize[i],
+                        dst[i] + first * dst_linesize[i], dst_linesize[i],
+                        -((-this->picture_width) >> x_shift), last - first);
+    }
+}
+
+/**
+ * Scale src into the picture area. With color correction the source is fed
+ * to swscale in bands and every band of output is corrected right away,
+ * while it is still in the cache, instead of in another pass over the
+ * picture.
+ */
+static void scale_picture(video_preprocess *vp, struct SwsContext *ctx, int src_pix_fmt,
+                          uint8_t *const src[4], const int src_linesize[4],
+                          uint8_t *dst[4], int dst_linesize[4]) {
+    ff2theora this = vp->this;
+    int height = vp->display_height - (this->frame_topBand + this->frame_bottomBand);
+    int y, lines = 0;
+
+    if (!this->y_lut_used && !this->uv_lut_used) {
+        sws_scale(ctx, (const uint8_t * const*)src, src_linesize, 0, height,
+                  dst, dst_linesize);
+        return;
+    }
+    for (y = 0; y < height; y += LUT_BAND_HEIGHT) {
+        uint8_t *band[4];
+        int band_linesize[4];
+        int n;
+
+        /* the band height keeps this aligned to the chroma lines */
+        crop_picture(band, band_linesize, src, src_linesize, src_pix_fmt, y, 0);
+        n = sws_scale(ctx, (const uint8_t * const*)band, band_linesize,
+                      y, FFMIN(LUT_BAND_HEIGHT, height - y), dst, dst_linesize);
+        correct_lines(this, dst, dst_linesize, lines, lines + n);
+        lines += n;
+    }
+}
+
+/**
+ * Convert, crop and scale in with one sws_scale call.
+ * @return -1 if the crop does not line up with the decoded pixel format
+ */
+static int preprocess_fused(video_preprocess *vp, AVFrame *in,
+                            uint8_t *dst[4], int dst_linesize[4]) {
+    ff2theora this = vp->this;
+    uint8_t *src[4];
+    int src_linesize[4];
+
+    if (!this->sws_fused_ctx ||
+        crop_picture(src, src_linesize, in->data, in->linesize, vp->src_pix_fmt,
+                     this->frame_topBand, this->frame_leftBand) < 0)
+        return -1;
+    scale_picture(vp, this->sws_fused_ctx, vp->src_pix_fmt, src, src_linesize, dst, dst_linesize);
+    return 0;
+}
+
+/* full size steps, then crop and resize */
+static void preprocess_full(video_preprocess *vp, AVFrame *in, int deinterlace,
+                            uint8_t *dst[4], int dst_linesize[4]) {
+    ff2theora this = vp->this;
+    int display_width = vp->display_width;
+    int display_height = vp->display_height;
+    AVPicture *src = (AVPicture *)in;
+    AVPicture output_cropped;
+
+    if (vp->src_pix_fmt != this->pix_fmt) {
+        AVFrame *output = get_output(vp);
+        sws_scale(this->sws_colorspace_ctx,
+            (const uint8_t * const*)in->data, in->linesize, 0, display_height,
+            output->data, output->linesize);
+        src = (AVPicture *)output;
+    }
+    if (deinterlace) {
+        AVFrame *output = get_output(vp);
+        /* works in place if src is already the output */
+        if (avpicture_deinterlace((AVPicture *)output, src, this->pix_fmt, display_width, display_height)<0) {
+                fprintf(stderr, "Deinterlace failed.\n");
+                exit(1);
+        }
+        src = (AVPicture *)output;
+    }
+    else if (this->vhook && src == (AVPicture *)in) {
+        /* the decoder's picture must not be modified */
+        AVFrame *output = get_output(vp);
+        av_picture_copy((AVPicture *)output, src, this->pix_fmt,
+                        display_width, display_height);
+        src = (AVPicture *)output;
+    }
+
+#ifdef HAVE_FRAMEHOOK
+    if (this->vhook)
+        frame_hook_process(src, this->pix_fmt, display_width,display_height, 0);
+#endif
+
+    output_cropped = *src;
+    if (this->frame_topBand || this->frame_leftBand) {
+        if (av_picture_crop(&output_cropped, src, this->pix_fmt,
+                          this->frame_topBand, this->frame_leftBand) < 0) {
+            av_log(NULL, AV_LOG_ERROR, "error cropping picture\n");
+        }
+    }
+    if (this->sws_scale_ctx) {
+        scale_picture(vp, this->sws_scale_ctx, this->pix_fmt,
+                      output_cropped.data, output_cropped.linesize, dst, dst_linesize);
+    }
+    else{
+        av_image_copy(dst, dst_linesize,
+                      (const uint8_t **)output_cropped.data, output_cropped.linesize,
+                      this->pix_fmt, this->picture_width, this->picture_height);
+        correct_lines(this, dst, dst_linesize, 0, this->picture_height);
+    }
+}
+
+void video_preprocess_frame(void *opaque, AVFrame *in, AVFrame *out) {
+    video_preprocess *vp = opaque;
+    ff2theora this = vp->this;
+    uint8_t *dst[4];
+    int dst_linesize[4];
+    int x;
+    /* yadif already ran on the decoded frames */
+    int deinterlace = this->deinterlacer == DEINTERLACER_FAST &&
+                      ((this->deinterlace==0 && in->interlaced_frame) ||
+                       this->deinterlace==1);
+
+    /* the offsets are even, so this can not fail for 4:2:0 */
+    crop_picture(dst, dst_linesize, out->data, out->linesize, this->pix_fmt,
+                 this->frame_y_offset, this->frame_x_offset);
+    if (deinterlace || this->vhook ||
+        preprocess_fused(vp, in, dst, dst_linesize) < 0)
+        preprocess_full(vp, in, deinterlace, dst, dst_linesize);
+
+    /* swscale may write a few bytes past the end of each line, which lands
+       in the right padding and the left padding of the next line */
+    x = this->frame_x_offset + this->picture_width;
+    if (x < this->frame_width) {
+        fill_padding(this, out, x, this->frame_y_offset,
+                     this->frame_width - x, this->picture_height);
+        fill_padding(this, out, 0, this->frame_y_offset,
+                     this->frame_x_offset, this->picture_height);
+    }
+}
+
+struct SwsContext *video_preprocess_sws_context(int src_w, int src_h, int src_pix_fmt,
+                                                int dst_w, int dst_h, int dst_pix_fmt,
+                                                int flags, int threads) {
+    struct SwsContext *ctx = sws_alloc_context();
+
+    if (!ctx) {
+        fprintf(stderr, "Failed to allocate memory\n");
+        exit(1);
+    }
+    av_opt_set_int(ctx, "sws_flags", flags, 0);
+    av_opt_set_int(ctx, "srcw", src_w, 0);
+    av_opt_set_int(ctx, "srch", src_h, 0);
+    av_opt_set_int(ctx, "src_format", src_pix_fmt, 0);
+    av_opt_set_int(ctx, "dstw", dst_w, 0);
+    av_opt_set_int(ctx, "dsth", dst_h, 0);
+    av_opt_set_int(ctx, "dst_format", dst_pix_fmt, 0);
+    av_opt_set_int(ctx, "threads", threads, 0);
+    if (sws_init_context(ctx, NULL, NULL) < 0) {
+        sws_freeContext(ctx);
+        return NULL;
+    }
+    return ctx;
+}
+
+void video_preprocess_close(video_preprocess *vp) {
+    frame_dealloc(vp->output);
+    vp->output = NULL;
+}
+
+#ifdef PREPROCESS_BENCH
+#include "libavutil/time.h"
+
+/*
+ * Compares the memory traffic of the fused path with the chain of full
+ * frame copies it replaced: decoded -> output_tmp -> output -> cropped ->
+ * resized -> padded -> buffered.
+ */
+
+static int64_t picture_bytes(int pix_fmt, int width, int height) {
+    return avpicture_get_size(pix_fmt, width, height);
+}
+
+int main(int argc, char **argv) {
+    struct ff2theora bench;
+    ff2theora this = &bench;
+    video_preprocess vp;
+    AVFrame *in, *pictures[2];
+    AVFrame *output_tmp, *output, *output_resized, *output_padded, *buffered;
+    AVPicture output_cropped;
+    int width, height, frames = 200;
+    int crop_width, crop_height;
+    int64_t before = 0, after = 0, t;
+    double before_time, after_time;
+    int i;
+
+    if (argc < 5) {
+        fprintf(stderr, "usage: %s width height out_width out_height [pix_fmt] [frames]\n", argv[0]);
+        exit(1);
+    }
+    avcodec_register_all();
+
+    memset(this, 0, sizeof(*this));
+    memset(&vp, 0, sizeof(vp));
+    width = atoi(argv[1]);
+    height = atoi(argv[2]);
+    this->picture_width = atoi(argv[3]);
+    this->picture_height = atoi(argv[4]);
+    vp.src_pix_fmt = argc > 5 ? av_get_pix_fmt(argv[5]) : AV_PIX_FMT_YUV420P;
+    if (argc > 6)
+        frames = atoi(argv[6]);
+    if (vp.src_pix_fmt == AV_PIX_FMT_NONE) {
+        fprintf(stderr, "unknown pixel format %s\n", argv[5]);
+        exit(1);
+    }
+
+    /* crop 8 lines top and bottom, like a letterboxed source */
+    this->pix_fmt = AV_PIX_FMT_YUV420P;
+    this->deinterlace = -1;
+    this->frame_topBand = this->frame_bottomBand = 8;
+    this->frame_width = ((this->picture_width + 15) >>4)<<4;
+    this->frame_height = ((this->picture_height + 15) >>4)<<4;
+    this->frame_x_offset = (this->frame_width-this->picture_width)>>1&~1;
+    this->frame_y_offset = (this->frame_height-this->picture_height)>>1&~1;
+    crop_width = width;
+    crop_height = height - this->frame_topBand - this->frame_bottomBand;
+
+    this->sws_colorspace_ctx = sws_getContext(width, height, vp.src_pix_fmt,
+                                              width, height, this->pix_fmt,
+                                              SWS_BILINEAR, NULL, NULL, NULL);
+    this->sws_scale_ctx = sws_getContext(crop_width, crop_height, this->pix_fmt,
+                                         this->picture_width, this->picture_height, this->pix_fmt,
+                                         SWS_BILINEAR, NULL, NULL, NULL);
+    this->sws_fused_ctx = sws_getContext(crop_width, crop_height, vp.src_pix_fmt,
+                                         this->picture_width, this->picture_height, this->pix_fmt,
+                                         SWS_BILINEAR, NULL, NULL, NULL);
+    vp.this = this;
+    vp.display_width = width;
+    vp.display_height = height;
+
+    in = frame_alloc(vp.src_pix_fmt, width, height);
+    output_tmp = frame_alloc(this->pix_fmt, width, height);
+    output = frame_alloc(this->pix_fmt, width, height);
+    output_resized = frame_alloc(this->pix_fmt, this->picture_width, this->picture_height);
+    output_padded = frame_alloc(this->pix_fmt, this->frame_width, this->frame_height);
+    buffered = frame_alloc(this->pix_fmt, this->frame_width, this->frame_height);
+    for (i = 0; i < 2; i++) {
+        pictures[i] = frame_alloc(this->pix_fmt, this->frame_width, this->frame_height);
+        video_preprocess_init_picture(&vp, pictures[i]);
+    }
+    for (i = 0; i < avpicture_get_size(vp.src_pix_fmt, width, height); i++)
+        in->data[0][i] = i * 7;
+
+    /* every pass reads its input and writes its output once */
+    t = av_gettime();
+    for (i = 0; i < frames; i++) {
+        if (vp.src_pix_fmt != this->pix_fmt) {
+            sws_scale(this->sws_colorspace_ctx, (const uint8_t * const*)in->data, in->linesize,
+                      0, height, output_tmp->data, output_tmp->linesize);
+        } else {
+            av_picture_copy((AVPicture *)output_tmp, (AVPicture *)in, this->pix_fmt, width, height);
+        }
+        av_picture_copy((AVPicture *)output, (AVPicture *)output_tmp, this->pix_fmt, width, height);
+        av_picture_crop(&output_cropped, (AVPicture *)output, this->pix_fmt,
+                        this->frame_topBand, this->frame_leftBand);
+        sws_scale(this->sws_scale_ctx, (const uint8_t * const*)output_cropped.data,
+                  output_cropped.linesize, 0, crop_height,
+                  output_resized->data, output_resized->linesize);
+        av_picture_pad((AVPicture *)output_padded, (AVPicture *)output_resized,
+                       this->frame_height, this->frame_width, this->pix_fmt,
+                       this->frame_y_offset, this->frame_y_offset,
+                       this->frame_x_offset, this->frame_x_offset, padcolor);
+        av_picture_copy((AVPicture *)buffered, (AVPicture *)output_padded, this->pix_fmt,
+                        this->frame_width, this->frame_height);
+    }
+    before_time = (av_gettime() - t) / 1000.0 / frames;
+    before += picture_bytes(vp.src_pix_fmt, width, height) + picture_bytes(this->pix_fmt, width, height);
+    before += 2 * picture_bytes(this->pix_fmt, width, height);
+    before += picture_bytes(this->pix_fmt, crop_width, crop_height) +
+              picture_bytes(this->pix_fmt, this->picture_width, this->picture_height);
+    before += picture_bytes(this->pix_fmt, this->picture_width, this->picture_height) +
+              picture_bytes(this->pix_fmt, this->frame_width, this->frame_height);
+    before += 2 * picture_bytes(this->pix_fmt, this->frame_width, this->frame_height);
+
+    t = av_gettime();
+    for (i = 0; i < frames; i++)
+        video_preprocess_frame(&vp, in, pictures[i & 1]);
+    after_time = (av_gettime() - t) / 1000.0 / frames;
+    after += picture_bytes(vp.src_pix_fmt, crop_width, crop_height) +
+             picture_bytes(this->pix_fmt, this->picture_width, this->picture_height);
+
+    printf("%dx%d %s -> %dx%d in %dx%d\n", width, height, av_get_pix_fmt_name(vp.src_pix_fmt),
+           this->picture_width, this->picture_height, this->frame_width, this->frame_height);
+    printf("before: %8.2f MB/frame %8.3f ms/frame\n", before / 1048576.0, before_time);
+    printf("after:  %8.2f MB/frame %8.3f ms/frame\n", after / 1048576.0, after_time);
+    printf("fused path used: %s\n", vp.output ? "no" : "yes");
+
+    frame_dealloc(in);
+    frame_dealloc(output_tmp);
+    frame_dealloc(output);
+    frame_dealloc(output_resized);
+    frame_dealloc(output_padded);
+    frame_dealloc(buffered);
+    frame_dealloc(pictures[0]);
+    frame_dealloc(pictures[1]);
+    video_preprocess_close(&vp);
+    sws_freeContext(this->sws_colorspace_ctx);
+    sws_freeContext(this->sws_scale_ctx);
+    sws_freeContext(this->sws_fused_ctx);
+    return 0;
+}
+#endif
@@ -0,0 +1,68 @@
+/* -*- tab-width:4;c-file-style:"cc-mode"; -*- */
+/*
+ * preprocess.h -- deinterlace, crop, scale and pad decoded video pictures
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with This program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef _F2T_PREPROCESS_H_
+#define _F2T_PREPROCESS_H_
+
+#include "libavformat/avformat.h"
+#include "theora/theoraenc.h"
+
+#include "subtitles.h"
+#include "ffmpeg2theora.h"
+
+/* state of the video preprocessing chain */
+typedef struct {
+    ff2theora this;
+
+    /* format and size of the decoded pictures, after --vf */
+    int src_pix_fmt;
+    int display_width;
+    int display_height;
+
+    /* full size picture in this->pix_fmt, only allocated once a frame has
+       to be deinterlaced or passed to a frame hook */
+    AVFrame *output;
+} video_preprocess;
+
+/**
+ * Fills a newly allocated frame_width x frame_height picture with the
+ * padding color. The picture area is overwritten by every frame, so the
+ * padding is only ever written once per picture.
+ */
+extern void video_preprocess_init_picture(void *opaque, AVFrame *picture);
+
+/**
+ * deinterlace, crop and resize a decoded picture into the
+ * picture area of out. Pictures that need none of the full size steps are
+ * converted and scaled by a single sws_scale call straight from the
+ * decoder's buffer.
+ * @param in decoded picture in vp->src_pix_fmt
+ * @param out picture set up by video_preprocess_init_picture
+ */
+extern void video_preprocess_frame(void *opaque, AVFrame *in, AVFrame *out);
+
+/**
+ * swscale context for the preprocessing chain. Whole pictures are scaled
+ * in bands on threads threads, 0 for one per core.
+ */
+extern struct SwsContext *video_preprocess_sws_context(int src_w, int src_h, int src_pix_fmt,
+                                                       int dst_w, int dst_h, int dst_pix_fmt,
+                                                       int flags, int threads);
+
+extern void video_preprocess_close(video_preprocess *vp);
+
+#endif
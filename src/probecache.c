@@ -0,0 +1,426 @@
+/* -*- tab-width:4;c-file-style:"cc-mode"; -*- */
+/*
+ * probecache.c -- remember what avformat_find_stream_info found in an input
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with This program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#if !defined(_FILE_OFFSET_BITS)
+#define _FILE_OFFSET_BITS 64
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "libavutil/avstring.h"
+#include "libavutil/mem.h"
+#include "libavformat/avformat.h"
+
+#include "probecache.h"
+
+#define PROBE_CACHE_MAGIC "F2TPROBE"
+#define PROBE_CACHE_VERSION 1
+
+/* sanity limits for what is read back from a cache file */
+#define PROBE_CACHE_MAX_STREAMS 1024
+#define PROBE_CACHE_MAX_EXTRADATA (16 * 1024 * 1024)
+#define PROBE_CACHE_MAX_INDEX (16 * 1024 * 1024)
+
+/*
+ * Entries are written in host byte order with the sizes of the structures
+ * in the header, a cache is only meant to be read on the machine that
+ * wrote it. Anything that doesn't fit makes the entry invalid.
+ */
+typedef struct {
+    int32_t version;
+    int32_t header_size;
+    int32_t stream_size;
+    int32_t index_entry_size;
+    int64_t file_size;
+    int64_t file_mtime;
+    int64_t duration;
+    int64_t start_time;
+    int64_t bit_rate;
+    int32_t nb_streams;
+} probe_header;
+
+/* what avformat_find_stream_info fills in for one stream */
+typedef struct {
+    /* AVStream */
+    AVRational time_base;
+    AVRational r_frame_rate;
+    AVRational avg_frame_rate;
+    AVRational sample_aspect_ratio;
+    int64_t start_time;
+    int64_t duration;
+    int64_t nb_frames;
+    int32_t disposition;
+
+    /* AVCodecContext */
+    int32_t codec_type;
+    int32_t codec_id;
+    uint32_t codec_tag;
+    int64_t bit_rate;
+    int64_t rc_max_rate;
+    int32_t rc_buffer_size;
+    AVRational codec_time_base;
+    int32_t ticks_per_frame;
+    int32_t width, height;
+    int32_t coded_width, coded_height;
+    int32_t pix_fmt;
+    AVRational codec_sample_aspect_ratio;
+    int32_t has_b_frames;
+    int32_t field_order;
+    int32_t color_range;
+    int32_t color_primaries;
+    int32_t color_trc;
+    int32_t colorspace;
+    int32_t chroma_sample_location;
+    int32_t sample_rate;
+    int32_t channels;
+    uint64_t channel_layout;
+    int32_t sample_fmt;
+    int32_t frame_size;
+    int32_t block_align;
+    int32_t bits_per_coded_sample;
+    int32_t bits_per_raw_sample;
+    int32_t profile;
+    int32_t level;
+
+    int32_t extradata_size;
+    int32_t nb_index_entries;
+} probe_stream;
+
+struct probe_cache {
+    probe_header header;
+    probe_stream *streams;
+    uint8_t **extradata;
+    AVIndexEntry **index;
+};
+
+probe_cache *probe_cache_create(AVFormatContext *ic) {
+    probe_cache *pc = av_mallocz(sizeof(*pc));
+    int i;
+
+    if (pc) {
+        pc->streams = av_mallocz_array(ic->nb_streams, sizeof(*pc->streams));
+        pc->extradata = av_mallocz_array(ic->nb_streams, sizeof(*pc->extradata));
+        pc->index = av_mallocz_array(ic->nb_streams, sizeof(*pc->index));
+    }
+    if (!pc || (ic->nb_streams && (!pc->streams || !pc->extradata || !pc->index))) {
+        fprintf(stderr, "Failed to allocate memory\n");
+        exit(1);
+    }
+
+    pc->header.version = PROBE_CACHE_VERSION;
+    pc->header.header_size = sizeof(probe_header);
+    pc->header.stream_size = sizeof(probe_stream);
+    pc->header.index_entry_size = sizeof(AVIndexEntry);
+    pc->header.duration = ic->duration;
+    pc->header.start_time = ic->start_time;
+    pc->header.bit_rate = ic->bit_rate;
+    pc->header.nb_streams = ic->nb_streams;
+
+    for (i = 0; i < ic->nb_streams; i++) {
+        AVStream *st = ic->streams[i];
+        AVCodecContext *enc = st->codec;
+        probe_stream *ps = &pc->streams[i];
+
+        ps->time_base = st->time_base;
+        ps->r_frame_rate = st->r_frame_rate;
+        ps->avg_frame_rate = st->avg_frame_rate;
+        ps->sample_aspect_ratio = st->sample_aspect_ratio;
+        ps->start_time = st->start_time;
+        ps->duration = st->duration;
+        ps->nb_frames = st->nb_frames;
+        ps->disposition = st->disposition;
+
+        ps->codec_type = enc->codec_type;
+        ps->codec_id = enc->codec_id;
+        ps->codec_tag = enc->codec_tag;
+        ps->bit_rate = enc->bit_rate;
+        ps->rc_max_rate = enc->rc_max_rate;
+        ps->rc_buffer_size = enc->rc_buffer_size;
+        ps->codec_time_base = enc->time_base;
+        ps->ticks_per_frame = enc->ticks_per_frame;
+        ps->width = enc->width;
+        ps->height = enc->height;
+        ps->coded_width = enc->coded_width;
+        ps->coded_height = enc->coded_height;
+        ps->pix_fmt = enc->pix_fmt;
+        ps->codec_sample_aspect_ratio = enc->sample_aspect_ratio;
+        ps->has_b_frames = enc->has_b_frames;
+        ps->field_order = enc->field_order;
+        ps->color_range = enc->color_range;
+        ps->color_primaries = enc->color_primaries;
+        ps->color_trc = enc->color_trc;
+        ps->colorspace = enc->colorspace;
+        ps->chroma_sample_location = enc->chroma_sample_location;
+        ps->sample_rate = enc->sample_rate;
+        ps->channels = enc->channels;
+        ps->channel_layout = enc->channel_layout;
+        ps->sample_fmt = enc->sample_fmt;
+        ps->frame_size = enc->frame_size;
+        ps->block_align = enc->block_align;
+        ps->bits_per_coded_sample = enc->bits_per_coded_sample;
+        ps->bits_per_raw_sample = enc->bits_per_raw_sample;
+        ps->profile = enc->profile;
+        ps->level = enc->level;
+
+        if (enc->extradata_size > 0 && enc->extradata) {
+            pc->extradata[i] = av_memdup(enc->extradata, enc->extradata_size);
+            if (!pc->extradata[i]) {
+                fprintf(stderr, "Failed to allocate memory\n");
+                exit(1);
+            }
+            ps->extradata_size = enc->extradata_size;
+        }
+    }
+    return pc;
+}
+
+int probe_cache_apply(probe_cache *pc, AVFormatContext *ic) {
+    int i, j;
+
+    /* formats that only find their streams while reading packets, or a
+       demuxer that now sees the input differently, need a real probe */
+    if (pc->header.nb_streams != ic->nb_streams)
+        return 0;
+    for (i = 0; i < ic->nb_streams; i++) {
+        AVStream *st = ic->streams[i];
+        if (av_cmp_q(pc->streams[i].time_base, st->time_base) ||
+            (st->codec->codec_type != AVMEDIA_TYPE_UNKNOWN &&
+             st->codec->codec_type != pc->streams[i].codec_type))
+            return 0;
+    }
+
+    for (i = 0; i < ic->nb_streams; i++) {
+        AVStream *st = ic->streams[i];
+        AVCodecContext *enc = st->codec;
+        probe_stream *ps = &pc->streams[i];
+
+        st->r_frame_rate = ps->r_frame_rate;
+        st->avg_frame_rate = ps->avg_frame_rate;
+        st->sample_aspect_ratio = ps->sample_aspect_ratio;
+        st->start_time = ps->start_time;
+        st->duration = ps->duration;
+        st->nb_frames = ps->nb_frames;
+        st->disposition = ps->disposition;
+        /* the codec is known, packets needn't be held back to probe it */
+        st->request_probe = 0;
+
+        enc->codec_type = ps->codec_type;
+        enc->codec_id = ps->codec_id;
+        enc->codec_tag = ps->codec_tag;
+        enc->bit_rate = ps->bit_rate;
+        enc->rc_max_rate = ps->rc_max_rate;
+        enc->rc_buffer_size = ps->rc_buffer_size;
+        enc->time_base = ps->codec_time_base;
+        enc->ticks_per_frame = ps->ticks_per_frame;
+        enc->width = ps->width;
+        enc->height = ps->height;
+        enc->coded_width = ps->coded_width;
+        enc->coded_height = ps->coded_height;
+        enc->pix_fmt = ps->pix_fmt;
+        enc->sample_aspect_ratio = ps->codec_sample_aspect_ratio;
+        enc->has_b_frames = ps->has_b_frames;
+        enc->field_order = ps->field_order;
+        enc->color_range = ps->color_range;
+        enc->color_primaries = ps->color_primaries;
+        enc->color_trc = ps->color_trc;
+        enc->colorspace = ps->colorspace;
+        enc->chroma_sample_location = ps->chroma_sample_location;
+        enc->sample_rate = ps->sample_rate;
+        enc->channels = ps->channels;
+        enc->channel_layout = ps->channel_layout;
+        enc->sample_fmt = ps->sample_fmt;
+        enc->frame_size = ps->frame_size;
+        enc->block_align = ps->block_align;
+        enc->bits_per_coded_sample = ps->bits_per_coded_sample;
+        enc->bits_per_raw_sample = ps->bits_per_raw_sample;
+        enc->profile = ps->profile;
+        enc->level = ps->level;
+
+        if (ps->extradata_size) {
+            av_freep(&enc->extradata);
+            enc->extradata = av_mallocz(ps->extradata_size + FF_INPUT_BUFFER_PADDING_SIZE);
+            if (!enc->extradata) {
+                fprintf(stderr, "Failed to allocate memory\n");
+                exit(1);
+            }
+            memcpy(enc->extradata, pc->extradata[i], ps->extradata_size);
+            enc->extradata_size = ps->extradata_size;
+        }
+
+        for (j = 0; j < ps->nb_index_entries; j++) {
+            AVIndexEntry *ie = &pc->index[i][j];
+            av_add_index_entry(st, ie->pos, ie->timestamp, ie->size,
+                               ie->min_distance, ie->flags);
+        }
+    }
+
+    ic->duration = pc->header.duration;
+    ic->start_time = pc->header.start_time;
+    ic->bit_rate = pc->header.bit_rate;
+    return 1;
+}
+
+int probe_cache_update_index(probe_cache *pc, AVFormatContext *ic) {
+    int i, updated = 0;
+
+    for (i = 0; i < ic->nb_streams && i < pc->header.nb_streams; i++) {
+        AVStream *st = ic->streams[i];
+        probe_stream *ps = &pc->streams[i];
+
+        if (st->nb_index_entries <= ps->nb_index_entries)
+            continue;
+        av_freep(&pc->index[i]);
+        pc->index[i] = av_memdup(st->index_entries,
+                                 st->nb_index_entries * sizeof(*st->index_entries));
+        if (!pc->index[i]) {
+            fprintf(stderr, "Failed to allocate memory\n");
+            exit(1);
+        }
+        ps->nb_index_entries = st->nb_index_entries;
+        updated = 1;
+    }
+    return updated;
+}
+
+static char *entry_name(const char *dir, const char *oshash) {
+    return av_asprintf("%s/%s.probe", dir, oshash);
+}
+
+static int file_stat(const char *filename, int64_t *size, int64_t *mtime) {
+    struct stat st;
+
+    if (stat(filename, &st) || !S_ISREG(st.st_mode))
+        return -1;
+    *size = st.st_size;
+    *mtime = st.st_mtime;
+    return 0;
+}
+
+probe_cache *probe_cache_load(const char *dir, const char *oshash,
+                              const char *filename) {
+    probe_cache *pc = NULL;
+    char magic[8], *name;
+    int64_t size, mtime;
+    FILE *f;
+    int i;
+
+    if (file_stat(filename, &size, &mtime) < 0 ||
+        !(name = entry_name(dir, oshash)))
+        return NULL;
+    f = fopen(name, "rb");
+    av_free(name);
+    if (!f)
+        return NULL;
+
+    if (!(pc = av_mallocz(sizeof(*pc))) ||
+        fread(magic, sizeof(magic), 1, f) != 1 ||
+        memcmp(magic, PROBE_CACHE_MAGIC, sizeof(magic)) ||
+        fread(&pc->header, sizeof(pc->header), 1, f) != 1 ||
+        pc->header.version != PROBE_CACHE_VERSION ||
+        pc->header.header_size != sizeof(probe_header) ||
+        pc->header.stream_size != sizeof(probe_stream) ||
+        pc->header.index_entry_size != sizeof(AVIndexEntry) ||
+        pc->header.file_size != size || pc->header.file_mtime != mtime ||
+        pc->header.nb_streams < 0 || pc->header.nb_streams > PROBE_CACHE_MAX_STREAMS)
+        goto fail;
+
+    pc->streams = av_mallocz_array(pc->header.nb_streams, sizeof(*pc->streams));
+    pc->extradata = av_mallocz_array(pc->header.nb_streams, sizeof(*pc->extradata));
+    pc->index = av_mallocz_array(pc->header.nb_streams, sizeof(*pc->index));
+    if (pc->header.nb_streams && (!pc->streams || !pc->extradata || !pc->index))
+        goto fail;
+
+    for (i = 0; i < pc->header.nb_streams; i++) {
+        probe_stream *ps = &pc->streams[i];
+
+        if (fread(ps, sizeof(*ps), 1, f) != 1 ||
+            ps->extradata_size < 0 || ps->extradata_size > PROBE_CACHE_MAX_EXTRADATA ||
+            ps->nb_index_entries < 0 || ps->nb_index_entries > PROBE_CACHE_MAX_INDEX)
+            goto fail;
+        if (ps->extradata_size &&
+            (!(pc->extradata[i] = av_malloc(ps->extradata_size)) ||
+             fread(pc->extradata[i], ps->extradata_size, 1, f) != 1))
+            goto fail;
+        if (ps->nb_index_entries &&
+            (!(pc->index[i] = av_malloc_array(ps->nb_index_entries, sizeof(AVIndexEntry))) ||
+             fread(pc->index[i], sizeof(AVIndexEntry), ps->nb_index_entries, f) != ps->nb_index_entries))
+            goto fail;
+    }
+    fclose(f);
+    return pc;
+
+fail:
+    fclose(f);
+    probe_cache_free(pc);
+    return NULL;
+}
+
+void probe_cache_save(probe_cache *pc, const char *dir, const char *oshash,
+                      const char *filename) {
+    char *name = entry_name(dir, oshash);
+    char *tmp_name = av_asprintf("%s/%s.probe.%d", dir, oshash, getpid());
+    FILE *f = NULL;
+    int i, ok;
+
+    if (!name || !tmp_name ||
+        file_stat(filename, &pc->header.file_size, &pc->header.file_mtime) < 0 ||
+        !(f = fopen(tmp_name, "wb"))) {
+        av_free(name);
+        av_free(tmp_name);
+        return;
+    }
+
+    ok = fwrite(PROBE_CACHE_MAGIC, 8, 1, f) == 1 &&
+         fwrite(&pc->header, sizeof(pc->header), 1, f) == 1;
+    for (i = 0; ok && i < pc->header.nb_streams; i++) {
+        probe_stream *ps = &pc->streams[i];
+        ok = fwrite(ps, sizeof(*ps), 1, f) == 1 &&
+             (!ps->extradata_size ||
+              fwrite(pc->extradata[i], ps->extradata_size, 1, f) == 1) &&
+             (!ps->nb_index_entries ||
+              fwrite(pc->index[i], sizeof(AVIndexEntry), ps->nb_index_entries, f) == ps->nb_index_entries);
+    }
+    /* several jobs may work on the same input, the last one wins */
+    if (fclose(f) || !ok || rename(tmp_name, name)) {
+        fprintf(stderr, "  Unable to write the probe cache entry `%s'.\n", name);
+        unlink(tmp_name);
+    }
+    av_free(name);
+    av_free(tmp_name);
+}
+
+void probe_cache_free(probe_cache *pc) {
+    int i;
+
+    if (!pc)
+        return;
+    for (i = 0; i < pc->header.nb_streams; i++) {
+        if (pc->extradata)
+            av_free(pc->extradata[i]);
+        if (pc->index)
+            av_free(pc->index[i]);
+    }
+    av_free(pc->streams);
+    av_free(pc->extradata);
+    av_free(pc->index);
+    av_free(pc);
+}
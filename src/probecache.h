@@ -0,0 +1,51 @@
+/* -*- tab-width:4;c-file-style:"cc-mode"; -*- */
+/*
+ * probecache.h -- remember what avformat_find_stream_info found in an input
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with This program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef _F2T_PROBECACHE_H_
+#define _F2T_PROBECACHE_H_
+
+#include "libavformat/avformat.h"
+
+typedef struct probe_cache probe_cache;
+
+/**
+ * Takes the stream parameters, codec extradata and duration of ic, right
+ * after avformat_find_stream_info. The keyframe index is added later with
+ * probe_cache_update_index, once the input has been read.
+ */
+extern probe_cache *probe_cache_create(AVFormatContext *ic);
+/**
+ * Sets the parameters from the cache on the streams of ic, just opened,
+ * instead of calling avformat_find_stream_info. Returns 0 and leaves ic
+ * alone if its streams don't match those in the cache.
+ */
+extern int probe_cache_apply(probe_cache *pc, AVFormatContext *ic);
+/* Takes the keyframe index of ic if it has more entries, returns 1 then. */
+extern int probe_cache_update_index(probe_cache *pc, AVFormatContext *ic);
+
+/**
+ * The entry of filename in the cache directory dir is named after its
+ * oshash and only used while the size and modification time of the file
+ * are the same as when it was saved. Returns NULL without a valid entry.
+ */
+extern probe_cache *probe_cache_load(const char *dir, const char *oshash,
+                                     const char *filename);
+extern void probe_cache_save(probe_cache *pc, const char *dir, const char *oshash,
+                             const char *filename);
+extern void probe_cache_free(probe_cache *pc);
+
+#endif
@@ -60,31 +60,46 @@
 #include "kate/oggkate.h"
 #endif
 
+#include "libavutil/time.h"
+
 #include "theorautils.h"
 
 
 void init_info(oggmux_info *info) {
     info->output_seekable = MAYBE_SEEKABLE;
+    info->output_buffer = NULL;
+    info->output_buffer_size = OUTPUT_BUFFER_SIZE;
+    info->output_buffer_len = 0;
+    info->output_offset = 0;
+    info->output_length = 0;
     info->with_skeleton = 1; /* skeleton is enabled by default    */
     info->skeleton_3 = 0; /* by default, output skeleton 4 with keyframe indexes. */
     info->index_interval = 2000;
     info->theora_index_reserve = -1;
+    info->adaptive_index = 0;
     info->vorbis_index_reserve = -1;
     info->kate_index_reserve = -1;
     info->indexing_complete = 0;
+    info->page_policy = PAGE_POLICY_DEFAULT;
+    info->page_stats = 0;
+    info->live = 0;
+    info->max_delay = 500;
     info->frontend = NULL; /*frontend mode*/
+    info->no_stats = 0;
     info->videotime =  0;
     info->audiotime = 0;
     info->audio_bytesout = 0;
     info->video_bytesout = 0;
     info->kate_bytesout = 0;
 
-    info->videopage_valid = 0;
-    info->audiopage_valid = 0;
-    info->audiopage_buffer_length = 0;
-    info->videopage_buffer_length = 0;
-    info->audiopage = NULL;
-    info->videopage = NULL;
+    info->streams = NULL;
+    info->n_streams = 0;
+    info->video_stream = -1;
+    info->page_heap = NULL;
+    info->page_heap_size = 0;
+    info->streams_waiting = 0;
+    info->changed_streams = NULL;
+    info->n_changed_streams = 0;
     info->start_time = time(NULL);
     info->duration = -1;
     info->speed_level = -1;
@@ -101,15 +116,32 @@ void init_info(oggmux_info *info) {
     info->twopass_file = NULL;
     info->twopass = 0;
     info->passno = 0;
+    info->twopass_data = NULL;
+    info->twopass_size = 0;
+    info->twopass_capacity = 0;
+    info->twopass_pos = 0;
 
     info->with_kate = 0;
     info->n_kate_streams = 0;
     info->kate_streams = NULL;
 
-    info->prev_vorbis_window = -1;
+    info->n_audio_streams = 0;
+    info->audio_streams = NULL;
+
     info->content_offset = 0;
 
     info->serialno = 0;
+
+    memset(&info->video_packets, 0, sizeof(info->video_packets));
+
+    info->frame_times = NULL;
+    info->frame_times_head = 0;
+    info->n_frame_times = 0;
+    info->frame_times_capacity = 0;
+    info->delay = 0;
+    info->max_delay_seen = 0;
+    info->delay_sum = 0;
+    info->delay_count = 0;
 }
 
 void oggmux_setup_kate_streams(oggmux_info *info, int n_kate_streams)
@@ -122,11 +154,27 @@ void oggmux_setup_kate_streams(oggmux_info *info, int n_kate_streams)
     info->kate_streams = (oggmux_kate_stream*)malloc(n_kate_streams*sizeof(oggmux_kate_stream));
     for (n=0; n<n_kate_streams; ++n) {
         oggmux_kate_stream *ks=info->kate_streams+n;
-        ks->katepage_valid = 0;
-        ks->katepage_buffer_length = 0;
-        ks->katepage = NULL;
-        ks->katetime = 0;
         ks->last_end_time = -1;
+        ks->stream = -1;
+    }
+}
+
+void oggmux_setup_audio_streams(oggmux_info *info, int n_audio_streams)
+{
+    int n;
+
+    info->n_audio_streams = n_audio_streams;
+    info->audio_streams = NULL;
+    if (n_audio_streams == 0) return;
+    info->audio_streams = (oggmux_audio_stream*)calloc(n_audio_streams, sizeof(oggmux_audio_stream));
+    if (!info->audio_streams) {
+        fprintf(stderr, "ERROR: malloc failure in oggmux_setup_audio_streams\n");
+        exit(1);
+    }
+    for (n=0; n<n_audio_streams; ++n) {
+        oggmux_audio_stream *as=info->audio_streams+n;
+        as->prev_vorbis_window = -1;
+        as->stream = -1;
     }
 }
 
@@ -157,63 +205,131 @@ static void write64le(unsigned char *ptr,ogg_int64_t v)
     ptr[7]=(hi>>24)&0xff;
 }
 
-/* Write an ogg page to the output file. The first time this is called, we
-   determine the seekable-ness of the output stream, and store the result
-   in info->output_seekable. */
-static void
-write_page(oggmux_info* info, ogg_page* page)
+/* Pages are collected in output_buffer and written with a single fwrite
+   once it is full. outfile is unbuffered, so that is one write for the
+   whole buffer instead of a few per page, and the file offset is tracked
+   here instead of asking ftello for every page. */
+static void output_flush(oggmux_info *info)
 {
-    int x;
-    assert(page->header_len > 0);
-    x = fwrite(page->header, 1, page->header_len, info->outfile);
-    if (x != page->header_len) {
-        fprintf(stderr, "FAILURE: Failed to write page header to disk!\n");
+    if (info->output_buffer_len == 0)
+        return;
+    if (fwrite(info->output_buffer, 1, info->output_buffer_len, info->outfile)
+        != info->output_buffer_len) {
+        fprintf(stderr, "FAILURE: Failed to write pages to disk!\n");
         exit(1);
     }
-    x = fwrite(page->body, 1, page->body_len, info->outfile);
-    if (x != page->body_len) {
-        fprintf(stderr, "FAILURE: Failed to write page body to disk!\n");
-        exit(1);
+    info->output_offset += info->output_buffer_len;
+    info->output_buffer_len = 0;
+}
+
+static ogg_int64_t output_tell(oggmux_info *info)
+{
+    return info->output_offset + info->output_buffer_len;
+}
+
+static int output_seek(oggmux_info *info, ogg_int64_t offset)
+{
+    output_flush(info);
+    if (fseeko(info->outfile, offset, SEEK_SET) < 0)
+        return -1;
+    info->output_offset = offset;
+    return 0;
+}
+
+static void output_write(oggmux_info *info, const unsigned char *data, long len)
+{
+    if (info->output_buffer_len + len > info->output_buffer_size) {
+        output_flush(info);
+        if (len > info->output_buffer_size) {
+            /* larger than the whole buffer, no point in copying it */
+            if (fwrite(data, 1, len, info->outfile) != len) {
+                fprintf(stderr, "FAILURE: Failed to write pages to disk!\n");
+                exit(1);
+            }
+            info->output_offset += len;
+            len = 0;
+        }
     }
-    if (info->output_seekable == MAYBE_SEEKABLE) {
-        /* This is our first page write. Determine if the output
-           is seekable. */
-        ogg_int64_t offset = ftello(info->outfile);
-        if (offset == -1 || fseeko(info->outfile, 0, SEEK_SET) < 0) {
-            info->output_seekable = NOT_SEEKABLE;
-        } else {
-            /* Output appears to be seekable, seek the write cursor back
-               to previous position. */
-            info->output_seekable = SEEKABLE;
-            assert(info->output_seekable > 0);
-            if (fseeko(info->outfile, offset, SEEK_SET) < 0) {
-                fprintf(stderr, "ERROR: failed to seek in seekable output file!?!\n");
-                exit (1);
-            }  
+    memcpy(info->output_buffer + info->output_buffer_len, data, len);
+    info->output_buffer_len += len;
+    if (output_tell(info) > info->output_length)
+        info->output_length = output_tell(info);
+}
+
+/* Moves everything in outfile from offset on delta bytes further into the
+   file, a buffer at a time and starting at the end, so that nothing is
+   overwritten before it has been moved. Returns -1 without changing the
+   file if outfile can't be read from. */
+static int output_move(oggmux_info *info, ogg_int64_t offset, ogg_int64_t delta)
+{
+    ogg_int64_t end = info->output_length;
+    long len;
+
+    output_flush(info);
+    while (end > offset) {
+        len = end - offset < info->output_buffer_size
+            ? (long)(end - offset) : info->output_buffer_size;
+        end -= len;
+        if (fseeko(info->outfile, end, SEEK_SET) < 0 ||
+            fread(info->output_buffer, 1, len, info->outfile) != len) {
+            if (end + len == info->output_length) {
+                clearerr(info->outfile);
+                return -1;
+            }
+            fprintf(stderr, "FAILURE: Failed to read pages back from disk!\n");
+            exit(1);
+        }
+        if (fseeko(info->outfile, end + delta, SEEK_SET) < 0 ||
+            fwrite(info->output_buffer, 1, len, info->outfile) != len) {
+            fprintf(stderr, "FAILURE: Failed to write pages to disk!\n");
+            exit(1);
         }
     }
+    info->output_length += delta;
+    return 0;
+}
+
+/* Sets up the output buffer and determines the seekable-ness of the output
+   stream, storing the result in info->output_seekable. */
+static void output_init(oggmux_info *info)
+{
+    ogg_int64_t offset;
+
+    info->output_buffer = malloc(info->output_buffer_size);
+    if (!info->output_buffer) {
+        fprintf(stderr, "ERROR: Failed to allocate the output buffer\n");
+        exit(1);
+    }
+    setvbuf(info->outfile, NULL, _IONBF, 0);
+
+    /* a live stream is never gone back to, wherever it goes */
+    offset = info->live ? -1 : ftello(info->outfile);
+    if (offset == -1 || fseeko(info->outfile, offset, SEEK_SET) < 0) {
+        info->output_seekable = NOT_SEEKABLE;
+        offset = 0;
+    } else {
+        info->output_seekable = SEEKABLE;
+    }
+    info->output_offset = info->output_length = offset;
+}
+
+/* Write an ogg page to the output file. */
+static void
+write_page(oggmux_info* info, ogg_page* page)
+{
+    assert(page->header_len > 0);
+    output_write(info, page->header, page->header_len);
+    output_write(info, page->body, page->body_len);
     /* We should know the seekableness by now... */
     assert(info->output_seekable != MAYBE_SEEKABLE);
 }
 
 static ogg_int64_t output_file_length(oggmux_info* info)
 {
-    ogg_int64_t offset, length;
     if (info->skeleton_3 || !info->indexing_complete) {
         return -1;
     }
-    offset = ftello(info->outfile);
-    if (fseeko(info->outfile, 0, SEEK_END) < 0) {
-        fprintf(stderr, "ERROR: Can't seek output file to write index!\n");
-        return -1;
-    }
-    length = ftello(info->outfile);
-    if (fseeko(info->outfile, offset, SEEK_SET) < 0) {
-        fprintf(stderr, "ERROR: Can't seek output file to write index!\n");
-        return -1;
-    }
-
-    return length;
+    return info->output_length;
 }
 
 
@@ -263,8 +379,8 @@ const char* theora_message_headers = "Content-Type: video/theora\r\n"
                                      "Name: video_1\r\n";
 
 const char* vorbis_message_headers = "Content-Type: audio/vorbis\r\n"
-                                     "Role: audio/main\r\n"
-                                     "Name: audio_1\r\n";
+                                     "Role: audio/%s\r\n"
+                                     "Name: audio_%d\r\n";
 #ifdef HAVE_KATE
 const char* kate_message_headers =   "Content-Type: application/x-kate\r\n\r\n"
                                      "Role: text/subtitle\r\n";
@@ -277,6 +393,7 @@ const char* kate_message_headers =   "Content-Type: application/x-kate\r\n\r\n"
 void add_fisbone_packet (oggmux_info *info) {
     ogg_packet op;
     size_t packet_size = 0;
+    int n;
     if (!info->audio_only) {
         memset (&op, 0, sizeof (op));
         packet_size = FISBONE_SIZE + strlen(theora_message_headers);
@@ -306,9 +423,20 @@ void add_fisbone_packet (oggmux_info *info) {
         _ogg_free (op.packet);
     }
 
-    if (!info->video_only) {
+    for (n=0; n<info->n_audio_streams; ++n) {
+        oggmux_audio_stream *as=info->audio_streams+n;
+        char message_headers[128];
+        int message_headers_len;
+        /* the first audio stream is the main one, the others are
+           alternatives to it, e.g. in another language */
+        message_headers_len = snprintf(message_headers, sizeof(message_headers),
+                                       vorbis_message_headers, n ? "alternate" : "main", n+1);
+        if (as->language[0])
+            message_headers_len += snprintf(message_headers+message_headers_len,
+                                            sizeof(message_headers)-message_headers_len,
+                                            "Language: %s\r\n", as->language);
         memset (&op, 0, sizeof (op));
-        packet_size = FISBONE_SIZE + strlen(vorbis_message_headers);
+        packet_size = FISBONE_SIZE + message_headers_len;
         op.packet = _ogg_calloc (packet_size, sizeof(unsigned char));
         if (op.packet == NULL) return;
 
@@ -316,15 +444,15 @@ void add_fisbone_packet (oggmux_info *info) {
         /* it will be the fisbone packet for the vorbis audio */
         memcpy (op.packet, FISBONE_IDENTIFIER, 8); /* identifier */
         write32le(op.packet+8, FISBONE_MESSAGE_HEADER_OFFSET); /* offset of the message header fields */
-        write32le(op.packet+12, info->vo.serialno); /* serialno of the vorbis stream */
+        write32le(op.packet+12, as->vo.serialno); /* serialno of the vorbis stream */
         write32le(op.packet+16, 3); /* number of header packet */
         /* granulerate, temporal resolution of the bitstream in Hz */
-        write64le(op.packet+20, info->sample_rate); /* granulerate numerator */
+        write64le(op.packet+20, as->sample_rate); /* granulerate numerator */
         write64le(op.packet+28, (ogg_int64_t)1); /* granulerate denominator */
         write64le(op.packet+36, 0); /* start granule */
         write32le(op.packet+44, 2); /* preroll, for vorbis its 2 */
         *(op.packet+48) = 0; /* granule shift, always 0 for vorbis */
-        memcpy(op.packet+FISBONE_SIZE, vorbis_message_headers, strlen(vorbis_message_headers));
+        memcpy(op.packet+FISBONE_SIZE, message_headers, message_headers_len);
 
         /* Important: Check the case of Content-Type for correctness */
 
@@ -446,7 +574,7 @@ static int write_index_placeholder_for_stream (oggmux_info *info,
 
     /* Remember where we wrote the index pages, so that we can overwrite them
        once we've encoded the entire file. */
-    index->page_location = ftello(info->outfile);
+    index->page_location = output_tell(info);
 
     /* There should be no packets in the stream. */
     assert(ogg_stream_flush(&info->so, &og) == 0);
@@ -506,21 +634,33 @@ typedef struct {
     ogg_int64_t time;
 } keypoint;
 
-/* Overwrites pages on disk for a stream's index with actual index data. */
+/* A stream's index, in the order the index packets are in the file. */
+typedef struct {
+    seek_index* index;
+    const char* name;
+    ogg_uint32_t serialno;
+    int target_packet;
+    int num_headers;
+    /* size of the index packet once it has been grown to fit */
+    int packet_size;
+} index_stream;
+
+/* Spare bytes left in an index grown by --adaptive-index, so that it isn't
+   grown again for a few bytes. */
+#define INDEX_GROWTH_SLACK 10
+
+/* Chooses the keyframes for a stream's index, at most max_keypoints of them.
+   Returns the number of keypoints stored in *keypoints_out, or -1 if they
+   can't be allocated. */
 static int
-write_index_pages (seek_index* index,
-                   const char* name,
-                   oggmux_info *info,
-                   ogg_uint32_t serialno,
-                   int target_packet,
-                   int num_headers)
+find_keypoints (seek_index* index,
+                int target_packet,
+                int num_headers,
+                int max_keypoints,
+                keypoint** keypoints_out)
 {
-    ogg_packet op;
-    ogg_page og;
     int i;
     int k = 0;
-    int result;
-    int num_keypoints;
     int packetno;
     int last_packetno = num_headers-1; /* Take into account header packets... */
     keypoint* keypoints = 0;
@@ -528,35 +668,16 @@ write_index_pages (seek_index* index,
     int prev_keyframe_pageno = -INT_MAX;
     ogg_int64_t prev_keyframe_start_time = -INT_MAX;
     int packet_in_page = 0;
-    unsigned char* p = 0;
-    ogg_int64_t prev_offset = 0;
-    ogg_int64_t prev_time = 0;
-    const unsigned char* limit = 0;
-    int index_bytes = 0;  
-    int keypoints_cutoff = 0;
-
-    /* Must have indexed keypoints to go on */
-    if (index->max_keypoints == 0 || index->packet_num == 0) {
-      fprintf(stderr, "WARNING: no key points for %s stream %08x\n", name, serialno);
-      return 0;
-    }
-
-    /* Must have placeholder packet to rewrite. */
-    assert(index->page_location > 0);
-
-    num_keypoints = index->max_keypoints;
 
     /* Calculate and store the keypoints. */
-    keypoints = (keypoint*)malloc(sizeof(keypoint) * num_keypoints);
+    keypoints = (keypoint*)malloc(sizeof(keypoint) * max_keypoints);
     if (!keypoints) {
         fprintf(stderr, "ERROR: malloc failure in rewrite_index_page\n");
         return -1;
     }
-    memset(keypoints, -1, sizeof(keypoint) * num_keypoints);
+    memset(keypoints, -1, sizeof(keypoint) * max_keypoints);
 
-    prev_offset = 0;
-    prev_time = 0;
-    for (i=0; i < index->packet_num && k < num_keypoints; i++) {
+    for (i=0; i < index->packet_num && k < max_keypoints; i++) {
         packetno = index->packets[i].packetno;
         /* Increment pageno until we find the page which contains the start of
          * the keyframe's packet. */
@@ -587,31 +708,100 @@ write_index_pages (seek_index* index,
         /* Add to final keyframe index. */        
         keypoints[k].offset = index->pages[pageno].offset;
         keypoints[k].time = index->packets[i].start_time;
-        
-        /* Count how many bytes is required to encode this keypoint. */
-        index_bytes += bytes_required(keypoints[k].offset - prev_offset);
-        prev_offset = keypoints[k].offset;
-        index_bytes += bytes_required(keypoints[k].time - prev_time);
-        prev_time = keypoints[k].time;
-
         k++;
 
-        if (index_bytes < index->packet_size) {
-            keypoints_cutoff = k;
+        prev_keyframe_start_time = index->packets[i].start_time;
+    }
+
+    *keypoints_out = keypoints;
+    return k;
+}
+
+/* Counts how many bytes are required to encode num_keypoints keypoints, and
+   how many of them fit into packet_size bytes. */
+static int
+keypoints_bytes (const keypoint* keypoints,
+                 int num_keypoints,
+                 int packet_size,
+                 int* keypoints_cutoff)
+{
+    int i;
+    int index_bytes = 0;
+    ogg_int64_t prev_offset = 0;
+    ogg_int64_t prev_time = 0;
+
+    *keypoints_cutoff = 0;
+    for (i=0; i<num_keypoints; i++) {
+        index_bytes += bytes_required(keypoints[i].offset - prev_offset);
+        prev_offset = keypoints[i].offset;
+        index_bytes += bytes_required(keypoints[i].time - prev_time);
+        prev_time = keypoints[i].time;
+
+        if (index_bytes < packet_size) {
+            *keypoints_cutoff = i + 1;
         }
+    }
+    return index_bytes;
+}
 
-        prev_keyframe_start_time = index->packets[i].start_time;
+/* Overwrites pages on disk for a stream's index with actual index data.
+   If the index pages have been moved, the pages of a stream without
+   keypoints are written again too. */
+static int
+write_index_pages (seek_index* index,
+                   const char* name,
+                   oggmux_info *info,
+                   ogg_uint32_t serialno,
+                   int target_packet,
+                   int num_headers,
+                   int moved)
+{
+    ogg_packet op;
+    ogg_page og;
+    int i;
+    int result;
+    int num_keypoints = 0;
+    int max_keypoints;
+    keypoint* keypoints = 0;
+    unsigned char* p = 0;
+    ogg_int64_t prev_offset = 0;
+    ogg_int64_t prev_time = 0;
+    const unsigned char* limit = 0;
+    int index_bytes = 0;  
+    int keypoints_cutoff = 0;
+
+    /* An adaptive index isn't limited by the duration estimate, it has been
+       grown to fit all keyframes. */
+    max_keypoints = info->adaptive_index ? index->packet_num : index->max_keypoints;
+
+    /* Must have indexed keypoints to go on */
+    if (max_keypoints == 0 || index->packet_num == 0) {
+      fprintf(stderr, "WARNING: no key points for %s stream %08x\n", name, serialno);
+      if (!moved)
+          return 0;
+    } else {
+        num_keypoints = find_keypoints(index, target_packet, num_headers,
+                                       max_keypoints, &keypoints);
+        if (num_keypoints == -1)
+            return -1;
     }
+
+    /* Must have placeholder packet to rewrite. */
+    assert(index->page_location > 0);
+
+    index_bytes = keypoints_bytes(keypoints, num_keypoints,
+                                  index->packet_size, &keypoints_cutoff);
     if (index_bytes > index->packet_size) {
-        printf("WARNING: Underestimated space for %s keyframe index, dropped %d keyframes, "
+        fprintf(stderr, "WARNING: Underestimated space for %s keyframe index, dropped %d keyframes, "
                "only part of the file may be indexed. Rerun with --%s-index-reserve %d to "
                "ensure a complete index, or use OggIndex to re-index.\n",
-               name, (k - keypoints_cutoff), name, index_bytes);
-    } else if (index_bytes < index->packet_size &&
+               name, (num_keypoints - keypoints_cutoff), name, index_bytes);
+    } else if (!info->adaptive_index &&
+               index_bytes < index->packet_size &&
                index->packet_size - index_bytes > 10000)
     {
         /* We over estimated the index size by 10,000 bytes or more. */
-        printf("Allocated %d bytes for %s keyframe index, %d are unused. "
+        fprintf(stderr, "Allocated %d bytes for %s keyframe index, %d are unused. "
                "Index contains %d keyframes. "
                "Rerun with '--%s-index-reserve %d' to encode with the optimal sized %s index,"
                " or use OggIndex to re-index.\n",
@@ -630,11 +820,13 @@ write_index_pages (seek_index* index,
         return -1;
     }
 
-    /* Write first sample time numerator. */
-    write64le(op.packet+26, index->start_time);
+    if (keypoints) {
+        /* Write first sample time numerator. */
+        write64le(op.packet+26, index->start_time);
 
-    /* Write last sample time numerator. */
-    write64le(op.packet+34, index->end_time);
+        /* Write last sample time numerator. */
+        write64le(op.packet+34, index->end_time);
+    }
    
     /* Write keypoint data into packet. */
     p = op.packet + 42;
@@ -658,7 +850,7 @@ write_index_pages (seek_index* index,
     free(op.packet);
 
     /* Seek to location of existing index pages. */
-    if (fseeko(info->outfile, index->page_location, SEEK_SET) < 0) {
+    if (output_seek(info, index->page_location) < 0) {
         fprintf(stderr, "ERROR: Can't seek output file to write index.!\n");
         return -1;
     }
@@ -679,6 +871,195 @@ write_index_pages (seek_index* index,
     return 0;
 }
 
+static void
+set_index_stream (index_stream* stream,
+                  seek_index* index,
+                  const char* name,
+                  ogg_uint32_t serialno,
+                  int target_packet,
+                  int num_headers)
+{
+    stream->index = index;
+    stream->name = name;
+    stream->serialno = serialno;
+    stream->target_packet = target_packet;
+    stream->num_headers = num_headers;
+    stream->packet_size = index->packet_size;
+}
+
+/* Lists the indexed streams in the order write_placeholder_index_pages
+   wrote their index packets. Returns the number of streams, or -1 if the
+   list can't be allocated. */
+static int get_index_streams (oggmux_info* info, index_stream** streams_out)
+{
+    index_stream* streams;
+    int max_streams = 1 + info->n_audio_streams;
+    int n = 0;
+    int i;
+
+#ifdef HAVE_KATE
+    if (info->with_kate)
+        max_streams += info->n_kate_streams;
+#endif
+    streams = (index_stream*)malloc(sizeof(index_stream) * max_streams);
+    if (!streams) {
+        fprintf(stderr, "ERROR: malloc failure in write_seek_index\n");
+        return -1;
+    }
+
+    if (!info->audio_only)
+        set_index_stream(&streams[n++], &info->theora_index, "theora",
+                         info->to.serialno, 1, 3);
+    for (i=0; i<info->n_audio_streams; ++i) {
+        oggmux_audio_stream *as=info->audio_streams+i;
+        set_index_stream(&streams[n++], &as->index, "vorbis",
+                         as->vo.serialno, 2, 3);
+    }
+#ifdef HAVE_KATE
+    if (info->with_kate) {
+        for (i=0; i<info->n_kate_streams; ++i) {
+            oggmux_kate_stream *ks=info->kate_streams+i;
+            set_index_stream(&streams[n++], &ks->index, "kate",
+                             ks->ko.serialno, 1, ks->ki.num_headers);
+        }
+    }
+#endif
+
+    *streams_out = streams;
+    return n;
+}
+
+/* Returns the number of bytes write_index_pages writes for an index packet
+   with room for packet_size bytes of keypoints. */
+static ogg_int64_t index_pages_bytes (ogg_uint32_t serialno, int packet_size)
+{
+    ogg_stream_state os;
+    ogg_packet op;
+    ogg_page og;
+    ogg_int64_t bytes = 0;
+
+    if (create_index_packet(packet_size, &op, serialno, 0) == -1) {
+        fprintf(stderr, "ERROR: malloc failure in write_seek_index\n");
+        exit(1);
+    }
+    ogg_stream_init(&os, serialno);
+    ogg_stream_packetin(&os, &op);
+    free(op.packet);
+    while (ogg_stream_pageout(&os, &og))
+        bytes += og.header_len + og.body_len;
+    if (ogg_stream_flush(&os, &og))
+        bytes += og.header_len + og.body_len;
+    ogg_stream_clear(&os);
+    return bytes;
+}
+
+/* Counts the bytes the keypoints of a stream take once everything they
+   point to has moved by delta bytes. Sets *fits if they fit the reserve.
+   Returns -1 if the keypoints can't be allocated. */
+static int moved_index_bytes (index_stream* stream, ogg_int64_t delta, int* fits)
+{
+    seek_index* index = stream->index;
+    keypoint* keypoints;
+    int num_keypoints;
+    int keypoints_cutoff;
+    int index_bytes;
+    int i;
+
+    *fits = 1;
+    if (index->packet_num == 0)
+        return 0;
+    num_keypoints = find_keypoints(index,
+                                   stream->target_packet,
+                                   stream->num_headers,
+                                   index->packet_num,
+                                   &keypoints);
+    if (num_keypoints == -1)
+        return -1;
+    for (i=0; i<num_keypoints; i++)
+        keypoints[i].offset += delta;
+    index_bytes = keypoints_bytes(keypoints, num_keypoints,
+                                  stream->packet_size, &keypoints_cutoff);
+    free(keypoints);
+    *fits = keypoints_cutoff == num_keypoints;
+    return index_bytes;
+}
+
+/* With --adaptive-index, the reserve written before encoding is only an
+   estimate. Once all keyframes are known, every index that is too small
+   for them is grown to fit, and everything after the skeleton headers is
+   moved further into the file to make room. Only the data that follows the
+   indexes is moved, nothing is encoded again, but all of it is copied.
+   Returns 1 if the indexes have been moved, 0 if they haven't and -1 on
+   failure. */
+static int grow_index_pages (oggmux_info* info,
+                             index_stream* streams,
+                             int num_streams)
+{
+    ogg_int64_t old_bytes = 0;
+    ogg_int64_t new_bytes = 0;
+    ogg_int64_t location;
+    ogg_int64_t delta = 0;
+    int grown;
+    int i, j;
+
+    for (i=0; i<num_streams; i++) {
+        seek_index* index = streams[i].index;
+
+        /* The placeholders must follow each other for them to be moved. */
+        if (i > 0 &&
+            index->page_location != streams[0].index->page_location + old_bytes)
+        {
+            return 0;
+        }
+        old_bytes += index_pages_bytes(streams[i].serialno, index->packet_size);
+    }
+
+    /* Growing one index moves what every index points to, and larger
+       offsets can take more bytes to encode. So the sizes are worked out
+       again with the offsets moved, until no index has to grow any more. */
+    do {
+        grown = 0;
+        new_bytes = 0;
+        for (i=0; i<num_streams; i++) {
+            int fits;
+            int index_bytes = moved_index_bytes(&streams[i], delta, &fits);
+            if (index_bytes == -1)
+                return -1;
+            if (!fits) {
+                streams[i].packet_size = index_bytes + INDEX_GROWTH_SLACK;
+                grown = 1;
+            }
+            new_bytes += index_pages_bytes(streams[i].serialno, streams[i].packet_size);
+        }
+        delta = new_bytes - old_bytes;
+    } while (grown);
+    if (delta == 0)
+        return 0;
+
+    if (output_move(info, info->content_offset, delta) == -1) {
+        fprintf(stderr, "WARNING: Can't read back output file to grow the "
+                        "keyframe indexes, they may be incomplete.\n");
+        return 0;
+    }
+
+    /* Everything the indexes point to has moved by delta bytes. */
+    location = streams[0].index->page_location;
+    for (i=0; i<num_streams; i++) {
+        seek_index* index = streams[i].index;
+        for (j=0; j<index->pages_num; j++)
+            index->pages[j].offset += delta;
+        if (streams[i].packet_size != index->packet_size) {
+            fprintf(stderr, "Grew %s keyframe index from %d to %d bytes.\n",
+                    streams[i].name, index->packet_size, streams[i].packet_size);
+            index->packet_size = streams[i].packet_size;
+        }
+        index->page_location = location;
+        location += index_pages_bytes(streams[i].serialno, index->packet_size);
+    }
+    info->content_offset += delta;
+    return 1;
+}
+
 /* Overwrites existing skeleton index placeholder packets with valid keyframe
    index data. Must only be called once we've constructed the index data after
    encoding the entire file. */
@@ -686,10 +1067,27 @@ int write_seek_index (oggmux_info* info)
 {
     ogg_uint32_t serialno;
     ogg_page og;
+    ogg_packet op;
+    index_stream* streams;
+    int num_streams;
+    int moved = 0;
+    int i;
 
     /* We shouldn't write indexes for skeleton 3, it's a skeleton 4 feature. */
     assert(!info->skeleton_3);
 
+    num_streams = get_index_streams(info, &streams);
+    if (num_streams == -1)
+        return -1;
+
+    if (info->adaptive_index) {
+        moved = grow_index_pages(info, streams, num_streams);
+        if (moved == -1) {
+            free(streams);
+            return -1;
+        }
+    }
+
     /* Mark that we're done indexing. This causes the header packets' fields
        to be filled with valid, non-unknown values. */
     info->indexing_complete = 1;
@@ -708,8 +1106,9 @@ int write_seek_index (oggmux_info* info)
 
     /* Rewrite the skeleton BOS page. It will have changed to account for
        learning the start time, end time, and length. */
-    if (fseeko(info->outfile, 0, SEEK_SET) < 0) {
+    if (output_seek(info, 0) < 0) {
         fprintf(stderr, "ERROR: Can't seek output file to rewrite skeleton BOS!\n");
+        free(streams);
         return -1;
     }
     write_page (info, &og);
@@ -728,40 +1127,38 @@ int write_seek_index (oggmux_info* info)
     }
 
     /* Write a new line, so that when we print out indexing stats, it's on a new line. */
-    printf("\n");
-    if (!info->audio_only &&
-        write_index_pages(&info->theora_index,
-                          "theora",
-                          info,
-                          info->to.serialno,
-                          1,
-                          3) == -1)
-    {
-        return -1;
-    }
-    if (!info->video_only && 
-        write_index_pages(&info->vorbis_index,
-                          "vorbis",
-                          info,
-                          info->vo.serialno,
-                          2,
-                          3) == -1)
-    {
-        return -1;
+    fprintf(stderr, "\n");
+    for (i=0; i<num_streams; i++) {
+        if (write_index_pages(streams[i].index,
+                              streams[i].name,
+                              info,
+                              streams[i].serialno,
+                              streams[i].target_packet,
+                              streams[i].num_headers,
+                              moved) == -1)
+        {
+            free(streams);
+            return -1;
+        }
     }
+    free(streams);
 
-#ifdef HAVE_KATE
-    if (info->with_kate) {
-        int n;
-        for (n=0; n<info->n_kate_streams; ++n) {
-            oggmux_kate_stream *ks=info->kate_streams+n;
-            if (write_index_pages(&ks->index, "kate", info, ks->ko.serialno, 1, ks->ki.num_headers) == -1)
-            {
-                return -1;
-            }
+    if (moved) {
+        /* The skeleton e_o_s page follows the indexes, and its page number
+           changes when they take up more pages. */
+        memset (&op, 0, sizeof (op));
+        op.e_o_s = 1;
+        ogg_stream_packetin (&info->so, &op);
+        if (ogg_stream_flush(&info->so, &og) != 1) {
+            fprintf (stderr, "Internal Ogg library error.\n");
+            exit (1);
+        }
+        write_page (info, &og);
+        if (output_tell(info) != info->content_offset) {
+            fprintf(stderr, "ERROR: Grown keyframe indexes don't end where the content starts!\n");
+            return -1;
         }
     }
-#endif
 
     return 0;
 }
@@ -772,6 +1169,8 @@ int write_seek_index (oggmux_info* info)
    after encode when we add the index. */
 static int write_placeholder_index_pages (oggmux_info *info)
 {
+    int n;
+
     if (info->theora_index_reserve != -1) {
         info->theora_index.packet_size = info->theora_index_reserve;
     }
@@ -782,20 +1181,21 @@ static int write_placeholder_index_pages (oggmux_info *info)
     {
         return -1;
     }
-    if (info->vorbis_index_reserve != -1) {
-        info->vorbis_index.packet_size = info->vorbis_index_reserve;
-    }
-    if (!info->video_only &&
-        write_index_placeholder_for_stream(info,
-                                           &info->vorbis_index,
-                                           info->vo.serialno) == -1)
-    {
-        return -1;
+    for (n=0; n<info->n_audio_streams; ++n) {
+        oggmux_audio_stream *as=info->audio_streams+n;
+        if (info->vorbis_index_reserve != -1) {
+            as->index.packet_size = info->vorbis_index_reserve;
+        }
+        if (write_index_placeholder_for_stream(info,
+                                               &as->index,
+                                               as->vo.serialno) == -1)
+        {
+            return -1;
+        }
     }
 
 #ifdef HAVE_KATE
     if (info->with_kate) {
-        int n;
         for (n=0; n<info->n_kate_streams; ++n) {
             oggmux_kate_stream *ks=info->kate_streams+n;
             if (info->kate_index_reserve != -1) {
@@ -814,39 +1214,143 @@ static int write_placeholder_index_pages (oggmux_info *info)
     return 0;
 }
 
-void oggmux_init (oggmux_info *info) {
-    ogg_page og;
-    ogg_packet op;
-    int ret;
+static int add_stream(oggmux_info *info, int type, ogg_stream_state *os, seek_index *index)
+{
+    oggmux_stream *st = info->streams + info->n_streams;
+
+    memset(st, 0, sizeof(*st));
+    st->type = type;
+    st->os = os;
+    st->index = index;
+    if (type != OGGMUX_KATE)
+        info->streams_waiting++;
+    return info->n_streams++;
+}
 
-    /* yayness.  Set up Ogg output stream */
-    srand (time (NULL));
-    info->serialno = rand();
-    ogg_stream_init (&info->vo, info->serialno++);
+/* Sets up the streams oggmux_flush interleaves. */
+static void init_streams(oggmux_info *info)
+{
+    int n = 1 + info->n_audio_streams;
 
-    if (info->passno!=1) {
-        th_comment_add_tag(&info->tc, "ENCODER", PACKAGE_STRING);
-        vorbis_comment_add_tag(&info->vc, "ENCODER", PACKAGE_STRING);
-        if (strcmp(info->oshash, "0000000000000000") > 0) {
-            th_comment_add_tag(&info->tc, "SOURCE_OSHASH", info->oshash);
-            vorbis_comment_add_tag(&info->vc, "SOURCE_OSHASH", info->oshash);
+#ifdef HAVE_KATE
+    if (info->with_kate)
+        n += info->n_kate_streams;
+#endif
+    info->streams = malloc(n * sizeof(*info->streams));
+    info->page_heap = malloc(n * sizeof(*info->page_heap));
+    info->changed_streams = malloc(n * sizeof(*info->changed_streams));
+    if (!info->streams || !info->page_heap || !info->changed_streams) {
+        fprintf(stderr, "Failed to allocate memory\n");
+        exit(1);
+    }
+    info->n_streams = 0;
+    info->page_heap_size = 0;
+    info->streams_waiting = 0;
+    info->n_changed_streams = 0;
+#ifdef HAVE_KATE
+    if (info->with_kate) {
+        for (n = 0; n < info->n_kate_streams; n++) {
+            oggmux_kate_stream *ks = info->kate_streams + n;
+            ks->stream = add_stream(info, OGGMUX_KATE, &ks->ko, &ks->index);
+            info->streams[ks->stream].idx = n;
         }
     }
-
-    if (!info->audio_only) {
-        ogg_stream_init (&info->to, info->serialno++);
-        seek_index_init(&info->theora_index, info->index_interval);
+#endif
+    if (!info->audio_only)
+        info->video_stream = add_stream(info, OGGMUX_THEORA, &info->to, &info->theora_index);
+    for (n = 0; n < info->n_audio_streams; n++) {
+        oggmux_audio_stream *as = info->audio_streams + n;
+        as->stream = add_stream(info, OGGMUX_VORBIS, &as->vo, &as->index);
+        info->streams[as->stream].idx = n;
     }
-    /* init theora done */
+}
+
+/* Notes that stream s may have new pages for oggmux_flush. */
+static void stream_changed(oggmux_info *info, int s)
+{
+    if (!info->streams[s].changed) {
+        info->streams[s].changed = 1;
+        info->changed_streams[info->n_changed_streams++] = s;
+    }
+}
+
+/* Cuts everything in the ogg stream of stream s into pages, which wait
+   behind the page in og, so that the next packet starts a new page. */
+static void stream_cut_pages(oggmux_info *info, int s)
+{
+    oggmux_stream *st = info->streams + s;
+    ogg_page og;
+
+    while (ogg_stream_flush(st->os, &og) > 0) {
+        oggmux_queued_page *q;
+        long len = og.header_len + og.body_len;
+        if (st->n_queued == st->queued_capacity) {
+            int capacity = st->queued_capacity * 2 + 2;
+            q = realloc(st->queued, capacity * sizeof(*q));
+            if (!q) {
+                fprintf(stderr, "ERROR: malloc failure in stream_cut_pages\n");
+                exit(1);
+            }
+            memset(q + st->queued_capacity, 0, (capacity - st->queued_capacity) * sizeof(*q));
+            st->queued = q;
+            st->queued_capacity = capacity;
+        }
+        q = st->queued + st->n_queued++;
+        if (q->size < len) {
+            q->data = realloc(q->data, len);
+            q->size = len;
+        }
+        memcpy(q->data, og.header, og.header_len);
+        memcpy(q->data + og.header_len, og.body, og.body_len);
+        q->header_len = og.header_len;
+        q->body_len = og.body_len;
+    }
+    stream_changed(info, s);
+}
+
+void oggmux_init (oggmux_info *info) {
+    ogg_page og;
+    ogg_packet op;
+    int ret, n;
+
+    init_streams(info);
+
+    /* yayness.  Set up Ogg output stream */
+    srand (time (NULL));
+    info->serialno = rand();
+    for (n=0; n<info->n_audio_streams; ++n)
+        ogg_stream_init (&info->audio_streams[n].vo, info->serialno++);
+
+    if (info->passno!=1) {
+        output_init(info);
+        th_comment_add_tag(&info->tc, "ENCODER", PACKAGE_STRING);
+        vorbis_comment_add_tag(&info->vc, "ENCODER", PACKAGE_STRING);
+        if (strcmp(info->oshash, "0000000000000000") > 0) {
+            th_comment_add_tag(&info->tc, "SOURCE_OSHASH", info->oshash);
+            vorbis_comment_add_tag(&info->vc, "SOURCE_OSHASH", info->oshash);
+        }
+    }
+
+    if (!info->audio_only) {
+        ogg_stream_init (&info->to, info->serialno++);
+        seek_index_init(&info->theora_index, info->index_interval);
+    }
+    /* init theora done */
     /* initialize Vorbis too, if we have audio. */
-    if (!info->video_only) {
-        int ret;
-        vorbis_info_init (&info->vi);
+    for (n=0; n<info->n_audio_streams; ++n) {
+        oggmux_audio_stream *as=info->audio_streams+n;
+        int ret, i;
+        seek_index_init(&as->index, info->index_interval);
+        as->vorbis_granulepos = 0;
+        /* the first pass only encodes video */
+        if (info->passno==1)
+            continue;
+        vorbis_info_init (&as->vi);
         /* Encoding using a VBR quality mode.  */
         if (info->vorbis_quality>-99)
-            ret =vorbis_encode_init_vbr (&info->vi, info->channels,info->sample_rate,info->vorbis_quality);
+            ret =vorbis_encode_init_vbr (&as->vi, as->channels,as->sample_rate,info->vorbis_quality);
         else
-            ret=vorbis_encode_init(&info->vi,info->channels,info->sample_rate,-1,info->vorbis_bitrate,-1);
+            ret=vorbis_encode_init(&as->vi,as->channels,as->sample_rate,-1,info->vorbis_bitrate,-1);
 
         if (ret) {
             fprintf (stderr,
@@ -855,12 +1359,30 @@ void oggmux_init (oggmux_info *info) {
             exit (1);
         }
 
+        /* the comments of all streams, and the language of this one */
+        vorbis_comment_init (&as->vc);
+        for (i = 0; i < info->vc.comments; i++)
+            vorbis_comment_add (&as->vc, info->vc.user_comments[i]);
+        if (as->language[0])
+            vorbis_comment_add_tag (&as->vc, "LANGUAGE", as->language);
+
         /* set up the analysis state and auxiliary encoding storage */
-        vorbis_analysis_init (&info->vd, &info->vi);
-        vorbis_block_init (&info->vd, &info->vb);
-        
-        seek_index_init(&info->vorbis_index, info->index_interval);
-        info->vorbis_granulepos = 0;
+        vorbis_analysis_init (&as->vd, &as->vi);
+        vorbis_block_init (&as->vd, &as->vb);
+
+        as->channel_map = (int*)malloc(as->channels * sizeof(int));
+        as->audio_planes = (float**)malloc(as->channels * sizeof(float*));
+        if (!as->channel_map || !as->audio_planes) {
+            fprintf(stderr, "ERROR: malloc failure in oggmux_init\n");
+            exit(1);
+        }
+        for (i = 0; i < as->channels; i++)
+            as->channel_map[i] = i;
+        if (as->channels == 6) {
+            /* 5.1 input: [fl, fr, c, lfe, rl, rr], vorbis: [fl, c, fr, rl, rr, lfe] */
+            static const int map_5_1[6] = { 0, 2, 1, 5, 3, 4 };
+            memcpy(as->channel_map, map_5_1, sizeof(map_5_1));
+        }
     }
     /* audio init done */
 
@@ -891,6 +1413,7 @@ void oggmux_init (oggmux_info *info) {
 
     if (info->with_skeleton &&
         !info->skeleton_3 &&
+        !info->adaptive_index &&
         info->duration == -1)
     {
         /* We've not got a duration, we can't index the keyframes. */
@@ -903,9 +1426,9 @@ void oggmux_init (oggmux_info *info) {
     if (info->with_skeleton && info->passno!=1) {
         /* Sometimes the output file is not seekable. We can't write the seek
            index if the output is not seekable. So write a Skeleton3.0 header
-           packet, which will in turn determine if the file is seekable. If it
-           is, we can safely construct an index, so then overwrite the header
-           page with a Skeleton4.0 header page. */
+           packet, and if output_init found the file to be seekable, we can
+           safely construct an index, so then overwrite the header page with
+           a Skeleton4.0 header page. */
         int skeleton_3 = info->skeleton_3;
         info->skeleton_3 = 1;
         ogg_stream_init (&info->so, info->serialno++);
@@ -927,7 +1450,7 @@ void oggmux_init (oggmux_info *info) {
         if (!info->skeleton_3) {
             /* Output is seekable and we're indexing. Overwrite the
                Skeleton3.0 BOS page with a Skeleton4.0 BOS page. */
-            if (fseeko (info->outfile, 0, SEEK_SET) < 0) {
+            if (output_seek (info, 0) < 0) {
                 fprintf (stderr, "ERROR: failed to seek in seekable output file!?!\n");
                 exit (1);
             }
@@ -973,24 +1496,25 @@ void oggmux_init (oggmux_info *info) {
             ogg_stream_packetin(&info->to, &op);
         }
     }
-    if (!info->video_only && info->passno!=1) {
+    for (n=0; n<info->n_audio_streams && info->passno!=1; ++n) {
+        oggmux_audio_stream *as=info->audio_streams+n;
         ogg_packet header;
         ogg_packet header_comm;
         ogg_packet header_code;
 
-        vorbis_analysis_headerout (&info->vd, &info->vc, &header,
+        vorbis_analysis_headerout (&as->vd, &as->vc, &header,
                        &header_comm, &header_code);
-        ogg_stream_packetin (&info->vo, &header);    /* automatically placed in its own
+        ogg_stream_packetin (&as->vo, &header);    /* automatically placed in its own
                                  * page */
-        if (ogg_stream_pageout (&info->vo, &og) != 1) {
+        if (ogg_stream_pageout (&as->vo, &og) != 1) {
             fprintf (stderr, "Internal Ogg library error.\n");
             exit (1);
         }
         write_page (info, &og);
 
         /* remaining vorbis header packets */
-        ogg_stream_packetin (&info->vo, &header_comm);
-        ogg_stream_packetin (&info->vo, &header_code);
+        ogg_stream_packetin (&as->vo, &header_comm);
+        ogg_stream_packetin (&as->vo, &header_code);
     }
 
 #ifdef HAVE_KATE
@@ -1050,16 +1574,18 @@ void oggmux_init (oggmux_info *info) {
             break;
         write_page (info, &og);
     }
-    while (1 && !info->video_only && info->passno!=1) {
-        int result = ogg_stream_flush (&info->vo, &og);
-        if (result < 0) {
-            /* can't get here */
-            fprintf (stderr, "Internal Ogg library error.\n");
-            exit (1);
+    for (n=0; n<info->n_audio_streams && info->passno!=1; ++n) {
+        while (1) {
+            int result = ogg_stream_flush (&info->audio_streams[n].vo, &og);
+            if (result < 0) {
+                /* can't get here */
+                fprintf (stderr, "Internal Ogg library error.\n");
+                exit (1);
+            }
+            if (result == 0)
+                break;
+            write_page (info, &og);
         }
-        if (result == 0)
-            break;
-        write_page (info, &og);
     }
 #ifdef HAVE_KATE
     if (info->with_kate && info->passno!=1) {
@@ -1108,19 +1634,125 @@ void oggmux_init (oggmux_info *info) {
         
         /* Record the offset of the next page; it's the first non-header, or
          * content page. */
-        info->content_offset = ftello(info->outfile);
+        info->content_offset = output_tell(info);
     }
 }
 
-/**
- * adds a video frame to the encoding sink
- * if e_o_s is 1 the end of the logical bitstream will be marked.
- * @param this ff2theora struct
- * @param info oggmux_info
- * @param yuv_buffer
- * @param e_o_s 1 indicates ond of stream
- */
-void oggmux_add_video (oggmux_info *info, th_ycbcr_buffer ycbcr, int e_o_s) {
+static void
+oggmux_packet_list_append (oggmux_packet_list *packets, ogg_packet *op,
+                           ogg_int64_t start_time, ogg_int64_t end_time,
+                           int keyframe)
+{
+    oggmux_packet *p;
+
+    if (packets->count == packets->capacity) {
+        int capacity = packets->capacity * 3 / 2 + 4;
+        oggmux_packet *tmp = realloc(packets->packets, capacity * sizeof(oggmux_packet));
+        if (!tmp) {
+            fprintf(stderr, "ERROR: out of memory in oggmux_packet_list_append\n");
+            exit(1);
+        }
+        memset(tmp + packets->capacity, 0,
+               (capacity - packets->capacity) * sizeof(oggmux_packet));
+        packets->packets = tmp;
+        packets->capacity = capacity;
+    }
+    p = packets->packets + packets->count;
+    if (p->data_size < op->bytes || !p->data) {
+        long size = op->bytes > 0 ? op->bytes : 1;
+        unsigned char *tmp = realloc(p->data, size);
+        if (!tmp) {
+            fprintf(stderr, "ERROR: out of memory in oggmux_packet_list_append\n");
+            exit(1);
+        }
+        p->data = tmp;
+        p->data_size = size;
+    }
+    memcpy(p->data, op->packet, op->bytes);
+    p->op = *op;
+    p->op.packet = p->data;
+    p->start_time = start_time;
+    p->end_time = end_time;
+    p->keyframe = keyframe;
+    packets->count++;
+}
+
+void oggmux_packet_list_free (oggmux_packet_list *packets)
+{
+    int i;
+    for (i = 0; i < packets->capacity; i++) {
+        free(packets->packets[i].data);
+    }
+    free(packets->packets);
+    memset(packets, 0, sizeof(*packets));
+}
+
+void oggmux_twopass_rewind (oggmux_info *info)
+{
+    if (!info->twopass_file) {
+        info->twopass_pos = 0;
+        return;
+    }
+    if (fseek(info->twopass_file,0,SEEK_SET)<0) {
+        fprintf(stderr,"Unable to seek in two-pass data file.\n");
+        exit(1);
+    }
+}
+
+/* The data of every frame used to be flushed to the file as it was
+   written, which costs a system call per frame for no gain: the file
+   is only read back once the first pass is over. */
+void oggmux_twopass_write (oggmux_info *info, const unsigned char *buffer, int bytes)
+{
+    if (info->twopass_file) {
+        if (fwrite(buffer,1,bytes,info->twopass_file)<bytes) {
+            fprintf(stderr,"Unable to write to two-pass data file.\n");
+            exit(1);
+        }
+        return;
+    }
+    if (info->twopass_pos + bytes > info->twopass_capacity) {
+        int capacity = info->twopass_capacity * 2 + 4096;
+        unsigned char *tmp;
+        while (capacity < info->twopass_pos + bytes)
+            capacity *= 2;
+        tmp = realloc(info->twopass_data, capacity);
+        if (!tmp) {
+            fprintf(stderr,"Out of memory for two-pass data.\n");
+            exit(1);
+        }
+        info->twopass_data = tmp;
+        info->twopass_capacity = capacity;
+    }
+    memcpy(info->twopass_data + info->twopass_pos, buffer, bytes);
+    info->twopass_pos += bytes;
+    if (info->twopass_pos > info->twopass_size)
+        info->twopass_size = info->twopass_pos;
+}
+
+static int twopass_read (oggmux_info *info, unsigned char *buffer, int bytes)
+{
+    if (info->twopass_file)
+        return fread(buffer,1,bytes,info->twopass_file);
+    if (bytes > info->twopass_size - info->twopass_pos)
+        bytes = info->twopass_size - info->twopass_pos;
+    memcpy(buffer, info->twopass_data + info->twopass_pos, bytes);
+    info->twopass_pos += bytes;
+    return bytes;
+}
+
+void oggmux_twopass_free (oggmux_info *info)
+{
+    free(info->twopass_data);
+    info->twopass_data = NULL;
+    info->twopass_size = info->twopass_capacity = info->twopass_pos = 0;
+}
+
+static void
+oggmux_encode_video_frame (oggmux_info *info, th_enc_ctx *td, th_ycbcr_buffer ycbcr,
+                           int e_o_s, ogg_int64_t frame_offset,
+                           oggmux_packet_list *packets)
+{
     ogg_packet op;
     int ret;
 
@@ -1130,7 +1762,7 @@ void oggmux_add_video (oggmux_info *info, th_ycbcr_buffer ycbcr, int e_o_s) {
           static int buf_pos;
           int bytes;
           /*Ask the encoder how many bytes it would like.*/
-          bytes=th_encode_ctl(info->td,TH_ENCCTL_2PASS_IN,NULL,0);
+          bytes=th_encode_ctl(td,TH_ENCCTL_2PASS_IN,NULL,0);
           if(bytes<0){
             fprintf(stderr,"Error submitting pass data in second pass.\n");
             exit(1);
@@ -1139,12 +1771,12 @@ void oggmux_add_video (oggmux_info *info, th_ycbcr_buffer ycbcr, int e_o_s) {
           if(bytes==0)break;
           /*Read in some more bytes, if necessary.*/
           if(bytes>80-buf_pos)bytes=80-buf_pos;
-          if(bytes>0&&fread(buffer+buf_pos,1,bytes,info->twopass_file)<bytes){
+          if(bytes>0&&twopass_read(info,buffer+buf_pos,bytes)<bytes){
             fprintf(stderr,"Could not read frame data from two-pass data file!\n");
             exit(1);
           }
           /*And pass them off.*/
-          ret=th_encode_ctl(info->td,TH_ENCCTL_2PASS_IN,buffer,bytes);
+          ret=th_encode_ctl(td,TH_ENCCTL_2PASS_IN,buffer,bytes);
           if(ret<0){
             fprintf(stderr,"Error submitting pass data in second pass.\n");
             exit(1);
@@ -1156,59 +1788,178 @@ void oggmux_add_video (oggmux_info *info, th_ycbcr_buffer ycbcr, int e_o_s) {
         }
     }
 
-    th_encode_ycbcr_in(info->td, ycbcr);
+    th_encode_ycbcr_in(td, ycbcr);
     /* in two-pass mode's first pass we need to extract and save the pass data */
     if(info->passno==1){
 
         unsigned char *buffer;
-        int bytes = th_encode_ctl(info->td, TH_ENCCTL_2PASS_OUT, &buffer, sizeof(buffer));
+        int bytes = th_encode_ctl(td, TH_ENCCTL_2PASS_OUT, &buffer, sizeof(buffer));
         if(bytes<0){
           fprintf(stderr,"Could not read two-pass data from encoder.\n");
           exit(1);
         }
-        if(fwrite(buffer,1,bytes,info->twopass_file)<bytes){
-          fprintf(stderr,"Unable to write to two-pass data file.\n");
-          exit(1);
-        }
-        fflush(info->twopass_file);
+        oggmux_twopass_write(info,buffer,bytes);
     }
 
-    while (th_encode_packetout (info->td, e_o_s, &op) > 0) {
-        if (!info->skeleton_3 &&
-            info->passno != 1)
-        {
-            ogg_int64_t frameno = th_granule_frame(info->td, op.granulepos);
-            ogg_int64_t start_time = (1000 * info->ti.fps_denominator * frameno) /
-                                     info->ti.fps_numerator;
-            ogg_int64_t end_time =   (1000 * info->ti.fps_denominator * (frameno + 1)) /
-                                     info->ti.fps_numerator;
-            seek_index_record_sample(&info->theora_index,
-                                     op.packetno,
-                                     start_time,
-                                     end_time,
-                                     th_packet_iskeyframe(&op));
+    while (th_encode_packetout (td, e_o_s, &op) > 0) {
+        ogg_int64_t frameno;
+        if (frame_offset) {
+            /* the keyframe number is in the upper bits */
+            op.granulepos += frame_offset << info->ti.keyframe_granule_shift;
+            op.packetno += frame_offset;
         }
-        ogg_stream_packetin (&info->to, &op);
-        info->v_pkg++;
+        frameno = th_granule_frame(td, op.granulepos);
+        ogg_int64_t start_time = (1000 * info->ti.fps_denominator * frameno) /
+                                 info->ti.fps_numerator;
+        ogg_int64_t end_time =   (1000 * info->ti.fps_denominator * (frameno + 1)) /
+                                 info->ti.fps_numerator;
+        oggmux_packet_list_append(packets, &op, start_time, end_time,
+                                  th_packet_iskeyframe(&op));
     }
     if(info->passno==1 && e_o_s){
         /* need to read the final (summary) packet */
         unsigned char *buffer;
-        int bytes = th_encode_ctl(info->td, TH_ENCCTL_2PASS_OUT, &buffer, sizeof(buffer));
+        int bytes = th_encode_ctl(td, TH_ENCCTL_2PASS_OUT, &buffer, sizeof(buffer));
         if(bytes<0){
           fprintf(stderr,"Could not read two-pass summary data from encoder.\n");
           exit(1);
         }
-        if(fseek(info->twopass_file,0,SEEK_SET)<0){
-          fprintf(stderr,"Unable to seek in two-pass data file.\n");
-          exit(1);
+        oggmux_twopass_rewind(info);
+        oggmux_twopass_write(info,buffer,bytes);
+    }
+}
+
+/**
+ * encodes a video frame, appending the resulting packets to packets
+ * if e_o_s is 1 the end of the logical bitstream will be marked.
+ * @param info oggmux_info
+ * @param ycbcr frame to encode
+ * @param dups number of times the frame is repeated after the first
+ * @param e_o_s 1 indicates end of stream
+ * @param packets list the encoded packets are appended to
+ */
+void oggmux_encode_video (oggmux_info *info, th_ycbcr_buffer ycbcr, int dups, int e_o_s,
+                          oggmux_packet_list *packets) {
+    oggmux_encode_video_segment(info, info->td, ycbcr, dups, e_o_s, 0, packets);
+}
+
+/**
+ * encodes a video frame like oggmux_encode_video, but with td, an encoder
+ * of its own for a segment of the stream. The segment encoder started with
+ * a keyframe at frame 0, frame_offset is the number of frames before the
+ * segment, which moves its packets to their place in the stream.
+ */
+void oggmux_encode_video_segment (oggmux_info *info, th_enc_ctx *td, th_ycbcr_buffer ycbcr,
+                                  int dups, int e_o_s, ogg_int64_t frame_offset,
+                                  oggmux_packet_list *packets) {
+    if (dups > 0) {
+        //this only works if dups < keyint,
+        //see http://theora.org/doc/libtheora-1.1/theoraenc_8h.html#a8bb9b05471c42a09f8684a2583b8a1df
+        if (th_encode_ctl(td, TH_ENCCTL_SET_DUP_COUNT, &dups, sizeof(int)) == TH_EINVAL) {
+            while (dups--)
+                oggmux_encode_video_frame(info, td, ycbcr, e_o_s, frame_offset, packets);
         }
-        if(fwrite(buffer,1,bytes,info->twopass_file)<bytes){
-          fprintf(stderr,"Unable to write to two-pass data file.\n");
-          exit(1);
+    }
+    oggmux_encode_video_frame(info, td, ycbcr, e_o_s, frame_offset, packets);
+}
+
+/* Remembers when the frame of a video packet came in, to tell the
+   --live delay once its page is written. */
+static void record_frame_time(oggmux_info *info, ogg_int64_t granulepos, ogg_int64_t input_time)
+{
+    oggmux_frame_time *ft;
+
+    if (info->n_frame_times == info->frame_times_capacity) {
+        if (info->frame_times_head > 0) {
+            info->n_frame_times -= info->frame_times_head;
+            memmove(info->frame_times, info->frame_times + info->frame_times_head,
+                    info->n_frame_times * sizeof(*ft));
+            info->frame_times_head = 0;
+        }
+        else {
+            int capacity = info->frame_times_capacity * 2 + 16;
+            ft = realloc(info->frame_times, capacity * sizeof(*ft));
+            if (!ft) {
+                fprintf(stderr, "ERROR: malloc failure in record_frame_time\n");
+                exit(1);
+            }
+            info->frame_times = ft;
+            info->frame_times_capacity = capacity;
+        }
+    }
+    ft = info->frame_times + info->n_frame_times++;
+    ft->frame = th_granule_frame(info->td, granulepos);
+    ft->input_time = input_time;
+}
+
+/* Takes the delay of the frames that are complete once a video page of
+   granulepos is written. */
+static void frames_written(oggmux_info *info, ogg_int64_t granulepos)
+{
+    ogg_int64_t frame, now;
+
+    if (granulepos < 0)
+        return;
+    frame = th_granule_frame(info->td, granulepos);
+    now = av_gettime();
+    while (info->frame_times_head < info->n_frame_times &&
+           info->frame_times[info->frame_times_head].frame <= frame) {
+        info->delay = now - info->frame_times[info->frame_times_head++].input_time;
+        if (info->delay > info->max_delay_seen)
+            info->max_delay_seen = info->delay;
+        info->delay_sum += info->delay;
+        info->delay_count++;
+    }
+    if (info->frame_times_head == info->n_frame_times)
+        info->frame_times_head = info->n_frame_times = 0;
+}
+
+/**
+ * adds encoded video packets to the theora stream and the seek index
+ * and empties the list.
+ */
+void oggmux_mux_video (oggmux_info *info, oggmux_packet_list *packets) {
+    int i;
+    for (i = 0; i < packets->count; i++) {
+        oggmux_packet *p = packets->packets + i;
+        if (!info->skeleton_3 &&
+            info->passno != 1)
+        {
+            seek_index_record_sample(&info->theora_index,
+                                     p->op.packetno,
+                                     p->start_time,
+                                     p->end_time,
+                                     p->keyframe);
+        }
+        /* the keyframe starts a page, so seeking to it reads no more
+           than it needs */
+        if (p->keyframe == 1 &&
+            info->page_policy == PAGE_POLICY_SEEK &&
+            info->passno != 1)
+        {
+            stream_cut_pages(info, info->video_stream);
         }
-        fflush(info->twopass_file);
+        if (info->live && info->passno != 1 && p->op.granulepos >= 0)
+            record_frame_time(info, p->op.granulepos, packets->input_time);
+        ogg_stream_packetin (&info->to, &p->op);
+        info->v_pkg++;
     }
+    if (packets->count)
+        stream_changed(info, info->video_stream);
+    packets->count = 0;
+}
+
+/**
+ * adds a video frame to the encoding sink
+ * if e_o_s is 1 the end of the logical bitstream will be marked.
+ * @param info oggmux_info
+ * @param ycbcr frame to encode
+ * @param dups number of times the frame is repeated after the first
+ * @param e_o_s 1 indicates ond of stream
+ */
+void oggmux_add_video (oggmux_info *info, th_ycbcr_buffer ycbcr, int dups, int e_o_s) {
+    oggmux_encode_video(info, ycbcr, dups, e_o_s, &info->video_packets);
+    oggmux_mux_video(info, &info->video_packets);
 }
 
 static ogg_int64_t
@@ -1217,56 +1968,51 @@ vorbis_time(vorbis_dsp_state * dsp, ogg_int64_t granulepos) {
 }
 
 /**
- * adds audio samples to encoding sink
+ * encodes audio samples, appending the resulting packets to packets
+ * @param idx the audio stream
  * @param buffer pointer to buffer
  * @param samples samples in buffer
  * @param e_o_s 1 indicates end of stream.
+ * @param packets list the encoded packets are appended to
  */
-void oggmux_add_audio (oggmux_info *info, uint8_t **buffer, int samples, int e_o_s) {
+void oggmux_encode_audio (oggmux_info *info, int idx, uint8_t **buffer, int samples, int e_o_s,
+                          oggmux_packet_list *packets) {
+    if (samples > 0) {
+        float **planes = oggmux_audio_buffer(info, idx, samples);
+        int i;
+        for (i = 0; i < info->audio_streams[idx].channels; i++)
+            memcpy(planes[i], buffer[i], samples * sizeof(float));
+    }
+    oggmux_encode_audio_buffer(info, idx, samples, e_o_s, packets);
+}
+
+float **oggmux_audio_buffer (oggmux_info *info, int idx, int samples) {
+    oggmux_audio_stream *as = info->audio_streams + idx;
+    float **vorbis_buffer = vorbis_analysis_buffer (&as->vd, samples);
+    int i;
+    for (i = 0; i < as->channels; i++)
+        as->audio_planes[i] = vorbis_buffer[as->channel_map[i]];
+    return as->audio_planes;
+}
+
+void oggmux_encode_audio_buffer (oggmux_info *info, int idx, int samples, int e_o_s,
+                                 oggmux_packet_list *packets) {
+    oggmux_audio_stream *as = info->audio_streams + idx;
     ogg_packet op;
 
-    int i, j, k, count = 0;
-    float **vorbis_buffer;
-
-    if (samples <= 0) {
-        /* end of audio stream */
-        if (e_o_s)
-            vorbis_analysis_wrote (&info->vd, 0);
-    }
-    else{
-        vorbis_buffer = vorbis_analysis_buffer (&info->vd, samples);
-        /* uninterleave samples */
-        for (i = 0; i < samples; i++) {
-            for (j=0;j<info->channels;j++) {
-                k = j;
-                /* 5.1 input: [fl, fr, c, lfe, rl, rr] */
-                if(info->channels == 6) {
-                    switch(j) {
-                        case 0: k = 0; break;
-                        case 1: k = 2; break;
-                        case 2: k = 1; break;
-                        case 3: k = 5; break;
-                        case 4: k = 3; break;
-                        case 5: k = 4; break;
-                        default: k = j;
-                    }
-                }
-                vorbis_buffer[k][i] = ((const float  *)buffer[j])[i];
-            }
-        }
-        vorbis_analysis_wrote (&info->vd, samples);
-        /* end of audio stream */
-        if (e_o_s)
-            vorbis_analysis_wrote (&info->vd, 0);
-    }
+    if (samples > 0)
+        vorbis_analysis_wrote (&as->vd, samples);
+    /* end of audio stream */
+    if (e_o_s)
+        vorbis_analysis_wrote (&as->vd, 0);
 
-    while (vorbis_analysis_blockout (&info->vd, &info->vb) == 1) {
+    while (vorbis_analysis_blockout (&as->vd, &as->vb) == 1) {
         /* analysis, assume we want to use bitrate management */
-        vorbis_analysis (&info->vb, NULL);
-        vorbis_bitrate_addblock (&info->vb);
+        vorbis_analysis (&as->vb, NULL);
+        vorbis_bitrate_addblock (&as->vb);
 
         /* weld packets into the bitstream */
-        if (vorbis_bitrate_flushpacket (&info->vd, &op)) {
+        if (vorbis_bitrate_flushpacket (&as->vd, &op)) {
             assert(op.granulepos != -1);
             
             /* For indexing, we must accurately know the presentation time of
@@ -1277,9 +2023,9 @@ void oggmux_add_audio (oggmux_info *info, uint8_t **buffer, int samples, int e_o
                we accurately know the samples in each packet, the presentation
                time of a vorbis page is the presentation time of the second
                packet in the page. */
-            int num_samples = (info->prev_vorbis_window == -1) ? 0 :
-                               info->prev_vorbis_window/4 + info->vb.pcmend / 4;
-            info->prev_vorbis_window = info->vb.pcmend;
+            int num_samples = (as->prev_vorbis_window == -1) ? 0 :
+                               as->prev_vorbis_window/4 + as->vb.pcmend / 4;
+            as->prev_vorbis_window = as->vb.pcmend;
 
             ogg_int64_t start_granule = op.granulepos - num_samples;
             if (start_granule < 0) {
@@ -1296,7 +2042,7 @@ void oggmux_add_audio (oggmux_info *info, uint8_t **buffer, int samples, int e_o
                 }
                 start_granule = 0;
             }
-            if (start_granule < info->vorbis_granulepos) {
+            if (start_granule < as->vorbis_granulepos) {
                 /* This packet starts before the end of the previous packet. This is
                    allowed by the specification in the last packet only, and the
                    trailing samples should be discarded and not played/indexed. */
@@ -1304,32 +2050,61 @@ void oggmux_add_audio (oggmux_info *info, uint8_t **buffer, int samples, int e_o
                     fprintf(stderr, "WARNING: vorbis packet %" PRId64 " (granulepos %" PRId64 ") starts before"
                             " the end of the preceeding packet!", op.packetno, op.granulepos);
                 }
-                start_granule = info->vorbis_granulepos;
+                start_granule = as->vorbis_granulepos;
             }
-            info->vorbis_granulepos = op.granulepos;
-            ogg_int64_t start_time = vorbis_time (&info->vd, start_granule);
-            
-            if (op.granulepos != -1 &&
-                !info->skeleton_3 &&
-                info->passno != 1)
-            {
-                ogg_int64_t end_time = vorbis_time (&info->vd, op.granulepos);
-                seek_index_record_sample(&info->vorbis_index,
-                                         op.packetno,
-                                         start_time,
-                                         end_time,
-                                         1);
-            }
-            ogg_stream_packetin (&info->vo, &op);
-            info->a_pkg++;
+            as->vorbis_granulepos = op.granulepos;
+            ogg_int64_t start_time = vorbis_time (&as->vd, start_granule);
+            ogg_int64_t end_time = vorbis_time (&as->vd, op.granulepos);
+            oggmux_packet_list_append(packets, &op, start_time, end_time, 1);
         }
         /* libvorbis should encode with 1:1 block:packet ratio. If not, our
            vorbis sample length calculations will be wrong! */
-        assert(vorbis_bitrate_flushpacket (&info->vd, &op) == 0);
+        assert(vorbis_bitrate_flushpacket (&as->vd, &op) == 0);
     }
 
 }
 
+/**
+ * adds encoded audio packets to the vorbis stream and the seek index
+ * and empties the list.
+ */
+void oggmux_mux_audio (oggmux_info *info, int idx, oggmux_packet_list *packets) {
+    oggmux_audio_stream *as = info->audio_streams + idx;
+    int i;
+    for (i = 0; i < packets->count; i++) {
+        oggmux_packet *p = packets->packets + i;
+        if (p->op.granulepos != -1 &&
+            !info->skeleton_3 &&
+            info->passno != 1)
+        {
+            seek_index_record_sample(&as->index,
+                                     p->op.packetno,
+                                     p->start_time,
+                                     p->end_time,
+                                     p->keyframe);
+        }
+        ogg_stream_packetin (&as->vo, &p->op);
+        as->a_pkg++;
+        info->a_pkg++;
+    }
+    if (packets->count)
+        stream_changed(info, as->stream);
+    packets->count = 0;
+}
+
+/**
+ * adds audio samples to encoding sink
+ * @param idx the audio stream
+ * @param buffer pointer to buffer
+ * @param samples samples in buffer
+ * @param e_o_s 1 indicates end of stream.
+ */
+void oggmux_add_audio (oggmux_info *info, int idx, uint8_t **buffer, int samples, int e_o_s) {
+    oggmux_packet_list *packets = &info->audio_streams[idx].packets;
+    oggmux_encode_audio(info, idx, buffer, samples, e_o_s, packets);
+    oggmux_mux_audio(info, idx, packets);
+}
+
 static void oggmux_record_kate_index(oggmux_info *info, oggmux_kate_stream *ks, const ogg_packet *op, ogg_int64_t start_time, ogg_int64_t end_time)
 {
     if (ks->last_end_time >= 0)
@@ -1380,6 +2155,7 @@ void oggmux_add_kate_text (oggmux_info *info, int idx, double t0, double t1, con
         ogg_stream_packetin (&ks->ko, &op);
         ogg_packet_clear (&op);
         info->k_pkg++;
+        stream_changed(info, ks->stream);
     }
     else {
         fprintf(stderr, "Failed to encode kate data packet (%f --> %f, [%s]): %d\n",
@@ -1416,6 +2192,7 @@ void oggmux_add_kate_image (oggmux_info *info, int idx, double t0, double t1, co
         ogg_stream_packetin (&ks->ko, &op);
         ogg_packet_clear (&op);
         info->k_pkg++;
+        stream_changed(info, ks->stream);
     }
     else {
         fprintf(stderr, "Failed to encode kate data packet (%f --> %f, image): %d\n",
@@ -1443,6 +2220,7 @@ void oggmux_add_kate_end_packet (oggmux_info *info, int idx, double t) {
         ogg_stream_packetin (&ks->ko, &op);
         ogg_packet_clear (&op);
         info->k_pkg++;
+        stream_changed(info, ks->stream);
     }
     else {
         fprintf(stderr, "Failed to encode kate end packet at %f: %d\n", t, ret);
@@ -1485,6 +2263,8 @@ static void print_stats(oggmux_info *info, double timebase) {
     int remaining_minutes = ((long) remaining / 60) % 60;
     int remaining_hours = (long) remaining / 3600;
 
+    if (info->no_stats)
+        return;
     if (info->passno==1) {
         if (timebase - last > 0.5 || timebase < last) {
             last = timebase;
@@ -1525,7 +2305,14 @@ static void print_stats(oggmux_info *info, double timebase) {
             fflush (info->frontend);
         }
         else if (timebase > 0) {
-            if (!remaining) {
+            if (info->live) {
+                fprintf (stderr,"\r  %d:%02d:%02d.%02d audio: %dkbps video: %dkbps, delay: %4d ms, max: %4d ms   ",
+                    hours, minutes, seconds, hundredths,
+                    info->akbps, info->vkbps,
+                    (int)(info->delay / 1000), (int)(info->max_delay_seen / 1000)
+                );
+            }
+            else if (!remaining) {
                 remaining = time(NULL) - info->start_time;
                 remaining_seconds = (long) remaining % 60;
                 remaining_minutes = ((long) remaining / 60) % 60;
@@ -1565,268 +2352,281 @@ ogg_page_start_packets(unsigned char* page)
 }
 
 
-static void write_audio_page(oggmux_info *info)
+/* Copies a page that is still waiting when oggmux_flush returns out of
+   its stream, whose buffers change as soon as more packets are added. */
+static void keep_page(ogg_page *og, unsigned char **buffer, int *buffer_length)
 {
-    int ret;
-    ogg_int64_t page_offset = ftello(info->outfile);
-    int packets = ogg_page_packets((ogg_page *)&info->audiopage);
-    int packet_start_num = ogg_page_start_packets(info->audiopage);
+    long len = og->header_len + og->body_len;
+    if (og->header == *buffer)
+        return;
+    if (*buffer_length < len) {
+        *buffer = realloc(*buffer, len);
+        *buffer_length = len;
+    }
+    memcpy(*buffer, og->header, og->header_len);
+    memcpy(*buffer + og->header_len, og->body, og->body_len);
+    og->header = *buffer;
+    og->body = *buffer + og->header_len;
+}
 
-    ret = fwrite(info->audiopage, 1, info->audiopage_len, info->outfile);
-    if (ret < info->audiopage_len) {
-        fprintf(stderr,"error writing audio page\n");
-    }
-    else {
-        info->audio_bytesout += ret;
-    }
-    info->audiopage_valid = 0;
-    info->a_pkg -= packets;
+static int page_before(oggmux_info *info, int a, int b)
+{
+    double ta = info->streams[a].time, tb = info->streams[b].time;
+    /* on a tie, kate pages go first, then video, then audio */
+    return ta < tb || (ta == tb && a < b);
+}
 
-    ret = seek_index_record_page(&info->vorbis_index,
-                                 page_offset,
-                                 packet_start_num);
-    assert(ret == 0);
-#ifdef OGGMUX_DEBUG
-    info->a_page++;
-    info->v_page=0;
-    fprintf(stderr,"\naudio page %d (%d pkgs) | pkg remaining %d\n",info->a_page,ogg_page_packets((ogg_page *)&info->audiopage),info->a_pkg);
-#endif
+static void page_heap_push(oggmux_info *info, int s)
+{
+    int *heap = info->page_heap;
+    int i = info->page_heap_size++;
 
-    info->akbps = rint (info->audio_bytesout * 8. / info->audiotime * .001);
-    if (info->akbps<0)
-        info->akbps=0;
-    print_stats(info, info->audiotime);
+    while (i > 0 && page_before(info, s, heap[(i - 1) / 2])) {
+        heap[i] = heap[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    heap[i] = s;
 }
 
-static void write_video_page(oggmux_info *info)
+static int page_heap_pop(oggmux_info *info)
 {
-    int ret;
-    ogg_int64_t page_offset = ftello(info->outfile);
-    int packets = ogg_page_packets((ogg_page *)&info->videopage);
-    int packet_start_num = ogg_page_start_packets(info->videopage);
+    int *heap = info->page_heap;
+    int top = heap[0], last = heap[--info->page_heap_size];
+    int i = 0, child;
+
+    while ((child = 2 * i + 1) < info->page_heap_size) {
+        if (child + 1 < info->page_heap_size && page_before(info, heap[child + 1], heap[child]))
+            child++;
+        if (!page_before(info, heap[child], last))
+            break;
+        heap[i] = heap[child];
+        i = child;
+    }
+    heap[i] = last;
+    return top;
+}
 
-    ret = fwrite(info->videopage, 1, info->videopage_len, info->outfile);
-    if (ret < info->videopage_len) {
-        fprintf(stderr,"error writing video page\n");
+/* Takes the next page out of the ogg stream of st, cut the way
+   info->page_policy wants. */
+static int stream_pageout(oggmux_info *info, oggmux_stream *st, ogg_page *og)
+{
+    int pkg;
+
+    if (st->type == OGGMUX_KATE) {
+        /* always flush kate stream */
+        return ogg_stream_flush(st->os, og) > 0;
+    }
+    pkg = st->type == OGGMUX_THEORA ? info->v_pkg : info->audio_streams[st->idx].a_pkg;
+    switch (info->page_policy) {
+    case PAGE_POLICY_LATENCY:
+        return ogg_stream_flush(st->os, og) > 0;
+    case PAGE_POLICY_THROUGHPUT:
+        /* fewer pages mean fewer headers and checksums */
+        return ogg_stream_pageout_fill(st->os, og, OGGMUX_MAX_PAGE_BODY) > 0;
+    default:
+        // this way seeking is much better,
+        // not sure if 23 packets  is a good value. it works though
+        return (pkg>22 && ogg_stream_flush(st->os, og)) || ogg_stream_pageout(st->os, og);
     }
-    else {
-        info->video_bytesout += ret;
+}
+
+/* Takes the next page of stream s, if it has one, and queues it by its time. */
+static void stream_next_page(oggmux_info *info, int s)
+{
+    oggmux_stream *st = info->streams + s;
+    ogg_int64_t granulepos;
+
+    if (st->queued_head < st->n_queued) {
+        /* swap buffers with the page, which is free */
+        oggmux_queued_page *q = st->queued + st->queued_head++;
+        unsigned char *data = st->page;
+        int size = st->page_buffer_length;
+        st->page = q->data;
+        st->page_buffer_length = q->size;
+        q->data = data;
+        q->size = size;
+        st->og.header = st->page;
+        st->og.header_len = q->header_len;
+        st->og.body = st->page + q->header_len;
+        st->og.body_len = q->body_len;
+        if (st->queued_head == st->n_queued)
+            st->queued_head = st->n_queued = 0;
+    }
+    else if (!stream_pageout(info, st, &st->og)) {
+        return;
     }
-    info->videopage_valid = 0;
-    info->v_pkg -= packets;
 
-    ret = seek_index_record_page(&info->theora_index,
-                                 page_offset,
-                                 packet_start_num);
-    assert(ret == 0);
-#ifdef OGGMUX_DEBUG
-    info->v_page++;
-    info->a_page=0;
-    fprintf(stderr,"\nvideo page %d (%d pkgs) | pkg remaining %d\n",info->v_page,ogg_page_packets((ogg_page *)&info->videopage),info->v_pkg);
+    granulepos = ogg_page_granulepos(&st->og);
+    switch (st->type) {
+    case OGGMUX_THEORA:
+        if (granulepos>0)
+            info->videotime = th_granule_time(info->td, granulepos);
+        st->time = info->videotime;
+        break;
+    case OGGMUX_VORBIS:
+        if (granulepos>0)
+            st->time = vorbis_granule_time(&info->audio_streams[st->idx].vd, granulepos);
+        if (st->idx == 0)
+            info->audiotime = st->time;
+        break;
+#ifdef HAVE_KATE
+    case OGGMUX_KATE:
+        if (granulepos>0)
+            st->time = kate_granule_time(&info->kate_streams[st->idx].ki, granulepos);
+        break;
 #endif
-
-    info->vkbps = rint (info->video_bytesout * 8. / info->videotime * .001);
-    if (info->vkbps<0)
-        info->vkbps=0;
-    print_stats(info, info->videotime);
+    }
+    st->page_valid = 1;
+    if (info->live)
+        st->page_wait_start = av_gettime();
+    if (st->type != OGGMUX_KATE)
+        info->streams_waiting--;
+    page_heap_push(info, s);
 }
 
-static void write_kate_page(oggmux_info *info, int idx)
+static void write_stream_page(oggmux_info *info, int s)
 {
+    oggmux_stream *st = info->streams + s;
     int ret;
-    oggmux_kate_stream *ks=info->kate_streams+idx;
-    ogg_int64_t page_offset = ftello(info->outfile);
-    int packet_start_num = ogg_page_start_packets(ks->katepage);
-
-    ret = fwrite(ks->katepage, 1, ks->katepage_len, info->outfile);
-    if (ret < ks->katepage_len) {
-        fprintf(stderr,"error writing kate page\n");
-    }
-    else {
-        info->kate_bytesout += ret;
-    }
-    ks->katepage_valid = 0;
-    info->k_pkg -= ogg_page_packets((ogg_page *)&ks->katepage);
-
-    ret = seek_index_record_page(&ks->index,
+    ogg_int64_t page_offset = output_tell(info);
+    int packets = ogg_page_packets(&st->og);
+    int packet_start_num = ogg_page_start_packets(st->og.header);
+    long bytes = st->og.header_len + st->og.body_len;
+
+    write_page(info, &st->og);
+    st->page_valid = 0;
+    st->pages++;
+    st->header_bytes += st->og.header_len;
+    st->body_bytes += st->og.body_len;
+    if (st->type != OGGMUX_KATE)
+        info->streams_waiting++;
+
+    ret = seek_index_record_page(st->index,
                                  page_offset,
                                  packet_start_num);
     assert(ret == 0);
 
+    switch (st->type) {
+    case OGGMUX_THEORA:
+        info->video_bytesout += bytes;
+        info->v_pkg -= packets;
 #ifdef OGGMUX_DEBUG
-    info->k_page++;
-    fprintf(stderr,"\nkate page %d (%d pkgs) | pkg remaining %d\n",info->k_page,ogg_page_packets((ogg_page *)&ks->katepage),info->k_pkg);
+        info->v_page++;
+        info->a_page=0;
+        fprintf(stderr,"\nvideo page %d (%d pkgs) | pkg remaining %d\n",info->v_page,packets,info->v_pkg);
 #endif
-
-
-    /*
-    info->kkbps = rint (info->kate_bytesout * 8. / info->katetime * .001);
-    if (info->kkbps<0)
-        info->kkbps=0;
-    print_stats(info, info->katetime);
-    */
-}
-
-static int find_best_valid_kate_page(oggmux_info *info)
-{
-    int n;
-    double t=0.0;
-    int best=-1;
-    if (info->with_kate) for (n=0; n<info->n_kate_streams;++n) {
-        oggmux_kate_stream *ks=info->kate_streams+n;
-        if (ks->katepage_valid) {
-          if (best==-1 || ks->katetime<t) {
-            t=ks->katetime;
-            best=n;
-          }
-        }
+        info->vkbps = rint (info->video_bytesout * 8. / info->videotime * .001);
+        if (info->vkbps<0)
+            info->vkbps=0;
+        if (info->live)
+            frames_written(info, ogg_page_granulepos(&st->og));
+        print_stats(info, info->videotime);
+        break;
+    case OGGMUX_VORBIS:
+        info->audio_bytesout += bytes;
+        info->audio_streams[st->idx].a_pkg -= packets;
+        info->a_pkg -= packets;
+#ifdef OGGMUX_DEBUG
+        info->a_page++;
+        info->v_page=0;
+        fprintf(stderr,"\naudio page %d (%d pkgs) | pkg remaining %d\n",info->a_page,packets,info->a_pkg);
+#endif
+        info->akbps = rint (info->audio_bytesout * 8. / info->audiotime * .001);
+        if (info->akbps<0)
+            info->akbps=0;
+        print_stats(info, st->time);
+        break;
+    case OGGMUX_KATE:
+        info->kate_bytesout += bytes;
+        info->k_pkg -= packets;
+#ifdef OGGMUX_DEBUG
+        info->k_page++;
+        fprintf(stderr,"\nkate page %d (%d pkgs) | pkg remaining %d\n",info->k_page,packets,info->k_pkg);
+#endif
+        break;
     }
-    return best;
 }
 
 void oggmux_flush (oggmux_info *info, int e_o_s)
 {
-    int n,len;
-    ogg_page og;
-    int best;
+    ogg_int64_t now;
+    int n;
 
     if (info->passno==1) {
+        info->n_changed_streams = 0;
+        for (n=0; n<info->n_streams; ++n)
+            info->streams[n].changed = 0;
         print_stats(info, info->videotime);
         return;
     }
-    /* flush out the ogg pages to info->outfile */
-    while (1) {
-        /* Get pages for both streams, if not already present, and if available.*/
-        if (!info->audio_only && !info->videopage_valid) {
-            // this way seeking is much better,
-            // not sure if 23 packets  is a good value. it works though
-            int v_next=0;
-            if (info->v_pkg>22 && ogg_stream_flush(&info->to, &og)) {
-                v_next=1;
-            }
-            else if (ogg_stream_pageout(&info->to, &og)) {
-                v_next=1;
-            }
-            if (v_next) {
-                len = og.header_len + og.body_len;
-                if (info->videopage_buffer_length < len) {
-                    info->videopage = realloc(info->videopage, len);
-                    info->videopage_buffer_length = len;
-                }
-                info->videopage_len = len;
-                memcpy(info->videopage, og.header, og.header_len);
-                memcpy(info->videopage+og.header_len , og.body, og.body_len);
 
-                info->videopage_valid = 1;
-                if (ogg_page_granulepos(&og)>0) {
-                    info->videotime = th_granule_time(info->td, ogg_page_granulepos(&og));
-                }
-            }
-        }
-        if (!info->video_only && !info->audiopage_valid) {
-            // this way seeking is much better,
-            // not sure if 23 packets  is a good value. it works though
-            int a_next=0;
-            if (info->a_pkg>22 && ogg_stream_flush(&info->vo, &og)) {
-                a_next=1;
-            }
-            else if (ogg_stream_pageout(&info->vo, &og)) {
-                a_next=1;
-            }
-            if (a_next) {
-                len = og.header_len + og.body_len;
-                if (info->audiopage_buffer_length < len) {
-                    info->audiopage = realloc(info->audiopage, len);
-                    info->audiopage_buffer_length = len;
-                }
-                info->audiopage_len = len;
-                memcpy(info->audiopage, og.header, og.header_len);
-                memcpy(info->audiopage+og.header_len , og.body, og.body_len);
+    /* Only streams that got packets can have new pages. */
+    for (n=0; n<info->n_changed_streams; ++n) {
+        int s = info->changed_streams[n];
+        info->streams[s].changed = 0;
+        if (!info->streams[s].page_valid)
+            stream_next_page(info, s);
+    }
+    info->n_changed_streams = 0;
 
-                info->audiopage_valid = 1;
-                if (ogg_page_granulepos(&og)>0) {
-                    info->audiotime= vorbis_granule_time (&info->vd, ogg_page_granulepos(&og));
-                }
-            }
-        }
+    /* flush out the ogg pages to info->outfile, earliest first. Until the
+       end, a page can only go once every audio and video stream has one
+       waiting, or an earlier page of another stream might still come.
+       Live, a stream that falls behind holds the others up for no more
+       than max_delay, its pages may then come a little out of order. */
+    now = info->live ? av_gettime() : 0;
+    while (info->page_heap_size > 0 &&
+           (e_o_s || !info->streams_waiting ||
+            (info->live && now - info->streams[info->page_heap[0]].page_wait_start
+                           >= info->max_delay * (ogg_int64_t)1000))) {
+        int s = page_heap_pop(info);
+        write_stream_page(info, s);
+        stream_next_page(info, s);
+    }
 
-#ifdef HAVE_KATE
-        if (info->with_kate) for (n=0; n<info->n_kate_streams; ++n) {
-            oggmux_kate_stream *ks=info->kate_streams+n;
-            if (!ks->katepage_valid) {
-                int k_next=0;
-                /* always flush kate stream */
-                if (ogg_stream_flush(&ks->ko, &og) > 0) {
-                    k_next = 1;
-                }
-                if (k_next) {
-                    len = og.header_len + og.body_len;
-                    if (ks->katepage_buffer_length < len) {
-                        ks->katepage = realloc(ks->katepage, len);
-                        ks->katepage_buffer_length = len;
-                    }
-                    ks->katepage_len = len;
-                    memcpy(ks->katepage, og.header, og.header_len);
-                    memcpy(ks->katepage+og.header_len , og.body, og.body_len);
-
-                    ks->katepage_valid = 1;
-                    if (ogg_page_granulepos(&og)>0) {
-                        ks->katetime= kate_granule_time (&ks->ki,
-                            ogg_page_granulepos(&og));
-                    }
-                }
-            }
-        }
-#endif
+    for (n=0; n<info->page_heap_size; ++n) {
+        oggmux_stream *st = info->streams + info->page_heap[n];
+        keep_page(&st->og, &st->page, &st->page_buffer_length);
+    }
 
-#ifdef HAVE_KATE
-#define CHECK_KATE_OUTPUT(which) \
-        if (best >= 0 && info->kate_streams[best].katetime <= info->which##time) { \
-            write_kate_page(info, best); \
-            continue; \
-        }
-#else
-#define CHECK_KATE_OUTPUT(which) ((void)0)
-#endif
+    /* someone may be waiting for the data at the other end of a pipe */
+    if (info->output_seekable != SEEKABLE)
+        output_flush(info);
+}
 
-        best=find_best_valid_kate_page(info);
-
-        if (info->video_only && info->videopage_valid) {
-            CHECK_KATE_OUTPUT(video);
-            write_video_page(info);
-        }
-        else if (info->audio_only && info->audiopage_valid) {
-            CHECK_KATE_OUTPUT(audio);
-            write_audio_page(info);
-        }
-        /* We're using both. We can output only:
-        *  a) If we have valid pages for both
-        *  b) At EOS, for the remaining stream.
-        */
-        else if (info->videopage_valid && info->audiopage_valid) {
-            /* Make sure they're in the right order. */
-            if (info->videotime <= info->audiotime) {
-              CHECK_KATE_OUTPUT(video);
-              write_video_page(info);
-            }
-            else {
-              CHECK_KATE_OUTPUT(audio);
-              write_audio_page(info);
-            }
-        }
-        else if (e_o_s && best>=0) {
-            write_kate_page(info, best);
-        }
-        else if (e_o_s && info->videopage_valid) {
-            write_video_page(info);
-        }
-        else if (e_o_s && info->audiopage_valid) {
-            write_audio_page(info);
-        }
-        else {
-            break; /* Nothing more writable at the moment */
-        }
-    }
+/* Prints how much of each stream went into page headers, including
+   their checksums, and how often a page starts, for --page-stats. */
+static void print_page_stats(oggmux_info *info)
+{
+    ogg_int64_t pages = 0, header_bytes = 0, bytes = 0;
+    int n;
+
+    fprintf(stderr, "\nPage statistics:\n");
+    for (n=0; n<info->n_streams; ++n) {
+        oggmux_stream *st = info->streams + n;
+        ogg_int64_t stream_bytes = st->header_bytes + st->body_bytes;
+        char name[32];
+
+        if (!st->pages)
+            continue;
+        if (st->type == OGGMUX_THEORA)
+            snprintf(name, sizeof(name), "theora");
+        else
+            snprintf(name, sizeof(name), "%s %d",
+                     st->type == OGGMUX_VORBIS ? "vorbis" : "kate", st->idx+1);
+        fprintf(stderr, "  %-9s %8" PRId64 " pages, %6.0f bytes per page, %5.2f%% headers",
+                name, st->pages, (double)stream_bytes / st->pages,
+                100. * st->header_bytes / stream_bytes);
+        if (st->time > 0)
+            fprintf(stderr, ", a page every %.3f s", st->time / st->pages);
+        fprintf(stderr, "\n");
+        pages += st->pages;
+        header_bytes += st->header_bytes;
+        bytes += stream_bytes;
+    }
+    if (pages)
+        fprintf(stderr, "  %-9s %8" PRId64 " pages, %6.0f bytes per page, %5.2f%% headers\n",
+                "total", pages, (double)bytes / pages, 100. * header_bytes / bytes);
 }
 
 void oggmux_close (oggmux_info *info) {
@@ -1838,10 +2638,22 @@ void oggmux_close (oggmux_info *info) {
 
     print_stats(info, info->duration);
 
-    ogg_stream_clear (&info->vo);
-    vorbis_block_clear (&info->vb);
-    vorbis_dsp_clear (&info->vd);
-    vorbis_info_clear (&info->vi);
+    for (n=0; n<info->n_audio_streams; ++n) {
+        oggmux_audio_stream *as=info->audio_streams+n;
+        ogg_stream_clear (&as->vo);
+        if (info->passno!=1) {
+            vorbis_block_clear (&as->vb);
+            vorbis_dsp_clear (&as->vd);
+            vorbis_comment_clear (&as->vc);
+            vorbis_info_clear (&as->vi);
+            free(as->channel_map);
+            free(as->audio_planes);
+        }
+        oggmux_packet_list_free(&as->packets);
+    }
+    free(info->audio_streams);
+    info->audio_streams = NULL;
+    info->n_audio_streams = 0;
 
     ogg_stream_clear (&info->to);
     th_encode_free (info->td);
@@ -1864,18 +2676,41 @@ void oggmux_close (oggmux_info *info) {
     if (info->with_skeleton)
         ogg_stream_clear (&info->so);
 
-    if (info->passno!=1 && info->outfile && info->outfile != stdout)
-        fclose (info->outfile);
-
-    if (info->videopage)
-        free(info->videopage);
-    if (info->audiopage)
-        free(info->audiopage);
-
-    for (n=0; n<info->n_kate_streams; ++n) {
-        if (info->kate_streams[n].katepage)
-            free(info->kate_streams[n].katepage);
-    }
+    if (info->passno!=1 && info->outfile) {
+        output_flush(info);
+        if (info->outfile != stdout)
+            fclose (info->outfile);
+    }
+    free(info->output_buffer);
+    info->output_buffer = NULL;
+    info->output_buffer_len = 0;
+
+    if (info->page_stats && info->passno!=1)
+        print_page_stats(info);
+    if (info->live && info->delay_count && info->passno!=1)
+        fprintf(stderr, "\nDelay from input to output: %.0f ms on average, %.0f ms at most\n",
+                info->delay_sum / 1000. / info->delay_count, info->max_delay_seen / 1000.);
+    free(info->frame_times);
+    info->frame_times = NULL;
+    info->n_frame_times = info->frame_times_head = info->frame_times_capacity = 0;
+    for (n=0; n<info->n_streams; ++n) {
+        oggmux_stream *st = info->streams + n;
+        int i;
+        for (i=0; i<st->queued_capacity; ++i)
+            free(st->queued[i].data);
+        free(st->queued);
+        free(st->page);
+    }
+    free(info->streams);
+    info->streams = NULL;
+    info->n_streams = 0;
+    free(info->page_heap);
+    info->page_heap = NULL;
+    info->page_heap_size = 0;
+    free(info->changed_streams);
+    info->changed_streams = NULL;
     free(info->kate_streams);
+
+    oggmux_packet_list_free(&info->video_packets);
 }
 
@@ -40,6 +40,53 @@
 #define KEYPOINT_SIZE 20
 #define SKELETON_VERSION(major, minor) (((major)<<16)|(minor))
 
+/* Default size of the buffer pages are collected in before they are
+   written to the output file. */
+#define OUTPUT_BUFFER_SIZE (1024 * 1024)
+
+/* the most data a page can hold, 255 segments of 255 bytes */
+#define OGGMUX_MAX_PAGE_BODY (255 * 255)
+
+/* how the audio and video streams are cut into pages, see --page-policy */
+enum {
+    PAGE_POLICY_DEFAULT,
+    PAGE_POLICY_LATENCY,    /* a page for whatever is there at every flush */
+    PAGE_POLICY_SEEK,       /* a new page at every keyframe */
+    PAGE_POLICY_THROUGHPUT  /* pages as full as they get */
+};
+
+/* An encoded packet waiting to be muxed. The packet data is owned by the
+   list, entries are reused between frames to avoid reallocating. */
+typedef struct
+{
+    ogg_packet op;
+    unsigned char *data;
+    long data_size;
+    /* presentation interval in ms, used for the keyframe index */
+    ogg_int64_t start_time;
+    ogg_int64_t end_time;
+    int keyframe;
+}
+oggmux_packet;
+
+typedef struct
+{
+    oggmux_packet *packets;
+    int count;
+    int capacity;
+    /* when the frame came in, in microseconds, for --live */
+    ogg_int64_t input_time;
+}
+oggmux_packet_list;
+
+/* A video frame on its way to the output, for the --live delay. */
+typedef struct
+{
+    ogg_int64_t frame;
+    ogg_int64_t input_time;
+}
+oggmux_frame_time;
+
 typedef struct
 {
 #ifdef HAVE_KATE
@@ -49,16 +96,89 @@ typedef struct
 #endif
     ogg_stream_state ko;    /* take physical pages, weld into a logical
                              * stream of packets */
-    int katepage_valid;
-    unsigned char *katepage;
-    int katepage_len;
-    int katepage_buffer_length;
-    double katetime;
     seek_index index;
     ogg_int64_t last_end_time;
+    int stream;             /* its oggmux_stream */
 }
 oggmux_kate_stream;
 
+/* An audio track, each encoded by its own vorbis encoder. The encoder
+   state may be used on a different thread than the rest of oggmux_info,
+   but only by one thread at a time. */
+typedef struct
+{
+    int channels;
+    int sample_rate;
+    char language[16];      /* LANGUAGE comment, empty if unknown */
+    vorbis_info vi;         /* struct that stores all the static vorbis bitstream settings */
+    vorbis_comment vc;      /* oggmux_info's comments and the language */
+    vorbis_dsp_state vd;    /* central working state for the packet->PCM decoder */
+    vorbis_block vb;        /* local working space for packet->PCM decode */
+    int *channel_map;       /* vorbis channel of each input channel */
+    float **audio_planes;   /* analysis buffer in input channel order */
+    int prev_vorbis_window; /* Window size of previous vorbis block. Used to
+                               calculate duration of vorbis packets. */
+    /* Granulepos of the last encoded packet. */
+    ogg_int64_t vorbis_granulepos;
+
+    ogg_stream_state vo;    /* take physical pages, weld into a logical
+                             * stream of packets */
+    seek_index index;
+    int a_pkg;              /* packets in vo not written yet */
+    int stream;             /* its oggmux_stream */
+    /* packets produced by oggmux_add_audio */
+    oggmux_packet_list packets;
+}
+oggmux_audio_stream;
+
+/* A page cut from a stream before its turn, with a copy of its data. */
+typedef struct
+{
+    unsigned char *data;
+    int size;
+    long header_len;
+    long body_len;
+}
+oggmux_queued_page;
+
+/* kinds of oggmux_stream, in the order their pages win ties */
+enum {
+    OGGMUX_KATE,
+    OGGMUX_THEORA,
+    OGGMUX_VORBIS
+};
+
+/* A logical stream as oggmux_flush sees it. Its next page waits in og
+   for its turn, pointing into the ogg stream while oggmux_flush runs. It
+   is only copied to page if it is still waiting when oggmux_flush returns. */
+typedef struct
+{
+    int type;
+    int idx;                /* of the kate or audio stream */
+    ogg_stream_state *os;
+    seek_index *index;
+    ogg_page og;
+    int page_valid;
+    unsigned char *page;
+    int page_buffer_length;
+    /* time of the last page with a granulepos */
+    double time;
+    /* got packets since the last oggmux_flush */
+    int changed;
+    /* when og started waiting, in microseconds, for --live */
+    ogg_int64_t page_wait_start;
+    /* pages cut early, e.g. before a keyframe, to follow og in order */
+    oggmux_queued_page *queued;
+    int queued_head;
+    int n_queued;
+    int queued_capacity;
+    /* written so far, for --page-stats */
+    ogg_int64_t pages;
+    ogg_int64_t header_bytes;
+    ogg_int64_t body_bytes;
+}
+oggmux_stream;
+
 enum SeekableState {
     MAYBE_SEEKABLE = -1,
     NOT_SEEKABLE = 0,
@@ -72,6 +192,13 @@ typedef struct
     /* Greather than zero if outfile is seekable.
        Value one of SeekableState. */
     int output_seekable;
+    /* pages not yet written to outfile */
+    unsigned char *output_buffer;
+    int output_buffer_size;
+    int output_buffer_len;
+    /* offset in outfile the buffer is written to, and the size of the file */
+    ogg_int64_t output_offset;
+    ogg_int64_t output_length;
 
     char oshash[32];
     int audio_only;
@@ -82,15 +209,24 @@ typedef struct
     int theora_index_reserve;
     int vorbis_index_reserve;
     int kate_index_reserve;
+    /* grow the index reserve to fit all keyframes once encoding is done */
+    int adaptive_index;
     int indexing_complete;
+    /* one of the PAGE_POLICY values */
+    int page_policy;
+    /* print page statistics when done */
+    int page_stats;
+    /* streaming: never seek, and write no page later than max_delay ms
+       after it was cut, even if another stream falls behind */
+    int live;
+    int max_delay;
     FILE *frontend;
+    /* no progress output, for all but one of the outputs of --batch */
+    int no_stats;
     /* vorbis settings */
-    int sample_rate;
-    int channels;
     double vorbis_quality;
     int vorbis_bitrate;
 
-    vorbis_info vi;       /* struct that stores all the static vorbis bitstream settings */
     vorbis_comment vc;    /* struct that stores all the user comments */
 
     /* theora settings */
@@ -100,29 +236,29 @@ typedef struct
 
     /* state info */
     th_enc_ctx *td;
-    vorbis_dsp_state vd; /* central working state for the packet->PCM decoder */
-    vorbis_block vb;     /* local working space for packet->PCM decode */
 
     int with_kate;
 
     /* used for muxing */
     ogg_stream_state to;    /* take physical pages, weld into a logical
                              * stream of packets */
-    ogg_stream_state vo;    /* take physical pages, weld into a logical
-                             * stream of packets */
     ogg_stream_state so;    /* take physical pages, weld into a logical
                              * stream of packets, used for skeleton stream */
 
-    int audiopage_valid;
-    int videopage_valid;
-    unsigned char *audiopage;
-    unsigned char *videopage;
-    int videopage_len;
-    int audiopage_len;
-    int videopage_buffer_length;
-    int audiopage_buffer_length;
+    /* All streams, kate first, then theora and vorbis. The ones with a
+       page waiting are kept in a heap ordered by page time. */
+    oggmux_stream *streams;
+    int n_streams;
+    int video_stream;
+    int *page_heap;
+    int page_heap_size;
+    /* audio and video streams without a page waiting */
+    int streams_waiting;
+    /* streams that got packets since the last oggmux_flush */
+    int *changed_streams;
+    int n_changed_streams;
 
-    /* some stats */
+    /* some stats, audiotime is the time of the first audio stream */
     double audiotime;
     double videotime;
     double duration;
@@ -147,28 +283,66 @@ typedef struct
     FILE *twopass_file;
     int twopass;
     int passno;
+    /* two-pass data of a --two-pass run, which never leaves memory */
+    unsigned char *twopass_data;
+    int twopass_size;
+    int twopass_capacity;
+    int twopass_pos;
 
     int n_kate_streams;
     oggmux_kate_stream *kate_streams;
 
+    int n_audio_streams;
+    oggmux_audio_stream *audio_streams;
+
     seek_index theora_index;
-    seek_index vorbis_index;
-    int prev_vorbis_window; /* Window size of previous vorbis block. Used to
-                               calculate duration of vorbis packets. */
     /* The offset of the first non header page in bytes. */
     ogg_int64_t content_offset;
-    /* Granulepos of the last encoded packet. */
-    ogg_int64_t vorbis_granulepos;
 
     ogg_int32_t serialno;
+
+    /* packets produced by oggmux_add_video */
+    oggmux_packet_list video_packets;
+
+    /* --live: the video frames not written yet, and the delay in
+       microseconds from reading a frame to writing its page */
+    oggmux_frame_time *frame_times;
+    int frame_times_head;
+    int n_frame_times;
+    int frame_times_capacity;
+    ogg_int64_t delay;
+    ogg_int64_t max_delay_seen;
+    ogg_int64_t delay_sum;
+    ogg_int64_t delay_count;
 }
 oggmux_info;
 
 void init_info(oggmux_info *info);
 extern void oggmux_setup_kate_streams(oggmux_info *info, int n_kate_streams);
+/* Allocates the audio streams, their channels, sample_rate and language
+   are to be filled in before oggmux_init. */
+extern void oggmux_setup_audio_streams(oggmux_info *info, int n_audio_streams);
 extern void oggmux_init (oggmux_info *info);
-extern void oggmux_add_video (oggmux_info *info, th_ycbcr_buffer ycbcr, int e_o_s);
-extern void oggmux_add_audio (oggmux_info *info, uint8_t **buffer, int samples,int e_o_s);
+extern void oggmux_add_video (oggmux_info *info, th_ycbcr_buffer ycbcr, int dups, int e_o_s);
+extern void oggmux_add_audio (oggmux_info *info, int idx, uint8_t **buffer, int samples,int e_o_s);
+/* Two-pass data goes to twopass_file if one was given, otherwise to memory. */
+extern void oggmux_twopass_rewind (oggmux_info *info);
+extern void oggmux_twopass_write (oggmux_info *info, const unsigned char *buffer, int bytes);
+extern void oggmux_twopass_free (oggmux_info *info);
+/* The encode functions only touch the encoder state and may run on a
+   different thread than the mux functions, which own the ogg streams
+   and the seek index. Packets must be muxed in the order they were
+   encoded. The audio streams may be encoded on a thread each. */
+extern void oggmux_encode_video (oggmux_info *info, th_ycbcr_buffer ycbcr, int dups, int e_o_s, oggmux_packet_list *packets);
+extern void oggmux_encode_video_segment (oggmux_info *info, th_enc_ctx *td, th_ycbcr_buffer ycbcr, int dups, int e_o_s, ogg_int64_t frame_offset, oggmux_packet_list *packets);
+extern void oggmux_mux_video (oggmux_info *info, oggmux_packet_list *packets);
+extern void oggmux_encode_audio (oggmux_info *info, int idx, uint8_t **buffer, int samples, int e_o_s, oggmux_packet_list *packets);
+/* Returns room for samples samples of each input channel in the vorbis
+   analysis buffer, to be filled before oggmux_encode_audio_buffer. */
+extern float **oggmux_audio_buffer (oggmux_info *info, int idx, int samples);
+extern void oggmux_encode_audio_buffer (oggmux_info *info, int idx, int samples, int e_o_s, oggmux_packet_list *packets);
+extern void oggmux_mux_audio (oggmux_info *info, int idx, oggmux_packet_list *packets);
+extern void oggmux_packet_list_free (oggmux_packet_list *packets);
 #ifdef HAVE_KATE
 extern void oggmux_add_kate_text (oggmux_info *info, int idx, double t0, double t1, const char *text, size_t len, int x1, int x2, int y1, int y2);
 extern void oggmux_add_kate_image (oggmux_info *info, int idx, double t0, double t1, const kate_region *kr, const kate_palette *kp, const kate_bitmap *kb);
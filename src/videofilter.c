@@ -0,0 +1,392 @@
+/* -*- tab-width:4;c-file-style:"cc-mode"; -*- */
+/*
+ * videofilter.c -- run decoded pictures through a libavfilter graph
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with This program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "libavfilter/avfilter.h"
+#include "libavfilter/buffersink.h"
+#include "libavfilter/buffersrc.h"
+#include "libavutil/mem.h"
+
+#include "videofilter.h"
+
+struct videofilter {
+    AVFilterGraph *graph;
+    AVFilterContext *src;
+    AVFilterContext *sink;
+    int eof;
+};
+
+videofilter *videofilter_open(const char *description, int pix_fmt,
+                              int width, int height, AVRational time_base,
+                              AVRational sample_aspect_ratio, AVRational frame_rate,
+                              int threads) {
+    AVFilterInOut *outputs, *inputs;
+    videofilter *vf;
+    char args[256];
+
+    vf = av_mallocz(sizeof(*vf));
+    outputs = avfilter_inout_alloc();
+    inputs = avfilter_inout_alloc();
+    if (!vf || !outputs || !inputs || !(vf->graph = avfilter_graph_alloc())) {
+        fprintf(stderr, "Failed to allocate memory\n");
+        exit(1);
+    }
+    vf->graph->nb_threads = threads;
+
+    if (!sample_aspect_ratio.num)
+        sample_aspect_ratio = (AVRational){ 0, 1 };
+    snprintf(args, sizeof(args),
+             "video_size=%dx%d:pix_fmt=%d:time_base=%d/%d:pixel_aspect=%d/%d:frame_rate=%d/%d",
+             width, height, pix_fmt, time_base.num, time_base.den,
+             sample_aspect_ratio.num, sample_aspect_ratio.den,
+             frame_rate.num, frame_rate.den);
+    if (avfilter_graph_create_filter(&vf->src, avfilter_get_by_name("buffer"),
+                                     "in", args, NULL, vf->graph) < 0 ||
+        avfilter_graph_create_filter(&vf->sink, avfilter_get_by_name("buffersink"),
+                                     "out", NULL, NULL, vf->graph) < 0) {
+        fprintf(stderr, "ERROR: Unable to set up the video filters\n");
+        exit(1);
+    }
+
+    outputs->name = av_strdup("in");
+    outputs->filter_ctx = vf->src;
+    inputs->name = av_strdup("out");
+    inputs->filter_ctx = vf->sink;
+    if (avfilter_graph_parse_ptr(vf->graph, description, &inputs, &outputs, NULL) < 0 ||
+        avfilter_graph_config(vf->graph, NULL) < 0) {
+        fprintf(stderr, "ERROR: Invalid video filters \"%s\"\n", description);
+        exit(1);
+    }
+    avfilter_inout_free(&inputs);
+    avfilter_inout_free(&outputs);
+    return vf;
+}
+
+void videofilter_get_output(videofilter *vf, int *pix_fmt, int *width, int *height,
+                            AVRational *sample_aspect_ratio, AVRational *frame_rate) {
+    AVFilterLink *link = vf->sink->inputs[0];
+
+    *pix_fmt = link->format;
+    *width = link->w;
+    *height = link->h;
+    *sample_aspect_ratio = link->sample_aspect_ratio;
+    *frame_rate = av_buffersink_get_frame_rate(vf->sink);
+}
+
+void videofilter_add_frame(videofilter *vf, AVFrame *frame) {
+    if (vf->eof)
+        return;
+    vf->eof = !frame;
+    if (av_buffersrc_add_frame(vf->src, frame) < 0) {
+        fprintf(stderr, "ERROR: Video filtering failed\n");
+        exit(1);
+    }
+}
+
+int videofilter_get_frame(videofilter *vf, AVFrame *frame) {
+    int ret = av_buffersink_get_frame(vf->sink, frame);
+
+    if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF)
+        return 0;
+    if (ret < 0) {
+        fprintf(stderr, "ERROR: Video filtering failed\n");
+        exit(1);
+    }
+    return 1;
+}
+
+void videofilter_close(videofilter *vf) {
+    avfilter_graph_free(&vf->graph);
+    av_free(vf);
+}
+
+#ifdef VIDEOFILTER_BENCH
+#include "libavutil/channel_layout.h"
+#include "libavutil/opt.h"
+#include "libavutil/time.h"
+#include "libswresample_compat.h"
+
+#include "decodepool.h"
+#include "pipeline.h"
+
+/*
+ * Counts the heap allocations per frame of ffmpeg2theora's path from
+ * packets to the pictures and samples handed to the encoders: decoding
+ * into the decodepool, the filters, the pictures held in the pipeline's
+ * queue and the audio resampled to float. The packets are encoded
+ * beforehand, demuxing isn't counted. The allocator is replaced with
+ * counting wrappers around glibc's.
+ *
+ *   videofilter_bench [filters [frames [codec [threads]]]]
+ */
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void *__libc_memalign(size_t alignment, size_t size);
+
+/* decoder threads allocate too */
+static volatile int64_t allocations, allocated_bytes;
+
+static void count(size_t size) {
+    __sync_add_and_fetch(&allocations, 1);
+    __sync_add_and_fetch(&allocated_bytes, size);
+}
+
+void *malloc(size_t size) {
+    count(size);
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size) {
+    count(nmemb * size);
+    return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+    count(size);
+    return __libc_realloc(ptr, size);
+}
+
+void *memalign(size_t alignment, size_t size) {
+    count(size);
+    return __libc_memalign(alignment, size);
+}
+
+int posix_memalign(void **ptr, size_t alignment, size_t size) {
+    count(size);
+    *ptr = __libc_memalign(alignment, size);
+    return *ptr ? 0 : ENOMEM;
+}
+
+static AVCodecContext *open_codec(AVCodec *codec, AVCodecContext *enc) {
+    if (!codec || avcodec_open2(enc, codec, NULL) < 0) {
+        fprintf(stderr, "Failed to open %s\n", codec ? codec->name : "codec");
+        exit(1);
+    }
+    return enc;
+}
+
+/* Encodes n frames, a moving picture or a tone, into *packets. Returns the
+   number of packets, the encoder may hold some frames back. */
+static int encode(AVCodecContext *enc, int n, AVPacket **packets) {
+    AVFrame *frame = av_frame_alloc();
+    int i, x, y, got_packet, ret, count = 0;
+
+    *packets = av_mallocz_array(n, sizeof(**packets));
+    frame->format = enc->codec_type == AVMEDIA_TYPE_VIDEO ? enc->pix_fmt : enc->sample_fmt;
+    frame->width = enc->width;
+    frame->height = enc->height;
+    frame->nb_samples = enc->frame_size;
+    frame->channel_layout = enc->channel_layout;
+    if (!*packets || av_frame_get_buffer(frame, 32) < 0) {
+        fprintf(stderr, "Failed to allocate memory\n");
+        exit(1);
+    }
+    for (i = 0; i < n; i++) {
+        /* the encoder may still hold the last one */
+        if (av_frame_make_writable(frame) < 0) {
+            fprintf(stderr, "Failed to allocate memory\n");
+            exit(1);
+        }
+        if (enc->codec_type == AVMEDIA_TYPE_VIDEO) {
+            for (y = 0; y < enc->height; y++)
+                for (x = 0; x < enc->width; x++)
+                    frame->data[0][y * frame->linesize[0] + x] = x + y + i * 3;
+            for (y = 0; y < enc->height / 2; y++)
+                for (x = 0; x < enc->width / 2; x++) {
+                    frame->data[1][y * frame->linesize[1] + x] = 128 + y + i * 2;
+                    frame->data[2][y * frame->linesize[2] + x] = 64 + x + i * 5;
+                }
+            frame->pts = i;
+        }
+        else {
+            int16_t *samples = (int16_t *)frame->data[0];
+            for (x = 0; x < frame->nb_samples; x++)
+                samples[2 * x] = samples[2 * x + 1] =
+                    (int64_t)(i * frame->nb_samples + x) * 440 % enc->sample_rate * 20000 / enc->sample_rate - 10000;
+            frame->pts = (int64_t)i * frame->nb_samples;
+        }
+        av_init_packet(&(*packets)[count]);
+        if (enc->codec_type == AVMEDIA_TYPE_VIDEO)
+            ret = avcodec_encode_video2(enc, &(*packets)[count], frame, &got_packet);
+        else
+            ret = avcodec_encode_audio2(enc, &(*packets)[count], frame, &got_packet);
+        if (ret < 0) {
+            fprintf(stderr, "Failed to encode\n");
+            exit(1);
+        }
+        count += got_packet;
+    }
+    av_frame_free(&frame);
+    return count;
+}
+
+int main(int argc, char **argv) {
+    const char *description = argc > 1 ? argv[1] : "yadif,hqdn3d";
+    int frames = argc > 2 ? atoi(argv[2]) : 500;
+    const char *codec_name = argc > 3 ? argv[3] : "mpeg4";
+    int threads = argc > 4 ? atoi(argv[4]) : 1;
+    int warmup, filtered = 0, samples = 0;
+    int video_packets, audio_packets, audio_packet = 0;
+    AVCodecContext *venc, *vdec, *aenc, *adec;
+    AVPacket *video, *audio, pkt;
+    AVFrame *decoded, *audio_frame, *queue[PIPELINE_QUEUE_SIZE];
+    struct SwrContext *swr_ctx;
+    uint8_t **resampled;
+    videofilter *vf = NULL;
+    int64_t t = 0, counted, counted_bytes;
+    int i, got_frame;
+
+    /* each frame thread fills the pools of its own context */
+    warmup = 16 * FFMAX(threads, 1);
+    avcodec_register_all();
+    avfilter_register_all();
+
+    venc = avcodec_alloc_context3(NULL);
+    venc->width = 720;
+    venc->height = 576;
+    venc->pix_fmt = AV_PIX_FMT_YUV420P;
+    venc->time_base = (AVRational){1, 25};
+    venc->gop_size = 12;
+    venc->max_b_frames = 2;
+    venc->bit_rate = 4000000;
+    open_codec(avcodec_find_encoder_by_name(codec_name), venc);
+    video_packets = encode(venc, warmup + frames, &video);
+
+    aenc = avcodec_alloc_context3(NULL);
+    aenc->sample_fmt = AV_SAMPLE_FMT_S16;
+    aenc->sample_rate = 48000;
+    aenc->channel_layout = AV_CH_LAYOUT_STEREO;
+    aenc->channels = 2;
+    aenc->bit_rate = 192000;
+    open_codec(avcodec_find_encoder(AV_CODEC_ID_MP2), aenc);
+    audio_packets = encode(aenc, (int64_t)(warmup + frames) * aenc->sample_rate / 25 / aenc->frame_size,
+                           &audio);
+
+    /* decoders set up like open_decoder() does */
+    vdec = avcodec_alloc_context3(NULL);
+    vdec->thread_count = threads;
+    vdec->refcounted_frames = 1;
+    decodepool_open(vdec);
+    open_codec(avcodec_find_decoder(venc->codec_id), vdec);
+    adec = avcodec_alloc_context3(NULL);
+    decodepool_open(adec);
+    open_codec(avcodec_find_decoder(aenc->codec_id), adec);
+
+    if (strcmp(description, "none"))
+        vf = videofilter_open(description, AV_PIX_FMT_YUV420P, 720, 576, (AVRational){1, 25},
+                              (AVRational){16, 15}, (AVRational){25, 1}, 1);
+
+    swr_ctx = swr_alloc();
+    av_opt_set_int(swr_ctx, "in_channel_layout", AV_CH_LAYOUT_STEREO, 0);
+    av_opt_set_int(swr_ctx, "in_sample_rate", aenc->sample_rate, 0);
+    av_opt_set_int(swr_ctx, "in_sample_fmt", AV_SAMPLE_FMT_S16, 0);
+    av_opt_set_int(swr_ctx, "out_channel_layout", AV_CH_LAYOUT_STEREO, 0);
+    av_opt_set_int(swr_ctx, "out_sample_rate", 44100, 0);
+    av_opt_set_int(swr_ctx, "out_sample_fmt", AV_SAMPLE_FMT_FLTP, 0);
+    if (swr_init(swr_ctx) < 0 ||
+        av_samples_alloc_array_and_samples(&resampled, NULL, 2, 2 * aenc->frame_size,
+                                           AV_SAMPLE_FMT_FLTP, 0) < 0) {
+        fprintf(stderr, "Failed to set up resampling\n");
+        exit(1);
+    }
+
+    decoded = av_frame_alloc();
+    audio_frame = av_frame_alloc();
+    for (i = 0; i < PIPELINE_QUEUE_SIZE; i++)
+        queue[i] = av_frame_alloc();
+
+    frames = video_packets - warmup;
+    for (i = 0; i < video_packets; i++) {
+        if (i == warmup) {
+            allocations = allocated_bytes = 0;
+            filtered = samples = 0;
+            t = av_gettime();
+        }
+        pkt = video[i];
+        avcodec_decode_video2(vdec, decoded, &got_frame, &pkt);
+        if (got_frame) {
+            /* the pipeline keeps the latest pictures queued for the encoder */
+            if (vf) {
+                decoded->pts = av_frame_get_best_effort_timestamp(decoded);
+                videofilter_add_frame(vf, decoded);
+                while (videofilter_get_frame(vf, decoded)) {
+                    av_frame_unref(queue[filtered % PIPELINE_QUEUE_SIZE]);
+                    av_frame_move_ref(queue[filtered++ % PIPELINE_QUEUE_SIZE], decoded);
+                }
+            }
+            else {
+                av_frame_unref(queue[filtered % PIPELINE_QUEUE_SIZE]);
+                av_frame_move_ref(queue[filtered++ % PIPELINE_QUEUE_SIZE], decoded);
+            }
+        }
+        /* the audio up to the end of this picture */
+        while (audio_packet < audio_packets &&
+               (int64_t)audio_packet * aenc->frame_size * 25 < (int64_t)(i + 1) * aenc->sample_rate) {
+            pkt = audio[audio_packet++];
+            avcodec_decode_audio4(adec, audio_frame, &got_frame, &pkt);
+            if (got_frame)
+                samples += swr_convert(swr_ctx, resampled, 2 * aenc->frame_size,
+                                       (const uint8_t **)audio_frame->extended_data,
+                                       audio_frame->nb_samples);
+        }
+    }
+    t = av_gettime() - t;
+    /* before printf allocates its buffer */
+    counted = allocations;
+    counted_bytes = allocated_bytes;
+
+    printf("%s, %s on %d threads: %d frames in, %d out, %d samples\n",
+           description, codec_name, threads, frames, filtered, samples);
+    printf("%.1f allocations, %.0f bytes per frame, %.2f ms per frame\n",
+           (double)counted / frames, (double)counted_bytes / frames,
+           t / 1000.0 / frames);
+
+    if (vf)
+        videofilter_close(vf);
+    for (i = 0; i < PIPELINE_QUEUE_SIZE; i++)
+        av_frame_free(&queue[i]);
+    av_frame_free(&decoded);
+    av_frame_free(&audio_frame);
+    avcodec_close(vdec);
+    decodepool_close(vdec);
+    avcodec_close(adec);
+    decodepool_close(adec);
+    avcodec_close(venc);
+    avcodec_close(aenc);
+    av_free(vdec);
+    av_free(adec);
+    av_free(venc);
+    av_free(aenc);
+    for (i = 0; i < video_packets; i++)
+        av_free_packet(&video[i]);
+    for (i = 0; i < audio_packets; i++)
+        av_free_packet(&audio[i]);
+    av_free(video);
+    av_free(audio);
+    av_freep(&resampled[0]);
+    av_freep(&resampled);
+    swr_free(&swr_ctx);
+    return 0;
+}
+#endif
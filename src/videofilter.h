@@ -0,0 +1,50 @@
+/* -*- tab-width:4;c-file-style:"cc-mode"; -*- */
+/*
+ * videofilter.h -- run decoded pictures through a libavfilter graph
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with This program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef _F2T_VIDEOFILTER_H_
+#define _F2T_VIDEOFILTER_H_
+
+#include "libavcodec/avcodec.h"
+
+typedef struct videofilter videofilter;
+
+/**
+ * Sets up the filters in description, e.g. "yadif=mode=send_field", for
+ * decoded pictures of pix_fmt and width x height. Filters that support it
+ * run in slices on threads threads, 0 for one per core.
+ */
+extern videofilter *videofilter_open(const char *description, int pix_fmt,
+                                     int width, int height, AVRational time_base,
+                                     AVRational sample_aspect_ratio, AVRational frame_rate,
+                                     int threads);
+/**
+ * Format, size and frame rate of the filtered pictures, the filters may
+ * change any of them. frame_rate is 0/0 if the filters don't know it.
+ */
+extern void videofilter_get_output(videofilter *vf, int *pix_fmt, int *width, int *height,
+                                   AVRational *sample_aspect_ratio, AVRational *frame_rate);
+/* Takes the reference of a decoded frame, NULL once the decoder is drained. */
+extern void videofilter_add_frame(videofilter *vf, AVFrame *frame);
+/**
+ * Moves the next filtered picture into frame. Filters may hold pictures
+ * back, so a picture added doesn't have to come out right away.
+ * @return 1 with a picture, 0 if more input is needed or all is drained
+ */
+extern int videofilter_get_frame(videofilter *vf, AVFrame *frame);
+extern void videofilter_close(videofilter *vf);
+
+#endif